@@ -0,0 +1,110 @@
+#include "allocation_tracker.h"
+
+#ifdef MIDI_TRACK_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// thread_local needs Visual Studio 2015, the compiler extensions work with every toolset.
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+namespace {
+
+// Zero-initialized, so no thread has to run a constructor before its first allocation.
+THREAD_LOCAL uint32_t scopeDepth = 0;
+
+std::atomic<uint64_t> allocations(0);
+std::atomic<uint64_t> realtimeAllocations(0);
+std::atomic<uint64_t> realtimeBytes(0);
+
+void* Allocate(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (scopeDepth > 0) {
+		realtimeAllocations.fetch_add(1, std::memory_order_relaxed);
+		realtimeBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	return malloc((size > 0) ? size : 1);
+}
+
+}
+
+void* operator new(std::size_t size) {
+	void* p = Allocate(size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size) {
+	void* p = Allocate(size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw() {
+	return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) throw() {
+	return Allocate(size);
+}
+
+void operator delete(void* p) throw() {
+	free(p);
+}
+
+void operator delete[](void* p) throw() {
+	free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() {
+	free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw() {
+	free(p);
+}
+
+NoAllocationScope::NoAllocationScope() {
+	scopeDepth++;
+}
+
+NoAllocationScope::~NoAllocationScope() {
+	scopeDepth--;
+}
+
+bool AllocationTrackingEnabled() {
+	return true;
+}
+
+AllocationCounts GetAllocationCounts() {
+	AllocationCounts c;
+	c.allocations = allocations.load(std::memory_order_relaxed);
+	c.realtimeAllocations = realtimeAllocations.load(std::memory_order_relaxed);
+	c.realtimeBytes = realtimeBytes.load(std::memory_order_relaxed);
+	return c;
+}
+
+#else
+
+bool AllocationTrackingEnabled() {
+	return false;
+}
+
+AllocationCounts GetAllocationCounts() {
+	AllocationCounts c;
+	c.allocations = 0;
+	c.realtimeAllocations = 0;
+	c.realtimeBytes = 0;
+	return c;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+
+Debug check that the realtime threads never allocate.
+
+The sequencer thread, the audio callback, the render workers and the input
+thread of MIDI thru run inside a NoAllocationScope while they play.
+Everything they need is allocated before: the voice pool, the rings to the
+audio thread, the batch and the SysEx buffers of the sequencer. A heap
+allocation there takes the allocator lock, which another thread may hold, and
+shows up as a timing spike.
+
+When the player is built with MIDI_TRACK_ALLOCATIONS, the global operator new
+and delete are replaced by ones which count every allocation and those made
+by a thread inside a scope. The benchmarks read the counts and fail when a
+realtime thread allocated. Without the define the scopes compile to nothing
+and the counts stay 0.
+
+*/
+
+struct AllocationCounts {
+	uint64_t allocations;         // All allocations since the start of the process.
+	uint64_t realtimeAllocations; // Allocations made inside a NoAllocationScope.
+	uint64_t realtimeBytes;
+};
+
+// Marks the current thread as one which must not allocate until the scope ends. Scopes nest.
+class NoAllocationScope {
+public:
+#ifdef MIDI_TRACK_ALLOCATIONS
+	NoAllocationScope();
+	~NoAllocationScope();
+#else
+	NoAllocationScope() {}
+#endif
+
+private:
+	NoAllocationScope(const NoAllocationScope&);
+	NoAllocationScope& operator=(const NoAllocationScope&);
+};
+
+// True if the player was built with MIDI_TRACK_ALLOCATIONS.
+bool AllocationTrackingEnabled();
+
+AllocationCounts GetAllocationCounts();
@@ -0,0 +1,85 @@
+#include "arena.h"
+
+#include <algorithm>
+
+Arena::Arena() : blockUsed(0), usedBytes(0) {
+}
+
+Arena::~Arena() {
+	Release();
+}
+
+void Arena::AddBlock(size_t size) {
+	Block b;
+	b.data = new uint8_t[size];
+	b.size = size;
+	blocks.push_back(b);
+	blockUsed = 0;
+}
+
+void* Arena::Allocate(size_t bytes, size_t alignment) {
+	if (alignment < ARENA_MIN_ALIGN) {
+		alignment = ARENA_MIN_ALIGN;
+	}
+	if (!blocks.empty()) {
+		const Block& b = blocks.back();
+		uintptr_t start = (uintptr_t(b.data) + blockUsed + alignment - 1) & ~uintptr_t(alignment - 1);
+		size_t offset = size_t(start - uintptr_t(b.data));
+		if ((offset <= b.size) && (bytes <= b.size - offset)) {
+			blockUsed = offset + bytes;
+			usedBytes += bytes;
+			return b.data + offset;
+		}
+	}
+
+	// new[] may align the block to less than asked for.
+	AddBlock(std::max(bytes + alignment, ARENA_BLOCK_SIZE));
+	return Allocate(bytes, alignment);
+}
+
+void Arena::Reserve(size_t bytes) {
+	// The first allocation may start up to ARENA_MIN_ALIGN bytes further on.
+	bytes += ARENA_MIN_ALIGN;
+	if (!blocks.empty() && (blockUsed <= blocks.back().size) && (bytes <= blocks.back().size - blockUsed)) {
+		return;
+	}
+	AddBlock(std::max(bytes, ARENA_BLOCK_SIZE));
+}
+
+void Arena::Reset() {
+	if (blocks.size() > 1) {
+		std::vector<Block>::iterator largest = blocks.begin();
+		for (std::vector<Block>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+			if (it->size > largest->size) {
+				largest = it;
+			}
+		}
+		Block keep = *largest;
+		for (std::vector<Block>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+			if (it->data != keep.data) {
+				delete[] it->data;
+			}
+		}
+		blocks.clear();
+		blocks.push_back(keep);
+	}
+	blockUsed = 0;
+	usedBytes = 0;
+}
+
+void Arena::Release() {
+	for (size_t i = 0; i < blocks.size(); i++) {
+		delete[] blocks[i].data;
+	}
+	blocks.clear();
+	blockUsed = 0;
+	usedBytes = 0;
+}
+
+size_t Arena::ReservedBytes() const {
+	size_t total = 0;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		total += blocks[i].size;
+	}
+	return total;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/*
+
+Bump allocator for data which is built once and freed all at once, such as
+the arrays of a song.
+
+Allocations are carved out of large blocks one after another and are never
+freed one by one. Reset() forgets all of them but keeps the largest block, so
+building the next song of a similar size does not touch the heap at all, and
+Reserve() lets a builder which knows its sizes up front get one block for
+everything. Nothing is constructed or destroyed: only plain structures and
+arrays of them may be placed in an arena.
+
+*/
+
+// Alignment of every allocation unless a larger one is asked for.
+const size_t ARENA_MIN_ALIGN = 16;
+
+// Size of the blocks allocated when an allocation does not fit into the current one.
+const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+class Arena {
+public:
+	Arena();
+	~Arena();
+
+	// Uninitialized memory of the given size. The alignment must be a power of two.
+	void* Allocate(size_t bytes, size_t alignment = ARENA_MIN_ALIGN);
+
+	template <typename T>
+	T* AllocateArray(size_t count) {
+		return static_cast<T*>(Allocate(sizeof(T) * count, std::alignment_of<T>::value));
+	}
+
+	// Makes sure that allocations of the given total size, each aligned to ARENA_MIN_ALIGN,
+	// are served from the current block.
+	void Reserve(size_t bytes);
+
+	// Forgets all allocations. The largest block is kept for reuse.
+	void Reset();
+
+	// Forgets all allocations and frees every block.
+	void Release();
+
+	// Bytes handed out since the last reset, and the size of all blocks held.
+	size_t UsedBytes() const { return usedBytes; }
+	size_t ReservedBytes() const;
+
+private:
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	struct Block {
+		uint8_t* data;
+		size_t size;
+	};
+
+	void AddBlock(size_t size);
+
+	std::vector<Block> blocks; // The current block is the last one.
+	size_t blockUsed;          // Bytes used in the current block.
+	size_t usedBytes;
+};
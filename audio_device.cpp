@@ -0,0 +1,155 @@
+#include "audio_device.h"
+
+#include <chrono>
+#include <sstream>
+
+#include "hires_clock.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h> // Link with winmm.lib
+
+// Sleeps are only accurate to the 1 ms timer period.
+static const int64_t SPIN_NS = 1500000;
+#else
+static const int64_t SPIN_NS = 200000;
+#endif
+
+// Longest single sleep, so that Stop() is served promptly.
+static const int64_t MAX_SLEEP_NS = 20000000;
+
+static int64_t FramesToNanos(uint64_t frames, uint32_t sampleRate) {
+	return int64_t(frames / sampleRate * 1000000000ull + frames % sampleRate * 1000000000ull / sampleRate);
+}
+
+static void UpdateMax(std::atomic<int64_t>& value, int64_t sample) {
+	int64_t current = value.load(std::memory_order_relaxed);
+	if (sample > current) {
+		// Only the audio thread writes, a plain store is enough.
+		value.store(sample, std::memory_order_relaxed);
+	}
+}
+
+AudioDevice::AudioDevice() :
+	callback(nullptr),
+	callbacks(0),
+	deadlineMisses(0),
+	totalCallbackNs(0),
+	maxCallbackNs(0),
+	maxWakeLateNs(0)
+{
+}
+
+bool AudioDevice::Prepare(const AudioDeviceConfig& cfg, AudioCallback& cb, std::string& err) {
+	if ((cfg.blockFrames < AUDIO_MIN_BLOCK_FRAMES) || (cfg.blockFrames > AUDIO_MAX_BLOCK_FRAMES)) {
+		std::ostringstream oss;
+		oss << "block size " << cfg.blockFrames << " is out of range " << AUDIO_MIN_BLOCK_FRAMES << " .. " << AUDIO_MAX_BLOCK_FRAMES;
+		err = oss.str();
+		return false;
+	}
+	if ((cfg.sampleRate == 0) || (cfg.bufferBlocks < 2)) {
+		err = "invalid audio format";
+		return false;
+	}
+
+	config = cfg;
+	callback = &cb;
+	block.assign(size_t(config.blockFrames) * 2, 0);
+
+	callbacks.store(0);
+	deadlineMisses.store(0);
+	totalCallbackNs.store(0);
+	maxCallbackNs.store(0);
+	maxWakeLateNs.store(0);
+	return true;
+}
+
+void AudioDevice::RenderBlock(int64_t dueNs, int64_t deadlineNs) {
+	int64_t startNs = NowNanos();
+	callback->RenderAudio(&block[0], config.blockFrames);
+	int64_t endNs = NowNanos();
+
+	int64_t durationNs = endNs - startNs;
+	totalCallbackNs.fetch_add(durationNs, std::memory_order_relaxed);
+	UpdateMax(maxCallbackNs, durationNs);
+	UpdateMax(maxWakeLateNs, startNs - dueNs);
+	if (endNs > deadlineNs) {
+		deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+	}
+	callbacks.fetch_add(1, std::memory_order_release);
+}
+
+AudioDeviceStats AudioDevice::Stats() const {
+	AudioDeviceStats stats;
+	stats.callbacks = callbacks.load(std::memory_order_acquire);
+	stats.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+	stats.totalCallbackNs = totalCallbackNs.load(std::memory_order_relaxed);
+	stats.maxCallbackNs = maxCallbackNs.load(std::memory_order_relaxed);
+	stats.maxWakeLateNs = maxWakeLateNs.load(std::memory_order_relaxed);
+	stats.blockNs = config.sampleRate ? FramesToNanos(config.blockFrames, config.sampleRate) : 0;
+	return stats;
+}
+
+NullAudioDevice::NullAudioDevice() : stopRequested(false) {
+}
+
+NullAudioDevice::~NullAudioDevice() {
+	Stop();
+}
+
+bool NullAudioDevice::Start(const AudioDeviceConfig& cfg, AudioCallback& cb, std::string& err) {
+	Stop();
+	if (!Prepare(cfg, cb, err)) {
+		return false;
+	}
+	stopRequested.store(false);
+	thread = std::thread(&NullAudioDevice::Run, this);
+	return true;
+}
+
+void NullAudioDevice::Stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+	stopRequested.store(true);
+	thread.join();
+}
+
+void NullAudioDevice::Run() {
+#ifdef _WIN32
+	timeBeginPeriod(1);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+
+	// Block n is requested when block n - 1 starts playing and is due one block later.
+	int64_t originNs = NowNanos();
+	uint64_t n = 0;
+	while (!stopRequested.load(std::memory_order_relaxed)) {
+		int64_t dueNs = originNs + FramesToNanos(n * config.blockFrames, config.sampleRate);
+		int64_t remaining = dueNs - NowNanos();
+		if (remaining > 0) {
+			if (remaining > SPIN_NS) {
+				int64_t sleepNs = remaining - SPIN_NS;
+				std::this_thread::sleep_for(std::chrono::nanoseconds(sleepNs < MAX_SLEEP_NS ? sleepNs : MAX_SLEEP_NS));
+			}
+			else {
+				CpuRelax();
+			}
+			continue;
+		}
+
+		n++;
+		RenderBlock(dueNs, originNs + FramesToNanos(n * config.blockFrames, config.sampleRate));
+
+		// After a dropout a sound card carries on from the current time, it does not ask for the lost blocks in a burst.
+		int64_t nowNs = NowNanos();
+		if (nowNs > originNs + FramesToNanos((n + 1) * config.blockFrames, config.sampleRate)) {
+			originNs = nowNs - FramesToNanos(n * config.blockFrames, config.sampleRate);
+		}
+	}
+
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+
+Block based audio output.
+
+A device calls an AudioCallback on its own thread for every block of
+interleaved 16-bit stereo frames. Every block has a deadline, the time at
+which the device starts playing it; a callback which returns later than that
+is counted as a deadline miss, which on a real device is an audible dropout.
+The device also keeps the duration of the callbacks, so the load of the render
+path can be compared to the time available per block.
+
+The null device plays nothing: it asks for a block every block period of its
+clock, exactly like a sound card with two blocks of buffering would, and
+throws the audio away. It measures the render path without any sound hardware,
+e.g. on a build server.
+
+*/
+
+const uint32_t AUDIO_MIN_BLOCK_FRAMES = 64;
+const uint32_t AUDIO_MAX_BLOCK_FRAMES = 1024;
+const uint32_t AUDIO_DEFAULT_BLOCK_FRAMES = 256;
+
+class AudioCallback {
+public:
+	virtual ~AudioCallback() {}
+
+	// Renders 'frames' interleaved stereo frames. Called on the audio thread,
+	// must neither block, nor lock, nor allocate.
+	virtual void RenderAudio(int16_t* out, uint32_t frames) = 0;
+};
+
+struct AudioDeviceConfig {
+	AudioDeviceConfig() : sampleRate(44100), blockFrames(AUDIO_DEFAULT_BLOCK_FRAMES), bufferBlocks(3) {}
+
+	uint32_t sampleRate;
+	uint32_t blockFrames;  // AUDIO_MIN_BLOCK_FRAMES .. AUDIO_MAX_BLOCK_FRAMES.
+	uint32_t bufferBlocks; // Blocks queued on the device, including the one playing. Not used by the null device.
+};
+
+struct AudioDeviceStats {
+	uint64_t callbacks;
+	uint64_t deadlineMisses;
+	int64_t totalCallbackNs;
+	int64_t maxCallbackNs;
+	int64_t maxWakeLateNs;  // Worst delay between the time a block was due to be rendered and the callback.
+	int64_t blockNs;        // Duration of one block.
+
+	double AverageCallbackNs() const { return callbacks ? double(totalCallbackNs) / double(callbacks) : 0.0; }
+
+	// Share of the real time spent in the callback, in percent.
+	double LoadPercent() const { return (callbacks && blockNs) ? 100.0 * AverageCallbackNs() / double(blockNs) : 0.0; }
+};
+
+class AudioDevice {
+public:
+	AudioDevice();
+	virtual ~AudioDevice() {}
+
+	// Starts calling the callback. The callback must stay alive until Stop().
+	virtual bool Start(const AudioDeviceConfig& config, AudioCallback& callback, std::string& err) = 0;
+	virtual void Stop() = 0;
+
+	virtual const char* Name() const = 0;
+
+	const AudioDeviceConfig& Config() const { return config; }
+
+	// Safe to call while the device is running.
+	AudioDeviceStats Stats() const;
+
+protected:
+	// Checks the configuration and prepares the block buffer and the statistics.
+	bool Prepare(const AudioDeviceConfig& config, AudioCallback& callback, std::string& err);
+
+	// Runs the callback into 'block' and accounts it. Times are NowNanos() values.
+	void RenderBlock(int64_t dueNs, int64_t deadlineNs);
+
+	AudioDeviceConfig config;
+	AudioCallback* callback;
+	std::vector<int16_t> block;
+
+private:
+	AudioDevice(const AudioDevice&);
+	AudioDevice& operator=(const AudioDevice&);
+
+	std::atomic<uint64_t> callbacks;
+	std::atomic<uint64_t> deadlineMisses;
+	std::atomic<int64_t> totalCallbackNs;
+	std::atomic<int64_t> maxCallbackNs;
+	std::atomic<int64_t> maxWakeLateNs;
+};
+
+// Device without output, driven by the monotonic clock.
+class NullAudioDevice : public AudioDevice {
+public:
+	NullAudioDevice();
+	~NullAudioDevice();
+
+	bool Start(const AudioDeviceConfig& config, AudioCallback& callback, std::string& err);
+	void Stop();
+
+	const char* Name() const { return "null"; }
+
+private:
+	void Run();
+
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+};
@@ -0,0 +1,381 @@
+#include "bank_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "dls_bank.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const char SNAPSHOT_MAGIC[4] = { 'S', 'M', 'B', 'S' };
+
+// Stored as written; reads back differently on a machine of the other byte order.
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// Sections start on page boundaries, so each one maps and faults in on its own.
+const size_t SECTION_ALIGN = MAPPED_FILE_PAGE_SIZE;
+
+struct SnapshotSection {
+	uint64_t offset;
+	uint64_t count;
+	uint32_t elementSize;
+	uint32_t reserved;
+};
+
+struct SnapshotHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t headerSize;
+	uint64_t fileSize;
+	uint64_t sourceSize;
+	int64_t sourceTime;      // Modification time as reported by the file system.
+	uint64_t sourceHash;     // FNV-1a of the whole DLS file.
+	uint32_t padSamples;
+	uint32_t waveAlign;
+	SnapshotSection instruments; // BankSnapshotInstrument, sorted by key.
+	SnapshotSection regions;     // BankSnapshotRegion.
+	SnapshotSection waves;       // BankSnapshotWave, in wave pool order.
+	SnapshotSection samples;     // int16_t.
+};
+
+static_assert(sizeof(BankSnapshotInstrument) == 16, "the bank snapshot stores BankSnapshotInstrument as is");
+static_assert(sizeof(BankSnapshotRegion) == 36, "the bank snapshot stores BankSnapshotRegion as is");
+static_assert(sizeof(BankSnapshotWave) == 24, "the bank snapshot stores BankSnapshotWave as is");
+static_assert(BANK_SNAPSHOT_WAVE_ALIGN % sizeof(int16_t) == 0, "waves start on whole samples");
+
+struct FileStamp {
+	uint64_t size;
+	int64_t time;
+};
+
+#ifdef _WIN32
+bool GetFileStamp(const std::string& path, FileStamp& stamp) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) {
+		return false;
+	}
+	stamp.size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	stamp.time = int64_t((uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime);
+	return true;
+}
+
+bool RenameReplacing(const std::string& from, const std::string& to) {
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+bool GetFileStamp(const std::string& path, FileStamp& stamp) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		return false;
+	}
+	stamp.size = uint64_t(st.st_size);
+#ifdef __APPLE__
+	stamp.time = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	stamp.time = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+bool RenameReplacing(const std::string& from, const std::string& to) {
+	return rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+uint64_t HashBytes(const uint8_t* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+size_t AlignUp(size_t offset, size_t align) {
+	return (offset + align - 1) / align * align;
+}
+
+SnapshotSection MakeSection(size_t& offset, size_t count, size_t elementSize) {
+	SnapshotSection s;
+	s.offset = offset;
+	s.count = count;
+	s.elementSize = uint32_t(elementSize);
+	s.reserved = 0;
+	offset = AlignUp(offset + count * elementSize, SECTION_ALIGN);
+	return s;
+}
+
+bool SectionFits(const SnapshotSection& s, size_t elementSize, uint64_t fileSize) {
+	return (s.elementSize == elementSize) && (s.offset % SECTION_ALIGN == 0) && (s.offset <= fileSize) &&
+		(s.count <= (fileSize - s.offset) / elementSize);
+}
+
+// Zeros up to the given offset.
+void PadTo(std::ofstream& out, uint64_t offset) {
+	static const char zeros[SECTION_ALIGN] = { 0 };
+	uint64_t pos = uint64_t(out.tellp());
+	while (pos < offset) {
+		size_t n = size_t(std::min<uint64_t>(offset - pos, SECTION_ALIGN));
+		out.write(zeros, std::streamsize(n));
+		pos += n;
+	}
+}
+
+void WriteSection(std::ofstream& out, const SnapshotSection& s, const void* data) {
+	PadTo(out, s.offset);
+	if (s.count > 0) {
+		out.write((const char*)data, std::streamsize(s.count * s.elementSize));
+	}
+}
+
+// Samples played from a wave: up to the loop end for looped waves.
+uint32_t PlayedLength(const SynthWave& w) {
+	return (w.loopLength > 0) ? w.loopStart + w.loopLength : w.length;
+}
+
+}
+
+std::string BankSnapshotPath(const std::string& dlsPath) {
+	return dlsPath + BANK_SNAPSHOT_EXTENSION;
+}
+
+bool WriteBankSnapshot(const std::string& dlsPath, DlsBank& bank, std::string& err) {
+	FileStamp stamp;
+	if (!GetFileStamp(dlsPath, stamp)) {
+		err = "can not read file: " + dlsPath;
+		return false;
+	}
+	if (bank.FromSnapshot() || (bank.ImageSize() != stamp.size)) {
+		err = "the bank was not loaded from the DLS file: " + dlsPath;
+		return false;
+	}
+
+	std::vector<BankSnapshotInstrument> instruments(bank.InstrumentCount());
+	std::vector<BankSnapshotRegion> regions;
+	for (size_t i = 0; i < bank.InstrumentCount(); i++) {
+		bank.LoadInstrument(i);
+		const DlsInstrument& inst = bank.Instrument(i);
+		BankSnapshotInstrument& out = instruments[i];
+		out.key = inst.key;
+		out.firstRegion = uint32_t(regions.size());
+		out.regionCount = inst.loadedRegions;
+		out.reserved = 0;
+		for (uint32_t r = 0; r < inst.loadedRegions; r++) {
+			const SynthRegion& region = bank.Region(inst.firstRegion + r);
+			BankSnapshotRegion s;
+			memset(&s, 0, sizeof(s));
+			s.wave = bank.RegionWave(inst.firstRegion + r);
+			s.keyLow = region.keyLow;
+			s.keyHigh = region.keyHigh;
+			s.velocityLow = region.velocityLow;
+			s.velocityHigh = region.velocityHigh;
+			s.unityNote = region.unityNote;
+			s.fineTuneCents = region.fineTuneCents;
+			s.gain = region.gain;
+			s.pan = region.pan;
+			s.attackSec = region.attackSec;
+			s.decaySec = region.decaySec;
+			s.sustainLevel = region.sustainLevel;
+			s.releaseSec = region.releaseSec;
+			regions.push_back(s);
+		}
+	}
+
+	// Every wave aligned and padded with the continuation of its loop, or with silence.
+	const size_t alignSamples = BANK_SNAPSHOT_WAVE_ALIGN / sizeof(int16_t);
+	std::vector<BankSnapshotWave> waves(bank.WaveCount());
+	std::vector<int16_t> samples;
+	for (size_t i = 0; i < waves.size(); i++) {
+		const SynthWave& w = bank.Wave(i).wave;
+		BankSnapshotWave& out = waves[i];
+		memset(&out, 0, sizeof(out));
+		uint32_t length = PlayedLength(w);
+		if ((w.samples == nullptr) || (length == 0)) {
+			continue;
+		}
+		out.sampleOffset = samples.size();
+		out.length = length;
+		out.loopStart = w.loopStart;
+		out.loopLength = w.loopLength;
+		out.sampleRate = w.sampleRate;
+		samples.insert(samples.end(), w.samples, w.samples + length);
+		for (uint32_t k = 0; k < BANK_SNAPSHOT_PAD_SAMPLES; k++) {
+			samples.push_back((w.loopLength > 0) ? w.samples[w.loopStart + k % w.loopLength] : int16_t(0));
+		}
+		samples.resize(AlignUp(samples.size(), alignSamples), 0);
+	}
+	// The pages of the DLS file were only needed for the copy.
+	for (size_t i = 0; i < bank.InstrumentCount(); i++) {
+		bank.UnloadInstrument(i);
+	}
+
+	SnapshotHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = BANK_SNAPSHOT_VERSION;
+	h.byteOrder = SNAPSHOT_BYTE_ORDER;
+	h.headerSize = sizeof(SnapshotHeader);
+	h.sourceSize = stamp.size;
+	h.sourceTime = stamp.time;
+	h.sourceHash = HashBytes(bank.Image(), bank.ImageSize());
+	h.padSamples = BANK_SNAPSHOT_PAD_SAMPLES;
+	h.waveAlign = uint32_t(BANK_SNAPSHOT_WAVE_ALIGN);
+
+	size_t offset = AlignUp(sizeof(SnapshotHeader), SECTION_ALIGN);
+	h.instruments = MakeSection(offset, instruments.size(), sizeof(BankSnapshotInstrument));
+	h.regions = MakeSection(offset, regions.size(), sizeof(BankSnapshotRegion));
+	h.waves = MakeSection(offset, waves.size(), sizeof(BankSnapshotWave));
+	h.samples = MakeSection(offset, samples.size(), sizeof(int16_t));
+	h.fileSize = offset;
+
+	std::string path = BankSnapshotPath(dlsPath);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		out.write((const char*)&h, sizeof(h));
+		WriteSection(out, h.instruments, instruments.empty() ? nullptr : &instruments[0]);
+		WriteSection(out, h.regions, regions.empty() ? nullptr : &regions[0]);
+		WriteSection(out, h.waves, waves.empty() ? nullptr : &waves[0]);
+		WriteSection(out, h.samples, samples.empty() ? nullptr : &samples[0]);
+		PadTo(out, h.fileSize);
+		out.close();
+		if (!out) {
+			remove(tempPath.c_str());
+			err = "can not write file: " + tempPath;
+			return false;
+		}
+	}
+	if (!RenameReplacing(tempPath, path)) {
+		remove(tempPath.c_str());
+		err = "can not replace file: " + path;
+		return false;
+	}
+	return true;
+}
+
+BankSnapshot::BankSnapshot() :
+	instruments(nullptr),
+	instrumentCount(0),
+	regions(nullptr),
+	regionCount(0),
+	waves(nullptr),
+	waveCount(0),
+	samples(nullptr)
+{
+}
+
+void BankSnapshot::Close() {
+	instruments = nullptr;
+	instrumentCount = 0;
+	regions = nullptr;
+	regionCount = 0;
+	waves = nullptr;
+	waveCount = 0;
+	samples = nullptr;
+	mapping.Close();
+}
+
+bool BankSnapshot::Open(const std::string& dlsPath, std::string& err) {
+	Close();
+
+	FileStamp stamp;
+	if (!GetFileStamp(dlsPath, stamp)) {
+		err = "can not read file: " + dlsPath;
+		return false;
+	}
+
+	std::string path = BankSnapshotPath(dlsPath);
+	std::string mapErr;
+	if (!mapping.Open(path, mapErr)) {
+		err = "no snapshot: " + mapErr;
+		return false;
+	}
+
+	const uint8_t* data = mapping.Data();
+	uint64_t size = mapping.Size();
+	SnapshotHeader h;
+	if (size < sizeof(h)) {
+		err = "snapshot is truncated: " + path;
+		Close();
+		return false;
+	}
+	memcpy(&h, data, sizeof(h));
+	if ((memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) || (h.version != BANK_SNAPSHOT_VERSION) ||
+		(h.byteOrder != SNAPSHOT_BYTE_ORDER) || (h.headerSize != sizeof(SnapshotHeader)) ||
+		(h.padSamples != BANK_SNAPSHOT_PAD_SAMPLES) || (h.waveAlign != BANK_SNAPSHOT_WAVE_ALIGN))
+	{
+		err = "snapshot is of another version: " + path;
+		Close();
+		return false;
+	}
+	if ((h.fileSize != size) || !SectionFits(h.instruments, sizeof(BankSnapshotInstrument), size) ||
+		!SectionFits(h.regions, sizeof(BankSnapshotRegion), size) || !SectionFits(h.waves, sizeof(BankSnapshotWave), size) ||
+		!SectionFits(h.samples, sizeof(int16_t), size) || (h.instruments.count == 0))
+	{
+		err = "snapshot is corrupt: " + path;
+		Close();
+		return false;
+	}
+
+	if (h.sourceSize != stamp.size) {
+		err = "snapshot is stale, the file size changed: " + path;
+		Close();
+		return false;
+	}
+	if (h.sourceTime != stamp.time) {
+		// Copied or touched files keep their content: compare the hash before giving up.
+		MappedFile source;
+		if (!source.Open(dlsPath, err)) {
+			Close();
+			return false;
+		}
+		if (HashBytes(source.Data(), source.Size()) != h.sourceHash) {
+			err = "snapshot is stale, the file changed: " + path;
+			Close();
+			return false;
+		}
+	}
+
+	instruments = (const BankSnapshotInstrument*)(data + h.instruments.offset);
+	instrumentCount = size_t(h.instruments.count);
+	regions = (const BankSnapshotRegion*)(data + h.regions.offset);
+	regionCount = size_t(h.regions.count);
+	waves = (const BankSnapshotWave*)(data + h.waves.offset);
+	waveCount = size_t(h.waves.count);
+	samples = (const int16_t*)(data + h.samples.offset);
+
+	// The tables are small; the sample section is not touched here.
+	bool valid = true;
+	for (size_t i = 0; valid && (i < instrumentCount); i++) {
+		const BankSnapshotInstrument& inst = instruments[i];
+		valid = (inst.firstRegion <= regionCount) && (inst.regionCount <= regionCount - inst.firstRegion) &&
+			((i == 0) || (instruments[i - 1].key <= inst.key));
+	}
+	for (size_t i = 0; valid && (i < regionCount); i++) {
+		valid = regions[i].wave < waveCount;
+	}
+	uint64_t sampleCount = h.samples.count;
+	for (size_t i = 0; valid && (i < waveCount); i++) {
+		const BankSnapshotWave& w = waves[i];
+		valid = (w.length == 0) || ((w.sampleOffset <= sampleCount) &&
+			(uint64_t(w.length) + BANK_SNAPSHOT_PAD_SAMPLES <= sampleCount - w.sampleOffset) &&
+			(w.sampleOffset % (BANK_SNAPSHOT_WAVE_ALIGN / sizeof(int16_t)) == 0) &&
+			(uint64_t(w.loopStart) + w.loopLength <= w.length));
+	}
+	if (!valid) {
+		err = "snapshot is corrupt: " + path;
+		Close();
+		return false;
+	}
+	return true;
+}
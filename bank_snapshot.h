@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.h"
+
+class DlsBank;
+
+/*
+
+Fast-start snapshot of a DLS instrument bank.
+
+Loading a DLS file walks its RIFF chunks to index the instruments and the
+wave pool, and every instrument parses its regions, articulations and wave
+formats the first time it plays. A snapshot holds the result: the instrument
+index, the regions with their articulation resolved, and the sample data of
+every wave as 16-bit mono PCM, each wave 16-byte aligned and followed by
+BANK_SNAPSHOT_PAD_SAMPLES samples which continue its loop or are silent, so
+the resampler runs its vector kernels up to the loop end without wrapping.
+Looped waves are stored up to their loop end only. The sections start on page
+boundaries and are used in place: opening a snapshot maps the file and
+checks its header, and the pages of an instrument are read in when it is
+loaded.
+
+The snapshot of "gm.dls" is "gm.dls.sbk" and records the size, modification
+time and hash of the DLS file, with the same rules as the song cache: it is
+used while the size and time match, or when only the time changed but the
+hash did not. DlsBank::Load() uses an up-to-date snapshot by itself; the DLS
+file is still mapped for DirectMusic, which reads the collection from it, but
+none of its pages are touched by the bank.
+
+*/
+
+struct BankSnapshotInstrument {
+	uint32_t key;          // DlsInstrumentKey.
+	uint32_t firstRegion;
+	uint32_t regionCount;
+	uint32_t reserved;
+};
+
+// SynthRegion with its wave as an index.
+struct BankSnapshotRegion {
+	uint32_t wave;
+	uint8_t keyLow;
+	uint8_t keyHigh;
+	uint8_t velocityLow;
+	uint8_t velocityHigh;
+	uint8_t unityNote;
+	uint8_t reserved;
+	int16_t fineTuneCents;
+	float gain;
+	float pan;
+	float attackSec;
+	float decaySec;
+	float sustainLevel;
+	float releaseSec;
+};
+
+struct BankSnapshotWave {
+	uint64_t sampleOffset; // In samples from the start of the sample section.
+	uint32_t length;       // 0 if the wave can not be played.
+	uint32_t loopStart;
+	uint32_t loopLength;
+	uint32_t sampleRate;
+};
+
+// Path of the snapshot of a DLS file.
+std::string BankSnapshotPath(const std::string& dlsPath);
+
+// Loads every instrument of the bank and writes the snapshot of the DLS file it was loaded from.
+// The file is written under a temporary name and renamed, so readers never see it half written.
+bool WriteBankSnapshot(const std::string& dlsPath, DlsBank& bank, std::string& err);
+
+class BankSnapshot {
+public:
+	BankSnapshot();
+
+	// Maps the snapshot of a DLS file. Fails with the reason if it is missing, stale or unreadable.
+	bool Open(const std::string& dlsPath, std::string& err);
+	void Close();
+
+	bool IsOpen() const { return mapping.IsOpen(); }
+	MappedFile& Mapping() { return mapping; }
+	const MappedFile& Mapping() const { return mapping; }
+
+	size_t InstrumentCount() const { return instrumentCount; }
+	const BankSnapshotInstrument* Instruments() const { return instruments; }
+	size_t RegionCount() const { return regionCount; }
+	const BankSnapshotRegion* Regions() const { return regions; }
+	size_t WaveCount() const { return waveCount; }
+	const BankSnapshotWave* Waves() const { return waves; }
+	const int16_t* Samples() const { return samples; }
+
+private:
+	BankSnapshot(const BankSnapshot&);
+	BankSnapshot& operator=(const BankSnapshot&);
+
+	MappedFile mapping;
+	const BankSnapshotInstrument* instruments;
+	size_t instrumentCount;
+	const BankSnapshotRegion* regions;
+	size_t regionCount;
+	const BankSnapshotWave* waves;
+	size_t waveCount;
+	const int16_t* samples;
+};
+
+const char BANK_SNAPSHOT_EXTENSION[] = ".sbk";
+
+// Bumped whenever the layout of the file or of the stored structures changes.
+const uint32_t BANK_SNAPSHOT_VERSION = 1;
+
+// Samples stored after the end of every wave, at least the margin of the cubic kernel.
+const uint32_t BANK_SNAPSHOT_PAD_SAMPLES = 8;
+
+// Alignment of the first sample of every wave.
+const size_t BANK_SNAPSHOT_WAVE_ALIGN = 16;
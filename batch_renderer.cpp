@@ -0,0 +1,227 @@
+#include "batch_renderer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#include "hires_clock.h"
+#include "pcm_file_writer.h"
+#include "smf.h"
+#include "timeline.h"
+#include "work_stealing_pool.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+std::string LowerExtension(const std::string& path) {
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash))) {
+		return std::string();
+	}
+	std::string ext = path.substr(dot);
+	for (size_t i = 0; i < ext.size(); i++) {
+		ext[i] = char(tolower((unsigned char)ext[i]));
+	}
+	return ext;
+}
+
+bool IsMidiFileName(const std::string& name) {
+	std::string ext = LowerExtension(name);
+	return (ext == ".mid") || (ext == ".midi") || (ext == ".kar") || (ext == ".rmi");
+}
+
+// File name without directory and extension.
+std::string BaseName(const std::string& path) {
+	size_t slash = path.find_last_of("/\\");
+	std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	return (dot == std::string::npos || dot == 0) ? name : name.substr(0, dot);
+}
+
+std::string JoinPath(const std::string& dir, const std::string& name) {
+	if (dir.empty()) {
+		return name;
+	}
+	char last = dir[dir.size() - 1];
+	return ((last == '/') || (last == '\\')) ? dir + name : dir + "/" + name;
+}
+
+#ifdef _WIN32
+bool IsDirectory(const std::string& path) {
+	DWORD attributes = GetFileAttributesA(path.c_str());
+	return (attributes != INVALID_FILE_ATTRIBUTES) && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+bool MakeDirectory(const std::string& path) {
+	return CreateDirectoryA(path.c_str(), NULL) || (GetLastError() == ERROR_ALREADY_EXISTS);
+}
+
+bool ListDirectory(const std::string& dir, std::vector<std::string>& names) {
+	WIN32_FIND_DATAA data;
+	HANDLE h = FindFirstFileA(JoinPath(dir, "*").c_str(), &data);
+	if (h == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			names.push_back(data.cFileName);
+		}
+	} while (FindNextFileA(h, &data));
+	FindClose(h);
+	return true;
+}
+#else
+bool IsDirectory(const std::string& path) {
+	struct stat st;
+	return (stat(path.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+bool MakeDirectory(const std::string& path) {
+	return (mkdir(path.c_str(), 0777) == 0) || IsDirectory(path);
+}
+
+bool ListDirectory(const std::string& dir, std::vector<std::string>& names) {
+	DIR* d = opendir(dir.c_str());
+	if (!d) {
+		return false;
+	}
+	while (struct dirent* entry = readdir(d)) {
+		std::string name = entry->d_name;
+		if (!IsDirectory(JoinPath(dir, name))) {
+			names.push_back(name);
+		}
+	}
+	closedir(d);
+	return true;
+}
+#endif
+
+uint64_t FileSize(const std::string& path) {
+	std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+	return in ? uint64_t(in.tellg()) : 0;
+}
+
+}
+
+bool CollectMidiFiles(const std::string& input, std::vector<std::string>& files, std::string& err) {
+	files.clear();
+
+	if (IsDirectory(input)) {
+		std::vector<std::string> names;
+		if (!ListDirectory(input, names)) {
+			err = "can not list directory: " + input;
+			return false;
+		}
+		std::sort(names.begin(), names.end());
+		for (size_t i = 0; i < names.size(); i++) {
+			if (IsMidiFileName(names[i])) {
+				files.push_back(JoinPath(input, names[i]));
+			}
+		}
+	}
+	else {
+		std::ifstream in(input.c_str());
+		if (!in) {
+			err = "can not open list file: " + input;
+			return false;
+		}
+		std::string line;
+		while (std::getline(in, line)) {
+			while (!line.empty() && isspace((unsigned char)line[line.size() - 1])) {
+				line.erase(line.size() - 1);
+			}
+			if (!line.empty() && (line[0] != '#')) {
+				files.push_back(line);
+			}
+		}
+	}
+
+	if (files.empty()) {
+		err = "no MIDI files found in " + input;
+		return false;
+	}
+	return true;
+}
+
+bool RenderBatch(const std::vector<std::string>& files, const std::string& outputDir, InstrumentBank* bank,
+	const OfflineRenderOptions& options, unsigned threads,
+	std::vector<BatchFileResult>& results, BatchSummary& summary, std::string& err)
+{
+	memset(&summary, 0, sizeof(summary));
+	if (!MakeDirectory(outputDir)) {
+		err = "can not create output directory: " + outputDir;
+		return false;
+	}
+
+	results.assign(files.size(), BatchFileResult());
+	for (size_t i = 0; i < files.size(); i++) {
+		BatchFileResult& r = results[i];
+		r.input = files[i];
+		r.output = JoinPath(outputDir, BaseName(files[i]) + ".wav");
+		r.ok = false;
+		r.worker = 0;
+		r.parseUs = 0;
+		memset(&r.stats, 0, sizeof(r.stats));
+	}
+
+	// Largest files first: the pool deals tasks in index order.
+	std::vector<std::pair<uint64_t, size_t> > order(files.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		order[i] = std::make_pair(FileSize(files[i]), i);
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) { return a.first > b.first; });
+
+	WorkStealingPool pool(threads);
+	std::vector<std::unique_ptr<OfflineRenderer> > renderers(pool.ThreadCount());
+	for (size_t i = 0; i < renderers.size(); i++) {
+		renderers[i].reset(new OfflineRenderer(options));
+	}
+
+	int64_t startUs = NowMicros();
+	pool.Run(files.size(), [&](size_t task, unsigned worker) {
+		BatchFileResult& r = results[order[task].second];
+		r.worker = worker;
+
+		int64_t parseStartUs = NowMicros();
+		SmfFile smf;
+		Timeline timeline;
+		if (!smf.Load(r.input, r.err) || !timeline.Build(smf, r.err)) {
+			return;
+		}
+		r.parseUs = NowMicros() - parseStartUs;
+
+		PcmFileWriter out;
+		if (!out.Open(r.output, options.synth.sampleRate, 2, true, r.err)) {
+			return;
+		}
+		OfflineRenderer& renderer = *renderers[worker];
+		r.ok = renderer.Render(timeline, bank, out, r.err) && out.Close(r.err);
+		r.stats = renderer.Stats();
+	});
+
+	summary.wallUs = NowMicros() - startUs;
+	summary.files = files.size();
+	summary.threads = pool.ThreadCount();
+	summary.stolenTasks = pool.StolenTasks();
+	for (size_t i = 0; i < results.size(); i++) {
+		const BatchFileResult& r = results[i];
+		if (!r.ok) {
+			summary.failed++;
+			continue;
+		}
+		summary.audioUs += r.stats.songUs;
+		summary.busyUs += r.parseUs + r.stats.renderUs;
+	}
+	return true;
+}
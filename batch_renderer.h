@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "instrument_bank.h"
+#include "offline_renderer.h"
+
+/*
+
+Renders many MIDI files concurrently on a work-stealing thread pool.
+
+All workers share one instrument bank, which must be safe for concurrent
+FindRegion calls (DlsBank and BuiltinInstrumentBank are). Each worker owns an
+OfflineRenderer and parses the files it renders itself. Files are dealt
+largest first, so that the longest songs do not end up last.
+
+*/
+
+struct BatchFileResult {
+	std::string input;
+	std::string output;
+	bool ok;
+	std::string err;
+	unsigned worker;
+	int64_t parseUs;           // Parsing and merging of the MIDI file.
+	OfflineRenderStats stats;
+};
+
+struct BatchSummary {
+	size_t files;
+	size_t failed;
+	unsigned threads;
+	int64_t wallUs;
+	int64_t audioUs;           // Total length of the rendered audio.
+	int64_t busyUs;            // Sum of the per-file parse and render times.
+	uint64_t stolenTasks;
+
+	double SongsPerMinute() const { return wallUs > 0 ? double(files - failed) * 60e6 / double(wallUs) : 0.0; }
+	double RealtimeFactor() const { return wallUs > 0 ? double(audioUs) / double(wallUs) : 0.0; }
+	double RealtimeFactorPerCore() const { return threads > 0 ? RealtimeFactor() / threads : 0.0; }
+};
+
+// Input is either a directory, whose .mid, .midi, .kar and .rmi files are taken,
+// or a text file with one path per line; empty lines and lines starting with '#' are skipped.
+bool CollectMidiFiles(const std::string& input, std::vector<std::string>& files, std::string& err);
+
+// Renders every file into outputDir as <name>.wav, creating the directory if needed.
+// Returns false only if the batch could not start; per-file failures are reported in the results.
+bool RenderBatch(const std::vector<std::string>& files, const std::string& outputDir, InstrumentBank* bank,
+	const OfflineRenderOptions& options, unsigned threads,
+	std::vector<BatchFileResult>& results, BatchSummary& summary, std::string& err);
@@ -0,0 +1,198 @@
+// Heap allocations of the realtime threads during playback.
+//
+// Usage: allocation_bench
+//
+// Every corpus shape is played by the sequencer into the realtime synthesizer
+// on the null audio device, rendering with two threads, while the transport is
+// used: a pause, a tempo change and a seek to shortly before the end, where the
+// same song queued behind itself takes over. The allocations made meanwhile by
+// the sequencer thread, the audio callback and the render workers are counted
+// and any of them fails the benchmark. The timeline of every song is also built
+// a second time, which should reuse its arena and not allocate at all.
+//
+// Every song is then played the same way with a generated DLS bank of which
+// only the even instruments were loaded, and those are unloaded while it plays,
+// as a playlist releases the instruments of older songs. Notes of instruments
+// which are not resident must stay silent: the audio thread neither loads them,
+// which would lock and allocate, nor finds the unloaded ones again.
+//
+// The counts need a build with MIDI_TRACK_ALLOCATIONS, see allocation_tracker.h;
+// without it the songs are still played and the counts are shown as '-'.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "allocation_tracker.h"
+#include "audio_device.h"
+#include "builtin_bank.h"
+#include "dls_bank.h"
+#include "midi_corpus.h"
+#include "realtime_synth.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "timeline.h"
+
+static const uint32_t CORPUS_SCALE = 1;
+static const uint32_t CORPUS_SEED = 1;
+static const uint32_t RENDER_THREADS = 2;
+static const uint32_t BLOCK_FRAMES = 256;
+
+static const int64_t PLAY_US = 300000;
+static const int64_t PAUSED_US = 100000;
+static const int64_t FAST_US = 200000;
+static const double FAST_TEMPO_SCALE = 2.0;
+static const int64_t SEEK_BEFORE_END_US = 200000;
+static const int64_t NEXT_SONG_US = 400000;
+
+static const char BANK_FILE[] = "allocation_bench.dls";
+
+static void SleepMicros(int64_t us) {
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static void PrintCount(uint64_t count) {
+	if (AllocationTrackingEnabled()) {
+		printf(" %12llu", (unsigned long long)count);
+	}
+	else {
+		printf(" %12s", "-");
+	}
+}
+
+struct PlayCounts {
+	uint64_t allocations; // Made by the realtime threads.
+	uint64_t bytes;
+	uint32_t songs;
+};
+
+// Plays the song followed by itself with the transport in use, see above. 'playing' runs once the song plays.
+static bool Play(const Timeline& timeline, InstrumentBank& bank, const std::function<void()>& playing, PlayCounts& counts) {
+	SynthConfig synthConfig;
+	synthConfig.renderThreads = RENDER_THREADS;
+	RealtimeSynth realtime(synthConfig, BLOCK_FRAMES);
+	realtime.GetSynth().SetInstrumentBank(&bank);
+	AudioDeviceConfig config;
+	config.blockFrames = BLOCK_FRAMES;
+	NullAudioDevice device;
+	std::string err;
+	if (!device.Start(config, realtime, err)) {
+		fprintf(stderr, "%s\n", err.c_str());
+		return false;
+	}
+
+	Sequencer sequencer;
+	AllocationCounts before = GetAllocationCounts();
+	sequencer.Start(timeline, realtime);
+	sequencer.Enqueue(timeline);
+	SleepMicros(PLAY_US);
+	if (playing) {
+		playing();
+	}
+	sequencer.Pause();
+	SleepMicros(PAUSED_US);
+	sequencer.Resume();
+	sequencer.SetTempoScale(FAST_TEMPO_SCALE);
+	SleepMicros(FAST_US);
+	sequencer.Seek(timeline.DurationUs() - SEEK_BEFORE_END_US);
+	SleepMicros(NEXT_SONG_US);
+	counts.songs = sequencer.SongNumber() + 1;
+	sequencer.Stop();
+	sequencer.SetTempoScale(1.0);
+	device.Stop();
+	AllocationCounts after = GetAllocationCounts();
+
+	counts.allocations = after.realtimeAllocations - before.realtimeAllocations;
+	counts.bytes = after.realtimeBytes - before.realtimeBytes;
+	return true;
+}
+
+static bool WriteBankFile(const char* path) {
+	std::vector<uint8_t> image = GenerateCorpusBank();
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		return false;
+	}
+	bool ok = fwrite(&image[0], 1, image.size(), f) == image.size();
+	return (fclose(f) == 0) && ok;
+}
+
+int main() {
+	std::string err;
+	DlsBank dlsBank;
+	if (!WriteBankFile(BANK_FILE) || !dlsBank.Load(BANK_FILE, err, false)) {
+		fprintf(stderr, "Failed to write or load %s: %s\n", BANK_FILE, err.c_str());
+		remove(BANK_FILE);
+		return 1;
+	}
+
+	printf("%-16s %10s %12s %12s %12s %12s %12s %9s %6s\n", "song", "events", "sysex bytes", "rebuild", "realtime", "rt bytes",
+		"dls rt", "dls found", "songs");
+
+	bool ok = true;
+	for (int shape = 0; shape < CORPUS_SHAPE_COUNT; shape++) {
+		const char* name = CorpusShapeName(CorpusShape(shape));
+		std::vector<uint8_t> image = GenerateCorpusSong(CorpusShape(shape), CORPUS_SCALE, CORPUS_SEED);
+		SmfFile smf;
+		Timeline timeline;
+		if (!smf.Parse(&image[0], image.size(), err) || !timeline.Build(smf, err)) {
+			fprintf(stderr, "%s: %s\n", name, err.c_str());
+			ok = false;
+			break;
+		}
+		uint64_t beforeBuild = GetAllocationCounts().allocations;
+		timeline.Build(smf, err);
+		uint64_t rebuildAllocations = GetAllocationCounts().allocations - beforeBuild;
+
+		BuiltinInstrumentBank builtinBank;
+		PlayCounts builtin;
+		if (!Play(timeline, builtinBank, std::function<void()>(), builtin)) {
+			ok = false;
+			break;
+		}
+
+		for (size_t i = 0; i < dlsBank.InstrumentCount(); i += 2) {
+			dlsBank.LoadInstrument(i);
+		}
+		PlayCounts dls;
+		if (!Play(timeline, dlsBank, [&dlsBank]() {
+			for (size_t i = 0; i < dlsBank.InstrumentCount(); i++) {
+				dlsBank.UnloadInstrument(i);
+			}
+		}, dls)) {
+			ok = false;
+			break;
+		}
+		// Every instrument was unloaded, none may be found any more.
+		unsigned dlsFound = 0;
+		for (size_t i = 0; i < dlsBank.InstrumentCount(); i++) {
+			uint32_t key = dlsBank.Instrument(i).key;
+			if (dlsBank.FindRegion(uint8_t(key >> 16), uint8_t(key >> 8), uint8_t(key), (key >> 24) != 0, 60, 100)) {
+				dlsFound++;
+			}
+		}
+
+		printf("%-16s %10llu %12u", name, (unsigned long long)timeline.EventCount(), timeline.LongestSysex());
+		PrintCount(rebuildAllocations);
+		PrintCount(builtin.allocations);
+		PrintCount(builtin.bytes);
+		PrintCount(dls.allocations);
+		printf(" %9u %6u\n", dlsFound, builtin.songs);
+		ok = ok && (rebuildAllocations == 0) && (builtin.allocations == 0) && (dls.allocations == 0) && (dlsFound == 0) &&
+			(builtin.songs == 2) && (dls.songs == 2);
+	}
+
+	dlsBank.Clear();
+	remove(BANK_FILE);
+	if (!AllocationTrackingEnabled()) {
+		printf("Built without MIDI_TRACK_ALLOCATIONS, allocations were not counted.\n");
+	}
+	if (!ok) {
+		fprintf(stderr, "A realtime thread allocated, an unloaded instrument was still found, a rebuilt timeline allocated or the queued song did not start.\n");
+		return 1;
+	}
+	return 0;
+}
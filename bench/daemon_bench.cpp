@@ -0,0 +1,166 @@
+// Command-to-first-note latency of the player daemon.
+//
+// Usage: daemon_bench [scale]
+//        daemon_bench -
+//
+// Every corpus shape is written as a MIDI file of 32 * scale bars, 8 by
+// default, and played with a play command twice: cold, when the daemon loads
+// and parses the file as a player started for the song would, and warm, when
+// the song is still loaded. The time from the command to the first note-on
+// reaching the sink is measured, less the song time of that note.
+//
+// With '-' the daemon reads commands from standard input and plays them into
+// a sink which only counts messages, as a stand-in for the player's daemon
+// mode on systems without MIDI output.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hires_clock.h"
+#include "midi_corpus.h"
+#include "player_daemon.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "timeline.h"
+
+static const uint32_t DEFAULT_SCALE = 8;
+static const uint32_t CORPUS_SEED = 1;
+
+// Gives up waiting for the first note after this long.
+static const int64_t FIRST_NOTE_TIMEOUT_US = 10000000;
+
+// Notes the arrival of the first note-on after Arm().
+class FirstNoteSink : public MidiSink {
+public:
+	FirstNoteSink() : messages(0), firstNoteUs(0) {}
+
+	bool ShortMessage(uint32_t message) {
+		messages++;
+		if (((message & 0xF0) == 0x90) && (((message >> 16) & 0x7F) != 0) && (firstNoteUs.load() == 0)) {
+			firstNoteUs.store(NowMicros());
+		}
+		return true;
+	}
+	bool LongMessage(const uint8_t*, uint32_t) {
+		messages++;
+		return true;
+	}
+	void Reset() {}
+
+	void Arm() { firstNoteUs.store(0); }
+
+	// 0 if there was none in time.
+	int64_t WaitFirstNote() {
+		int64_t startUs = NowMicros();
+		while ((firstNoteUs.load() == 0) && (NowMicros() - startUs < FIRST_NOTE_TIMEOUT_US)) {
+			std::this_thread::yield();
+		}
+		return firstNoteUs.load();
+	}
+
+	uint64_t Messages() const { return messages.load(); }
+
+private:
+	std::atomic<uint64_t> messages;
+	std::atomic<int64_t> firstNoteUs;
+};
+
+// Song time of the first note-on, -1 if the song has none.
+static int64_t FirstNoteTime(const Timeline& timeline) {
+	for (size_t i = 0; i < timeline.EventCount(); i++) {
+		const TimelineEvent& e = timeline.Event(i);
+		if (((e.status & 0xF0) == 0x90) && (e.data2 != 0)) {
+			return e.timeUs;
+		}
+	}
+	return -1;
+}
+
+// Command to first note of one play command, less the song time of the note; -1 if it did not come.
+static int64_t TimePlay(PlayerDaemon& daemon, FirstNoteSink& sink, const std::string& path, int64_t noteUs) {
+	std::string reply;
+	sink.Arm();
+	int64_t startUs = NowMicros();
+	daemon.Execute("play " + path, reply);
+	if (reply.compare(0, 2, "ok") != 0) {
+		fprintf(stderr, "%s\n", reply.c_str());
+		return -1;
+	}
+	int64_t firstUs = sink.WaitFirstNote();
+	daemon.Execute("stop", reply);
+	return (firstUs > 0) ? std::max<int64_t>(0, firstUs - startUs - noteUs) : -1;
+}
+
+static int Serve() {
+	FirstNoteSink sink;
+	uint64_t messages = 0;
+	{
+		Sequencer sequencer;
+		PlayerDaemon daemon(sequencer, sink);
+		daemon.Serve(std::cin, std::cout);
+		messages = sink.Messages();
+	}
+	fprintf(stderr, "%llu messages played\n", (unsigned long long)messages);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if ((argc > 1) && (std::string(argv[1]) == "-")) {
+		return Serve();
+	}
+	uint32_t scale = (argc > 1) ? uint32_t(atoi(argv[1])) : DEFAULT_SCALE;
+	if (scale == 0) {
+		scale = DEFAULT_SCALE;
+	}
+
+	printf("%-16s %10s %10s %12s %12s\n", "song", "events", "song ms", "cold us", "warm us");
+
+	bool ok = true;
+	for (int shape = 0; shape < CORPUS_SHAPE_COUNT; shape++) {
+		const char* name = CorpusShapeName(CorpusShape(shape));
+		std::vector<uint8_t> image = GenerateCorpusSong(CorpusShape(shape), scale, CORPUS_SEED);
+		std::string path = std::string("daemon_bench_") + name + ".mid";
+		{
+			std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+			out.write((const char*)&image[0], std::streamsize(image.size()));
+		}
+
+		std::string err;
+		SmfFile smf;
+		Timeline timeline;
+		if (!smf.Parse(&image[0], image.size(), err) || !timeline.Build(smf, err)) {
+			fprintf(stderr, "%s: %s\n", name, err.c_str());
+			remove(path.c_str());
+			return 1;
+		}
+		int64_t noteUs = FirstNoteTime(timeline);
+
+		FirstNoteSink sink;
+		int64_t coldUs;
+		int64_t warmUs;
+		{
+			Sequencer sequencer;
+			PlayerDaemon daemon(sequencer, sink);
+			coldUs = TimePlay(daemon, sink, path, noteUs);
+			warmUs = TimePlay(daemon, sink, path, noteUs);
+		}
+		remove(path.c_str());
+
+		printf("%-16s %10llu %10lld %12lld %12lld\n", name, (unsigned long long)timeline.EventCount(),
+			(long long)(timeline.DurationUs() / 1000), (long long)coldUs, (long long)warmUs);
+		ok = ok && (coldUs >= 0) && (warmUs >= 0);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "A first note did not arrive.\n");
+		return 1;
+	}
+	return 0;
+}
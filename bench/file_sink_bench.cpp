@@ -0,0 +1,200 @@
+// Round trip of songs through the MIDI file sink.
+//
+// Usage: file_sink_bench [MIDI file ...]
+//
+// Every song, the synthetic corpus if no file is given, is sent as the
+// sequencer sends it, in batches of events due at the same time, through the
+// output optimizer with running status only into a file sink. The file is
+// saved as "file_sink_bench.mid" in the current directory, parsed again and
+// its events are compared with the song: the same channel messages and SysEx
+// in the same order, each within one tick of the file, 100 us, of its time.
+// The table shows the events sent, the events read back, the status bytes the
+// sink had to restore and the events which differ.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "midi_corpus.h"
+#include "output_optimizer.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "smf_file_sink.h"
+#include "timeline.h"
+
+static const uint32_t CORPUS_SCALE = 1;
+static const uint32_t CORPUS_SEED = 1;
+
+static const char* const ROUND_TRIP_PATH = "file_sink_bench.mid";
+
+// Time of one tick of the written file.
+static const int64_t TICK_US = SMF_SINK_US_PER_QUARTER / SMF_SINK_DIVISION;
+
+struct SongResult {
+	uint64_t sent;
+	uint64_t read;
+	uint64_t runningStatus;
+	uint64_t dropped;
+	uint64_t mismatches;
+};
+
+// Events which reach a sink: channel messages and SysEx.
+static bool IsSent(const TimelineEvent& e) {
+	return (e.status < SMF_STATUS_SYSEX) || (e.status == SMF_STATUS_SYSEX);
+}
+
+static void SendSong(const Timeline& timeline, MidiSink& sink) {
+	std::vector<MidiSinkEvent> batch;
+	std::vector<uint8_t> sysex;
+	size_t i = 0;
+	while (i < timeline.EventCount()) {
+		int64_t timeUs = timeline.Event(i).timeUs;
+		batch.clear();
+		sysex.clear();
+		size_t end = i;
+		while ((end < timeline.EventCount()) && (timeline.Event(end).timeUs == timeUs) && (end - i < SEQUENCER_MAX_BATCH)) {
+			end++;
+		}
+		// SysEx data is collected first, so pointers into it stay valid.
+		for (size_t k = i; k < end; k++) {
+			const TimelineEvent& e = timeline.Event(k);
+			if (e.status == SMF_STATUS_SYSEX) {
+				sysex.push_back(SMF_STATUS_SYSEX);
+				sysex.insert(sysex.end(), timeline.Payload(e), timeline.Payload(e) + e.payloadLength);
+			}
+		}
+		size_t sysexPos = 0;
+		for (size_t k = i; k < end; k++) {
+			const TimelineEvent& e = timeline.Event(k);
+			if (!IsSent(e)) {
+				continue;
+			}
+			MidiSinkEvent out;
+			out.timeUs = e.timeUs;
+			out.message = 0;
+			out.length = 0;
+			out.data = nullptr;
+			if (e.status < SMF_STATUS_SYSEX) {
+				out.message = PackShortMessage(e.status, e.data1, e.data2);
+			}
+			else {
+				out.data = &sysex[sysexPos];
+				out.length = e.payloadLength + 1;
+				sysexPos += out.length;
+			}
+			batch.push_back(out);
+		}
+		i = end;
+		if (!batch.empty()) {
+			sink.SubmitBatch(&batch[0], batch.size());
+		}
+	}
+}
+
+static bool SameEvent(const Timeline& a, const TimelineEvent& ea, const Timeline& b, const TimelineEvent& eb) {
+	if ((ea.status != eb.status) || (eb.timeUs > ea.timeUs) || (ea.timeUs - eb.timeUs >= TICK_US)) {
+		return false;
+	}
+	if (ea.status == SMF_STATUS_SYSEX) {
+		return (ea.payloadLength == eb.payloadLength) && (memcmp(a.Payload(ea), b.Payload(eb), ea.payloadLength) == 0);
+	}
+	return (ea.data1 == eb.data1) && ((ChannelMessageLength(ea.status) < 3) || (ea.data2 == eb.data2));
+}
+
+static bool RunSong(const Timeline& timeline, SongResult& r, std::string& err) {
+	memset(&r, 0, sizeof(r));
+	SmfFileSink sink;
+	MidiOutputOptimizerOptions options;
+	options.dropRedundant = false;
+	options.noteOffAsNoteOn = false;
+	MidiOutputOptimizer optimizer(sink, options);
+	SendSong(timeline, optimizer);
+	r.runningStatus = optimizer.Stats().runningStatus;
+	r.dropped = sink.Dropped();
+
+	SmfFile smf;
+	Timeline written;
+	if (!sink.Save(ROUND_TRIP_PATH, err) || !smf.Load(ROUND_TRIP_PATH, err) || !written.Build(smf, err)) {
+		return false;
+	}
+
+	size_t k = 0;
+	for (size_t i = 0; i < timeline.EventCount(); i++) {
+		const TimelineEvent& e = timeline.Event(i);
+		if (!IsSent(e)) {
+			continue;
+		}
+		r.sent++;
+		while ((k < written.EventCount()) && !IsSent(written.Event(k))) {
+			k++;
+		}
+		if (k == written.EventCount()) {
+			r.mismatches++;
+			continue;
+		}
+		if (!SameEvent(timeline, e, written, written.Event(k))) {
+			r.mismatches++;
+		}
+		k++;
+	}
+	for (size_t i = 0; i < written.EventCount(); i++) {
+		if (IsSent(written.Event(i))) {
+			r.read++;
+		}
+	}
+	if (r.read > r.sent) {
+		r.mismatches += r.read - r.sent;
+	}
+	return true;
+}
+
+static bool Report(const std::string& name, const Timeline& timeline) {
+	SongResult r;
+	std::string err;
+	if (!RunSong(timeline, r, err)) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), err.c_str());
+		return false;
+	}
+	printf("%-16s %9llu %9llu %9llu %9llu %6llu\n", name.c_str(), (unsigned long long)r.sent, (unsigned long long)r.read,
+		(unsigned long long)r.runningStatus, (unsigned long long)r.dropped, (unsigned long long)r.mismatches);
+	return (r.dropped == 0) && (r.mismatches == 0);
+}
+
+int main(int argc, char* argv[]) {
+	printf("%-16s %9s %9s %9s %9s %6s\n", "song", "sent", "read", "running", "dropped", "diffs");
+
+	bool ok = true;
+	std::string err;
+	if (argc < 2) {
+		for (int shape = 0; shape < CORPUS_SHAPE_COUNT; shape++) {
+			std::vector<uint8_t> image = GenerateCorpusSong(CorpusShape(shape), CORPUS_SCALE, CORPUS_SEED);
+			SmfFile smf;
+			Timeline timeline;
+			if (!smf.Parse(&image[0], image.size(), err) || !timeline.Build(smf, err)) {
+				fprintf(stderr, "%s: %s\n", CorpusShapeName(CorpusShape(shape)), err.c_str());
+				return 1;
+			}
+			ok = Report(CorpusShapeName(CorpusShape(shape)), timeline) && ok;
+		}
+	}
+	for (int a = 1; a < argc; a++) {
+		SmfFile smf;
+		Timeline timeline;
+		if (!smf.Load(argv[a], err) || !timeline.Build(smf, err)) {
+			fprintf(stderr, "%s: %s\n", argv[a], err.c_str());
+			ok = false;
+			continue;
+		}
+		std::string name = argv[a];
+		size_t slash = name.find_last_of("/\\");
+		ok = Report((slash == std::string::npos) ? name : name.substr(slash + 1), timeline) && ok;
+	}
+	remove(ROUND_TRIP_PATH);
+
+	if (!ok) {
+		fprintf(stderr, "The written MIDI file does not match the song.\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,210 @@
+// Micro-benchmark of the synthesizer kernels.
+//
+// Usage: kernel_bench [voices] [frames per voice]
+//
+// Every kernel set supported by the CPU is timed per kernel and through the
+// whole synthesizer, and its output is compared against the scalar kernels.
+// The exit code is non-zero when a vector kernel exceeds the tolerance.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "builtin_bank.h"
+#include "hires_clock.h"
+#include "smf.h"
+#include "synth.h"
+#include "synth_kernels.h"
+
+static const uint32_t WAVE_LENGTH = 1 << 16;
+static const float FLOAT_TOLERANCE = 1e-6f;
+
+struct BenchData {
+	std::vector<int16_t> wave;
+	std::vector<uint64_t> steps;    // Per voice.
+	std::vector<float> mono;        // Per voice, 'frames' samples each.
+	std::vector<float> stereo;
+	std::vector<int16_t> pcm;
+};
+
+static float MaxDifference(const std::vector<float>& a, const std::vector<float>& b) {
+	float diff = 0.0f;
+	for (size_t i = 0; i < a.size(); i++) {
+		diff = std::max(diff, std::fabs(a[i] - b[i]));
+	}
+	return diff;
+}
+
+static int MaxDifference(const std::vector<int16_t>& a, const std::vector<int16_t>& b) {
+	int diff = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		diff = std::max(diff, std::abs(int(a[i]) - int(b[i])));
+	}
+	return diff;
+}
+
+static void RunResample(const SynthKernels& k, SynthInterpolation mode, BenchData& d, uint32_t voices, uint32_t frames) {
+	ResampleKernel kernel = (mode == INTERPOLATION_CUBIC) ? k.resampleCubic : k.resampleLinear;
+	for (uint32_t v = 0; v < voices; v++) {
+		// Starts one sample in, so that cubic reads stay inside the wave.
+		uint64_t pos = (uint64_t(1 + v * 17) << 32) | (uint64_t(v) * 0x9E3779B9u);
+		kernel(&d.wave[0], pos, d.steps[v], &d.mono[size_t(v) * frames], frames);
+	}
+}
+
+static void RunMix(const SynthKernels& k, BenchData& d, uint32_t voices, uint32_t frames) {
+	for (uint32_t v = 0; v < voices; v++) {
+		k.mixStereo(&d.mono[size_t(v) * frames], &d.stereo[0], frames, 0.1f, 1e-4f * v, 0.2f, -1e-4f * v);
+	}
+}
+
+// Best of several runs, in ns per sample and voice.
+template <typename F>
+static double Time(F run, uint64_t samples) {
+	double best = 1e30;
+	for (int i = 0; i < 5; i++) {
+		int64_t start = NowNanos();
+		run();
+		double ns = double(NowNanos() - start) / double(samples);
+		if (ns < best) {
+			best = ns;
+		}
+	}
+	return best;
+}
+
+// Renders through the synthesizer with 'voices' held notes.
+static double TimeSynth(const SynthKernels& k, SynthInterpolation mode, uint32_t voices, uint32_t frames, std::vector<float>& out) {
+	BuiltinInstrumentBank bank;
+	SynthConfig config;
+	config.maxVoices = voices;
+	config.polyphony = voices;
+	config.interpolation = mode;
+	Synth synth(config);
+	synth.SetInstrumentBank(&bank);
+	synth.SetKernels(k);
+	for (uint32_t v = 0; v < voices; v++) {
+		synth.ShortMessage(PackShortMessage(0x90 | (v % 16 == 9 ? 0 : v % 16), uint8_t(36 + v % 60), 100));
+	}
+	uint32_t active = synth.ActiveVoices();
+
+	out.assign(size_t(frames) * 2, 0.0f);
+	int64_t start = NowNanos();
+	synth.RenderFloat(&out[0], frames);
+	return double(NowNanos() - start) / (double(frames) * (active ? active : 1));
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t voices = (argc > 1) ? uint32_t(atoi(argv[1])) : 64;
+	uint32_t frames = (argc > 2) ? uint32_t(atoi(argv[2])) : 4096;
+	if ((voices == 0) || (frames == 0)) {
+		fprintf(stderr, "Usage: kernel_bench [voices] [frames per voice]\n");
+		return 1;
+	}
+
+	BenchData d;
+	d.wave.resize(WAVE_LENGTH);
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < WAVE_LENGTH; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		d.wave[i] = int16_t(12000.0 * sin(i * 0.05) + int32_t(seed >> 20) - 2048);
+	}
+	d.steps.resize(voices);
+	for (uint32_t v = 0; v < voices; v++) {
+		// Pitch ratios between 0.5 and about 2, keeping every read inside the wave.
+		double ratio = pow(2.0, (int(v % 25) - 12) / 12.0);
+		d.steps[v] = uint64_t(ratio * 4294967296.0);
+	}
+	if (uint64_t(frames) * 2 + voices * 17 + 4 >= WAVE_LENGTH) {
+		fprintf(stderr, "Too many frames per voice, at most %u\n", (WAVE_LENGTH - voices * 17 - 4) / 2);
+		return 1;
+	}
+
+	const SynthKernels* sets[3] = { &ScalarSynthKernels(), Sse2SynthKernels(), Avx2SynthKernels() };
+	uint64_t samples = uint64_t(voices) * frames;
+
+	// Scalar reference output.
+	BenchData ref = d;
+	ref.mono.resize(samples);
+	RunResample(*sets[0], INTERPOLATION_LINEAR, ref, voices, frames);
+	std::vector<float> refLinear = ref.mono;
+	RunResample(*sets[0], INTERPOLATION_CUBIC, ref, voices, frames);
+	std::vector<float> refCubic = ref.mono;
+	ref.stereo.assign(size_t(frames) * 2, 0.0f);
+	RunMix(*sets[0], ref, voices, frames);
+	std::vector<float> refMix = ref.stereo;
+	ref.pcm.resize(ref.stereo.size());
+	sets[0]->floatToInt16(&ref.stereo[0], &ref.pcm[0], uint32_t(ref.stereo.size()));
+	std::vector<float> refSynthLinear, refSynthCubic;
+	TimeSynth(*sets[0], INTERPOLATION_LINEAR, voices, frames, refSynthLinear);
+	TimeSynth(*sets[0], INTERPOLATION_CUBIC, voices, frames, refSynthCubic);
+
+	printf("%u voices, %u frames per voice, best kernels: %s\n\n", voices, frames, BestSynthKernels().name);
+	printf("%-8s %-14s %12s %14s\n", "kernels", "kernel", "ns/sample", "max diff");
+
+	bool failed = false;
+	for (int s = 0; s < 3; s++) {
+		if (!sets[s]) {
+			continue;
+		}
+		const SynthKernels& k = *sets[s];
+		BenchData b = d;
+		b.mono.resize(samples);
+
+		double ns = Time([&]() { RunResample(k, INTERPOLATION_LINEAR, b, voices, frames); }, samples);
+		float diff = MaxDifference(b.mono, refLinear);
+		failed |= (diff > FLOAT_TOLERANCE);
+		printf("%-8s %-14s %12.3f %14g\n", k.name, "linear", ns, diff);
+
+		ns = Time([&]() { RunResample(k, INTERPOLATION_CUBIC, b, voices, frames); }, samples);
+		diff = MaxDifference(b.mono, refCubic);
+		failed |= (diff > FLOAT_TOLERANCE);
+		printf("%-8s %-14s %12.3f %14g\n", k.name, "cubic", ns, diff);
+
+		// The comparison run starts from silence, the timed runs accumulate.
+		b.stereo.assign(size_t(frames) * 2, 0.0f);
+		ns = Time([&]() { RunMix(k, b, voices, frames); }, samples);
+		b.mono = refCubic;
+		b.stereo.assign(size_t(frames) * 2, 0.0f);
+		RunMix(k, b, voices, frames);
+		diff = MaxDifference(b.stereo, refMix);
+		failed |= (diff > FLOAT_TOLERANCE * voices);
+		printf("%-8s %-14s %12.3f %14g\n", k.name, "mix stereo", ns, diff);
+
+		std::vector<float> sum = refMix;
+		ns = Time([&]() { k.accumulate(&refCubic[0], &sum[0], uint32_t(sum.size())); }, sum.size());
+		std::vector<float> refSum = refMix;
+		sets[0]->accumulate(&refCubic[0], &refSum[0], uint32_t(refSum.size()));
+		sum = refMix;
+		k.accumulate(&refCubic[0], &sum[0], uint32_t(sum.size()));
+		diff = MaxDifference(sum, refSum);
+		failed |= (diff > FLOAT_TOLERANCE);
+		printf("%-8s %-14s %12.3f %14g\n", k.name, "accumulate", ns, diff);
+
+		b.pcm.resize(refMix.size());
+		ns = Time([&]() { k.floatToInt16(&refMix[0], &b.pcm[0], uint32_t(refMix.size())); }, refMix.size());
+		int pcmDiff = MaxDifference(b.pcm, ref.pcm);
+		failed |= (pcmDiff > 0);
+		printf("%-8s %-14s %12.3f %14d\n", k.name, "float to int16", ns, pcmDiff);
+
+		std::vector<float> out;
+		ns = TimeSynth(k, INTERPOLATION_LINEAR, voices, frames, out);
+		diff = MaxDifference(out, refSynthLinear);
+		failed |= (diff > FLOAT_TOLERANCE * voices);
+		printf("%-8s %-14s %12.3f %14g\n", k.name, "synth linear", ns, diff);
+
+		ns = TimeSynth(k, INTERPOLATION_CUBIC, voices, frames, out);
+		diff = MaxDifference(out, refSynthCubic);
+		failed |= (diff > FLOAT_TOLERANCE * voices);
+		printf("%-8s %-14s %12.3f %14g\n", k.name, "synth cubic", ns, diff);
+	}
+
+	if (failed) {
+		printf("\nFAILED: vector kernels differ from the scalar reference.\n");
+		return 1;
+	}
+	printf("\nAll kernels match the scalar reference.\n");
+	return 0;
+}
@@ -0,0 +1,430 @@
+#include "midi_corpus.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "smf.h"
+
+namespace {
+
+const uint32_t TICKS_PER_BAR = CORPUS_DIVISION * 4;
+
+// xorshift32, the same sequence on every platform.
+class Random {
+public:
+	explicit Random(uint32_t seed) : state(seed ? seed : 0x9E3779B9u) {}
+
+	uint32_t Next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	// Uniform in [lo, hi].
+	uint32_t Range(uint32_t lo, uint32_t hi) { return lo + Next() % (hi - lo + 1); }
+
+private:
+	uint32_t state;
+};
+
+void WriteVarLen(std::vector<uint8_t>& out, uint32_t value) {
+	uint8_t buf[5];
+	int n = 0;
+	buf[n++] = uint8_t(value & 0x7F);
+	while ((value >>= 7) != 0) {
+		buf[n++] = uint8_t((value & 0x7F) | 0x80);
+	}
+	while (n > 0) {
+		out.push_back(buf[--n]);
+	}
+}
+
+void WriteBE32(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back(uint8_t(value >> 24));
+	out.push_back(uint8_t(value >> 16));
+	out.push_back(uint8_t(value >> 8));
+	out.push_back(uint8_t(value));
+}
+
+void WriteLE16(std::vector<uint8_t>& out, uint16_t value) {
+	out.push_back(uint8_t(value));
+	out.push_back(uint8_t(value >> 8));
+}
+
+void WriteLE32(std::vector<uint8_t>& out, uint32_t value) {
+	WriteLE16(out, uint16_t(value));
+	WriteLE16(out, uint16_t(value >> 16));
+}
+
+void WriteFourCC(std::vector<uint8_t>& out, const char* id) {
+	out.insert(out.end(), id, id + 4);
+}
+
+// Starts a RIFF chunk, or a list with its type; EndChunk() fills in the length.
+size_t BeginChunk(std::vector<uint8_t>& out, const char* id, const char* listType = nullptr) {
+	WriteFourCC(out, id);
+	size_t start = out.size();
+	WriteLE32(out, 0);
+	if (listType) {
+		WriteFourCC(out, listType);
+	}
+	return start;
+}
+
+void EndChunk(std::vector<uint8_t>& out, size_t start) {
+	uint32_t length = uint32_t(out.size() - start - 4);
+	for (int i = 0; i < 4; i++) {
+		out[start + i] = uint8_t(length >> (8 * i));
+	}
+	if (length & 1) {
+		out.push_back(0);
+	}
+}
+
+// 'ins ' list of one region over all notes and velocities which plays the wave.
+void WriteBankInstrument(std::vector<uint8_t>& out, uint32_t bank, uint32_t program, uint32_t wave) {
+	size_t ins = BeginChunk(out, "LIST", "ins ");
+	size_t insh = BeginChunk(out, "insh");
+	WriteLE32(out, 1);
+	WriteLE32(out, bank);
+	WriteLE32(out, program);
+	EndChunk(out, insh);
+
+	size_t lrgn = BeginChunk(out, "LIST", "lrgn");
+	size_t rgn = BeginChunk(out, "LIST", "rgn ");
+	size_t rgnh = BeginChunk(out, "rgnh");
+	WriteLE16(out, 0);
+	WriteLE16(out, 127);
+	WriteLE16(out, 0);
+	WriteLE16(out, 127);
+	WriteLE16(out, 0); // Options.
+	WriteLE16(out, 0); // Key group.
+	EndChunk(out, rgnh);
+	size_t wlnk = BeginChunk(out, "wlnk");
+	WriteLE16(out, 0); // Options.
+	WriteLE16(out, 0); // Phase group.
+	WriteLE32(out, 1); // Left channel.
+	WriteLE32(out, wave);
+	EndChunk(out, wlnk);
+	EndChunk(out, rgn);
+	EndChunk(out, lrgn);
+	EndChunk(out, ins);
+}
+
+// Events of one track in any order, written sorted by tick with running status.
+class TrackBuilder {
+public:
+	TrackBuilder() {}
+
+	void Channel(uint32_t tick, uint8_t status, uint8_t data1, uint8_t data2) {
+		uint8_t msg[3] = { status, uint8_t(data1 & 0x7F), uint8_t(data2 & 0x7F) };
+		Add(tick, 1, msg, uint32_t(ChannelMessageLength(status)));
+	}
+
+	// Note On and a Note On with velocity 0 as Note Off, which keeps the running status.
+	void Note(uint32_t tick, uint32_t length, uint8_t channel, uint8_t note, uint8_t velocity) {
+		Channel(tick, uint8_t(0x90 | channel), note, velocity);
+		uint8_t off[3] = { uint8_t(0x90 | channel), note, 0 };
+		Add(tick + length, 0, off, 3);
+	}
+
+	void Meta(uint32_t tick, uint8_t type, const uint8_t* data, uint32_t length) {
+		std::vector<uint8_t> msg;
+		msg.push_back(SMF_STATUS_META);
+		msg.push_back(type);
+		WriteVarLen(msg, length);
+		msg.insert(msg.end(), data, data + length);
+		Add(tick, 1, &msg[0], uint32_t(msg.size()));
+	}
+
+	void Tempo(uint32_t tick, uint32_t usPerQuarter) {
+		uint8_t data[3] = { uint8_t(usPerQuarter >> 16), uint8_t(usPerQuarter >> 8), uint8_t(usPerQuarter) };
+		Meta(tick, SMF_META_TEMPO, data, 3);
+	}
+
+	// 'data' starts after the F0 byte and ends with F7.
+	void Sysex(uint32_t tick, const uint8_t* data, uint32_t length) {
+		std::vector<uint8_t> msg;
+		msg.push_back(SMF_STATUS_SYSEX);
+		WriteVarLen(msg, length);
+		msg.insert(msg.end(), data, data + length);
+		Add(tick, 1, &msg[0], uint32_t(msg.size()));
+	}
+
+	void Write(std::vector<uint8_t>& out, uint32_t endTick) {
+		std::stable_sort(items.begin(), items.end(), ItemEarlier());
+
+		std::vector<uint8_t> track;
+		track.reserve(bytes.size() + items.size() * 2 + 4);
+		uint32_t lastTick = 0;
+		uint8_t runningStatus = 0;
+		for (size_t i = 0; i < items.size(); i++) {
+			const Item& item = items[i];
+			const uint8_t* msg = &bytes[item.offset];
+			WriteVarLen(track, item.tick - lastTick);
+			lastTick = item.tick;
+
+			if (msg[0] < SMF_STATUS_SYSEX) {
+				if (msg[0] == runningStatus) {
+					track.insert(track.end(), msg + 1, msg + item.length);
+					continue;
+				}
+				runningStatus = msg[0];
+			}
+			else {
+				runningStatus = 0;
+			}
+			track.insert(track.end(), msg, msg + item.length);
+		}
+
+		uint32_t tail = (endTick > lastTick) ? endTick - lastTick : 0;
+		WriteVarLen(track, tail);
+		const uint8_t endOfTrack[] = { SMF_STATUS_META, SMF_META_END_OF_TRACK, 0x00 };
+		track.insert(track.end(), endOfTrack, endOfTrack + sizeof(endOfTrack));
+
+		const uint8_t mtrk[] = { 'M', 'T', 'r', 'k' };
+		out.insert(out.end(), mtrk, mtrk + sizeof(mtrk));
+		WriteBE32(out, uint32_t(track.size()));
+		out.insert(out.end(), track.begin(), track.end());
+	}
+
+private:
+	TrackBuilder(const TrackBuilder&);
+	TrackBuilder& operator=(const TrackBuilder&);
+
+	struct Item {
+		uint32_t tick;
+		uint32_t priority; // Note Offs (0) before everything else (1) at the same tick.
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct ItemEarlier {
+		bool operator()(const Item& a, const Item& b) const {
+			if (a.tick != b.tick) {
+				return a.tick < b.tick;
+			}
+			return a.priority < b.priority;
+		}
+	};
+
+	void Add(uint32_t tick, uint32_t priority, const uint8_t* msg, uint32_t length) {
+		Item item = { tick, priority, uint32_t(bytes.size()), length };
+		bytes.insert(bytes.end(), msg, msg + length);
+		items.push_back(item);
+	}
+
+	std::vector<Item> items;
+	std::vector<uint8_t> bytes;
+};
+
+void WriteConductor(std::vector<uint8_t>& out, CorpusShape shape, uint32_t endTick, Random& rnd) {
+	TrackBuilder conductor;
+	const char* name = CorpusShapeName(shape);
+	conductor.Meta(0, SMF_META_TRACK_NAME, reinterpret_cast<const uint8_t*>(name), uint32_t(strlen(name)));
+	const uint8_t timeSignature[] = { 4, 2, 24, 8 };
+	conductor.Meta(0, SMF_META_TIME_SIGNATURE, timeSignature, sizeof(timeSignature));
+
+	if (shape == CORPUS_TEMPO_CHANGES) {
+		// Random walk between 66 and 200 BPM.
+		uint32_t usPerQuarter = 500000;
+		for (uint32_t tick = 0; tick < endTick; tick += 32) {
+			conductor.Tempo(tick, usPerQuarter);
+			usPerQuarter = std::min(900000u, std::max(300000u, usPerQuarter + rnd.Range(0, 40000) - 20000));
+		}
+	}
+	else {
+		conductor.Tempo(0, 500000);
+	}
+	conductor.Write(out, endTick);
+}
+
+// Quarter or shorter notes of random pitch, starting at 'offset' ticks into every step.
+void WriteMelody(std::vector<uint8_t>& out, uint8_t channel, uint8_t program, uint32_t step, uint32_t offset,
+	uint32_t endTick, Random& rnd) {
+	TrackBuilder track;
+	track.Channel(0, uint8_t(0xC0 | channel), program, 0);
+	track.Channel(0, uint8_t(0xB0 | channel), 7, 100);
+	for (uint32_t tick = offset; tick + step <= endTick; tick += step) {
+		track.Note(tick, step - step / 4, channel, uint8_t(rnd.Range(48, 84)), uint8_t(rnd.Range(64, 127)));
+	}
+	track.Write(out, endTick);
+}
+
+void WriteChords(std::vector<uint8_t>& out, uint8_t channel, uint32_t endTick, Random& rnd) {
+	TrackBuilder track;
+	track.Channel(0, uint8_t(0xC0 | channel), uint8_t(channel * 8), 0);
+	const uint32_t step = CORPUS_DIVISION / 8;
+	for (uint32_t tick = 0; tick + step <= endTick; tick += step) {
+		uint8_t root = uint8_t(rnd.Range(36, 72));
+		uint8_t velocity = uint8_t(rnd.Range(40, 127));
+		track.Note(tick, step - 10, channel, root, velocity);
+		track.Note(tick, step - 10, channel, uint8_t(root + 4), velocity);
+		track.Note(tick, step - 10, channel, uint8_t(root + 7), velocity);
+	}
+	track.Write(out, endTick);
+}
+
+void WriteAutomation(std::vector<uint8_t>& out, uint8_t channel, uint32_t endTick, Random& rnd) {
+	TrackBuilder track;
+	track.Channel(0, uint8_t(0xC0 | channel), uint8_t(48 + channel), 0);
+	for (uint32_t tick = 0; tick + TICKS_PER_BAR <= endTick; tick += TICKS_PER_BAR) {
+		track.Note(tick, TICKS_PER_BAR - 1, channel, uint8_t(rnd.Range(48, 72)), 100);
+	}
+
+	// Triangle sweeps, a different period per controller.
+	for (uint32_t tick = 0; tick < endTick; tick += 4) {
+		if (tick % 8 == 0) {
+			uint32_t phase = (tick / 8) % 256;
+			track.Channel(tick, uint8_t(0xB0 | channel), 1, uint8_t(phase < 128 ? phase : 255 - phase));
+		}
+		else {
+			uint32_t phase = (tick / 8) % 192;
+			track.Channel(tick, uint8_t(0xB0 | channel), 11, uint8_t(phase < 96 ? 31 + phase : 222 - phase));
+		}
+		uint32_t phase = (tick / 4) % 1024;
+		uint32_t bend = (phase < 512 ? phase : 1023 - phase) * 32;
+		track.Channel(tick, uint8_t(0xE0 | channel), uint8_t(bend & 0x7F), uint8_t(bend >> 7));
+	}
+	track.Write(out, endTick);
+}
+
+void WriteSysexDumps(std::vector<uint8_t>& out, uint32_t endTick, Random& rnd) {
+	TrackBuilder track;
+	std::vector<uint8_t> dump(CORPUS_SYSEX_DUMP_BYTES - 1);
+	for (uint32_t tick = 0; tick < endTick; tick += TICKS_PER_BAR) {
+		// Non-commercial manufacturer ID, synthesizers ignore it.
+		dump[0] = 0x7D;
+		for (size_t i = 1; i + 1 < dump.size(); i++) {
+			dump[i] = uint8_t(rnd.Next() & 0x7F);
+		}
+		dump.back() = 0xF7;
+		track.Sysex(tick, &dump[0], uint32_t(dump.size()));
+	}
+	track.Write(out, endTick);
+}
+
+}
+
+std::vector<uint8_t> GenerateCorpusBank() {
+	const uint32_t instrumentCount = 129;
+	const uint32_t DRUM_BANK = 0x80000000u;
+
+	std::vector<uint8_t> image;
+	size_t riff = BeginChunk(image, "RIFF", "DLS ");
+	size_t colh = BeginChunk(image, "colh");
+	WriteLE32(image, instrumentCount);
+	EndChunk(image, colh);
+
+	size_t lins = BeginChunk(image, "LIST", "lins");
+	for (uint32_t program = 0; program < 128; program++) {
+		WriteBankInstrument(image, 0, program, program);
+	}
+	WriteBankInstrument(image, DRUM_BANK, 0, 128);
+	EndChunk(image, lins);
+
+	// Every wave list has the same size, so the pool table offsets are known up front.
+	std::vector<uint8_t> wave;
+	size_t list = BeginChunk(wave, "LIST", "wave");
+	size_t fmt = BeginChunk(wave, "fmt ");
+	WriteLE16(wave, 1);     // PCM.
+	WriteLE16(wave, 1);     // Mono.
+	WriteLE32(wave, 22050);
+	WriteLE32(wave, 22050); // Bytes per second.
+	WriteLE16(wave, 1);     // Block align.
+	WriteLE16(wave, 8);
+	EndChunk(wave, fmt);
+	size_t data = BeginChunk(wave, "data");
+	size_t samples = wave.size();
+	wave.resize(samples + CORPUS_BANK_WAVE_FRAMES);
+	EndChunk(wave, data);
+	EndChunk(wave, list);
+
+	size_t ptbl = BeginChunk(image, "ptbl");
+	WriteLE32(image, 8);
+	WriteLE32(image, instrumentCount);
+	for (uint32_t i = 0; i < instrumentCount; i++) {
+		WriteLE32(image, uint32_t(i * wave.size()));
+	}
+	EndChunk(image, ptbl);
+
+	size_t wvpl = BeginChunk(image, "LIST", "wvpl");
+	for (uint32_t i = 0; i < instrumentCount; i++) {
+		// A square wave with a period of its own per instrument, unsigned 8-bit.
+		uint32_t period = 16 + i % 64;
+		for (uint32_t f = 0; f < CORPUS_BANK_WAVE_FRAMES; f++) {
+			wave[samples + f] = uint8_t(((f % period) < period / 2) ? 0xA0 : 0x60);
+		}
+		image.insert(image.end(), wave.begin(), wave.end());
+	}
+	EndChunk(image, wvpl);
+	EndChunk(image, riff);
+	return image;
+}
+
+const char* CorpusShapeName(CorpusShape shape) {
+	switch (shape) {
+	case CORPUS_MANY_TRACKS: return "many_tracks";
+	case CORPUS_DENSE_NOTES: return "dense_notes";
+	case CORPUS_CONTROLLERS: return "controllers";
+	case CORPUS_SYSEX_DUMPS: return "sysex_dumps";
+	case CORPUS_TEMPO_CHANGES: return "tempo_changes";
+	default: return "unknown";
+	}
+}
+
+std::vector<uint8_t> GenerateCorpusSong(CorpusShape shape, uint32_t scale, uint32_t seed) {
+	Random rnd(seed * 2654435761u + uint32_t(shape));
+	uint32_t endTick = TICKS_PER_BAR * CORPUS_BARS_PER_SCALE * std::max(1u, scale);
+
+	uint16_t trackCount = 1;
+	std::vector<uint8_t> tracks;
+	WriteConductor(tracks, shape, endTick, rnd);
+
+	switch (shape) {
+	case CORPUS_MANY_TRACKS:
+		for (uint32_t t = 0; t < 128; t++) {
+			uint8_t channel = uint8_t(t % 16);
+			WriteMelody(tracks, channel, uint8_t(t), CORPUS_DIVISION, (t * 7) % CORPUS_DIVISION, endTick, rnd);
+			trackCount++;
+		}
+		break;
+	case CORPUS_DENSE_NOTES:
+		for (uint8_t ch = 0; ch < 16; ch++) {
+			WriteChords(tracks, ch, endTick, rnd);
+			trackCount++;
+		}
+		break;
+	case CORPUS_CONTROLLERS:
+		for (uint8_t ch = 0; ch < 16; ch++) {
+			WriteAutomation(tracks, ch, endTick, rnd);
+			trackCount++;
+		}
+		break;
+	case CORPUS_SYSEX_DUMPS:
+		WriteSysexDumps(tracks, endTick, rnd);
+		trackCount++;
+		for (uint8_t ch = 0; ch < 4; ch++) {
+			WriteMelody(tracks, ch, uint8_t(ch * 16), CORPUS_DIVISION, 0, endTick, rnd);
+			trackCount++;
+		}
+		break;
+	case CORPUS_TEMPO_CHANGES:
+		for (uint8_t ch = 0; ch < 8; ch++) {
+			WriteMelody(tracks, ch, uint8_t(ch * 16), CORPUS_DIVISION / 2, 0, endTick, rnd);
+			trackCount++;
+		}
+		break;
+	default:
+		break;
+	}
+
+	std::vector<uint8_t> image;
+	image.reserve(tracks.size() + 14);
+	const uint8_t mthd[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1,
+		uint8_t(trackCount >> 8), uint8_t(trackCount), uint8_t(CORPUS_DIVISION >> 8), uint8_t(CORPUS_DIVISION) };
+	image.insert(image.end(), mthd, mthd + sizeof(mthd));
+	image.insert(image.end(), tracks.begin(), tracks.end());
+	return image;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+
+Generator of synthetic Standard MIDI Files for the benchmarks.
+
+Every shape stresses one part of the player: the merge of many tracks, dense
+note streams, heavy controller automation, large SysEx dumps or a tempo map
+with thousands of changes. The songs are format 1 files with running status,
+like the files written by sequencer software. The output depends only on the
+shape, the scale and the seed, so results of different builds can be compared.
+A small DLS bank to play them with on the synthesizer is generated as well.
+
+*/
+
+enum CorpusShape {
+	CORPUS_MANY_TRACKS = 0,   // 128 tracks of sparse melodies.
+	CORPUS_DENSE_NOTES = 1,   // 16 tracks of 32nd note chords.
+	CORPUS_CONTROLLERS = 2,   // 16 tracks of modulation, expression and pitch bend sweeps.
+	CORPUS_SYSEX_DUMPS = 3,   // A 64 KB SysEx dump per bar next to a few note tracks.
+	CORPUS_TEMPO_CHANGES = 4, // A tempo change every 32 ticks.
+	CORPUS_SHAPE_COUNT = 5
+};
+
+const char* CorpusShapeName(CorpusShape shape);
+
+// Format 1 SMF image of CORPUS_BARS_PER_SCALE * scale bars of 4/4.
+std::vector<uint8_t> GenerateCorpusSong(CorpusShape shape, uint32_t scale, uint32_t seed);
+
+// DLS Level 1 image with an instrument for every program of the General MIDI bank and a standard drum
+// kit, each a single region over all notes. The waves are CORPUS_BANK_WAVE_FRAMES of 8-bit PCM, which the
+// bank converts into a private copy when an instrument is loaded.
+std::vector<uint8_t> GenerateCorpusBank();
+
+const uint16_t CORPUS_DIVISION = 480;
+const uint32_t CORPUS_BARS_PER_SCALE = 32;
+const uint32_t CORPUS_SYSEX_DUMP_BYTES = 65536;
+const uint32_t CORPUS_BANK_WAVE_FRAMES = 4096;
@@ -0,0 +1,287 @@
+// Bytes saved by the output optimizer, and a check that it changes nothing.
+//
+// Usage: output_bench [MIDI file ...]
+//
+// Every song, the synthetic corpus if no file is given, is sent as the
+// sequencer sends it, in batches of events due at the same time, once
+// straight into a recording sink and once through the output optimizer into
+// another one. The optimized recording is decoded with its running status and
+// both are replayed into a channel state: after every batch the controller,
+// program, pressure and pitch bend state of all channels and the notes started
+// and stopped must be the same, as must the program changes with the bank they
+// select and the data entries with the RPN or NRPN they change. A short song of
+// bank selects and parameter edits which the optimizer must not shorten is
+// checked the same way. The table shows messages and bytes on the wire with and
+// without the optimizer and the time saved on a 31250 baud link.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "midi_corpus.h"
+#include "midi_state.h"
+#include "output_optimizer.h"
+#include "recording_sink.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "timeline.h"
+
+static const uint32_t CORPUS_SCALE = 1;
+static const uint32_t CORPUS_SEED = 1;
+
+// Time of a byte on a MIDI DIN link: 10 bits at 31250 baud.
+static const double WIRE_US_PER_BYTE = 320.0;
+
+// What the receiving device ends up with.
+struct Receiver {
+	MidiState state;
+	RunningStatusDecoder decoder;
+	bool nrpnSelected[MIDI_CHANNELS];
+	std::vector<uint32_t> notes; // Note events of the current batch: channel | note << 8 | on << 16.
+	std::vector<uint64_t> edits; // Program changes and data entries of the current batch, see Edit().
+
+	Receiver() {
+		state.Reset();
+		memset(nrpnSelected, 0, sizeof(nrpnSelected));
+	}
+
+	// Program changes and data entries act on what the channel state does not show: the
+	// bank selected before and whether an RPN or an NRPN was selected last.
+	void Edit(uint8_t status, uint8_t data1, uint8_t data2) {
+		int chIdx = status & 0x0F;
+		const MidiChannelState& ch = state.channels[chIdx];
+		if ((status & 0xF0) == 0xC0) {
+			edits.push_back(uint64_t(status) | (uint64_t(data1) << 8) | (uint64_t(ch.controllers[0]) << 16) |
+				(uint64_t(ch.controllers[32]) << 24));
+		}
+		else if ((status & 0xF0) == 0xB0) {
+			if ((data1 == 98) || (data1 == 99)) {
+				nrpnSelected[chIdx] = true;
+			}
+			else if ((data1 == 100) || (data1 == 101)) {
+				nrpnSelected[chIdx] = false;
+			}
+			else if ((data1 == 6) || (data1 == 38) || (data1 == 96) || (data1 == 97)) {
+				// The LSB of the parameter number is the lower controller of each pair.
+				uint8_t lsb = nrpnSelected[chIdx] ? 98 : 100;
+				edits.push_back(uint64_t(status) | (uint64_t(data1) << 8) | (uint64_t(data2) << 16) |
+					(uint64_t(ch.controllers[lsb + 1]) << 24) | (uint64_t(ch.controllers[lsb]) << 32) |
+					(uint64_t(nrpnSelected[chIdx]) << 40));
+			}
+		}
+	}
+
+	void Drain(RecordingMidiSink& sink, bool runningStatus) {
+		RecordedEvent e;
+		std::vector<uint8_t> bytes;
+		notes.clear();
+		edits.clear();
+		while (sink.Pop(e, bytes)) {
+			if (e.kind != RECORDED_SHORT) {
+				decoder.Cancel();
+				continue;
+			}
+			uint32_t message = runningStatus ? decoder.Decode(e.message) : e.message;
+			uint8_t status = uint8_t(message);
+			uint8_t data1 = uint8_t(message >> 8);
+			uint8_t data2 = uint8_t(message >> 16);
+			if (((status & 0xF0) == 0x80) || ((status & 0xF0) == 0x90)) {
+				bool on = ((status & 0xF0) == 0x90) && (data2 > 0);
+				notes.push_back(uint32_t(status & 0x0F) | (uint32_t(data1) << 8) | (uint32_t(on) << 16));
+			}
+			else if (status < 0xF0) {
+				Edit(status, data1, data2);
+				state.Apply(status, data1, data2);
+			}
+		}
+		bytes.clear();
+	}
+};
+
+static bool SameState(const MidiState& a, const MidiState& b) {
+	for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+		if (a.channels[ch] != b.channels[ch]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct SongResult {
+	uint64_t batches;
+	uint64_t mismatches;
+	MidiOutputOptimizerStats stats;
+};
+
+// Sends batches straight and through the optimizer and compares what the receivers get.
+class OutputCheck {
+public:
+	OutputCheck() :
+		plain(SEQUENCER_MAX_BATCH * 2, CORPUS_SYSEX_DUMP_BYTES * 4),
+		recorded(SEQUENCER_MAX_BATCH * 2, CORPUS_SYSEX_DUMP_BYTES * 4),
+		optimizer(recorded, MidiOutputOptimizerOptions())
+	{
+		r.batches = 0;
+		r.mismatches = 0;
+	}
+
+	void Submit(const std::vector<MidiSinkEvent>& batch) {
+		plain.SubmitBatch(&batch[0], batch.size());
+		optimizer.SubmitBatch(&batch[0], batch.size());
+		expected.Drain(plain, false);
+		actual.Drain(recorded, true);
+		r.batches++;
+		if (!SameState(expected.state, actual.state) || (expected.notes != actual.notes) || (expected.edits != actual.edits)) {
+			r.mismatches++;
+		}
+	}
+
+	SongResult Result() {
+		r.stats = optimizer.Stats();
+		return r;
+	}
+
+private:
+	RecordingMidiSink plain;
+	RecordingMidiSink recorded;
+	MidiOutputOptimizer optimizer;
+	Receiver expected;
+	Receiver actual;
+	SongResult r;
+};
+
+static SongResult RunSong(const Timeline& timeline) {
+	OutputCheck check;
+	std::vector<MidiSinkEvent> batch;
+	std::vector<uint8_t> sysex;
+	size_t i = 0;
+	while (i < timeline.EventCount()) {
+		int64_t timeUs = timeline.Event(i).timeUs;
+		batch.clear();
+		sysex.clear();
+		size_t end = i;
+		while ((end < timeline.EventCount()) && (timeline.Event(end).timeUs == timeUs) && (end - i < SEQUENCER_MAX_BATCH)) {
+			end++;
+		}
+		// SysEx data is collected first, so pointers into it stay valid.
+		for (size_t k = i; k < end; k++) {
+			const TimelineEvent& e = timeline.Event(k);
+			if (e.status == SMF_STATUS_SYSEX) {
+				sysex.push_back(SMF_STATUS_SYSEX);
+				sysex.insert(sysex.end(), timeline.Payload(e), timeline.Payload(e) + e.payloadLength);
+			}
+		}
+		size_t sysexPos = 0;
+		for (size_t k = i; k < end; k++) {
+			const TimelineEvent& e = timeline.Event(k);
+			MidiSinkEvent out;
+			out.timeUs = e.timeUs;
+			out.message = 0;
+			out.length = 0;
+			out.data = nullptr;
+			if (e.status < SMF_STATUS_SYSEX) {
+				out.message = PackShortMessage(e.status, e.data1, e.data2);
+			}
+			else if (e.status == SMF_STATUS_SYSEX) {
+				out.data = &sysex[sysexPos];
+				out.length = e.payloadLength + 1;
+				sysexPos += out.length;
+			}
+			else {
+				continue;
+			}
+			batch.push_back(out);
+		}
+		i = end;
+		if (batch.empty()) {
+			continue;
+		}
+
+		check.Submit(batch);
+	}
+	return check.Result();
+}
+
+// Messages which set a value the channel already has but still change the device.
+static SongResult RunParameterEdits() {
+	static const uint32_t batches[][3] = {
+		// Program 5 of bank 0, then of bank 8: the second program change loads another instrument.
+		{ 0x0000B0, 0x0005C0, 0 },
+		{ 0x0800B0, 0x0005C0, 0 },
+		// Bank select and program change in batches of their own.
+		{ 0x0120B1, 0, 0 },
+		{ 0x0000C1, 0, 0 },
+		// Pitch bend range (RPN 0), an NRPN, then RPN 0 reselected with the same numbers.
+		{ 0x0065B0, 0x0064B0, 0x0206B0 },
+		{ 0x0163B0, 0x0862B0, 0x4006B0 },
+		{ 0x0065B0, 0x0064B0, 0x0C06B0 },
+		{ 0x0063B0, 0x0062B0, 0x0160B0 },
+		{ 0x0065B0, 0x0064B0, 0x0160B0 },
+	};
+
+	OutputCheck check;
+	std::vector<MidiSinkEvent> batch;
+	for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+		batch.clear();
+		for (size_t k = 0; (k < 3) && batches[b][k]; k++) {
+			MidiSinkEvent out;
+			out.timeUs = int64_t(b) * 1000;
+			out.message = batches[b][k];
+			out.length = 0;
+			out.data = nullptr;
+			batch.push_back(out);
+		}
+		check.Submit(batch);
+	}
+	return check.Result();
+}
+
+static bool Report(const std::string& name, const SongResult& r) {
+	const MidiOutputOptimizerStats& s = r.stats;
+	double saved = (s.bytesIn > 0) ? 100.0 * s.BytesSaved() / s.bytesIn : 0.0;
+	printf("%-16s %9llu %9llu %10llu %10llu %7.1f %9.1f %9llu %9llu %9llu %6llu\n", name.c_str(),
+		(unsigned long long)s.messagesIn, (unsigned long long)s.messagesOut, (unsigned long long)s.bytesIn,
+		(unsigned long long)s.bytesOut, saved, s.BytesSaved() * WIRE_US_PER_BYTE / 1e3, (unsigned long long)s.runningStatus,
+		(unsigned long long)s.redundant, (unsigned long long)s.noteOffsAsNoteOns, (unsigned long long)r.mismatches);
+	return r.mismatches == 0;
+}
+
+int main(int argc, char* argv[]) {
+	printf("%-16s %9s %9s %10s %10s %7s %9s %9s %9s %9s %6s\n", "song", "msgs in", "msgs out", "bytes in", "bytes out",
+		"saved %", "wire ms", "running", "redundant", "note-offs", "diffs");
+
+	bool ok = true;
+	std::string err;
+	if (argc < 2) {
+		for (int shape = 0; shape < CORPUS_SHAPE_COUNT; shape++) {
+			std::vector<uint8_t> image = GenerateCorpusSong(CorpusShape(shape), CORPUS_SCALE, CORPUS_SEED);
+			SmfFile smf;
+			Timeline timeline;
+			if (!smf.Parse(&image[0], image.size(), err) || !timeline.Build(smf, err)) {
+				fprintf(stderr, "%s: %s\n", CorpusShapeName(CorpusShape(shape)), err.c_str());
+				return 1;
+			}
+			ok = Report(CorpusShapeName(CorpusShape(shape)), RunSong(timeline)) && ok;
+		}
+		ok = Report("parameter edits", RunParameterEdits()) && ok;
+	}
+	for (int a = 1; a < argc; a++) {
+		SmfFile smf;
+		Timeline timeline;
+		if (!smf.Load(argv[a], err) || !timeline.Build(smf, err)) {
+			fprintf(stderr, "%s: %s\n", argv[a], err.c_str());
+			ok = false;
+			continue;
+		}
+		std::string name = argv[a];
+		size_t slash = name.find_last_of("/\\");
+		ok = Report((slash == std::string::npos) ? name : name.substr(slash + 1), RunSong(timeline)) && ok;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "The optimized output does not match.\n");
+		return 1;
+	}
+	return 0;
+}
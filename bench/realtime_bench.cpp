@@ -0,0 +1,88 @@
+// Deadline benchmark of the real-time render path.
+//
+// Usage: realtime_bench <MIDI file> [seconds] [block frames ...]
+//
+// The song is played by the sequencer into the real-time synthesizer on the
+// null audio device, once per block size, for at most the given number of
+// seconds. Every run reports the callback load and the deadline misses, i.e.
+// the blocks a sound card would have played as a dropout, and the p99 delay of
+// the sequencer dispatching the events, which shares the CPU with the callbacks.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_device.h"
+#include "builtin_bank.h"
+#include "realtime_synth.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "timeline.h"
+
+static void RunBlockSize(const Timeline& timeline, uint32_t blockFrames, int64_t seconds) {
+	BuiltinInstrumentBank bank;
+	RealtimeSynth realtime(SynthConfig(), blockFrames);
+	realtime.GetSynth().SetInstrumentBank(&bank);
+
+	AudioDeviceConfig config;
+	config.blockFrames = blockFrames;
+	NullAudioDevice device;
+	std::string err;
+	if (!device.Start(config, realtime, err)) {
+		printf("%6u  %s\n", blockFrames, err.c_str());
+		return;
+	}
+
+	Sequencer sequencer;
+	sequencer.Start(timeline, realtime);
+	int64_t waitedMs = 0;
+	while (sequencer.IsPlaying() && (waitedMs < seconds * 1000)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		waitedMs += 10;
+	}
+	sequencer.Stop();
+	device.Stop();
+
+	AudioDeviceStats s = device.Stats();
+	printf("%6u %9.2f %10llu %8llu %10.1f %10.1f %7.1f %12.1f %6llu %10.1f\n", blockFrames, s.blockNs / 1e6,
+		(unsigned long long)s.callbacks, (unsigned long long)s.deadlineMisses, s.AverageCallbackNs() / 1e3,
+		s.maxCallbackNs / 1e3, s.LoadPercent(), s.maxWakeLateNs / 1e3, (unsigned long long)realtime.LateEvents(),
+		sequencer.DispatchDelay().ValueAtPercentile(99.0) / 1e3);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: realtime_bench <MIDI file> [seconds] [block frames ...]\n");
+		return 1;
+	}
+	int64_t seconds = (argc > 2) ? atoi(argv[2]) : 10;
+
+	std::vector<uint32_t> blocks;
+	for (int i = 3; i < argc; i++) {
+		blocks.push_back(uint32_t(atoi(argv[i])));
+	}
+	if (blocks.empty()) {
+		for (uint32_t b = AUDIO_MIN_BLOCK_FRAMES; b <= AUDIO_MAX_BLOCK_FRAMES; b *= 2) {
+			blocks.push_back(b);
+		}
+	}
+
+	SmfFile smf;
+	Timeline timeline;
+	std::string err;
+	if (!smf.Load(argv[1], err) || !timeline.Build(smf, err)) {
+		fprintf(stderr, "%s: %s\n", argv[1], err.c_str());
+		return 1;
+	}
+
+	printf("%s, %lld s per block size, %s kernels\n\n", argv[1], (long long)seconds, BestSynthKernels().name);
+	printf("%6s %9s %10s %8s %10s %10s %7s %12s %6s %10s\n", "block", "block ms", "callbacks", "misses",
+		"avg us", "max us", "load %", "max late us", "late", "seq p99 us");
+	for (size_t i = 0; i < blocks.size(); i++) {
+		RunBlockSize(timeline, blocks[i], seconds);
+	}
+	return 0;
+}
@@ -0,0 +1,235 @@
+// Benchmark suite over a synthetic MIDI corpus.
+//
+// Usage: suite_bench [JSON file] [scale] [corpus directory]
+//
+// For every corpus shape a song of 32 * scale bars is generated and timed
+// through the whole player pipeline: parsing the file image, merging the
+// tracks into the timeline, seeking with controller chase and rendering
+// through the synthesizer. The streaming reader is timed to its first window
+// of events and through the whole song. Parse, merge and stream times are the
+// median of several runs. The results are printed as a table and, if a JSON
+// file is given ('-' for none), written there together with the revision the
+// benchmark was configured from, so the numbers can be tracked per commit.
+// The generated songs are saved as .mid files if a corpus directory is given.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "builtin_bank.h"
+#include "hires_clock.h"
+#include "midi_corpus.h"
+#include "offline_renderer.h"
+#include "pcm_file_writer.h"
+#include "process_stats.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "smf_stream.h"
+#include "synth_kernels.h"
+#include "timeline.h"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#ifdef _WIN32
+static const char* NULL_DEVICE = "NUL";
+#else
+static const char* NULL_DEVICE = "/dev/null";
+#endif
+
+static const int TIMED_RUNS = 7;
+static const int SEEKS = 20000;
+static const uint32_t CORPUS_SEED = 1;
+
+struct ShapeResult {
+	const char* shape;
+	uint64_t fileBytes;
+	uint32_t tracks;
+	uint64_t events;
+	int64_t songUs;
+	double parseUs;
+	double mergeUs;
+	double streamFirstUs;   // SmfStream: open and read the first sequencer window.
+	double streamUs;        // SmfStream: read the whole song.
+	double seekNs;          // Timeline::SeekToMicros.
+	double chaseNs;         // Timeline::Chase right after the seek.
+	double renderUs;
+	double realtimeFactor;
+	uint64_t memoryBytes;   // Resident set growth from the file image to the rendered song.
+	uint64_t peakRssBytes;  // Peak of the process so far.
+};
+
+static double Median(std::vector<double> v) {
+	std::sort(v.begin(), v.end());
+	return v[v.size() / 2];
+}
+
+static bool RunShape(CorpusShape shape, uint32_t scale, const std::string& corpusDir, ShapeResult& r, std::string& err) {
+	uint64_t rssBefore = ProcessResidentBytes();
+	std::vector<uint8_t> image = GenerateCorpusSong(shape, scale, CORPUS_SEED);
+
+	r.shape = CorpusShapeName(shape);
+	r.fileBytes = image.size();
+
+	if (!corpusDir.empty()) {
+		std::string path = corpusDir + "/" + r.shape + ".mid";
+		std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+		out.write((const char*)&image[0], std::streamsize(image.size()));
+		if (!out) {
+			err = "can not write file: " + path;
+			return false;
+		}
+	}
+
+	SmfFile smf;
+	Timeline timeline;
+	std::vector<double> parse;
+	std::vector<double> merge;
+	for (int run = 0; run < TIMED_RUNS; run++) {
+		int64_t t0 = NowNanos();
+		if (!smf.Parse(&image[0], image.size(), err)) {
+			return false;
+		}
+		int64_t t1 = NowNanos();
+		if (!timeline.Build(smf, err)) {
+			return false;
+		}
+		int64_t t2 = NowNanos();
+		parse.push_back((t1 - t0) / 1e3);
+		merge.push_back((t2 - t1) / 1e3);
+	}
+	r.parseUs = Median(parse);
+	r.mergeUs = Median(merge);
+
+	std::vector<TimelineEvent> window(SEQUENCER_STREAM_WINDOW);
+	std::vector<double> streamFirst;
+	std::vector<double> streamAll;
+	for (int run = 0; run < TIMED_RUNS; run++) {
+		SmfStream stream;
+		int64_t t0 = NowNanos();
+		if (!stream.Parse(&image[0], image.size(), err)) {
+			return false;
+		}
+		size_t n = stream.Read(&window[0], window.size());
+		int64_t t1 = NowNanos();
+		while (n > 0) {
+			n = stream.Read(&window[0], window.size());
+		}
+		int64_t t2 = NowNanos();
+		if (stream.Failed() || (stream.EventsRead() != timeline.EventCount())) {
+			err = "stream does not match the timeline: " + stream.Error();
+			return false;
+		}
+		streamFirst.push_back((t1 - t0) / 1e3);
+		streamAll.push_back((t2 - t0) / 1e3);
+	}
+	r.streamFirstUs = Median(streamFirst);
+	r.streamUs = Median(streamAll);
+
+	r.tracks = uint32_t(smf.TrackCount());
+	r.events = timeline.EventCount();
+	r.songUs = timeline.DurationUs();
+
+	// Random positions, the same for every build.
+	std::vector<int64_t> positions(SEEKS);
+	uint32_t x = 12345;
+	for (int i = 0; i < SEEKS; i++) {
+		x = x * 1103515245u + 12345u;
+		positions[i] = (r.songUs > 0) ? int64_t(x % uint32_t(r.songUs)) : 0;
+	}
+	std::vector<size_t> indices(SEEKS);
+	int64_t t0 = NowNanos();
+	for (int i = 0; i < SEEKS; i++) {
+		indices[i] = timeline.SeekToMicros(positions[i]);
+	}
+	int64_t t1 = NowNanos();
+	MidiState state;
+	for (int i = 0; i < SEEKS; i++) {
+		timeline.Chase(indices[i], state);
+	}
+	int64_t t2 = NowNanos();
+	r.seekNs = double(t1 - t0) / SEEKS;
+	r.chaseNs = double(t2 - t1) / SEEKS;
+
+	BuiltinInstrumentBank bank;
+	OfflineRenderer renderer((OfflineRenderOptions()));
+	PcmFileWriter out;
+	if (!out.Open(NULL_DEVICE, renderer.GetSynth().SampleRate(), 2, false, err) ||
+		!renderer.Render(timeline, &bank, out, err) || !out.Close(err)) {
+		return false;
+	}
+	r.renderUs = double(renderer.Stats().renderUs);
+	r.realtimeFactor = renderer.Stats().RealtimeFactor();
+
+	uint64_t rssAfter = ProcessResidentBytes();
+	r.memoryBytes = (rssAfter > rssBefore) ? rssAfter - rssBefore : 0;
+	r.peakRssBytes = ProcessPeakResidentBytes();
+	return true;
+}
+
+static std::string ToJson(const std::vector<ShapeResult>& results, uint32_t scale) {
+	char date[32];
+	time_t now = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	std::ostringstream oss;
+	oss << "{\n  \"revision\": \"" << BENCH_REVISION << "\",\n  \"date\": \"" << date << "\",\n  \"scale\": " << scale <<
+		",\n  \"kernels\": \"" << BestSynthKernels().name << "\",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const ShapeResult& r = results[i];
+		oss << "    {\"shape\": \"" << r.shape << "\", \"fileBytes\": " << r.fileBytes << ", \"tracks\": " << r.tracks <<
+			", \"events\": " << r.events << ", \"songUs\": " << r.songUs << ", \"parseUs\": " << r.parseUs <<
+			", \"mergeUs\": " << r.mergeUs << ", \"streamFirstUs\": " << r.streamFirstUs << ", \"streamUs\": " << r.streamUs <<
+			", \"seekNs\": " << r.seekNs << ", \"chaseNs\": " << r.chaseNs <<
+			", \"renderUs\": " << r.renderUs << ", \"realtimeFactor\": " << r.realtimeFactor <<
+			", \"memoryBytes\": " << r.memoryBytes << ", \"peakRssBytes\": " << r.peakRssBytes << "}" <<
+			((i + 1 < results.size()) ? "," : "") << "\n";
+	}
+	oss << "  ]\n}\n";
+	return oss.str();
+}
+
+int main(int argc, char* argv[]) {
+	std::string jsonPath = (argc > 1) ? argv[1] : "-";
+	uint32_t scale = (argc > 2) ? uint32_t(atoi(argv[2])) : 1;
+	std::string corpusDir = (argc > 3) ? argv[3] : "";
+	if (scale < 1) {
+		fprintf(stderr, "Usage: suite_bench [JSON file] [scale] [corpus directory]\n");
+		return 1;
+	}
+
+	printf("Revision %s, scale %u, %s kernels\n\n", BENCH_REVISION, scale, BestSynthKernels().name);
+	printf("%-14s %9s %8s %9s %10s %10s %9s %10s %8s %9s %9s %7s %9s\n", "shape", "KB", "events", "song s", "parse us",
+		"merge us", "stream 1st", "stream us", "seek ns", "chase ns", "render ms", "x real", "mem MB");
+
+	std::vector<ShapeResult> results;
+	for (int s = 0; s < CORPUS_SHAPE_COUNT; s++) {
+		ShapeResult r;
+		std::string err;
+		if (!RunShape(CorpusShape(s), scale, corpusDir, r, err)) {
+			fprintf(stderr, "%s: %s\n", CorpusShapeName(CorpusShape(s)), err.c_str());
+			return 1;
+		}
+		printf("%-14s %9.1f %8llu %9.1f %10.1f %10.1f %9.1f %10.1f %8.1f %9.1f %9.1f %7.1f %9.1f\n", r.shape, r.fileBytes / 1024.0,
+			(unsigned long long)r.events, r.songUs / 1e6, r.parseUs, r.mergeUs, r.streamFirstUs, r.streamUs, r.seekNs, r.chaseNs, r.renderUs / 1e3,
+			r.realtimeFactor, r.memoryBytes / 1048576.0);
+		results.push_back(r);
+	}
+	printf("\nPeak resident set: %.1f MB\n", ProcessPeakResidentBytes() / 1048576.0);
+
+	if (jsonPath != "-") {
+		std::ofstream out(jsonPath.c_str(), std::ios::trunc);
+		out << ToJson(results, scale);
+		if (!out) {
+			fprintf(stderr, "can not write file: %s\n", jsonPath.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
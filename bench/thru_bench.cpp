@@ -0,0 +1,97 @@
+// Latency benchmark of the live MIDI thru path.
+//
+// Usage: thru_bench <MIDI file> [seconds] [block frames]
+//
+// The sequencer plays the song into a loopback MIDI input, which stands in for
+// a keyboard. The thru router passes every message on to a sink, once to a sink
+// which drops everything, measuring the routing itself, and once to the
+// real-time synthesizer on the null audio device, in both cases through the
+// queue to the thru thread. Every run reports the ingress to egress latency
+// percentiles.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "audio_device.h"
+#include "builtin_bank.h"
+#include "midi_input.h"
+#include "midi_thru.h"
+#include "realtime_synth.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "timeline.h"
+
+static void Play(const Timeline& timeline, LoopbackMidiInput& loopback, int64_t seconds) {
+	Sequencer sequencer;
+	sequencer.Start(timeline, loopback);
+	int64_t waitedMs = 0;
+	while (sequencer.IsPlaying() && (waitedMs < seconds * 1000)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		waitedMs += 10;
+	}
+	sequencer.Stop();
+}
+
+static void Report(const char* name, const MidiThru& thru) {
+	LatencySummary s = thru.Latency().Summary();
+	printf("%-10s %10llu %10llu %10.2f %10.2f %10.2f %10.2f\n", name, (unsigned long long)s.count, (unsigned long long)thru.Dropped(),
+		s.p50Ns / 1e3, s.p99Ns / 1e3, s.maxNs / 1e3, s.meanNs / 1e3);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: thru_bench <MIDI file> [seconds] [block frames]\n");
+		return 1;
+	}
+	int64_t seconds = (argc > 2) ? atoi(argv[2]) : 10;
+	uint32_t blockFrames = (argc > 3) ? uint32_t(atoi(argv[3])) : AUDIO_MIN_BLOCK_FRAMES;
+
+	SmfFile smf;
+	Timeline timeline;
+	std::string err;
+	if (!smf.Load(argv[1], err) || !timeline.Build(smf, err)) {
+		fprintf(stderr, "%s: %s\n", argv[1], err.c_str());
+		return 1;
+	}
+
+	printf("%s, %lld s per sink\n\n", argv[1], (long long)seconds);
+	printf("%-10s %10s %10s %10s %10s %10s %10s\n", "sink", "messages", "dropped", "p50 us", "p99 us", "max us", "mean us");
+
+	LoopbackMidiInput loopback;
+
+	NullMidiSink nullSink;
+	MidiThru nullThru(nullSink);
+	nullThru.Start();
+	loopback.Start(nullThru, err);
+	Play(timeline, loopback, seconds);
+	loopback.Stop();
+	nullThru.Stop();
+	Report("null", nullThru);
+
+	BuiltinInstrumentBank bank;
+	RealtimeSynth realtime(SynthConfig(), blockFrames);
+	realtime.GetSynth().SetInstrumentBank(&bank);
+	AudioDeviceConfig config;
+	config.blockFrames = blockFrames;
+	NullAudioDevice device;
+	if (!device.Start(config, realtime, err)) {
+		fprintf(stderr, "%s\n", err.c_str());
+		return 1;
+	}
+	MidiThru synthThru(realtime);
+	synthThru.Start();
+	loopback.Start(synthThru, err);
+	Play(timeline, loopback, seconds);
+	loopback.Stop();
+	synthThru.Stop();
+	device.Stop();
+	Report("synth", synthThru);
+
+	AudioDeviceStats s = device.Stats();
+	printf("\nSynth: %u frames per block, %llu callbacks, %llu deadline misses, %llu dropped events\n", blockFrames,
+		(unsigned long long)s.callbacks, (unsigned long long)s.deadlineMisses, (unsigned long long)realtime.DroppedEvents());
+	return 0;
+}
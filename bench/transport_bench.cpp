@@ -0,0 +1,164 @@
+// Pause, seek and tempo changes of the sequencer while it plays.
+//
+// Usage: transport_bench
+//
+// Every corpus shape is played into a sink which keeps the notes and sustain
+// pedals a device would hold. Two seconds in, playback is paused: the time
+// until every note is released is measured, and a quarter of a second later
+// nothing may still sound. After resuming, the song is sent back to its first
+// second and the time until the sequencer thread plays from there is measured;
+// it must stay within twice the longest sleep of the thread. At last the tempo
+// is doubled and the song time played in the following second of wall clock
+// time is shown, which should be close to 2000 ms; the shapes with sparse
+// events land on their event grid.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "hires_clock.h"
+#include "midi_corpus.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "timeline.h"
+
+static const uint32_t CORPUS_SCALE = 1;
+static const uint32_t CORPUS_SEED = 1;
+
+static const int64_t PAUSE_AT_US = 2000000;
+static const int64_t PAUSED_US = 250000;
+static const int64_t SEEK_TO_US = 1000000;
+static const int64_t TEMPO_WINDOW_US = 1000000;
+static const double TEMPO_SCALE = 2.0;
+
+// Longest time for the thread to apply a seek: the rest of its current sleep, with room for a busy machine.
+static const int64_t SEEK_MAX_US = 2 * SEQUENCER_MAX_SLEEP_US;
+
+// Gives up waiting for the sequencer after this long.
+static const int64_t TIMEOUT_US = 2000000;
+
+// Notes and pedals held by the receiving device.
+class HeldNotesSink : public MidiSink {
+public:
+	HeldNotesSink() : held(0) {
+		memset(notes, 0, sizeof(notes));
+		memset(pedals, 0, sizeof(pedals));
+	}
+
+	bool ShortMessage(uint32_t message) {
+		uint8_t status = uint8_t(message);
+		uint8_t data1 = uint8_t(message >> 8) & 0x7F;
+		uint8_t data2 = uint8_t(message >> 16) & 0x7F;
+		uint8_t ch = status & 0x0F;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (((status & 0xF0) == 0x90) && (data2 != 0)) {
+			notes[ch][data1]++;
+			held++;
+		}
+		else if ((((status & 0xF0) == 0x80) || ((status & 0xF0) == 0x90)) && (notes[ch][data1] > 0)) {
+			notes[ch][data1]--;
+			held--;
+		}
+		else if (((status & 0xF0) == 0xB0) && (data1 == 64)) {
+			pedals[ch] = (data2 >= 64);
+		}
+		return true;
+	}
+	bool LongMessage(const uint8_t*, uint32_t) { return true; }
+	void Reset() {
+		std::lock_guard<std::mutex> lock(mutex);
+		memset(notes, 0, sizeof(notes));
+		memset(pedals, 0, sizeof(pedals));
+		held = 0;
+	}
+
+	// Notes which sound, counting those held by a pedal.
+	uint32_t Sounding() {
+		std::lock_guard<std::mutex> lock(mutex);
+		uint32_t sounding = held;
+		for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+			sounding += pedals[ch] ? 1 : 0;
+		}
+		return sounding;
+	}
+
+private:
+	std::mutex mutex;
+	uint32_t notes[MIDI_CHANNELS][128];
+	bool pedals[MIDI_CHANNELS];
+	uint32_t held;
+};
+
+static void SleepMicros(int64_t us) {
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+// Time until the condition holds, -1 on timeout.
+template <typename Condition>
+static int64_t TimeUntil(Condition condition) {
+	int64_t startUs = NowMicros();
+	while (!condition()) {
+		if (NowMicros() - startUs > TIMEOUT_US) {
+			return -1;
+		}
+		std::this_thread::yield();
+	}
+	return NowMicros() - startUs;
+}
+
+int main() {
+	printf("%-16s %10s %10s %10s %14s\n", "song", "pause us", "hanging", "seek us", "2x song ms/s");
+
+	bool ok = true;
+	for (int shape = 0; shape < CORPUS_SHAPE_COUNT; shape++) {
+		const char* name = CorpusShapeName(CorpusShape(shape));
+		std::vector<uint8_t> image = GenerateCorpusSong(CorpusShape(shape), CORPUS_SCALE, CORPUS_SEED);
+		std::string err;
+		SmfFile smf;
+		Timeline timeline;
+		if (!smf.Parse(&image[0], image.size(), err) || !timeline.Build(smf, err)) {
+			fprintf(stderr, "%s: %s\n", name, err.c_str());
+			return 1;
+		}
+
+		HeldNotesSink sink;
+		Sequencer sequencer;
+		sequencer.Start(timeline, sink);
+		SleepMicros(PAUSE_AT_US);
+
+		sequencer.Pause();
+		int64_t pauseUs = TimeUntil([&]() { return sink.Sounding() == 0; });
+		SleepMicros(PAUSED_US);
+		uint32_t hanging = sink.Sounding();
+
+		sequencer.Resume();
+		int64_t resumedAtUs = sequencer.PositionUs();
+		sequencer.Seek(SEEK_TO_US);
+		// The position moves back once the thread applied the seek or dispatched the first events after it.
+		int64_t seekUs = TimeUntil([&]() {
+			int64_t positionUs = sequencer.PositionUs();
+			return (positionUs >= SEEK_TO_US) && (positionUs < resumedAtUs);
+		});
+
+		sequencer.SetTempoScale(TEMPO_SCALE);
+		SleepMicros(TEMPO_WINDOW_US / 4);
+		int64_t fromUs = sequencer.PositionUs();
+		SleepMicros(TEMPO_WINDOW_US);
+		int64_t playedUs = sequencer.PositionUs() - fromUs;
+		sequencer.Stop();
+		sequencer.SetTempoScale(1.0);
+
+		printf("%-16s %10lld %10u %10lld %14lld\n", name, (long long)pauseUs, hanging, (long long)seekUs,
+			(long long)(playedUs / 1000));
+		ok = ok && (pauseUs >= 0) && (hanging == 0) && (seekUs >= 0) && (seekUs <= SEEK_MAX_US);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "Notes were left hanging or the sequencer did not follow.\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include "block_workers.h"
+
+#include <chrono>
+
+#include "hires_clock.h"
+
+// Idle wait of a worker: spinning first, then yielding, then sleeping.
+static const uint32_t SPIN_LIMIT = 4000;
+static const uint32_t YIELD_LIMIT = SPIN_LIMIT + 20000;
+static const int SLEEP_US = 100;
+
+BlockWorkers::BlockWorkers(unsigned threads) :
+	threadCount(threads > 0 ? threads : 1),
+	job(nullptr),
+	context(nullptr),
+	stopping(false),
+	generation(0),
+	pending(0)
+{
+	for (unsigned i = 1; i < threadCount; i++) {
+		this->threads.push_back(std::thread(&BlockWorkers::WorkerMain, this, i));
+	}
+}
+
+BlockWorkers::~BlockWorkers() {
+	stopping.store(true);
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void BlockWorkers::Run(Job job, void* context) {
+	this->job = job;
+	this->context = context;
+	pending.store(threadCount - 1, std::memory_order_relaxed);
+	// Release: the workers see the job and everything the caller wrote before.
+	generation.fetch_add(1, std::memory_order_release);
+
+	job(context, 0);
+
+	// Yields after a while, so that a worker sharing the core can finish.
+	uint32_t spins = 0;
+	while (pending.load(std::memory_order_acquire) != 0) {
+		if (++spins < SPIN_LIMIT) {
+			CpuRelax();
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void BlockWorkers::WorkerMain(unsigned worker) {
+	uint32_t seen = 0;
+	for (;;) {
+		uint32_t spins = 0;
+		uint32_t current;
+		while ((current = generation.load(std::memory_order_acquire)) == seen) {
+			if (stopping.load(std::memory_order_relaxed)) {
+				return;
+			}
+			spins++;
+			if (spins < SPIN_LIMIT) {
+				CpuRelax();
+			}
+			else if (spins < YIELD_LIMIT) {
+				std::this_thread::yield();
+			}
+			else {
+				std::this_thread::sleep_for(std::chrono::microseconds(SLEEP_US));
+			}
+		}
+		seen = current;
+
+		job(context, worker);
+
+		// Release: the caller sees everything this worker has rendered.
+		pending.fetch_sub(1, std::memory_order_release);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/*
+
+Worker threads which run one job per worker for every render block.
+
+Run() publishes the job by bumping an atomic generation counter and then
+waits on an atomic counter of unfinished workers: neither side takes a lock,
+so a block costs no system call while the workers are busy. Idle workers spin
+for a short time, then yield and finally sleep in short steps, so they do not
+burn a core between songs.
+
+*/
+
+class BlockWorkers {
+public:
+	typedef void (*Job)(void* context, unsigned worker);
+
+	// Number of workers including the calling thread, at least 1.
+	explicit BlockWorkers(unsigned threads);
+	~BlockWorkers();
+
+	unsigned ThreadCount() const { return threadCount; }
+
+	// Calls job(context, worker) once for every worker, the calling thread being worker 0,
+	// and returns when all of them have returned.
+	void Run(Job job, void* context);
+
+private:
+	BlockWorkers(const BlockWorkers&);
+	BlockWorkers& operator=(const BlockWorkers&);
+
+	void WorkerMain(unsigned worker);
+
+	unsigned threadCount;
+	std::vector<std::thread> threads;
+	Job job;
+	void* context;
+	std::atomic<bool> stopping;
+
+	// Written by the caller and by the workers, keep them on separate cache lines.
+	char pad0[64];
+	std::atomic<uint32_t> generation;
+	char pad1[64];
+	std::atomic<uint32_t> pending;
+	char pad2[64];
+};
@@ -0,0 +1,69 @@
+#include "builtin_bank.h"
+
+#include <cmath>
+
+// One cycle of the tone wave. At 44100 Hz a cycle of 256 samples plays 172.27 Hz,
+// which is 23.4 cents below note 53.
+static const uint32_t TONE_CYCLE = 256;
+static const uint32_t TONE_SAMPLE_RATE = 44100;
+static const uint32_t DRUM_LENGTH = 8820;
+
+BuiltinInstrumentBank::BuiltinInstrumentBank() {
+	const double pi = 3.14159265358979323846;
+
+	toneSamples.resize(TONE_CYCLE);
+	for (uint32_t i = 0; i < TONE_CYCLE; i++) {
+		toneSamples[i] = int16_t(20000.0 * sin(2.0 * pi * i / TONE_CYCLE));
+	}
+
+	// Deterministic noise with an exponential decay.
+	drumSamples.resize(DRUM_LENGTH);
+	uint32_t seed = 22222;
+	for (uint32_t i = 0; i < DRUM_LENGTH; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		double noise = double(int32_t(seed) >> 16) / 32768.0;
+		drumSamples[i] = int16_t(20000.0 * noise * exp(-6.0 * i / DRUM_LENGTH));
+	}
+
+	toneWave.samples = &toneSamples[0];
+	toneWave.length = TONE_CYCLE;
+	toneWave.loopStart = 0;
+	toneWave.loopLength = TONE_CYCLE;
+	toneWave.sampleRate = TONE_SAMPLE_RATE;
+	toneWave.padding = 0;
+
+	drumWave.samples = &drumSamples[0];
+	drumWave.length = DRUM_LENGTH;
+	drumWave.loopStart = 0;
+	drumWave.loopLength = 0;
+	drumWave.sampleRate = TONE_SAMPLE_RATE;
+	drumWave.padding = 0;
+
+	toneRegion.wave = &toneWave;
+	toneRegion.keyLow = 0;
+	toneRegion.keyHigh = 127;
+	toneRegion.velocityLow = 0;
+	toneRegion.velocityHigh = 127;
+	toneRegion.unityNote = 53;
+	toneRegion.reserved = 0;
+	toneRegion.fineTuneCents = 23;
+	toneRegion.gain = 1.0f;
+	toneRegion.pan = 0.0f;
+	toneRegion.attackSec = 0.005f;
+	toneRegion.decaySec = 1.0f;
+	toneRegion.sustainLevel = 0.6f;
+	toneRegion.releaseSec = 0.2f;
+
+	drumRegion = toneRegion;
+	drumRegion.wave = &drumWave;
+	drumRegion.unityNote = 60;
+	drumRegion.fineTuneCents = 0;
+	drumRegion.attackSec = 0.001f;
+	drumRegion.decaySec = 0.2f;
+	drumRegion.sustainLevel = 0.0f;
+	drumRegion.releaseSec = 0.1f;
+}
+
+const SynthRegion* BuiltinInstrumentBank::FindRegion(uint8_t, uint8_t, uint8_t, bool drum, uint8_t, uint8_t) {
+	return drum ? &drumRegion : &toneRegion;
+}
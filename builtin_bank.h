@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include "instrument_bank.h"
+
+// Minimal instrument bank generated at start: a looped sine for every program
+// and a decaying noise burst for percussion. Used when no DLS file is given.
+class BuiltinInstrumentBank : public InstrumentBank {
+public:
+	BuiltinInstrumentBank();
+
+	const SynthRegion* FindRegion(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum,
+		uint8_t note, uint8_t velocity);
+
+private:
+	std::vector<int16_t> toneSamples;
+	std::vector<int16_t> drumSamples;
+	SynthWave toneWave;
+	SynthWave drumWave;
+	SynthRegion toneRegion;
+	SynthRegion drumRegion;
+};
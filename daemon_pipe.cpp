@@ -0,0 +1,78 @@
+#include "daemon_pipe.h"
+
+#define NOMINMAX
+#include <windows.h>
+
+#include <sstream>
+
+// Windows Vista and later; older SDKs do not define it.
+#ifndef PIPE_REJECT_REMOTE_CLIENTS
+#define PIPE_REJECT_REMOTE_CLIENTS 0x00000008
+#endif
+
+namespace {
+
+const DWORD PIPE_BUFFER_SIZE = 4096;
+
+// False if the client went away.
+bool WriteReply(HANDLE hPipe, const std::string& reply) {
+	std::string line = reply + "\r\n";
+	DWORD written = 0;
+	return WriteFile(hPipe, line.data(), DWORD(line.size()), &written, NULL) && (written == line.size());
+}
+
+}
+
+bool ServeNamedPipe(PlayerDaemon& daemon, const std::string& name, std::string& err) {
+	bool running = true;
+	while (running) {
+		HANDLE hPipe = CreateNamedPipeA(name.c_str(), PIPE_ACCESS_DUPLEX,
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1,
+			PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, NULL);
+		if (hPipe == INVALID_HANDLE_VALUE) {
+			std::ostringstream oss;
+			oss << "CreateNamedPipe failed for " << name << ", error " << GetLastError();
+			err = oss.str();
+			return false;
+		}
+
+		// A client which connected between CreateNamedPipe and ConnectNamedPipe is connected already.
+		if (!ConnectNamedPipe(hPipe, NULL) && (GetLastError() != ERROR_PIPE_CONNECTED)) {
+			CloseHandle(hPipe);
+			continue;
+		}
+
+		std::string pending;
+		std::string reply;
+		char buffer[PIPE_BUFFER_SIZE];
+		DWORD bytesRead = 0;
+		bool connected = true;
+		while (running && connected && ReadFile(hPipe, buffer, sizeof(buffer), &bytesRead, NULL) && (bytesRead > 0)) {
+			pending.append(buffer, bytesRead);
+			size_t end;
+			while (running && connected && ((end = pending.find('\n')) != std::string::npos)) {
+				std::string line = pending.substr(0, end);
+				pending.erase(0, end + 1);
+				if (line.find_first_not_of(" \t\r") == std::string::npos) {
+					continue;
+				}
+				running = daemon.Execute(line, reply);
+				connected = WriteReply(hPipe, reply);
+			}
+			if (connected && (pending.size() > DAEMON_PIPE_MAX_LINE)) {
+				pending.clear();
+				connected = WriteReply(hPipe, "error command too long");
+			}
+		}
+		// A last command without a line break, e.g. from a client which closed its end.
+		if (running && connected && (pending.find_first_not_of(" \t\r") != std::string::npos)) {
+			running = daemon.Execute(pending, reply);
+			WriteReply(hPipe, reply);
+		}
+
+		FlushFileBuffers(hPipe);
+		DisconnectNamedPipe(hPipe);
+		CloseHandle(hPipe);
+	}
+	return true;
+}
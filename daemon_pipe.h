@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+#include "player_daemon.h"
+
+/*
+
+Named pipe control channel of the player daemon.
+
+The pipe accepts one client at a time and only local ones. A client writes
+command lines and reads one reply line per command; when it disconnects the
+pipe waits for the next client. From a command prompt, e.g.:
+
+	echo play C:\Music\song.mid > \\.\pipe\SimpleMidiPlayer
+
+*/
+
+// Serves commands until a client sends quit or the pipe fails.
+bool ServeNamedPipe(PlayerDaemon& daemon, const std::string& name, std::string& err);
+
+const char DAEMON_PIPE_DEFAULT_NAME[] = "\\\\.\\pipe\\SimpleMidiPlayer";
+
+// Longest command line; longer ones are answered with an error.
+const size_t DAEMON_PIPE_MAX_LINE = 4096;
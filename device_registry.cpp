@@ -0,0 +1,296 @@
+#include "device_registry.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace {
+
+const char REGISTRY_MAGIC[4] = { 'S', 'M', 'D', 'R' };
+
+// Stored as written; reads back differently on a machine of the other byte order.
+const uint32_t REGISTRY_BYTE_ORDER = 0x01020304;
+
+// Names and capability structures of real devices are far smaller.
+const uint32_t MAX_FIELD_SIZE = 64 * 1024;
+
+struct RegistryHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t kindCount;
+	uint64_t fingerprint;
+};
+
+#ifdef _WIN32
+bool RenameReplacing(const std::string& from, const std::string& to) {
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+bool RenameReplacing(const std::string& from, const std::string& to) {
+	return rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+void WriteU32(std::ofstream& out, uint32_t value) {
+	out.write((const char*)&value, sizeof(value));
+}
+
+void WriteBytes(std::ofstream& out, const void* data, size_t size) {
+	WriteU32(out, uint32_t(size));
+	if (size > 0) {
+		out.write((const char*)data, std::streamsize(size));
+	}
+}
+
+// Bounds-checked reads from the loaded file.
+class Reader {
+public:
+	Reader(const std::vector<char>& data) : data(data), pos(0) {}
+
+	bool Read(void* out, size_t size) {
+		if (size > data.size() - pos) {
+			return false;
+		}
+		memcpy(out, &data[pos], size);
+		pos += size;
+		return true;
+	}
+
+	bool ReadU32(uint32_t& value) { return Read(&value, sizeof(value)); }
+
+	bool ReadBytes(std::string& out) {
+		uint32_t size;
+		if (!ReadU32(size) || (size > MAX_FIELD_SIZE) || (size > data.size() - pos)) {
+			return false;
+		}
+		out.assign(data.begin() + pos, data.begin() + pos + size);
+		pos += size;
+		return true;
+	}
+
+	bool AtEnd() const { return pos == data.size(); }
+
+private:
+	const std::vector<char>& data;
+	size_t pos;
+};
+
+}
+
+DeviceRegistry::DeviceRegistry() {
+	for (int kind = 0; kind < DEVICE_KIND_COUNT; kind++) {
+		stale[kind].store(false);
+	}
+}
+
+void DeviceRegistry::Clear() {
+	for (int kind = 0; kind < DEVICE_KIND_COUNT; kind++) {
+		lists[kind] = DeviceList();
+		stale[kind].store(false);
+	}
+}
+
+void DeviceRegistry::Index(DeviceList& list) {
+	list.byName.clear();
+	list.byGuid.clear();
+	for (size_t i = 0; i < list.entries.size(); i++) {
+		const DeviceEntry& e = list.entries[i];
+		// The first device of a name wins, as a walk over the list would find it.
+		list.byName.insert(std::make_pair(e.name, int(i)));
+		if (e.hasGuid) {
+			list.byGuid.insert(std::make_pair(e.guid, int(i)));
+		}
+	}
+}
+
+DeviceUpdate DeviceRegistry::Update(DeviceKind kind, const std::vector<DeviceEntry>& devices) {
+	DeviceList& list = lists[kind];
+	DeviceUpdate u;
+	u.kept = 0;
+	u.added = 0;
+
+	// Matched against the previous enumeration before the indexes are rebuilt. Each previous
+	// device matches at most once, two devices of the same name are two devices.
+	typedef std::unordered_multimap<std::string, size_t> PreviousMap;
+	PreviousMap previousByName;
+	PreviousMap previousByGuid;
+	for (size_t i = 0; i < list.entries.size(); i++) {
+		const DeviceEntry& e = list.entries[i];
+		previousByName.insert(std::make_pair(e.name, i));
+		if (e.hasGuid) {
+			previousByGuid.insert(std::make_pair(e.guid, i));
+		}
+	}
+	std::vector<bool> matched(list.entries.size(), false);
+	for (size_t i = 0; i < devices.size(); i++) {
+		const DeviceEntry& e = devices[i];
+		std::pair<PreviousMap::iterator, PreviousMap::iterator> range =
+			e.hasGuid ? previousByGuid.equal_range(e.guid) : previousByName.equal_range(e.name);
+		bool found = false;
+		for (PreviousMap::iterator it = range.first; (it != range.second) && !found; ++it) {
+			if (!matched[it->second]) {
+				matched[it->second] = true;
+				found = true;
+			}
+		}
+		if (found) {
+			u.kept++;
+		}
+		else {
+			u.added++;
+		}
+	}
+	u.removed = size_t(std::count(matched.begin(), matched.end(), false));
+
+	list.entries = devices;
+	list.known = true;
+	Index(list);
+	stale[kind].store(false, std::memory_order_release);
+	return u;
+}
+
+bool DeviceRegistry::IsCurrent(DeviceKind kind) const {
+	return lists[kind].known && !stale[kind].load(std::memory_order_acquire);
+}
+
+void DeviceRegistry::Invalidate() {
+	for (int kind = 0; kind < DEVICE_KIND_COUNT; kind++) {
+		stale[kind].store(true, std::memory_order_release);
+	}
+}
+
+const DeviceEntry* DeviceRegistry::Get(DeviceKind kind, int index) const {
+	const DeviceList& list = lists[kind];
+	if ((index < 0) || (size_t(index) >= list.entries.size())) {
+		return nullptr;
+	}
+	return &list.entries[index];
+}
+
+int DeviceRegistry::FindByName(DeviceKind kind, const std::string& name) const {
+	const DeviceList& list = lists[kind];
+	std::unordered_map<std::string, int>::const_iterator it = list.byName.find(name);
+	return (it != list.byName.end()) ? it->second : -1;
+}
+
+int DeviceRegistry::FindByGuid(DeviceKind kind, const void* guid) const {
+	const DeviceList& list = lists[kind];
+	std::unordered_map<std::string, int>::const_iterator it = list.byGuid.find(std::string((const char*)guid, DEVICE_GUID_SIZE));
+	return (it != list.byGuid.end()) ? it->second : -1;
+}
+
+bool DeviceRegistry::Save(const std::string& path, uint64_t fingerprint, std::string& err) const {
+	RegistryHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, REGISTRY_MAGIC, sizeof(h.magic));
+	h.version = DEVICE_REGISTRY_VERSION;
+	h.byteOrder = REGISTRY_BYTE_ORDER;
+	h.kindCount = DEVICE_KIND_COUNT;
+	h.fingerprint = fingerprint;
+
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		out.write((const char*)&h, sizeof(h));
+		for (int kind = 0; kind < DEVICE_KIND_COUNT; kind++) {
+			// Kinds which were never enumerated are stored as unknown.
+			const DeviceList& list = lists[kind];
+			bool known = list.known && !stale[kind].load(std::memory_order_acquire);
+			WriteU32(out, known ? 1 : 0);
+			WriteU32(out, known ? uint32_t(list.entries.size()) : 0);
+			for (size_t i = 0; known && (i < list.entries.size()); i++) {
+				const DeviceEntry& e = list.entries[i];
+				WriteBytes(out, e.name.data(), e.name.size());
+				WriteU32(out, e.hasGuid ? 1 : 0);
+				out.write(e.guid.data(), DEVICE_GUID_SIZE);
+				WriteBytes(out, e.caps.empty() ? nullptr : &e.caps[0], e.caps.size());
+			}
+		}
+		out.close();
+		if (!out) {
+			remove(tempPath.c_str());
+			err = "can not write file: " + tempPath;
+			return false;
+		}
+	}
+	if (!RenameReplacing(tempPath, path)) {
+		remove(tempPath.c_str());
+		err = "can not replace file: " + path;
+		return false;
+	}
+	return true;
+}
+
+bool DeviceRegistry::Load(const std::string& path, uint64_t fingerprint, std::string& err) {
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in) {
+		err = "no device cache";
+		return false;
+	}
+	std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	Reader r(data);
+	RegistryHeader h;
+	if (!r.Read(&h, sizeof(h)) || (memcmp(h.magic, REGISTRY_MAGIC, sizeof(h.magic)) != 0)) {
+		err = "not a device cache";
+		return false;
+	}
+	if ((h.version != DEVICE_REGISTRY_VERSION) || (h.byteOrder != REGISTRY_BYTE_ORDER) || (h.kindCount != DEVICE_KIND_COUNT)) {
+		err = "device cache of another version";
+		return false;
+	}
+	if (h.fingerprint != fingerprint) {
+		err = "devices changed";
+		return false;
+	}
+
+	DeviceList loaded[DEVICE_KIND_COUNT];
+	for (int kind = 0; kind < DEVICE_KIND_COUNT; kind++) {
+		uint32_t known;
+		uint32_t count;
+		if (!r.ReadU32(known) || !r.ReadU32(count) || (count > MAX_FIELD_SIZE)) {
+			err = "device cache is damaged";
+			return false;
+		}
+		loaded[kind].known = (known != 0);
+		for (uint32_t i = 0; i < count; i++) {
+			DeviceEntry e;
+			uint32_t hasGuid;
+			std::string caps;
+			if (!r.ReadBytes(e.name) || !r.ReadU32(hasGuid) || !r.Read(&e.guid[0], DEVICE_GUID_SIZE) || !r.ReadBytes(caps)) {
+				err = "device cache is damaged";
+				return false;
+			}
+			e.hasGuid = (hasGuid != 0);
+			e.caps.assign(caps.begin(), caps.end());
+			loaded[kind].entries.push_back(e);
+		}
+	}
+	if (!r.AtEnd()) {
+		err = "device cache is damaged";
+		return false;
+	}
+
+	for (int kind = 0; kind < DEVICE_KIND_COUNT; kind++) {
+		lists[kind] = loaded[kind];
+		Index(lists[kind]);
+		stale[kind].store(false, std::memory_order_release);
+	}
+	return true;
+}
+
+uint64_t HashDeviceData(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+Cache of the output devices of the system.
+
+Enumerating DirectSound devices and DirectMusic ports loads drivers and takes
+a noticeable part of the start-up time, so each kind of device is enumerated
+once into the registry and looked up there by index, name or GUID in constant
+time. The registry owns its copies of names, GUIDs and capability structures;
+the caller stores the API's structure as raw bytes, e.g. a DMUS_PORTCAPS.
+
+The registry can be saved to a file together with a fingerprint of the
+devices which is cheap to compute, e.g. a hash of the WinMM device
+capabilities. A player which is started for every song loads the file and
+only enumerates again when the fingerprint changed.
+
+Invalidate() marks all kinds stale and may be called from any thread, e.g.
+when the system reports that a device arrived or was removed. The caller
+enumerates a stale kind again when it is next needed and Update() reports
+which devices were kept, added and removed, matched by GUID or else by name.
+
+*/
+
+enum DeviceKind {
+	DEVICE_AUDIO_OUTPUT, // DirectSound devices.
+	DEVICE_MUSIC_PORT,   // DirectMusic ports.
+	DEVICE_MIDI_OUTPUT,  // WinMM MIDI outputs.
+	DEVICE_KIND_COUNT
+};
+
+const size_t DEVICE_GUID_SIZE = 16;
+
+struct DeviceEntry {
+	DeviceEntry() : hasGuid(false) { guid.assign(DEVICE_GUID_SIZE, 0); }
+
+	std::string name;
+	bool hasGuid;              // The default DirectSound device has none.
+	std::string guid;          // DEVICE_GUID_SIZE bytes as stored in a GUID.
+	std::vector<uint8_t> caps; // Capabilities as returned by the API.
+};
+
+struct DeviceUpdate {
+	size_t kept;
+	size_t added;
+	size_t removed;
+};
+
+class DeviceRegistry {
+public:
+	DeviceRegistry();
+
+	void Clear();
+
+	// Replaces the devices of a kind with a fresh enumeration, in its order.
+	DeviceUpdate Update(DeviceKind kind, const std::vector<DeviceEntry>& devices);
+
+	// The kind was enumerated or loaded and nothing changed since.
+	bool IsCurrent(DeviceKind kind) const;
+
+	// Thread-safe.
+	void Invalidate();
+
+	size_t Count(DeviceKind kind) const { return lists[kind].entries.size(); }
+
+	// NULL if the index is out of range.
+	const DeviceEntry* Get(DeviceKind kind, int index) const;
+
+	// Index of the first device with the name or GUID, -1 if there is none.
+	int FindByName(DeviceKind kind, const std::string& name) const;
+	int FindByGuid(DeviceKind kind, const void* guid) const;
+
+	// The file is written under a temporary name and renamed, so readers never see it half written.
+	bool Save(const std::string& path, uint64_t fingerprint, std::string& err) const;
+
+	// Fails with the reason if the file is missing, unreadable or of other devices; nothing changes then.
+	bool Load(const std::string& path, uint64_t fingerprint, std::string& err);
+
+private:
+	DeviceRegistry(const DeviceRegistry&);
+	DeviceRegistry& operator=(const DeviceRegistry&);
+
+	struct DeviceList {
+		DeviceList() : known(false) {}
+
+		std::vector<DeviceEntry> entries;
+		std::unordered_map<std::string, int> byName;
+		std::unordered_map<std::string, int> byGuid;
+		bool known;
+	};
+
+	void Index(DeviceList& list);
+
+	DeviceList lists[DEVICE_KIND_COUNT];
+	std::atomic<bool> stale[DEVICE_KIND_COUNT];
+};
+
+// FNV-1a over device data, for the fingerprint; start with DEVICE_HASH_SEED.
+uint64_t HashDeviceData(uint64_t hash, const void* data, size_t size);
+
+const uint64_t DEVICE_HASH_SEED = 14695981039346656037ull;
+
+// Bumped whenever the layout of the file changes.
+const uint32_t DEVICE_REGISTRY_VERSION = 1;
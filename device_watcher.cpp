@@ -0,0 +1,118 @@
+#include "device_watcher.h"
+
+#define NOMINMAX
+#include <windows.h>
+#include <dbt.h>
+
+namespace {
+
+const char WINDOW_CLASS[] = "SimpleMidiPlayerDeviceWatcher";
+
+LRESULT CALLBACK WatcherWindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+	if (msg == WM_DEVICECHANGE) {
+		// Arrival and removal of an interface, or a change of the device tree without details.
+		if ((wParam == DBT_DEVICEARRIVAL) || (wParam == DBT_DEVICEREMOVECOMPLETE) || (wParam == DBT_DEVNODES_CHANGED)) {
+			DeviceChangeWatcher* watcher = (DeviceChangeWatcher*)GetWindowLongPtrA(hWnd, GWLP_USERDATA);
+			if (watcher) {
+				watcher->OnDeviceChange();
+			}
+		}
+		return TRUE;
+	}
+	if (msg == WM_DESTROY) {
+		PostQuitMessage(0);
+		return 0;
+	}
+	return DefWindowProcA(hWnd, msg, wParam, lParam);
+}
+
+}
+
+DeviceChangeWatcher::DeviceChangeWatcher() : hWindow(nullptr), hNotification(nullptr) {
+}
+
+DeviceChangeWatcher::~DeviceChangeWatcher() {
+	Stop();
+}
+
+bool DeviceChangeWatcher::Start(const std::function<void()>& callback, std::string& err) {
+	Stop();
+	onChange = callback;
+	startError.clear();
+
+	HANDLE hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!hReady) {
+		err = "CreateEvent failed";
+		return false;
+	}
+	thread = std::thread(&DeviceChangeWatcher::Run, this, (void*)hReady);
+	WaitForSingleObject(hReady, INFINITE);
+	CloseHandle(hReady);
+
+	if (!hWindow) {
+		thread.join();
+		err = startError;
+		return false;
+	}
+	return true;
+}
+
+void DeviceChangeWatcher::Stop() {
+	if (thread.joinable()) {
+		if (hWindow) {
+			PostMessageA((HWND)hWindow, WM_CLOSE, 0, 0);
+		}
+		thread.join();
+	}
+	hWindow = nullptr;
+}
+
+void DeviceChangeWatcher::OnDeviceChange() {
+	if (onChange) {
+		onChange();
+	}
+}
+
+void DeviceChangeWatcher::Run(void* hReady) {
+	HINSTANCE hInstance = GetModuleHandleA(NULL);
+	WNDCLASSEXA wc;
+	ZeroMemory(&wc, sizeof(wc));
+	wc.cbSize = sizeof(wc);
+	wc.lpfnWndProc = WatcherWindowProc;
+	wc.hInstance = hInstance;
+	wc.lpszClassName = WINDOW_CLASS;
+	// Fails harmlessly when a previous watcher registered the class.
+	RegisterClassExA(&wc);
+
+	HWND hWnd = CreateWindowExA(0, WINDOW_CLASS, "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+	if (!hWnd) {
+		startError = "CreateWindowEx failed";
+		SetEvent((HANDLE)hReady);
+		return;
+	}
+	SetWindowLongPtrA(hWnd, GWLP_USERDATA, LONG_PTR(this));
+
+	DEV_BROADCAST_DEVICEINTERFACE_A filter;
+	ZeroMemory(&filter, sizeof(filter));
+	filter.dbcc_size = sizeof(filter);
+	filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	hNotification = RegisterDeviceNotificationA(hWnd, &filter, DEVICE_NOTIFY_WINDOW_HANDLE | DEVICE_NOTIFY_ALL_INTERFACE_CLASSES);
+	if (!hNotification) {
+		startError = "RegisterDeviceNotification failed";
+		DestroyWindow(hWnd);
+		SetEvent((HANDLE)hReady);
+		return;
+	}
+
+	hWindow = hWnd;
+	SetEvent((HANDLE)hReady);
+
+	MSG msg;
+	while (GetMessageA(&msg, NULL, 0, 0) > 0) {
+		TranslateMessage(&msg);
+		DispatchMessageA(&msg);
+	}
+
+	UnregisterDeviceNotification((HDEVNOTIFY)hNotification);
+	hNotification = nullptr;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+/*
+
+Notification of device arrival and removal.
+
+A console program has no window to receive WM_DEVICECHANGE, so the watcher
+creates a message-only window on a thread of its own and registers it for
+the device interface notifications of all classes. The callback is called on
+that thread and should only mark cached device lists stale; it must not
+enumerate devices itself.
+
+*/
+
+class DeviceChangeWatcher {
+public:
+	DeviceChangeWatcher();
+	~DeviceChangeWatcher();
+
+	bool Start(const std::function<void()>& callback, std::string& err);
+	void Stop();
+
+	bool IsRunning() const { return hWindow != nullptr; }
+
+	// Called by the window procedure.
+	void OnDeviceChange();
+
+private:
+	DeviceChangeWatcher(const DeviceChangeWatcher&);
+	DeviceChangeWatcher& operator=(const DeviceChangeWatcher&);
+
+	void Run(void* hReady);
+
+	std::function<void()> onChange;
+	std::thread thread;
+	void* hWindow;       // HWND, set while the window exists.
+	void* hNotification; // HDEVNOTIFY
+	std::string startError;
+};
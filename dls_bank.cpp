@@ -0,0 +1,791 @@
+#include "dls_bank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+uint32_t FourCC(char a, char b, char c, char d) {
+	return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+const uint32_t ID_RIFF = FourCC('R', 'I', 'F', 'F');
+const uint32_t ID_LIST = FourCC('L', 'I', 'S', 'T');
+const uint32_t ID_DLS = FourCC('D', 'L', 'S', ' ');
+const uint32_t ID_LINS = FourCC('l', 'i', 'n', 's');
+const uint32_t ID_INS = FourCC('i', 'n', 's', ' ');
+const uint32_t ID_INSH = FourCC('i', 'n', 's', 'h');
+const uint32_t ID_LRGN = FourCC('l', 'r', 'g', 'n');
+const uint32_t ID_RGN = FourCC('r', 'g', 'n', ' ');
+const uint32_t ID_RGN2 = FourCC('r', 'g', 'n', '2');
+const uint32_t ID_RGNH = FourCC('r', 'g', 'n', 'h');
+const uint32_t ID_WSMP = FourCC('w', 's', 'm', 'p');
+const uint32_t ID_WLNK = FourCC('w', 'l', 'n', 'k');
+const uint32_t ID_LART = FourCC('l', 'a', 'r', 't');
+const uint32_t ID_LAR2 = FourCC('l', 'a', 'r', '2');
+const uint32_t ID_ART1 = FourCC('a', 'r', 't', '1');
+const uint32_t ID_ART2 = FourCC('a', 'r', 't', '2');
+const uint32_t ID_PTBL = FourCC('p', 't', 'b', 'l');
+const uint32_t ID_WVPL = FourCC('w', 'v', 'p', 'l');
+const uint32_t ID_WAVE = FourCC('w', 'a', 'v', 'e');
+const uint32_t ID_FMT = FourCC('f', 'm', 't', ' ');
+const uint32_t ID_DATA = FourCC('d', 'a', 't', 'a');
+
+// Articulation connection destinations and sources used by the synthesizer.
+const uint16_t CONN_SRC_NONE = 0x0000;
+const uint16_t CONN_DST_PAN = 0x0004;
+const uint16_t CONN_DST_EG1_ATTACKTIME = 0x0206;
+const uint16_t CONN_DST_EG1_DECAYTIME = 0x0207;
+const uint16_t CONN_DST_EG1_RELEASETIME = 0x0209;
+const uint16_t CONN_DST_EG1_SUSTAINLEVEL = 0x020A;
+
+const uint32_t F_INSTRUMENT_DRUMS = 0x80000000u;
+const int32_t ABSOLUTE_ZERO_TIME = int32_t(0x80000000u);
+
+// Release time used when an instrument does not define one, avoids clicks.
+const float DEFAULT_RELEASE_SEC = 0.01f;
+
+uint16_t ReadLE16(const uint8_t* p) {
+	return uint16_t(p[0] | (p[1] << 8));
+}
+
+uint32_t ReadLE32(const uint8_t* p) {
+	return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+struct RiffChunk {
+	RiffChunk() : id(0), listType(0), offset(0), length(0) {}
+
+	uint32_t id;
+	uint32_t listType; // LIST chunks only.
+	uint32_t offset;   // Body offset; for LIST chunks the first byte after the list type.
+	uint32_t length;   // Body length; for LIST chunks without the list type.
+};
+
+// Iterates the chunks stored inside [offset, offset + length) of the file image.
+class RiffReader {
+public:
+	RiffReader(const uint8_t* data, uint32_t offset, uint32_t length) : data(data), pos(offset), end(offset + length) {}
+
+	bool Next(RiffChunk& c) {
+		if ((pos > end) || (end - pos < 8)) {
+			return false;
+		}
+		c.id = ReadLE32(data + pos);
+		uint32_t len = ReadLE32(data + pos + 4);
+		uint32_t body = pos + 8;
+		if (len > end - body) {
+			len = end - body;
+		}
+		c.listType = 0;
+		c.offset = body;
+		c.length = len;
+		if ((c.id == ID_LIST || c.id == ID_RIFF) && (len >= 4)) {
+			c.listType = ReadLE32(data + body);
+			c.offset = body + 4;
+			c.length = len - 4;
+		}
+		pos = body + len + (len & 1);
+		return true;
+	}
+
+private:
+	const uint8_t* data;
+	uint32_t pos;
+	uint32_t end;
+};
+
+struct Articulation {
+	Articulation() : attackSec(0.0f), decaySec(0.0f), sustainLevel(1.0f), releaseSec(DEFAULT_RELEASE_SEC), pan(0.0f) {}
+
+	float attackSec;
+	float decaySec;
+	float sustainLevel;
+	float releaseSec;
+	float pan;
+};
+
+float TimeCentsToSeconds(int32_t tc) {
+	if (tc == ABSOLUTE_ZERO_TIME) {
+		return 0.0f;
+	}
+	return float(pow(2.0, double(tc) / (1200.0 * 65536.0)));
+}
+
+// Reads the static EG1 and pan connections of an 'art1' / 'art2' chunk.
+void ParseConnections(const uint8_t* data, const RiffChunk& c, Articulation& art) {
+	if (c.length < 8) {
+		return;
+	}
+	uint32_t headerSize = ReadLE32(data + c.offset);
+	uint32_t count = ReadLE32(data + c.offset + 4);
+	if (headerSize > c.length) {
+		return;
+	}
+	uint32_t pos = c.offset + headerSize;
+	uint32_t end = c.offset + c.length;
+	for (uint32_t i = 0; (i < count) && (end - pos >= 12); i++, pos += 12) {
+		uint16_t source = ReadLE16(data + pos);
+		uint16_t control = ReadLE16(data + pos + 2);
+		uint16_t destination = ReadLE16(data + pos + 4);
+		int32_t scale = int32_t(ReadLE32(data + pos + 8));
+		if ((source != CONN_SRC_NONE) || (control != CONN_SRC_NONE)) {
+			continue;
+		}
+		switch (destination) {
+		case CONN_DST_EG1_ATTACKTIME:
+			art.attackSec = TimeCentsToSeconds(scale);
+			break;
+		case CONN_DST_EG1_DECAYTIME:
+			art.decaySec = TimeCentsToSeconds(scale);
+			break;
+		case CONN_DST_EG1_RELEASETIME:
+			art.releaseSec = TimeCentsToSeconds(scale);
+			break;
+		case CONN_DST_EG1_SUSTAINLEVEL:
+			// 0.1 % units.
+			art.sustainLevel = std::min(1.0f, std::max(0.0f, float(scale) / (1000.0f * 65536.0f)));
+			break;
+		case CONN_DST_PAN:
+			// -50 % .. 50 % in 0.1 % units.
+			art.pan = std::min(1.0f, std::max(-1.0f, float(scale) / (500.0f * 65536.0f)));
+			break;
+		}
+	}
+}
+
+// Parses a 'lart' / 'lar2' list.
+void ParseArticulationList(const uint8_t* data, const RiffChunk& list, Articulation& art) {
+	RiffReader reader(data, list.offset, list.length);
+	RiffChunk c;
+	while (reader.Next(c)) {
+		if ((c.id == ID_ART1) || (c.id == ID_ART2)) {
+			ParseConnections(data, c, art);
+		}
+	}
+}
+
+struct SampleInfo {
+	SampleInfo() : present(false), unityNote(60), fineTune(0), attenuation(0), looped(false), loopStart(0), loopLength(0) {}
+
+	bool present;
+	uint8_t unityNote;
+	int16_t fineTune;
+	int32_t attenuation;
+	bool looped;
+	uint32_t loopStart;
+	uint32_t loopLength;
+};
+
+SampleInfo ParseWsmp(const uint8_t* data, const RiffChunk& c) {
+	SampleInfo info;
+	if (c.length < 20) {
+		return info;
+	}
+
+	const uint8_t* p = data + c.offset;
+	uint32_t headerSize = ReadLE32(p);
+	info.present = true;
+	info.unityNote = uint8_t(std::min<uint16_t>(ReadLE16(p + 4), 127));
+	info.fineTune = int16_t(ReadLE16(p + 6));
+	info.attenuation = int32_t(ReadLE32(p + 8));
+	uint32_t loopCount = ReadLE32(p + 16);
+	if ((loopCount > 0) && (headerSize <= c.length) && (c.length - headerSize >= 16)) {
+		const uint8_t* loop = p + headerSize;
+		info.looped = true;
+		info.loopStart = ReadLE32(loop + 8);
+		info.loopLength = ReadLE32(loop + 12);
+	}
+	return info;
+}
+
+bool PlaysAnyNote(const SynthRegion& r, const uint32_t* notes) {
+	for (int note = r.keyLow; note <= r.keyHigh; note++) {
+		if ((notes[note >> 5] >> (note & 31)) & 1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct CompareInstrumentKey {
+	bool operator()(const DlsInstrument& a, const DlsInstrument& b) const { return a.key < b.key; }
+	bool operator()(const DlsInstrument& a, uint32_t key) const { return a.key < key; }
+};
+
+}
+
+DlsBank::DlsBank() : convertedBytes(0) {
+}
+
+void DlsBank::Clear() {
+	instruments.clear();
+	ready.reset();
+	regions.clear();
+	regionWaves.clear();
+	regionResident.clear();
+	waves.clear();
+	converted.clear();
+	convertedBytes = 0;
+	snapshot.Close();
+	mapping.Close();
+}
+
+bool DlsBank::Load(const std::string& path, std::string& err, bool useSnapshot) {
+	Clear();
+
+	if (!mapping.Open(path, err)) {
+		return false;
+	}
+	if (mapping.Size() > 0xFFFFFFFFu) {
+		err = "DLS file is too large";
+		Clear();
+		return false;
+	}
+
+	// A stale or missing snapshot is not an error, the file is indexed instead.
+	std::string snapshotErr;
+	if (useSnapshot && snapshot.Open(path, snapshotErr)) {
+		return AttachSnapshot();
+	}
+
+	const uint8_t* data = mapping.Data();
+	RiffReader top(data, 0, uint32_t(mapping.Size()));
+	RiffChunk riff;
+	if (!top.Next(riff) || (riff.id != ID_RIFF) || (riff.listType != ID_DLS)) {
+		err = "not a DLS file: " + path;
+		Clear();
+		return false;
+	}
+
+	bool hasInstruments = false;
+	uint32_t ptblOffset = 0, ptblLength = 0, wvplOffset = 0, wvplLength = 0;
+
+	RiffReader reader(data, riff.offset, riff.length);
+	RiffChunk c;
+	while (reader.Next(c)) {
+		if ((c.id == ID_LIST) && (c.listType == ID_LINS)) {
+			if (!IndexInstruments(c.offset, c.length, err)) {
+				Clear();
+				return false;
+			}
+			hasInstruments = true;
+		}
+		else if (c.id == ID_PTBL) {
+			ptblOffset = c.offset;
+			ptblLength = c.length;
+		}
+		else if ((c.id == ID_LIST) && (c.listType == ID_WVPL)) {
+			wvplOffset = c.offset;
+			wvplLength = c.length;
+		}
+	}
+
+	if (!hasInstruments || (ptblLength == 0) || (wvplLength == 0)) {
+		err = "DLS file has no instruments or no wave pool: " + path;
+		Clear();
+		return false;
+	}
+
+	if (!IndexWavePool(ptblOffset, ptblLength, wvplOffset, wvplLength, err)) {
+		Clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool DlsBank::AttachSnapshot() {
+	const BankSnapshotInstrument* src = snapshot.Instruments();
+	instruments.resize(snapshot.InstrumentCount());
+	for (size_t i = 0; i < instruments.size(); i++) {
+		DlsInstrument& inst = instruments[i];
+		inst.key = src[i].key;
+		inst.offset = 0;
+		inst.length = 0;
+		inst.firstRegion = src[i].firstRegion;
+		inst.regionCount = src[i].regionCount;
+		inst.loadedRegions = 0;
+		inst.loaded = false;
+		inst.resident = false;
+	}
+
+	size_t totalRegions = snapshot.RegionCount();
+	regions.resize(totalRegions);
+	regionWaves.assign(totalRegions, 0);
+	regionResident.assign(totalRegions, 0);
+	ready.reset(new std::atomic<bool>[instruments.size()]);
+	for (size_t i = 0; i < instruments.size(); i++) {
+		ready[i].store(false, std::memory_order_relaxed);
+	}
+
+	DlsWave empty;
+	memset(&empty, 0, sizeof(empty));
+	waves.assign(snapshot.WaveCount(), empty);
+	return true;
+}
+
+bool DlsBank::IndexInstruments(uint32_t offset, uint32_t length, std::string& err) {
+	const uint8_t* data = mapping.Data();
+	uint32_t totalRegions = 0;
+
+	RiffReader reader(data, offset, length);
+	RiffChunk ins;
+	while (reader.Next(ins)) {
+		if ((ins.id != ID_LIST) || (ins.listType != ID_INS)) {
+			continue;
+		}
+
+		RiffReader sub(data, ins.offset, ins.length);
+		RiffChunk c;
+		while (sub.Next(c)) {
+			if ((c.id != ID_INSH) || (c.length < 12)) {
+				continue;
+			}
+			uint32_t regionCount = ReadLE32(data + c.offset);
+			uint32_t bank = ReadLE32(data + c.offset + 4);
+			uint32_t program = ReadLE32(data + c.offset + 8);
+
+			DlsInstrument inst;
+			inst.key = DlsInstrumentKey(uint8_t((bank >> 8) & 0x7F), uint8_t(bank & 0x7F), uint8_t(program & 0x7F),
+				(bank & F_INSTRUMENT_DRUMS) != 0);
+			inst.offset = ins.offset;
+			inst.length = ins.length;
+			inst.firstRegion = totalRegions;
+			inst.regionCount = std::min<uint32_t>(regionCount, 4096);
+			inst.loadedRegions = 0;
+			inst.loaded = false;
+			inst.resident = false;
+			instruments.push_back(inst);
+			totalRegions += inst.regionCount;
+			break;
+		}
+	}
+
+	if (instruments.empty()) {
+		err = "DLS file contains no instruments";
+		return false;
+	}
+
+	// First definition wins when a bank and program appear twice.
+	std::stable_sort(instruments.begin(), instruments.end(), CompareInstrumentKey());
+	regions.resize(totalRegions);
+	regionWaves.assign(totalRegions, 0);
+	regionResident.assign(totalRegions, 0);
+	ready.reset(new std::atomic<bool>[instruments.size()]);
+	for (size_t i = 0; i < instruments.size(); i++) {
+		ready[i].store(false, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+bool DlsBank::IndexWavePool(uint32_t ptblOffset, uint32_t ptblLength, uint32_t wvplOffset, uint32_t wvplLength, std::string& err) {
+	const uint8_t* data = mapping.Data();
+	if (ptblLength < 8) {
+		err = "invalid DLS pool table";
+		return false;
+	}
+	uint32_t headerSize = ReadLE32(data + ptblOffset);
+	uint32_t cueCount = ReadLE32(data + ptblOffset + 4);
+	if ((headerSize > ptblLength) || (cueCount > (ptblLength - headerSize) / 4)) {
+		err = "invalid DLS pool table";
+		return false;
+	}
+
+	// Wave lists in file order, used when the pool table offsets do not point at them.
+	std::vector<RiffChunk> waveLists;
+	RiffReader reader(data, wvplOffset, wvplLength);
+	RiffChunk c;
+	while (reader.Next(c)) {
+		if ((c.id == ID_LIST) && (c.listType == ID_WAVE)) {
+			waveLists.push_back(c);
+		}
+	}
+
+	DlsWave empty;
+	memset(&empty, 0, sizeof(empty));
+	waves.assign(cueCount, empty);
+
+	for (uint32_t i = 0; i < cueCount; i++) {
+		// Pool table offsets are relative to the first byte after the 'wvpl' list type.
+		uint32_t cue = ReadLE32(data + ptblOffset + headerSize + i * 4);
+		bool found = false;
+		if (cue < wvplLength) {
+			RiffReader at(data, wvplOffset + cue, wvplLength - cue);
+			RiffChunk w;
+			if (at.Next(w) && (w.id == ID_LIST) && (w.listType == ID_WAVE)) {
+				waves[i].offset = w.offset;
+				waves[i].length = w.length;
+				found = true;
+			}
+		}
+		if (!found && (i < waveLists.size())) {
+			waves[i].offset = waveLists[i].offset;
+			waves[i].length = waveLists[i].length;
+		}
+	}
+
+	return true;
+}
+
+bool DlsBank::LoadWave(uint32_t idx) {
+	if (idx >= waves.size()) {
+		return false;
+	}
+	DlsWave& w = waves[idx];
+	if (w.loaded) {
+		return w.wave.length > 0;
+	}
+	w.loaded = true;
+
+	if (snapshot.IsOpen()) {
+		const BankSnapshotWave& s = snapshot.Waves()[idx];
+		w.wave.samples = snapshot.Samples() + s.sampleOffset;
+		w.wave.length = s.length;
+		w.wave.loopStart = s.loopStart;
+		w.wave.loopLength = s.loopLength;
+		w.wave.sampleRate = s.sampleRate;
+		w.wave.padding = BANK_SNAPSHOT_PAD_SAMPLES;
+		return s.length > 0;
+	}
+	if (w.offset == 0) {
+		return false;
+	}
+
+	const uint8_t* data = mapping.Data();
+	uint16_t formatTag = 0, channels = 0, bits = 0;
+	uint32_t sampleRate = 0;
+	RiffChunk dataChunk;
+
+	RiffReader reader(data, w.offset, w.length);
+	RiffChunk c;
+	while (reader.Next(c)) {
+		if ((c.id == ID_FMT) && (c.length >= 16)) {
+			formatTag = ReadLE16(data + c.offset);
+			channels = ReadLE16(data + c.offset + 2);
+			sampleRate = ReadLE32(data + c.offset + 4);
+			bits = ReadLE16(data + c.offset + 14);
+		}
+		else if (c.id == ID_WSMP) {
+			SampleInfo info = ParseWsmp(data, c);
+			if (info.present) {
+				w.hasSample = true;
+				w.unityNote = info.unityNote;
+				w.fineTune = info.fineTune;
+				w.attenuation = info.attenuation;
+				w.loopStart = info.looped ? info.loopStart : 0;
+				w.loopLength = info.looped ? info.loopLength : 0;
+			}
+		}
+		else if (c.id == ID_DATA) {
+			dataChunk = c;
+		}
+	}
+
+	if ((formatTag != 1) || (channels == 0) || (sampleRate == 0) || (dataChunk.length == 0) ||
+		((bits != 8) && (bits != 16))) {
+		return false;
+	}
+
+	uint32_t frameBytes = uint32_t(channels) * (bits / 8);
+	uint32_t frames = dataChunk.length / frameBytes;
+	const uint8_t* pcm = data + dataChunk.offset;
+
+	if ((bits == 16) && (channels == 1) && ((size_t(pcm) & 1) == 0)) {
+		// Referenced in place.
+		w.wave.samples = (const int16_t*)pcm;
+	}
+	else {
+		// 8-bit, multi-channel or misaligned data: private 16-bit mono copy of the first channel.
+		std::vector<int16_t> copy(frames);
+		for (uint32_t i = 0; i < frames; i++) {
+			const uint8_t* f = pcm + size_t(i) * frameBytes;
+			copy[i] = (bits == 8) ? int16_t((int(f[0]) - 128) << 8) : int16_t(ReadLE16(f));
+		}
+		convertedBytes += uint64_t(frames) * sizeof(int16_t);
+		converted.push_back(std::vector<int16_t>());
+		converted.back().swap(copy);
+		w.wave.samples = converted.back().empty() ? nullptr : &converted.back()[0];
+	}
+
+	w.wave.length = frames;
+	w.wave.sampleRate = sampleRate;
+	w.wave.loopStart = 0;
+	w.wave.loopLength = 0;
+	if ((w.loopLength > 0) && (w.loopStart < frames) && (w.loopLength <= frames - w.loopStart)) {
+		w.wave.loopStart = w.loopStart;
+		w.wave.loopLength = w.loopLength;
+	}
+	return frames > 0;
+}
+
+bool DlsBank::LoadInstrument(size_t idx, const uint32_t* notes) {
+	if (idx >= instruments.size()) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(loadMutex);
+	bool ok = LoadInstrumentLocked(idx);
+	DlsInstrument& inst = instruments[idx];
+	inst.resident = true;
+	for (uint32_t i = 0; i < inst.loadedRegions; i++) {
+		size_t slot = inst.firstRegion + i;
+		if (regionResident[slot] || (notes && !PlaysAnyNote(regions[slot], notes))) {
+			continue;
+		}
+		regionResident[slot] = 1;
+		DlsWave& w = waves[regionWaves[slot]];
+		if ((w.users++ == 0) && IsInPlace(w)) {
+			MappedFile& source = WaveSource();
+			source.Prefetch(size_t((const uint8_t*)w.wave.samples - source.Data()), size_t(w.wave.length) * sizeof(int16_t));
+		}
+	}
+	ready[idx].store(true, std::memory_order_release);
+	return ok;
+}
+
+void DlsBank::UnloadInstrument(size_t idx) {
+	if (idx >= instruments.size()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(loadMutex);
+	DlsInstrument& inst = instruments[idx];
+	if (!inst.resident) {
+		return;
+	}
+	inst.resident = false;
+	// New notes no longer find the instrument, voices which play it already keep their regions.
+	ready[idx].store(false, std::memory_order_release);
+	for (uint32_t i = 0; i < inst.loadedRegions; i++) {
+		size_t slot = inst.firstRegion + i;
+		if (!regionResident[slot]) {
+			continue;
+		}
+		regionResident[slot] = 0;
+		DlsWave& w = waves[regionWaves[slot]];
+		if ((--w.users == 0) && IsInPlace(w)) {
+			// Converted copies stay: a voice may still be playing them.
+			MappedFile& source = WaveSource();
+			source.Evict(size_t((const uint8_t*)w.wave.samples - source.Data()), size_t(w.wave.length) * sizeof(int16_t));
+		}
+	}
+}
+
+bool DlsBank::IsInPlace(const DlsWave& w) {
+	const MappedFile& source = WaveSource();
+	const uint8_t* samples = (const uint8_t*)w.wave.samples;
+	return (w.wave.length > 0) && (samples >= source.Data()) && (samples < source.Data() + source.Size());
+}
+
+bool DlsBank::LoadInstrumentLocked(size_t idx) {
+	DlsInstrument& inst = instruments[idx];
+	if (inst.loaded) {
+		return true;
+	}
+	inst.loaded = true;
+	if (snapshot.IsOpen()) {
+		return LoadSnapshotRegions(inst);
+	}
+
+	const uint8_t* data = mapping.Data();
+
+	// Instrument articulation is the default for regions without their own.
+	Articulation global;
+	RiffChunk lrgn;
+	{
+		RiffReader reader(data, inst.offset, inst.length);
+		RiffChunk c;
+		while (reader.Next(c)) {
+			if ((c.id == ID_LIST) && ((c.listType == ID_LART) || (c.listType == ID_LAR2))) {
+				ParseArticulationList(data, c, global);
+			}
+			else if ((c.id == ID_LIST) && (c.listType == ID_LRGN)) {
+				lrgn = c;
+			}
+		}
+	}
+	if (lrgn.length == 0) {
+		return true;
+	}
+
+	RiffReader regionReader(data, lrgn.offset, lrgn.length);
+	RiffChunk rgn;
+	while (regionReader.Next(rgn) && (inst.loadedRegions < inst.regionCount)) {
+		if ((rgn.id != ID_LIST) || ((rgn.listType != ID_RGN) && (rgn.listType != ID_RGN2))) {
+			continue;
+		}
+
+		bool hasHeader = false, hasLink = false;
+		uint16_t keyLow = 0, keyHigh = 127, velLow = 0, velHigh = 127;
+		uint32_t tableIndex = 0;
+		SampleInfo sample;
+		Articulation art = global;
+
+		RiffReader reader(data, rgn.offset, rgn.length);
+		RiffChunk c;
+		while (reader.Next(c)) {
+			if ((c.id == ID_RGNH) && (c.length >= 12)) {
+				hasHeader = true;
+				keyLow = ReadLE16(data + c.offset);
+				keyHigh = ReadLE16(data + c.offset + 2);
+				velLow = ReadLE16(data + c.offset + 4);
+				velHigh = ReadLE16(data + c.offset + 6);
+				if ((velLow == 0) && (velHigh == 0)) {
+					// DLS Level 1 files leave the velocity range empty.
+					velHigh = 127;
+				}
+			}
+			else if (c.id == ID_WSMP) {
+				sample = ParseWsmp(data, c);
+			}
+			else if ((c.id == ID_WLNK) && (c.length >= 12)) {
+				hasLink = true;
+				tableIndex = ReadLE32(data + c.offset + 8);
+			}
+			else if ((c.id == ID_LIST) && ((c.listType == ID_LART) || (c.listType == ID_LAR2))) {
+				ParseArticulationList(data, c, art);
+			}
+		}
+
+		if (!hasHeader || !hasLink || !LoadWave(tableIndex)) {
+			continue;
+		}
+
+		const DlsWave& w = waves[tableIndex];
+		if (!sample.present) {
+			sample.unityNote = w.hasSample ? w.unityNote : 60;
+			sample.fineTune = w.hasSample ? w.fineTune : 0;
+			sample.attenuation = w.hasSample ? w.attenuation : 0;
+		}
+
+		SynthRegion& r = regions[inst.firstRegion + inst.loadedRegions];
+		regionWaves[inst.firstRegion + inst.loadedRegions] = tableIndex;
+		r.wave = &w.wave;
+		r.keyLow = uint8_t(std::min<uint16_t>(keyLow, 127));
+		r.keyHigh = uint8_t(std::min<uint16_t>(keyHigh, 127));
+		r.velocityLow = uint8_t(std::min<uint16_t>(velLow, 127));
+		r.velocityHigh = uint8_t(std::min<uint16_t>(velHigh, 127));
+		r.unityNote = sample.unityNote;
+		r.reserved = 0;
+		r.fineTuneCents = sample.fineTune;
+		// Attenuation is in 1/65536 centibel.
+		r.gain = std::min(4.0f, float(pow(10.0, double(sample.attenuation) / (65536.0 * 200.0))));
+		r.pan = art.pan;
+		r.attackSec = art.attackSec;
+		r.decaySec = art.decaySec;
+		r.sustainLevel = art.sustainLevel;
+		r.releaseSec = art.releaseSec;
+		inst.loadedRegions++;
+	}
+
+	return true;
+}
+
+// Regions of a snapshot are stored as the synthesizer uses them, only the wave pointers are resolved.
+bool DlsBank::LoadSnapshotRegions(DlsInstrument& inst) {
+	const BankSnapshotRegion* src = snapshot.Regions() + inst.firstRegion;
+	for (uint32_t i = 0; i < inst.regionCount; i++) {
+		const BankSnapshotRegion& s = src[i];
+		if (!LoadWave(s.wave)) {
+			continue;
+		}
+		size_t slot = inst.firstRegion + inst.loadedRegions;
+		SynthRegion& r = regions[slot];
+		regionWaves[slot] = s.wave;
+		r.wave = &waves[s.wave].wave;
+		r.keyLow = s.keyLow;
+		r.keyHigh = s.keyHigh;
+		r.velocityLow = s.velocityLow;
+		r.velocityHigh = s.velocityHigh;
+		r.unityNote = s.unityNote;
+		r.reserved = 0;
+		r.fineTuneCents = s.fineTuneCents;
+		r.gain = s.gain;
+		r.pan = s.pan;
+		r.attackSec = s.attackSec;
+		r.decaySec = s.decaySec;
+		r.sustainLevel = s.sustainLevel;
+		r.releaseSec = s.releaseSec;
+		inst.loadedRegions++;
+	}
+	return true;
+}
+
+int DlsBank::FindInstrument(uint32_t key) const {
+	std::vector<DlsInstrument>::const_iterator it =
+		std::lower_bound(instruments.begin(), instruments.end(), key, CompareInstrumentKey());
+	if ((it == instruments.end()) || (it->key != key)) {
+		return -1;
+	}
+	return int(it - instruments.begin());
+}
+
+int DlsBank::ResolveInstrument(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum) const {
+	int idx = FindInstrument(DlsInstrumentKey(bankMsb, bankLsb, program, drum));
+	if (idx < 0) {
+		// GM fallback: the same program in the capital bank.
+		idx = FindInstrument(DlsInstrumentKey(0, 0, program, drum));
+	}
+	if ((idx < 0) && drum) {
+		// Standard drum kit.
+		idx = FindInstrument(DlsInstrumentKey(0, 0, 0, true));
+	}
+	return idx;
+}
+
+bool DlsBank::LoadProgram(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum) {
+	int idx = ResolveInstrument(bankMsb, bankLsb, program, drum);
+	return (idx >= 0) && LoadInstrument(size_t(idx));
+}
+
+const SynthRegion* DlsBank::FindRegion(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum,
+	uint8_t note, uint8_t velocity)
+{
+	// Called by the audio thread, which must neither wait for the lock nor load: an instrument
+	// which was not made resident before plays nothing.
+	int idx = ResolveInstrument(bankMsb, bankLsb, program, drum);
+	if ((idx < 0) || !ready[idx].load(std::memory_order_acquire)) {
+		return nullptr;
+	}
+
+	const DlsInstrument& inst = instruments[idx];
+	for (uint32_t i = 0; i < inst.loadedRegions; i++) {
+		const SynthRegion& r = regions[inst.firstRegion + i];
+		if ((note >= r.keyLow) && (note <= r.keyHigh) && (velocity >= r.velocityLow) && (velocity <= r.velocityHigh)) {
+			return &r;
+		}
+	}
+	return nullptr;
+}
+
+DlsBankStats DlsBank::Stats() const {
+	std::lock_guard<std::mutex> lock(loadMutex);
+	DlsBankStats s;
+	s.instruments = instruments.size();
+	s.loadedInstruments = 0;
+	s.regions = 0;
+	s.waves = waves.size();
+	s.loadedWaves = 0;
+	s.waveBytes = 0;
+	s.convertedBytes = convertedBytes;
+	s.fileBytes = FromSnapshot() ? snapshot.Mapping().Size() : mapping.Size();
+
+	for (size_t i = 0; i < instruments.size(); i++) {
+		const DlsInstrument& inst = instruments[i];
+		if (inst.resident) {
+			s.loadedInstruments++;
+			for (uint32_t r = 0; r < inst.loadedRegions; r++) {
+				s.regions += regionResident[inst.firstRegion + r];
+			}
+		}
+	}
+	for (size_t i = 0; i < waves.size(); i++) {
+		if ((waves[i].users > 0) && (waves[i].wave.length > 0)) {
+			s.loadedWaves++;
+			s.waveBytes += uint64_t(waves[i].wave.length) * sizeof(int16_t);
+		}
+	}
+	return s;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bank_snapshot.h"
+#include "instrument_bank.h"
+#include "mapped_file.h"
+
+/*
+
+DLS Level 1 / Level 2 instrument bank.
+
+The file is memory-mapped and only its instrument headers and the wave pool
+table are read at load time. Regions and articulations of an instrument are
+parsed when the instrument is loaded, and wave data is referenced in place
+inside the mapping. Only 8-bit and multi-channel waves are converted into a
+private 16-bit mono copy.
+
+Instruments are loaded before they play, e.g. those of the next song while
+the current one plays: FindRegion runs on the audio thread and only looks up
+resident instruments, without a lock and without allocating, and a note of
+an instrument which is not resident stays silent. One bank can be shared by
+synthesizers running on different threads. Loading and unloading take a lock.
+
+A loaded instrument is resident: the pages of its in-place waves are read in
+when it is loaded, so the audio thread does not fault them in, and stay in the
+resident set until the instrument is unloaded and no other resident region
+plays the same wave. A drum kit can be loaded with the regions of the notes a
+song plays only. Unloading keeps the parsed regions, so a voice still
+playing an unloaded instrument keeps working and its pages are simply read
+from the file again; new notes do not find the instrument until it is loaded
+again.
+
+When the DLS file has an up-to-date snapshot (see bank_snapshot.h), the
+instrument index, the regions and the waves come from the snapshot instead:
+nothing of the DLS file is parsed, and the resident pages are those of the
+snapshot.
+
+*/
+
+// Bank and program of an instrument as a single sortable key.
+inline uint32_t DlsInstrumentKey(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum) {
+	return (drum ? 0x01000000u : 0u) | (uint32_t(bankMsb) << 16) | (uint32_t(bankLsb) << 8) | program;
+}
+
+struct DlsInstrument {
+	uint32_t key;         // DlsInstrumentKey.
+	uint32_t offset;      // Offset of the 'ins ' list body in the file.
+	uint32_t length;
+	uint32_t firstRegion; // Index of the first region slot in the region table.
+	uint32_t regionCount; // Number of region slots reserved by the instrument header.
+	uint32_t loadedRegions;
+	bool loaded;          // Regions are parsed.
+	bool resident;        // Wave data of some or all regions is held in memory.
+};
+
+struct DlsWave {
+	uint32_t offset;      // Offset of the 'wave' list body in the file; 0 if the pool entry is invalid.
+	uint32_t length;
+	bool loaded;
+	bool hasSample;       // Wave has its own 'wsmp' chunk.
+	uint8_t unityNote;
+	int16_t fineTune;
+	int32_t attenuation;
+	uint32_t loopStart;
+	uint32_t loopLength;
+	uint32_t users;       // Resident regions which play the wave.
+	SynthWave wave;
+};
+
+struct DlsBankStats {
+	size_t instruments;
+	size_t loadedInstruments; // Resident instruments.
+	size_t regions;           // Resident regions.
+	size_t waves;
+	size_t loadedWaves;       // Waves played by resident instruments.
+	uint64_t waveBytes;       // Sample data of those waves.
+	uint64_t convertedBytes;  // Sample data which had to be converted into a private copy.
+	uint64_t fileBytes;
+};
+
+class DlsBank : public InstrumentBank {
+public:
+	DlsBank();
+
+	// Uses the snapshot of the file if it is up to date, unless told not to.
+	bool Load(const std::string& path, std::string& err, bool useSnapshot = true);
+	void Clear();
+
+	bool FromSnapshot() const { return snapshot.IsOpen(); }
+
+	// File image, e.g. to hand it to DirectMusic without reading the file again.
+	const uint8_t* Image() const { return mapping.Data(); }
+	size_t ImageSize() const { return mapping.Size(); }
+
+	size_t InstrumentCount() const { return instruments.size(); }
+	const DlsInstrument& Instrument(size_t idx) const { return instruments[idx]; }
+
+	// Instrument index for an exact bank and program, or -1.
+	int FindInstrument(uint32_t key) const;
+
+	// Instrument index which plays a program: the exact bank, the same program in the
+	// General MIDI bank, and the standard drum kit for drums. -1 if there is none.
+	int ResolveInstrument(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum) const;
+
+	// Parses regions, articulation and waves of an instrument if not done yet and makes it resident.
+	// With a note mask (bit n: note n) only the regions which play one of these notes are made resident;
+	// loading again with other notes adds their regions.
+	bool LoadInstrument(size_t idx, const uint32_t* notes = nullptr);
+
+	// Loads the instrument which plays a program, with the same fallback as FindRegion.
+	bool LoadProgram(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum);
+
+	// Releases the wave data of an instrument which is not going to be played soon.
+	void UnloadInstrument(size_t idx);
+
+	DlsBankStats Stats() const;
+
+	// Loaded regions and their waves, e.g. to write a snapshot.
+	const SynthRegion& Region(size_t slot) const { return regions[slot]; }
+	uint32_t RegionWave(size_t slot) const { return regionWaves[slot]; }
+	size_t WaveCount() const { return waves.size(); }
+	const DlsWave& Wave(size_t idx) const { return waves[idx]; }
+
+	// Regions of resident instruments only, see above.
+	const SynthRegion* FindRegion(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum,
+		uint8_t note, uint8_t velocity);
+
+private:
+	bool AttachSnapshot();
+	bool IndexInstruments(uint32_t offset, uint32_t length, std::string& err);
+	bool IndexWavePool(uint32_t ptblOffset, uint32_t ptblLength, uint32_t wvplOffset, uint32_t wvplLength, std::string& err);
+	bool LoadInstrumentLocked(size_t idx);
+	bool LoadSnapshotRegions(DlsInstrument& inst);
+	bool LoadWave(uint32_t idx);
+	bool IsInPlace(const DlsWave& w);
+	MappedFile& WaveSource() { return snapshot.IsOpen() ? snapshot.Mapping() : mapping; }
+
+	MappedFile mapping;
+	BankSnapshot snapshot;
+	std::vector<DlsInstrument> instruments; // Sorted by key.
+	std::unique_ptr<std::atomic<bool>[]> ready; // Per instrument: regions are loaded and published.
+	mutable std::mutex loadMutex;           // Serializes loading of instruments and waves.
+	std::vector<SynthRegion> regions;       // Fixed size, so region pointers stay valid.
+	std::vector<uint32_t> regionWaves;      // Wave pool index of every loaded region.
+	std::vector<uint8_t> regionResident;    // Per loaded region: counted in the users of its wave.
+	std::vector<DlsWave> waves;             // Fixed size, so wave pointers stay valid.
+	std::vector<std::vector<int16_t> > converted;
+	uint64_t convertedBytes;
+};
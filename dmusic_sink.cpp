@@ -0,0 +1,119 @@
+#include <comdef.h>
+#include <dmusici.h>
+
+#include "dmusic_sink.h"
+
+// Channel group of the port the performance channels are assigned to.
+static const DWORD CHANNEL_GROUP = 1;
+
+DirectMusicPortSink::DirectMusicPortSink() : port(NULL), buffer(NULL), clock(NULL) {
+}
+
+DirectMusicPortSink::~DirectMusicPortSink() {
+	Close();
+}
+
+bool DirectMusicPortSink::Open(IDirectMusic8* directMusic, IDirectMusicPort8* p, std::string& err) {
+	Close();
+
+	DMUS_BUFFERDESC desc;
+	ZeroMemory(&desc, sizeof(desc));
+	desc.dwSize = sizeof(DMUS_BUFFERDESC);
+	desc.guidBufferFormat = GUID_NULL;
+	desc.cbBuffer = DMUS_SINK_BUFFER_SIZE;
+
+	HRESULT hr = directMusic->CreateMusicBuffer(&desc, &buffer, NULL);
+	if (FAILED(hr)) {
+		err = "can not create DirectMusic buffer";
+		return false;
+	}
+
+	hr = p->GetLatencyClock(&clock);
+	if (FAILED(hr)) {
+		err = "can not get port latency clock";
+		Close();
+		return false;
+	}
+
+	p->AddRef();
+	port = p;
+	return true;
+}
+
+void DirectMusicPortSink::Close() {
+	if (clock) {
+		clock->Release();
+		clock = NULL;
+	}
+	if (buffer) {
+		buffer->Release();
+		buffer = NULL;
+	}
+	if (port) {
+		port->Release();
+		port = NULL;
+	}
+}
+
+int64_t DirectMusicPortSink::Now() {
+	// The latency clock gives the earliest time at which the port can still play an event.
+	REFERENCE_TIME rt = 0;
+	clock->GetTime(&rt);
+	return rt;
+}
+
+bool DirectMusicPortSink::Pack(int64_t rt, const MidiSinkEvent& e) {
+	for (int attempt = 0; attempt < 2; attempt++) {
+		HRESULT hr;
+		if (e.data) {
+			hr = buffer->PackUnstructured(rt, CHANNEL_GROUP, e.length, (LPBYTE)e.data);
+		}
+		else {
+			hr = buffer->PackStructured(rt, CHANNEL_GROUP, e.message);
+		}
+
+		if (SUCCEEDED(hr)) {
+			return true;
+		}
+		if ((hr != DMUS_E_BUFFER_FULL) || !Play()) {
+			return false;
+		}
+	}
+	return false;
+}
+
+bool DirectMusicPortSink::Play() {
+	HRESULT hr = port->PlayBuffer(buffer);
+	buffer->Flush();
+	return SUCCEEDED(hr);
+}
+
+bool DirectMusicPortSink::ShortMessage(uint32_t message) {
+	MidiSinkEvent e = { 0, message, 0, NULL };
+	return SubmitBatch(&e, 1);
+}
+
+bool DirectMusicPortSink::LongMessage(const uint8_t* data, uint32_t length) {
+	MidiSinkEvent e = { 0, 0, length, data };
+	return SubmitBatch(&e, 1);
+}
+
+void DirectMusicPortSink::Reset() {
+	MidiSinkEvent events[32];
+	for (int ch = 0; ch < 16; ch++) {
+		MidiSinkEvent allSoundOff = { 0, DWORD(0xB0 | ch) | (120 << 8), 0, NULL };
+		MidiSinkEvent resetControllers = { 0, DWORD(0xB0 | ch) | (121 << 8), 0, NULL };
+		events[ch * 2] = allSoundOff;
+		events[ch * 2 + 1] = resetControllers;
+	}
+	SubmitBatch(events, 32);
+}
+
+bool DirectMusicPortSink::SubmitBatch(const MidiSinkEvent* events, size_t count) {
+	int64_t rt = Now();
+	bool ok = true;
+	for (size_t i = 0; i < count; i++) {
+		ok = Pack(rt, events[i]) && ok;
+	}
+	return Play() && ok;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+
+#include "midi_sink.h"
+
+struct IDirectMusic8;
+struct IDirectMusicPort8;
+struct IDirectMusicBuffer;
+struct IReferenceClock;
+
+// Output to an activated DirectMusic port through IDirectMusicBuffer / PlayBuffer.
+// A batch is packed into one buffer and played with a single PlayBuffer call.
+class DirectMusicPortSink : public MidiSink {
+public:
+	DirectMusicPortSink();
+	~DirectMusicPortSink();
+
+	// The port must stay alive while the sink is open.
+	bool Open(IDirectMusic8* directMusic, IDirectMusicPort8* port, std::string& err);
+	void Close();
+
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+	bool SubmitBatch(const MidiSinkEvent* events, size_t count);
+
+private:
+	DirectMusicPortSink(const DirectMusicPortSink&);
+	DirectMusicPortSink& operator=(const DirectMusicPortSink&);
+
+	bool Pack(int64_t rt, const MidiSinkEvent& e);
+	bool Play();
+	int64_t Now();
+
+	IDirectMusicPort8* port;
+	IDirectMusicBuffer* buffer;
+	IReferenceClock* clock;
+};
+
+// Size of the DirectMusic event buffer, also the largest SysEx message which can be sent.
+const unsigned long DMUS_SINK_BUFFER_SIZE = 64 * 1024;
@@ -0,0 +1,191 @@
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h> // Link with winmm.lib
+#include <dsound.h>   // Link with dsound.lib
+
+#include <chrono>
+#include <cstring>
+
+#include "dsound_audio_device.h"
+#include "hires_clock.h"
+
+static const DWORD BYTES_PER_FRAME = 4;
+
+DirectSoundAudioDevice::DirectSoundAudioDevice() :
+	directSound(NULL),
+	buffer(NULL),
+	blockBytes(0),
+	stopRequested(false)
+{
+}
+
+DirectSoundAudioDevice::~DirectSoundAudioDevice() {
+	Close();
+}
+
+bool DirectSoundAudioDevice::Open(const _GUID* deviceGuid, void* window, std::string& err) {
+	Close();
+
+	HRESULT hr = DirectSoundCreate8(deviceGuid, &directSound, NULL);
+	if (FAILED(hr)) {
+		err = "can not create DirectSound device";
+		return false;
+	}
+	hr = directSound->SetCooperativeLevel(HWND(window), DSSCL_PRIORITY);
+	if (FAILED(hr)) {
+		err = "can not set DirectSound cooperative level";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void DirectSoundAudioDevice::Close() {
+	Stop();
+	if (directSound) {
+		directSound->Release();
+		directSound = NULL;
+	}
+}
+
+bool DirectSoundAudioDevice::Start(const AudioDeviceConfig& cfg, AudioCallback& cb, std::string& err) {
+	Stop();
+	if (!directSound) {
+		err = "DirectSound device is not open";
+		return false;
+	}
+	if (!Prepare(cfg, cb, err)) {
+		return false;
+	}
+
+	WAVEFORMATEX waveFormat;
+	waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+	waveFormat.nChannels = 2;
+	waveFormat.nSamplesPerSec = config.sampleRate;
+	waveFormat.wBitsPerSample = 16;
+	waveFormat.nBlockAlign = waveFormat.nChannels * waveFormat.wBitsPerSample / 8;
+	waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+	waveFormat.cbSize = 0;
+
+	blockBytes = config.blockFrames * BYTES_PER_FRAME;
+
+	DSBUFFERDESC bufferDesc = {};
+	bufferDesc.dwSize = sizeof(DSBUFFERDESC);
+	bufferDesc.dwFlags = DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_GLOBALFOCUS;
+	bufferDesc.dwBufferBytes = blockBytes * config.bufferBlocks;
+	bufferDesc.lpwfxFormat = &waveFormat;
+
+	HRESULT hr = directSound->CreateSoundBuffer(&bufferDesc, &buffer, NULL);
+	if (FAILED(hr)) {
+		err = "can not create DirectSound buffer";
+		return false;
+	}
+
+	// Starts with silence: block 0 plays while the next ones are rendered.
+	void* p1;
+	void* p2;
+	DWORD n1, n2;
+	hr = buffer->Lock(0, 0, &p1, &n1, &p2, &n2, DSBLOCK_ENTIREBUFFER);
+	if (SUCCEEDED(hr)) {
+		memset(p1, 0, n1);
+		buffer->Unlock(p1, n1, p2, n2);
+	}
+
+	hr = buffer->Play(0, 0, DSBPLAY_LOOPING);
+	if (FAILED(hr)) {
+		err = "can not start DirectSound buffer";
+		buffer->Release();
+		buffer = NULL;
+		return false;
+	}
+
+	stopRequested.store(false);
+	thread = std::thread(&DirectSoundAudioDevice::Run, this);
+	return true;
+}
+
+void DirectSoundAudioDevice::Stop() {
+	if (thread.joinable()) {
+		stopRequested.store(true);
+		thread.join();
+	}
+	if (buffer) {
+		buffer->Stop();
+		buffer->Release();
+		buffer = NULL;
+	}
+}
+
+bool DirectSoundAudioDevice::WriteBlock(uint64_t index) {
+	DWORD offset = DWORD(index % config.bufferBlocks) * blockBytes;
+	void* p1;
+	void* p2;
+	DWORD n1, n2;
+	HRESULT hr = buffer->Lock(offset, blockBytes, &p1, &n1, &p2, &n2, 0);
+	if (hr == DSERR_BUFFERLOST) {
+		buffer->Restore();
+		hr = buffer->Lock(offset, blockBytes, &p1, &n1, &p2, &n2, 0);
+	}
+	if (FAILED(hr)) {
+		return false;
+	}
+
+	// Blocks never straddle the end of the buffer, the second part stays empty.
+	memcpy(p1, &block[0], n1);
+	buffer->Unlock(p1, n1, p2, n2);
+	return true;
+}
+
+void DirectSoundAudioDevice::Run() {
+	timeBeginPeriod(1);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+	const uint64_t blocks = config.bufferBlocks;
+	const uint64_t blockFrames = config.blockFrames;
+	const DWORD bufferBytes = blockBytes * config.bufferBlocks;
+	const double nsPerFrame = 1e9 / double(config.sampleRate);
+
+	uint64_t playFrame = 0;  // Frames played since Start(), from the play cursor.
+	DWORD lastCursor = 0;
+	uint64_t written = 1;    // Blocks in the buffer, block 0 being the initial silence.
+	const int64_t startNs = NowNanos();
+
+	while (!stopRequested.load(std::memory_order_relaxed)) {
+		DWORD cursor, writeCursor;
+		if (FAILED(buffer->GetCurrentPosition(&cursor, &writeCursor))) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+		playFrame += ((cursor + bufferBytes - lastCursor) % bufferBytes) / BYTES_PER_FRAME;
+		lastCursor = cursor;
+
+		// After a dropout the cursor has overtaken the rendered blocks: carry on after it.
+		uint64_t playing = playFrame / blockFrames;
+		if (written <= playing) {
+			written = playing + 1;
+		}
+
+		if (written < playing + blocks) {
+			// A block may be rendered once the previous pass over its part of the buffer has started playing
+			// and must be finished before the cursor reaches it.
+			int64_t nowNs = NowNanos();
+			int64_t dueNs = nowNs + int64_t((double(int64_t(written + 1) - int64_t(blocks)) * double(blockFrames) - double(playFrame)) * nsPerFrame);
+			int64_t deadlineNs = nowNs + int64_t(double(written * blockFrames - playFrame) * nsPerFrame);
+			RenderBlock(dueNs > startNs ? dueNs : startNs, deadlineNs);
+			WriteBlock(written);
+			written++;
+			continue;
+		}
+
+		// Sleeps until the playing block is nearly done.
+		int64_t remainingNs = int64_t(double((playing + 1) * blockFrames - playFrame) * nsPerFrame);
+		if (remainingNs > 2000000) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+
+	timeEndPeriod(1);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+#include "audio_device.h"
+
+struct _GUID;
+struct IDirectSound8;
+struct IDirectSoundBuffer;
+
+// Output to a DirectSound device through a looping secondary buffer of
+// bufferBlocks blocks. The audio thread polls the play cursor and renders every
+// block as soon as its part of the buffer has been played.
+class DirectSoundAudioDevice : public AudioDevice {
+public:
+	DirectSoundAudioDevice();
+	~DirectSoundAudioDevice();
+
+	// 'deviceGuid' as given by DirectSoundEnumerate, nullptr for the default device.
+	bool Open(const _GUID* deviceGuid, void* window, std::string& err);
+	void Close();
+
+	bool Start(const AudioDeviceConfig& config, AudioCallback& callback, std::string& err);
+	void Stop();
+
+	const char* Name() const { return "DirectSound"; }
+
+private:
+	void Run();
+	bool WriteBlock(uint64_t index);
+
+	IDirectSound8* directSound;
+	IDirectSoundBuffer* buffer;
+	unsigned long blockBytes;
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+};
@@ -0,0 +1,36 @@
+#include "hires_clock.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+
+static int64_t QueryFrequency() {
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+}
+
+int64_t NowNanos() {
+	static const int64_t freq = QueryFrequency();
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	// Split to avoid overflow of counter * 1e9.
+	int64_t seconds = counter.QuadPart / freq;
+	int64_t rest = counter.QuadPart % freq;
+	return seconds * 1000000000LL + rest * 1000000000LL / freq;
+}
+
+#else
+#include <time.h>
+
+int64_t NowNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+#endif
+
+int64_t NowMicros() {
+	return NowNanos() / 1000;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+// Monotonic high resolution clock.
+// QueryPerformanceCounter on Windows, CLOCK_MONOTONIC elsewhere.
+int64_t NowMicros();
+int64_t NowNanos();
+
+// Hint to the CPU that the thread is busy waiting.
+inline void CpuRelax() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	_mm_pause();
+#endif
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+// Mono 16-bit PCM sample data used by the synthesizer.
+struct SynthWave {
+	const int16_t* samples;
+	uint32_t length;      // Number of samples.
+	uint32_t loopStart;   // First sample of the loop.
+	uint32_t loopLength;  // Number of samples in the loop; 0 for one-shot waves.
+	uint32_t sampleRate;
+	uint32_t padding;     // Samples stored after the loop end, or after the end of a one-shot wave, which
+	                      // continue the loop or are silent, so the resampler may read them without wrapping.
+};
+
+// Everything the synthesizer needs to start a voice.
+struct SynthRegion {
+	const SynthWave* wave;
+	uint8_t keyLow;
+	uint8_t keyHigh;
+	uint8_t velocityLow;
+	uint8_t velocityHigh;
+	uint8_t unityNote;     // Note which plays the wave at its own pitch.
+	uint8_t reserved;
+	int16_t fineTuneCents;
+	float gain;            // Linear attenuation of the region.
+	float pan;             // -1 (left) .. 1 (right), added to the channel pan.
+	float attackSec;
+	float decaySec;
+	float sustainLevel;    // 0 .. 1.
+	float releaseSec;
+};
+
+// Source of instruments for the synthesizer.
+class InstrumentBank {
+public:
+	virtual ~InstrumentBank() {}
+
+	// Region which plays the note, or nullptr if the bank has nothing for it.
+	// 'drum' is set for the percussion channel.
+	virtual const SynthRegion* FindRegion(uint8_t bankMsb, uint8_t bankLsb, uint8_t program, bool drum,
+		uint8_t note, uint8_t velocity) = 0;
+};
@@ -0,0 +1,62 @@
+#include "instrument_lru.h"
+
+#include <algorithm>
+#include <utility>
+
+InstrumentLru::InstrumentLru(size_t maxInstruments, uint32_t songsKept) :
+	capacity(maxInstruments),
+	keepSongs(std::max<uint32_t>(songsKept, 1)),
+	song(0),
+	hits(0),
+	misses(0),
+	evictions(0)
+{
+}
+
+void InstrumentLru::Clear() {
+	lastUse.clear();
+	song = 0;
+	hits = 0;
+	misses = 0;
+	evictions = 0;
+}
+
+void InstrumentLru::UseSong(const std::vector<uint32_t>& keys, std::vector<uint32_t>& missing) {
+	missing.clear();
+	song++;
+	for (size_t i = 0; i < keys.size(); i++) {
+		std::map<uint32_t, uint32_t>::iterator it = lastUse.find(keys[i]);
+		if (it == lastUse.end()) {
+			lastUse[keys[i]] = song;
+			missing.push_back(keys[i]);
+			misses++;
+		}
+		else if (it->second != song) {
+			it->second = song;
+			hits++;
+		}
+	}
+}
+
+void InstrumentLru::Trim(std::vector<uint32_t>& evicted) {
+	evicted.clear();
+	if (lastUse.size() <= capacity) {
+		return;
+	}
+
+	// Songs after 'oldest' are kept.
+	uint32_t oldest = (song > keepSongs) ? song - keepSongs : 0;
+	std::vector<std::pair<uint32_t, uint32_t> > candidates; // (last song, key)
+	for (std::map<uint32_t, uint32_t>::const_iterator it = lastUse.begin(); it != lastUse.end(); ++it) {
+		if (it->second <= oldest) {
+			candidates.push_back(std::make_pair(it->second, it->first));
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	for (size_t i = 0; (i < candidates.size()) && (lastUse.size() > capacity); i++) {
+		lastUse.erase(candidates[i].second);
+		evicted.push_back(candidates[i].second);
+		evictions++;
+	}
+}
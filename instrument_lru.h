@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/*
+
+Resident set of instruments across the songs of a playlist.
+
+Songs are counted as they are prepared. UseSong() records the instruments of
+the next song and names those which are not resident yet, for the caller to
+load. Trim() then names the least recently used instruments to release while
+more than the capacity are resident. The instruments of the last songs, e.g.
+the one which just ended, the one playing and the next one, are never
+released, so notes which are still ringing keep their samples; the set can
+grow above the capacity when these songs use more instruments together.
+
+Keys are opaque, e.g. the DlsInstrumentKey of the instrument which plays.
+
+*/
+
+class InstrumentLru {
+public:
+	InstrumentLru(size_t maxInstruments, uint32_t songsKept);
+
+	void Clear();
+
+	// Starts the next song. 'missing' receives the keys which are not resident.
+	void UseSong(const std::vector<uint32_t>& keys, std::vector<uint32_t>& missing);
+
+	// Keys to release, least recently used first; they are no longer resident.
+	void Trim(std::vector<uint32_t>& evicted);
+
+	bool IsResident(uint32_t key) const { return lastUse.count(key) != 0; }
+	size_t ResidentCount() const { return lastUse.size(); }
+	size_t Capacity() const { return capacity; }
+
+	uint64_t Hits() const { return hits; }        // Instruments a song found resident.
+	uint64_t Misses() const { return misses; }    // Instruments which had to be loaded.
+	uint64_t Evictions() const { return evictions; }
+
+private:
+	std::map<uint32_t, uint32_t> lastUse; // Resident key -> last song which used it.
+	size_t capacity;
+	uint32_t keepSongs;
+	uint32_t song;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+// Instruments kept resident by default: a General MIDI song rarely uses more than 32.
+const size_t INSTRUMENT_LRU_DEFAULT_CAPACITY = 64;
+
+// The song which just ended, the one playing and the next one.
+const uint32_t INSTRUMENT_LRU_KEEP_SONGS = 3;
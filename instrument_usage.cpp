@@ -0,0 +1,89 @@
+#include "instrument_usage.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "dls_bank.h"
+
+namespace {
+
+struct CompareUsageKey {
+	bool operator()(const InstrumentUsage& a, uint32_t key) const { return a.key < key; }
+};
+
+}
+
+void ScanInstrumentUsage(const Timeline& song, std::vector<InstrumentUsage>& usage) {
+	usage.clear();
+	uint8_t bankMsb[16] = {};
+	uint8_t bankLsb[16] = {};
+	uint8_t program[16] = {};
+	// Instrument of every channel, as an index into usage; re-resolved after bank and program changes.
+	int current[16];
+	for (int ch = 0; ch < 16; ch++) {
+		current[ch] = -1;
+	}
+
+	for (size_t i = 0; i < song.EventCount(); i++) {
+		const TimelineEvent& e = song.Event(i);
+		uint8_t ch = e.status & 0x0F;
+		switch (e.status & 0xF0) {
+		case 0xB0:
+			if (e.data1 == 0) {
+				bankMsb[ch] = e.data2;
+				current[ch] = -1;
+			}
+			else if (e.data1 == 32) {
+				bankLsb[ch] = e.data2;
+				current[ch] = -1;
+			}
+			break;
+		case 0xC0:
+			program[ch] = e.data1;
+			current[ch] = -1;
+			break;
+		case 0x90:
+			if ((e.data2 > 0) && (e.data1 < 128)) {
+				if (current[ch] < 0) {
+					uint32_t key = DlsInstrumentKey(bankMsb[ch], bankLsb[ch], program[ch], (ch == 9) || (bankMsb[ch] == 127));
+					std::vector<InstrumentUsage>::iterator it = std::lower_bound(usage.begin(), usage.end(), key, CompareUsageKey());
+					if ((it == usage.end()) || (it->key != key)) {
+						InstrumentUsage u;
+						memset(&u, 0, sizeof(u));
+						u.key = key;
+						it = usage.insert(it, u);
+						// Indices behind the new entry moved up.
+						for (int c = 0; c < 16; c++) {
+							if (current[c] >= int(it - usage.begin())) {
+								current[c]++;
+							}
+						}
+					}
+					current[ch] = int(it - usage.begin());
+				}
+				InstrumentUsage& u = usage[current[ch]];
+				u.notes[e.data1 >> 5] |= 1u << (e.data1 & 31);
+				u.noteOns++;
+			}
+			break;
+		}
+	}
+}
+
+void PlayedNoteRanges(const uint32_t notes[4], std::vector<NoteRange>& ranges) {
+	ranges.clear();
+	int note = 0;
+	while (note < 128) {
+		if (!((notes[note >> 5] >> (note & 31)) & 1)) {
+			note++;
+			continue;
+		}
+		NoteRange r;
+		r.low = uint8_t(note);
+		while ((note < 128) && ((notes[note >> 5] >> (note & 31)) & 1)) {
+			note++;
+		}
+		r.high = uint8_t(note - 1);
+		ranges.push_back(r);
+	}
+}
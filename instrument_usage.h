@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "timeline.h"
+
+/*
+
+Instruments a song plays.
+
+The timeline is scanned once, following the bank select and program change
+state of every channel. Each note-on with a velocity marks its note in the
+instrument the channel plays at that moment. Channel 10 and bank 127 play drum
+kits, as in the synthesizer. Only these instruments need to be loaded before
+the song starts, and of a drum kit, whose regions are one sound per note, only
+the regions of the notes played.
+
+*/
+
+struct InstrumentUsage {
+	uint32_t key;       // DlsInstrumentKey of the bank and program the song asks for.
+	uint32_t notes[4];  // Bit n: note n is played.
+	uint32_t noteOns;
+
+	bool IsDrum() const { return (key & 0x01000000) != 0; }
+	bool PlaysNote(uint8_t note) const { return (notes[note >> 5] >> (note & 31)) & 1; }
+};
+
+// Contiguous range of played notes.
+struct NoteRange {
+	uint8_t low;
+	uint8_t high;
+};
+
+// Instruments which play at least one note, sorted by key.
+void ScanInstrumentUsage(const Timeline& song, std::vector<InstrumentUsage>& usage);
+
+// Ranges of the notes set in a note mask, lowest first.
+void PlayedNoteRanges(const uint32_t notes[4], std::vector<NoteRange>& ranges);
@@ -0,0 +1,59 @@
+#include "latency_recorder.h"
+
+#include <algorithm>
+
+LatencyRecorder::LatencyRecorder(size_t capacity) : samples(capacity > 0 ? capacity : 1) {
+	Clear();
+}
+
+void LatencyRecorder::Clear() {
+	used = 0;
+	count = 0;
+	minNs = 0;
+	maxNs = 0;
+	totalNs = 0.0;
+}
+
+void LatencyRecorder::Record(int64_t ns) {
+	if ((count == 0) || (ns < minNs)) {
+		minNs = ns;
+	}
+	if ((count == 0) || (ns > maxNs)) {
+		maxNs = ns;
+	}
+	count++;
+	totalNs += double(ns);
+	if (used < samples.size()) {
+		samples[used++] = ns;
+	}
+}
+
+// Nearest-rank percentile of sorted samples.
+static int64_t Percentile(const std::vector<int64_t>& sorted, double percent) {
+	size_t rank = size_t(percent / 100.0 * double(sorted.size()) + 0.999999);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > sorted.size()) {
+		rank = sorted.size();
+	}
+	return sorted[rank - 1];
+}
+
+LatencySummary LatencyRecorder::Summary() const {
+	LatencySummary s;
+	s.count = count;
+	s.minNs = minNs;
+	s.maxNs = maxNs;
+	s.meanNs = count ? totalNs / double(count) : 0.0;
+	s.unsampled = count - used;
+	s.p50Ns = 0;
+	s.p99Ns = 0;
+	if (used > 0) {
+		std::vector<int64_t> sorted(samples.begin(), samples.begin() + used);
+		std::sort(sorted.begin(), sorted.end());
+		s.p50Ns = Percentile(sorted, 50.0);
+		s.p99Ns = Percentile(sorted, 99.0);
+	}
+	return s;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct LatencySummary {
+	uint64_t count;
+	int64_t minNs;
+	int64_t p50Ns;
+	int64_t p99Ns;
+	int64_t maxNs;
+	double meanNs;
+	uint64_t unsampled; // Latencies counted in the minimum, maximum and mean only, the sample buffer being full.
+};
+
+// Collects latencies of one thread into a buffer allocated up front, so that
+// recording never allocates or locks. Percentiles are computed afterwards.
+class LatencyRecorder {
+public:
+	explicit LatencyRecorder(size_t capacity);
+
+	// Writer thread.
+	void Record(int64_t ns);
+
+	// Only when the writer is not recording.
+	LatencySummary Summary() const;
+	void Clear();
+
+	uint64_t Count() const { return count; }
+
+private:
+	std::vector<int64_t> samples;
+	size_t used;
+	uint64_t count;
+	int64_t minNs;
+	int64_t maxNs;
+	double totalNs;
+};
@@ -0,0 +1,181 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : data(nullptr), size(0)
+#ifdef _WIN32
+	, hFile(INVALID_HANDLE_VALUE), hMapping(NULL)
+#else
+	, fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+// Whole aligned blocks inside [offset, offset + length) of the mapping, false if there are none.
+static bool EvictRange(size_t mappingSize, size_t& offset, size_t& length) {
+	if ((offset >= mappingSize) || (length > mappingSize - offset)) {
+		return false;
+	}
+	size_t first = (offset + MAPPED_FILE_EVICT_ALIGN - 1) / MAPPED_FILE_EVICT_ALIGN * MAPPED_FILE_EVICT_ALIGN;
+	size_t last = (offset + length) / MAPPED_FILE_EVICT_ALIGN * MAPPED_FILE_EVICT_ALIGN;
+	if (last <= first) {
+		return false;
+	}
+	offset = first;
+	length = last - first;
+	return true;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t length) const {
+	if (!data || (offset >= size)) {
+		return;
+	}
+	if (length > size - offset) {
+		length = size - offset;
+	}
+	const volatile uint8_t* p = data + offset;
+	uint8_t sum = 0;
+	for (size_t pos = 0; pos < length; pos += MAPPED_FILE_PAGE_SIZE) {
+		sum += p[pos];
+	}
+	if (length > 0) {
+		sum += p[length - 1];
+	}
+	(void)sum;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path, std::string& err) {
+	Close();
+
+	hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		err = "can not open file: " + path;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(hFile, &fileSize)) {
+		err = "can not get file size: " + path;
+		Close();
+		return false;
+	}
+	if (fileSize.QuadPart == 0) {
+		err = "file is empty: " + path;
+		Close();
+		return false;
+	}
+	if (uint64_t(fileSize.QuadPart) > uint64_t(SIZE_MAX)) {
+		err = "file is too large: " + path;
+		Close();
+		return false;
+	}
+
+	hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL) {
+		err = "can not create file mapping: " + path;
+		Close();
+		return false;
+	}
+
+	data = (const uint8_t*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		err = "can not map file: " + path;
+		Close();
+		return false;
+	}
+
+	size = size_t(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data) {
+		UnmapViewOfFile(data);
+		data = nullptr;
+	}
+	if (hMapping) {
+		CloseHandle(hMapping);
+		hMapping = NULL;
+	}
+	if (hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
+
+void MappedFile::Evict(size_t offset, size_t length) {
+	if (data && EvictRange(size, offset, length)) {
+		// Unlocking pages which are not locked removes them from the working set.
+		VirtualUnlock((LPVOID)(data + offset), length);
+	}
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path, std::string& err) {
+	Close();
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		err = "can not open file: " + path;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		err = "can not get file size: " + path;
+		Close();
+		return false;
+	}
+	if (st.st_size == 0) {
+		err = "file is empty: " + path;
+		Close();
+		return false;
+	}
+
+	void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		err = "can not map file: " + path;
+		Close();
+		return false;
+	}
+
+	data = (const uint8_t*)p;
+	size = size_t(st.st_size);
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data) {
+		munmap((void*)data, size);
+		data = nullptr;
+	}
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+	size = 0;
+}
+
+void MappedFile::Evict(size_t offset, size_t length) {
+	if (data && EvictRange(size, offset, length)) {
+		madvise((void*)(data + offset), length, MADV_DONTNEED);
+	}
+}
+
+#endif
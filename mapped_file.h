@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+// Pointers returned by Data() stay valid until Close() is called or the object is destroyed.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string& path, std::string& err);
+	void Close();
+
+	bool IsOpen() const { return data != nullptr; }
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+	// Hints that the range will not be read again soon: its pages leave the resident
+	// set and are read from the file again if touched. Only whole pages inside the
+	// range are evicted, the data stays valid.
+	void Evict(size_t offset, size_t length);
+
+	// Reads one byte of every page in the range, so that the pages are resident
+	// before they are needed, e.g. by the audio thread.
+	void Prefetch(size_t offset, size_t length) const;
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const uint8_t* data;
+	size_t size;
+
+#ifdef _WIN32
+	void* hFile;
+	void* hMapping;
+#else
+	int fd;
+#endif
+};
+
+// Alignment of evicted ranges, a multiple of the page size on all supported systems.
+const size_t MAPPED_FILE_EVICT_ALIGN = 64 * 1024;
+
+// Distance between the bytes read by Prefetch(), the smallest page size of the supported systems.
+const size_t MAPPED_FILE_PAGE_SIZE = 4096;
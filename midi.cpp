@@ -8,13 +8,48 @@ WinMM library is able to play MIDI files only on external software and hardware
 
 */
 
+#include <cctype>
 #include <comdef.h>
 #include <dmusici.h>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <vector>
 #include <string>
 #include <mmsystem.h> // Link with winmm.lib
+#include <memory>
 #include <sstream>
+#include <thread>
+
+#include "bank_snapshot.h"
+#include "batch_renderer.h"
+#include "builtin_bank.h"
+#include "device_registry.h"
+#include "device_watcher.h"
+#include "dls_bank.h"
+#include "daemon_pipe.h"
+#include "dmusic_sink.h"
+#include "dsound_audio_device.h"
+#include "hires_clock.h"
+#include "instrument_lru.h"
+#include "instrument_usage.h"
+#include "midi_thru.h"
+#include "offline_renderer.h"
+#include "output_optimizer.h"
+#include "pcm_file_writer.h"
+#include "player_daemon.h"
+#include "playlist_player.h"
+#include "process_stats.h"
+#include "realtime_synth.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "smf_file_sink.h"
+#include "smf_stream.h"
+#include "song_cache.h"
+#include "timeline.h"
+#include "winmm_input.h"
+#include "winmm_sink.h"
 
 #define APP_NAME "Simple MIDI Player"
 #define APP_VER "1.0.2"
@@ -24,6 +59,9 @@ const WCHAR* WINDOWS_NT_DLL = L"ntdll.dll";
 const WCHAR* WINMM_DLL = L"winmm.dll";
 const WCHAR* DLS_FILE_NONE = L"-";
 
+// Device cache in the temporary directory, so that a player started for every song does not enumerate every time.
+const char DEVICE_CACHE_FILE[] = "SimpleMidiPlayer.devices";
+
 // Global pointers for DirectMusic interfaces
 IDirectMusicPerformance8* pPerformance = NULL;
 IDirectMusic8* pDirectMusic = NULL;
@@ -34,23 +72,47 @@ IDirectMusicLoader8* pLoader = NULL;
 IDirectMusicCollection8* pDLSCollection = NULL;
 IDirectMusicSegment8* pSegment = NULL;
 IDirectMusicPort8* pPort = NULL;
+IDirectMusicPort8* pDownloadPort = NULL; // pPort, or the synthesizer port of the default audio path.
 IDirectSoundBuffer* pDSBuffer = nullptr;
 BOOL isExternalSynth = FALSE;
 BOOL isSoftwareSynth = FALSE;
 
-// WinMM variables.
-std::vector<tagMIDIOUTCAPSA> midiOutDevices;
+// DirectSound devices, DirectMusic ports and WinMM MIDI outputs, enumerated once and cached across runs.
+DeviceRegistry devices;
+bool deviceCacheOpened = false;
+uint64_t deviceFingerprint = 0;
 
-struct DSDeviceData {
-	LPGUID guid;
-	std::string name;
-};
-std::vector<DSDeviceData> dsDeviceData;
+// Marks the cached devices stale when one arrives or is removed.
+DeviceChangeWatcher deviceWatcher;
+
+// Copy of the GUID of the selected DirectSound device.
+GUID dsDeviceGuid;
+
+// Versions of system libraries by file name, read when they are first printed.
+std::map<std::wstring, std::wstring> libraryVersions;
 
-struct MidiDeviceData {
-	std::string name;
+// Parsed MIDI file. In DS mode the segment is loaded from this mapping, so it must outlive the loader.
+SmfFile midiFile;
+Timeline timeline;
+
+// Up-to-date song cache of the MIDI file. The timeline is attached to its mapping when it is used.
+SongCache songCache;
+
+// DLS file mapped into memory. The DirectMusic collection is created from the same image.
+DlsBank dlsBank;
+
+// Instrument downloaded to the DirectMusic port. Drum kits are downloaded with the regions of the notes played only.
+struct PortInstrument {
+	IDirectMusicDownloadedInstrument* downloaded; // NULL if the download failed.
+	uint32_t notes[4];                            // Bit n: the region of note n is downloaded; all set for melodic instruments.
+	uint32_t noteRanges;
 };
-std::vector<MidiDeviceData> midiDeviceData;
+
+// Instruments downloaded to the DirectMusic port by DlsInstrumentKey of the DLS instrument.
+std::map<uint32_t, PortInstrument> portInstruments;
+
+// Instruments kept resident across the songs of a playlist.
+InstrumentLru residentInstruments(INSTRUMENT_LRU_DEFAULT_CAPACITY, INSTRUMENT_LRU_KEEP_SONGS);
 
 std::string convertWCharToStdStringWinAPI(const WCHAR* wideString) {
 	int bufferSize = WideCharToMultiByte(CP_UTF8, 0, wideString, -1, nullptr, 0, nullptr, nullptr);
@@ -64,6 +126,18 @@ std::string convertWCharToStdStringWinAPI(const WCHAR* wideString) {
 	return result;
 }
 
+// Command line arguments come in the ANSI code page.
+std::wstring convertAnsiToWStringWinAPI(const char* ansiString) {
+	int bufferSize = MultiByteToWideChar(CP_ACP, 0, ansiString, -1, nullptr, 0);
+	if (bufferSize == 0) {
+		return std::wstring();
+	}
+
+	std::wstring result(bufferSize - 1, L'\0'); // -1 to exclude null terminator in size
+	MultiByteToWideChar(CP_ACP, 0, ansiString, -1, &result[0], bufferSize);
+	return result;
+}
+
 void ShutdownDirectMusic()
 {
 	if (pSegment)
@@ -76,6 +150,18 @@ void ShutdownDirectMusic()
 		pDSBuffer->Release();
 		pDSBuffer = NULL;
 	}
+	if (pDownloadPort) {
+		for (std::map<uint32_t, PortInstrument>::iterator it = portInstruments.begin(); it != portInstruments.end(); ++it) {
+			if (it->second.downloaded) {
+				pDownloadPort->UnloadInstrument(it->second.downloaded);
+				it->second.downloaded->Release();
+			}
+		}
+		pDownloadPort->Release();
+		pDownloadPort = NULL;
+	}
+	portInstruments.clear();
+	residentInstruments.Clear();
 	if (pPort) {
 		pPort->Release();
 		pPort = NULL;
@@ -90,6 +176,10 @@ void ShutdownDirectMusic()
 		pLoader->Release();
 		pLoader = NULL;
 	}
+	timeline.Clear();
+	songCache.Close();
+	midiFile.Clear();
+	dlsBank.Clear();
 	if (pDirectSound) {
 		pDirectSound->Release();
 		pDirectSound = NULL;
@@ -107,75 +197,199 @@ void ShutdownDirectMusic()
 	CoUninitialize();
 }
 
-void EnumeratePorts() {
-	DMUS_PORTCAPS portCaps;
-	DWORD dwIndex = 0;
-	HRESULT hr;
-	MidiDeviceData dd;
+BOOL CALLBACK DSEnumProc(LPGUID lpGUID, LPCTSTR lpszDesc, LPCTSTR lpszDrvName, LPVOID lpContext)
+{
+	DeviceEntry dd;
+	dd.name = std::string(lpszDesc);
 
-	std::cout << "Available DirectMusic Ports:" << std::endl;
+	if (lpGUID != NULL)  //  NULL only for "Primary Sound Driver".
+	{
+		// The GUID is only valid during the callback, the entry keeps a copy.
+		dd.hasGuid = true;
+		dd.guid.assign((const char*)lpGUID, sizeof(GUID));
+	}
+
+	((std::vector<DeviceEntry>*)lpContext)->push_back(dd);
+	return TRUE;
+}
+
+std::string DeviceCachePath() {
+	char tempPath[MAX_PATH];
+	DWORD length = GetTempPathA(MAX_PATH, tempPath);
+	if ((length == 0) || (length > MAX_PATH)) {
+		return "";
+	}
+	return std::string(tempPath) + DEVICE_CACHE_FILE;
+}
 
-	while (true) {
-		// Initialize the size of the structure before calling the method
-		portCaps.dwSize = sizeof(DMUS_PORTCAPS);
+// Enumerates the WinMM MIDI outputs, which is cheap, and returns a fingerprint of them and of the wave outputs.
+// DirectSound devices and DirectMusic ports are built on these, so the fingerprint changes with them.
+uint64_t RefreshWinmmDevices() {
+	std::vector<DeviceEntry> found;
+	uint64_t hash = DEVICE_HASH_SEED;
+
+	UINT midiOutDevCount = midiOutGetNumDevs();
+	for (UINT i = 0; i < midiOutDevCount; i++) {
+		MIDIOUTCAPSA caps;
+		ZeroMemory(&caps, sizeof(caps));
+		midiOutGetDevCapsA(i, &caps, sizeof(caps));
+		hash = HashDeviceData(hash, &caps, sizeof(caps));
+
+		DeviceEntry dd;
+		dd.name = caps.szPname;
+		dd.caps.assign((const uint8_t*)&caps, (const uint8_t*)&caps + sizeof(caps));
+		found.push_back(dd);
+	}
 
-		// Enumerate the next port
-		hr = pDirectMusic->EnumPort(dwIndex, &portCaps);
+	UINT waveOutDevCount = waveOutGetNumDevs();
+	for (UINT i = 0; i < waveOutDevCount; i++) {
+		WAVEOUTCAPSA caps;
+		ZeroMemory(&caps, sizeof(caps));
+		waveOutGetDevCapsA(i, &caps, sizeof(caps));
+		hash = HashDeviceData(hash, &caps, sizeof(caps));
+	}
 
-		if (hr == S_OK) {
-			dd.name = convertWCharToStdStringWinAPI(portCaps.wszDescription);
-			midiDeviceData.push_back(dd);
+	devices.Update(DEVICE_MIDI_OUTPUT, found);
+	return hash;
+}
 
-			std::wcout << L"[" << dwIndex << L"] " << portCaps.wszDescription << std::endl;
+void WatchDevices() {
+	std::string cachePath = DeviceCachePath();
+	std::string err;
+	bool started = deviceWatcher.Start([cachePath]() {
+		// Enumerated again when next needed, also by the next run.
+		devices.Invalidate();
+		if (!cachePath.empty()) {
+			remove(cachePath.c_str());
+		}
+	}, err);
+	if (!started) {
+		std::cerr << "Device changes are not watched: " << err << std::endl;
+	}
+}
 
-			dwIndex++;
+// Enumerates a kind of device unless the registry holds a current list.
+// DirectMusic ports can only be enumerated once pDirectMusic exists.
+void EnsureDevices(DeviceKind kind) {
+	std::string err;
+	if (!deviceCacheOpened) {
+		deviceCacheOpened = true;
+		deviceFingerprint = RefreshWinmmDevices();
+		devices.Load(DeviceCachePath(), deviceFingerprint, err);
+		WatchDevices();
+	}
+	if (devices.IsCurrent(kind)) {
+		return;
+	}
+	if (!devices.IsCurrent(DEVICE_MIDI_OUTPUT)) {
+		deviceFingerprint = RefreshWinmmDevices();
+		if (kind == DEVICE_MIDI_OUTPUT) {
+			return;
 		}
-		else if (hr == S_FALSE) {
-			// No more ports are available; end the loop
-			break;
+	}
+
+	std::vector<DeviceEntry> found;
+	if (kind == DEVICE_AUDIO_OUTPUT) {
+		HRESULT hr = DirectSoundEnumerate((LPDSENUMCALLBACK)DSEnumProc, &found);
+		if (FAILED(hr)) {
+			std::cerr << "Error during DirectSound device enumeration: " << hr << std::endl;
+			return;
 		}
-		else {
-			// An error occurred
-			std::cerr << "Error during port enumeration: " << hr << std::endl;
-			break;
+	}
+	else if (kind == DEVICE_MUSIC_PORT) {
+		if (!pDirectMusic) {
+			return;
+		}
+		DMUS_PORTCAPS portCaps;
+		for (DWORD dwIndex = 0; ; dwIndex++) {
+			// Initialize the size of the structure before calling the method
+			portCaps.dwSize = sizeof(DMUS_PORTCAPS);
+			HRESULT hr = pDirectMusic->EnumPort(dwIndex, &portCaps);
+			if (hr == S_FALSE) {
+				// No more ports are available
+				break;
+			}
+			if (hr != S_OK) {
+				std::cerr << "Error during port enumeration: " << hr << std::endl;
+				return;
+			}
+			DeviceEntry dd;
+			dd.name = convertWCharToStdStringWinAPI(portCaps.wszDescription);
+			dd.hasGuid = true;
+			dd.guid.assign((const char*)&portCaps.guidPort, sizeof(GUID));
+			dd.caps.assign((const uint8_t*)&portCaps, (const uint8_t*)&portCaps + sizeof(portCaps));
+			found.push_back(dd);
 		}
 	}
+
+	bool refresh = devices.Count(kind) > 0;
+	DeviceUpdate u = devices.Update(kind, found);
+	if (refresh && ((u.added > 0) || (u.removed > 0))) {
+		std::cout << "Devices changed: " << u.kept << " kept, " << u.added << " added, " << u.removed << " removed" << std::endl;
+	}
+	if (!devices.Save(DeviceCachePath(), deviceFingerprint, err)) {
+		std::cerr << "Failed to write device cache: " << err << std::endl;
+	}
 }
 
-BOOL CALLBACK DSEnumProc(LPGUID lpGUID, LPCTSTR lpszDesc, LPCTSTR lpszDrvName, LPVOID lpContext)
-{
-	LPGUID lpTemp = NULL;
+std::string GuidToString(const DeviceEntry& dd) {
+	if (!dd.hasGuid) {
+		return "default";
+	}
+	GUID guid;
+	memcpy(&guid, dd.guid.data(), sizeof(guid));
+	char text[64];
+	sprintf_s(text, "{%08lX-%04hX-%04hX-%02X%02X-%02X%02X%02X%02X%02X%02X}", guid.Data1, guid.Data2, guid.Data3,
+		guid.Data4[0], guid.Data4[1], guid.Data4[2], guid.Data4[3], guid.Data4[4], guid.Data4[5], guid.Data4[6], guid.Data4[7]);
+	return text;
+}
 
-	if (lpGUID != NULL)  //  NULL only for "Primary Sound Driver".
-	{
-		if ((lpTemp = (LPGUID)malloc(sizeof(GUID))) == NULL)
-		{
-			return(TRUE);
+// Device given on the command line by index, name or GUID. -1, the default device, if there is no such device.
+int ResolveDeviceIndex(DeviceKind kind, const char* arg) {
+	std::string s = arg;
+	if (s.empty() || (s.find_first_not_of("-0123456789") == std::string::npos)) {
+		return std::atoi(arg);
+	}
+
+	EnsureDevices(kind);
+	int idx = devices.FindByName(kind, s);
+	if ((idx < 0) && (s[0] == '{')) {
+		std::wstring text(s.begin(), s.end());
+		GUID guid;
+		if (SUCCEEDED(CLSIDFromString(const_cast<LPOLESTR>(text.c_str()), &guid))) {
+			idx = devices.FindByGuid(kind, &guid);
 		}
-		memcpy(lpTemp, lpGUID, sizeof(GUID));
 	}
+	if (idx < 0) {
+		std::cerr << "Device is not found: " << s << ", using the default device" << std::endl;
+	}
+	return idx;
+}
 
-	//std::cout << lpGUID << " " << lpszDesc << " " << lpszDrvName << std::endl; //DEBUG.
-	DSDeviceData dd;
-	dd.guid = lpGUID;
-	dd.name = std::string(lpszDesc);
-	dsDeviceData.push_back(dd);
+std::string DeviceName(DeviceKind kind, int idx) {
+	const DeviceEntry* dd = devices.Get(kind, idx);
+	return dd ? dd->name : std::string();
+}
 
-	free(lpTemp);
-	return TRUE;
+void EnumeratePorts() {
+	EnsureDevices(DEVICE_MUSIC_PORT);
+
+	std::cout << "Available DirectMusic Ports:" << std::endl;
+	for (size_t i = 0; i < devices.Count(DEVICE_MUSIC_PORT); ++i) {
+		std::cout << "[" << i << "] " << devices.Get(DEVICE_MUSIC_PORT, int(i))->name << std::endl;
+	}
 }
 
 HRESULT EnumerateDirectSoundDevices() {
-	std::cout << "Available DirectSound Devices:" << std::endl;
-
-	HRESULT hr = DirectSoundEnumerate((LPDSENUMCALLBACK)DSEnumProc, NULL);
-	if (FAILED(hr)) return hr;
+	EnsureDevices(DEVICE_AUDIO_OUTPUT);
 
-	for (size_t i = 0; i < dsDeviceData.size(); ++i) {
-		std::cout << "[" << i << "] (" << dsDeviceData[i].guid << ") " << dsDeviceData[i].name << std::endl;
+	std::cout << "Available DirectSound Devices:" << std::endl;
+	for (size_t i = 0; i < devices.Count(DEVICE_AUDIO_OUTPUT); ++i) {
+		const DeviceEntry* dd = devices.Get(DEVICE_AUDIO_OUTPUT, int(i));
+		std::cout << "[" << i << "] (" << GuidToString(*dd) << ") " << dd->name << std::endl;
 	}
 
-	return S_OK;
+	return devices.IsCurrent(DEVICE_AUDIO_OUTPUT) ? S_OK : E_FAIL;
 }
 
 HRESULT CreateMusicPort(DMUS_PORTCAPS portCaps)
@@ -277,52 +491,241 @@ HRESULT CreateMusicPort(DMUS_PORTCAPS portCaps)
 }
 
 LPCGUID GetDeviceGuidByIndex(int index) {
-	if (index < 0) {
+	const DeviceEntry* dd = devices.Get(DEVICE_AUDIO_OUTPUT, index);
+	if (!dd || !dd->hasGuid) {
 		return NULL;
 	}
 
-	if (index < int(dsDeviceData.size())) {
-		return dsDeviceData[index].guid;
-	}
-
-	return NULL;
+	memcpy(&dsDeviceGuid, dd->guid.data(), sizeof(dsDeviceGuid));
+	return &dsDeviceGuid;
 }
 
 DMUS_PORTCAPS GetPortCapsByIndex(int idx) {
-	DMUS_PORTCAPS emptyPortCaps = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL };
 	DMUS_PORTCAPS portCaps;
-	DWORD dwIndex = 0;
-	HRESULT hr;
+	ZeroMemory(&portCaps, sizeof(portCaps));
+
+	EnsureDevices(DEVICE_MUSIC_PORT);
+	const DeviceEntry* dd = devices.Get(DEVICE_MUSIC_PORT, idx);
+	if (!dd || (dd->caps.size() != sizeof(DMUS_PORTCAPS))) {
+		std::cerr << "Device [" << idx << "] is not found" << std::endl;
+		return portCaps;
+	}
+
+	memcpy(&portCaps, &dd->caps[0], sizeof(portCaps));
+	return portCaps;
+}
+
+void PrintDlsStats(const char* title) {
+	DlsBankStats stats = dlsBank.Stats();
+	std::cout << title << ": " << stats.loadedInstruments << " of " << stats.instruments << " instruments, " <<
+		stats.regions << " regions, " << stats.loadedWaves << " of " << stats.waves << " waves, " <<
+		stats.waveBytes / 1024 << " KB of wave data in place, " << stats.convertedBytes / 1024 << " KB converted" << std::endl;
+}
+
+bool LoadDlsFile(const char* dls_file) {
+	std::string err;
+	uint64_t rssBefore = ProcessResidentBytes();
+	int64_t startUs = NowMicros();
+	if (!dlsBank.Load(dls_file, err)) {
+		std::cerr << "Failed to load DLS file: " << err << std::endl;
+		return false;
+	}
+	int64_t loadUs = NowMicros() - startUs;
+	uint64_t rssAfter = ProcessResidentBytes();
+
+	std::cout << "DLS file: " << dlsBank.ImageSize() / 1024 << " KB, " << dlsBank.InstrumentCount() << " instruments" << std::endl;
+	std::cout << "DLS index time: " << loadUs << " us" << (dlsBank.FromSnapshot() ? " from the snapshot" : "") <<
+		", resident memory: " << rssAfter / 1024 << " KB (+" << (rssAfter > rssBefore ? rssAfter - rssBefore : 0) / 1024 << " KB)" << std::endl;
+	return true;
+}
+
+// Instruments the song plays, by DlsInstrumentKey of the DLS instrument which plays them after the bank fallback,
+// with the notes played on them.
+std::map<uint32_t, InstrumentUsage> ResolveSongInstruments(const Timeline& song) {
+	std::vector<InstrumentUsage> usage;
+	ScanInstrumentUsage(song, usage);
+
+	std::map<uint32_t, InstrumentUsage> resolved;
+	for (size_t i = 0; i < usage.size(); i++) {
+		const InstrumentUsage& u = usage[i];
+		int idx = dlsBank.ResolveInstrument(uint8_t(u.key >> 16), uint8_t(u.key >> 8), uint8_t(u.key), u.IsDrum());
+		if (idx < 0) {
+			continue;
+		}
+		uint32_t key = dlsBank.Instrument(size_t(idx)).key;
+		std::map<uint32_t, InstrumentUsage>::iterator it = resolved.find(key);
+		if (it == resolved.end()) {
+			it = resolved.insert(std::make_pair(key, u)).first;
+			it->second.key = key;
+			continue;
+		}
+		for (int n = 0; n < 4; n++) {
+			it->second.notes[n] |= u.notes[n];
+		}
+		it->second.noteOns += u.noteOns;
+	}
+	return resolved;
+}
+
+// Makes the DLS instruments the song plays resident, of drum kits the regions of the notes played.
+// Returns the number of instruments which were not resident.
+size_t LoadSongInstruments(const std::map<uint32_t, InstrumentUsage>& used) {
+	size_t count = 0;
+	for (std::map<uint32_t, InstrumentUsage>::const_iterator it = used.begin(); it != used.end(); ++it) {
+		int idx = dlsBank.FindInstrument(it->first);
+		if (idx < 0) {
+			continue;
+		}
+		if (!dlsBank.Instrument(size_t(idx)).resident) {
+			count++;
+		}
+		dlsBank.LoadInstrument(size_t(idx), it->second.IsDrum() ? it->second.notes : nullptr);
+	}
+	return count;
+}
+
+void UnloadPortInstrument(uint32_t key) {
+	std::map<uint32_t, PortInstrument>::iterator it = portInstruments.find(key);
+	if (it == portInstruments.end()) {
+		return;
+	}
+	if (it->second.downloaded) {
+		pDownloadPort->UnloadInstrument(it->second.downloaded);
+		it->second.downloaded->Release();
+	}
+	portInstruments.erase(it);
+}
+
+// Downloads the instruments the song plays which the DirectMusic port does not have yet, and the regions of
+// drum notes it has not been given yet. Returns the number of instruments downloaded.
+size_t DownloadPortInstruments(const std::map<uint32_t, InstrumentUsage>& used) {
+	if (!pDownloadPort || !pDLSCollection) {
+		return 0;
+	}
 
-	while (true) {
-		portCaps.dwSize = sizeof(DMUS_PORTCAPS);
-		hr = pDirectMusic->EnumPort(dwIndex, &portCaps);
+	size_t count = 0;
+	std::vector<NoteRange> ranges;
+	std::vector<DMUS_NOTERANGE> noteRanges;
+	for (std::map<uint32_t, InstrumentUsage>::const_iterator it = used.begin(); it != used.end(); ++it) {
+		const InstrumentUsage& u = it->second;
+		PortInstrument instrument;
+		memset(&instrument, 0, sizeof(instrument));
+		if (u.IsDrum()) {
+			memcpy(instrument.notes, u.notes, sizeof(instrument.notes));
+		}
+		else {
+			memset(instrument.notes, 0xFF, sizeof(instrument.notes));
+		}
 
-		if (hr == S_FALSE) {
-			// Device list is searched, but device is not found
-			std::cerr << "Device [" << idx << "] is not found" << std::endl;
-			return emptyPortCaps;
+		std::map<uint32_t, PortInstrument>::iterator have = portInstruments.find(it->first);
+		if (have != portInstruments.end()) {
+			bool missingNotes = false;
+			for (int n = 0; n < 4; n++) {
+				missingNotes = missingNotes || ((instrument.notes[n] & ~have->second.notes[n]) != 0);
+				instrument.notes[n] |= have->second.notes[n];
+			}
+			if (!missingNotes) {
+				continue;
+			}
+			// A drum kit with new notes is downloaded again with the regions of the old and the new ones.
+			UnloadPortInstrument(it->first);
 		}
 
-		if (hr != S_OK) {
-			// An error occurred
-			std::cerr << "Error during port enumeration: " << hr << std::endl;
-			return emptyPortCaps;
+		noteRanges.clear();
+		if (u.IsDrum()) {
+			PlayedNoteRanges(instrument.notes, ranges);
+			for (size_t i = 0; i < ranges.size(); i++) {
+				DMUS_NOTERANGE r;
+				r.dwLowNote = ranges[i].low;
+				r.dwHighNote = ranges[i].high;
+				noteRanges.push_back(r);
+			}
+		}
+		instrument.noteRanges = DWORD(noteRanges.size());
+
+		IDirectMusicInstrument* dmInstrument = NULL;
+		HRESULT hr = pDLSCollection->GetInstrument((it->first & 0x00FFFFFF) | (u.IsDrum() ? F_INSTRUMENT_DRUMS : 0), &dmInstrument);
+		if (SUCCEEDED(hr)) {
+			hr = pDownloadPort->DownloadInstrument(dmInstrument, &instrument.downloaded,
+				noteRanges.empty() ? NULL : &noteRanges[0], DWORD(noteRanges.size()));
+			dmInstrument->Release();
+		}
+		if (FAILED(hr)) {
+			instrument.downloaded = NULL;
+		}
+		else {
+			count++;
 		}
+		portInstruments[it->first] = instrument;
+	}
+	return count;
+}
 
-		if (dwIndex != idx)
-		{
-			dwIndex++;
+// Marks the instruments of the next song of a playlist as used and releases the least recently used ones
+// above the capacity of the resident set. Returns the number of released instruments.
+size_t TrimResidentInstruments(const std::map<uint32_t, InstrumentUsage>& used, bool port) {
+	std::vector<uint32_t> keys;
+	for (std::map<uint32_t, InstrumentUsage>::const_iterator it = used.begin(); it != used.end(); ++it) {
+		keys.push_back(it->first);
+	}
+	std::vector<uint32_t> missing;
+	std::vector<uint32_t> evicted;
+	residentInstruments.UseSong(keys, missing);
+	residentInstruments.Trim(evicted);
+	for (size_t i = 0; i < evicted.size(); i++) {
+		if (port) {
+			UnloadPortInstrument(evicted[i]);
+		}
+		else {
+			int idx = dlsBank.FindInstrument(evicted[i]);
+			if (idx >= 0) {
+				dlsBank.UnloadInstrument(size_t(idx));
+			}
+		}
+	}
+	return evicted.size();
+}
+
+void PrintPortStats(const char* title) {
+	size_t downloaded = 0, failed = 0, drumKits = 0, drumNotes = 0;
+	for (std::map<uint32_t, PortInstrument>::const_iterator it = portInstruments.begin(); it != portInstruments.end(); ++it) {
+		if (!it->second.downloaded) {
+			failed++;
 			continue;
 		}
+		downloaded++;
+		if (it->second.noteRanges > 0) {
+			drumKits++;
+			for (int note = 0; note < 128; note++) {
+				drumNotes += (it->second.notes[note >> 5] >> (note & 31)) & 1;
+			}
+		}
+	}
+	std::cout << title << ": " << downloaded << " of " << dlsBank.InstrumentCount() << " instruments, " << drumKits <<
+		" drum kits with " << drumNotes << " notes, " << failed << " failed" << std::endl;
+}
+
+void PrintResidentStats() {
+	std::cout << "Resident instruments: " << residentInstruments.ResidentCount() << " (capacity " << residentInstruments.Capacity() <<
+		"), " << residentInstruments.Hits() << " reused, " << residentInstruments.Misses() << " loaded, " <<
+		residentInstruments.Evictions() << " released" << std::endl;
+}
 
-		break;
+void PreloadDlsInstruments() {
+	if (dlsBank.InstrumentCount() == 0) {
+		return;
 	}
 
-	return portCaps;
+	int64_t startUs = NowMicros();
+	LoadSongInstruments(ResolveSongInstruments(timeline));
+	int64_t loadUs = NowMicros() - startUs;
+
+	PrintDlsStats("DLS instruments used by the song");
+	std::cout << "DLS instrument load time: " << loadUs << " us, resident memory: " << ProcessResidentBytes() / 1024 << " KB" << std::endl;
 }
 
-HRESULT Initialise(int ds_device_idx, int midi_output_device_idx, WCHAR* dls_file_w)
+// Devices are given by index, name or GUID.
+HRESULT Initialise(const char* ds_device_str, const char* midi_output_device_str, char* dls_file)
 {
 	HWND hWnd = GetConsoleWindow();
 	if (hWnd == NULL) {
@@ -356,13 +759,16 @@ HRESULT Initialise(int ds_device_idx, int midi_output_device_idx, WCHAR* dls_fil
 	EnumeratePorts();
 	std::cout << std::endl;
 
+	int ds_device_idx = ResolveDeviceIndex(DEVICE_AUDIO_OUTPUT, ds_device_str);
+	int midi_output_device_idx = ResolveDeviceIndex(DEVICE_MUSIC_PORT, midi_output_device_str);
+
 	// Create the DirectSound object
 	LPCGUID pcGuidDevice = GetDeviceGuidByIndex(ds_device_idx);
 	hr = DirectSoundCreate8(pcGuidDevice, &pDirectSound, NULL);
 	if (FAILED(hr)) return hr;
 
 	if (ds_device_idx >= 0) {
-		std::cout << "Using DirectSound device: " << dsDeviceData[ds_device_idx].name << std::endl;
+		std::cout << "Using DirectSound device: " << DeviceName(DEVICE_AUDIO_OUTPUT, ds_device_idx) << std::endl;
 	}
 
 	hr = pDirectSound->SetCooperativeLevel(hWnd, DSSCL_PRIORITY);
@@ -390,9 +796,18 @@ HRESULT Initialise(int ds_device_idx, int midi_output_device_idx, WCHAR* dls_fil
 	hr = pDirectMusic->SetDirectSound(pDirectSound, hWnd);
 	if (FAILED(hr)) return hr;
 
-	// Load DLS file.
-	if (wcscmp(dls_file_w, DLS_FILE_NONE) != 0) {
-		hr = pLoader->LoadObjectFromFile(CLSID_DirectMusicCollection, IID_IDirectMusicCollection8, dls_file_w, (void**)&pDLSCollection);
+	// Load DLS file. It is indexed natively and DirectMusic reads the collection from the same mapping.
+	if (convertWCharToStdStringWinAPI(DLS_FILE_NONE) != dls_file) {
+		if (!LoadDlsFile(dls_file)) return E_FAIL;
+
+		DMUS_OBJECTDESC objDesc;
+		ZeroMemory(&objDesc, sizeof(objDesc));
+		objDesc.dwSize = sizeof(DMUS_OBJECTDESC);
+		objDesc.dwValidData = DMUS_OBJ_CLASS | DMUS_OBJ_MEMORY;
+		objDesc.guidClass = CLSID_DirectMusicCollection;
+		objDesc.pbMemData = const_cast<BYTE*>(dlsBank.Image());
+		objDesc.llMemLength = LONGLONG(dlsBank.ImageSize());
+		hr = pLoader->GetObject(&objDesc, IID_IDirectMusicCollection8, (void**)&pDLSCollection);
 		if (FAILED(hr)) return hr;
 	}
 
@@ -407,12 +822,19 @@ HRESULT Initialise(int ds_device_idx, int midi_output_device_idx, WCHAR* dls_fil
 		DWORD dwFlags = DMUS_AUDIOF_ALL;
 		hr = pPerformance->InitAudio(&pDirectMusicG, &pDirectSoundG, hWnd, dwDefaultPathType, dwPChannelCount, dwFlags, NULL); // Not compatible with AddPort !
 		if (FAILED(hr)) return hr;
+
+		// Instruments are downloaded to the synthesizer which plays the default audio path.
+		IDirectMusicAudioPath* pAudioPath = NULL;
+		if (SUCCEEDED(pPerformance->GetDefaultAudioPath(&pAudioPath))) {
+			pAudioPath->GetObjectInPath(DMUS_PCHANNEL_ALL, DMUS_PATH_PORT, 0, GUID_All_Objects, 0, IID_IDirectMusicPort8, (void**)&pDownloadPort);
+			pAudioPath->Release();
+		}
 	}
 	else {
 		// Find an output device by its index
 		DMUS_PORTCAPS portCaps = GetPortCapsByIndex(midi_output_device_idx);
 
-		std::cout << "Using MIDI device: " << midiDeviceData[midi_output_device_idx].name << std::endl;
+		std::cout << "Using MIDI device: " << DeviceName(DEVICE_MUSIC_PORT, midi_output_device_idx) << std::endl;
 
 		// Create a port and activate it
 		hr = CreateMusicPort(portCaps);
@@ -431,6 +853,9 @@ HRESULT Initialise(int ds_device_idx, int midi_output_device_idx, WCHAR* dls_fil
 
 		hr = pPort->Activate(TRUE);
 		if (FAILED(hr)) return hr;
+
+		pDownloadPort = pPort;
+		pDownloadPort->AddRef();
 	}
 
 	return S_OK;
@@ -463,12 +888,87 @@ HRESULT ListDevices()
 	return S_OK;
 }
 
-HRESULT PlayMidi(WCHAR* midi_file_w, BOOL isExternalSynth)
+void PrintTimeline() {
+	std::cout << "Timeline: " << timeline.EventCount() << " events, " << timeline.TempoSegmentCount() << " tempo segments, " <<
+		"length " << timeline.LengthTicks() << " ticks, " << timeline.DurationUs() / 1000 << " ms" << std::endl;
+}
+
+// Parses the file and builds its timeline, leaving both empty on failure.
+bool ParseMidiFile(const char* midi_file, std::string& err) {
+	int64_t startUs = NowMicros();
+	if (!midiFile.Load(midi_file, err)) {
+		err = "failed to parse MIDI file: " + err;
+		return false;
+	}
+	int64_t parseUs = NowMicros() - startUs;
+
+	startUs = NowMicros();
+	if (!timeline.Build(midiFile, err)) {
+		err = "failed to build MIDI timeline: " + err;
+		midiFile.Clear();
+		return false;
+	}
+	int64_t mergeUs = NowMicros() - startUs;
+
+	std::cout << "MIDI file: format " << midiFile.Format() << ", " << midiFile.TrackCount() << " tracks, " <<
+		midiFile.EventCount() << " events, division " << midiFile.Division() << std::endl;
+	PrintTimeline();
+	std::cout << "Parse time: " << parseUs << " us, merge time: " << mergeUs << " us" << std::endl;
+	return true;
+}
+
+bool LoadMidiFile(const char* midi_file) {
+	std::string err;
+	if (!ParseMidiFile(midi_file, err)) {
+		std::cerr << "Failed to load MIDI file: " << err << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Modes which play from the timeline alone take it from the song cache when the cache is up to date.
+bool LoadSong(const char* midi_file) {
+	std::string err;
+	int64_t startUs = NowMicros();
+	if (!songCache.Open(midi_file, err)) {
+		std::cout << "Song cache not used: " << err << std::endl;
+		return LoadMidiFile(midi_file);
+	}
+	timeline.Attach(songCache.GetTimeline().Arrays());
+	int64_t openUs = NowMicros() - startUs;
+
+	const SongSummary& summary = songCache.Summary();
+	std::cout << "Song cache: " << SongCachePath(midi_file) << ", format " << summary.format << ", " <<
+		summary.trackCount << " tracks, " << summary.noteCount << " notes" << std::endl;
+	PrintTimeline();
+	std::cout << "Cache open time: " << openUs << " us" << std::endl;
+	return true;
+}
+
+HRESULT PlayMidi(char* midi_file, BOOL isExternalSynth)
 {
 	HRESULT hr;
 
-	// Load MIDI file.
-	hr = pLoader->LoadObjectFromFile(CLSID_DirectMusicSegment, IID_IDirectMusicSegment8, midi_file_w, (void**)&pSegment);
+	// Parse MIDI file. The DirectMusic loader is more forgiving, a file the parser rejects is still played.
+	std::string err;
+	bool parsed = ParseMidiFile(midi_file, err);
+	if (parsed) {
+		// Create the segment from the file image which is already mapped into memory.
+		DMUS_OBJECTDESC objDesc;
+		ZeroMemory(&objDesc, sizeof(objDesc));
+		objDesc.dwSize = sizeof(DMUS_OBJECTDESC);
+		objDesc.dwValidData = DMUS_OBJ_CLASS | DMUS_OBJ_MEMORY;
+		objDesc.guidClass = CLSID_DirectMusicSegment;
+		objDesc.pbMemData = const_cast<BYTE*>(midiFile.Image());
+		objDesc.llMemLength = LONGLONG(midiFile.ImageSize());
+		hr = pLoader->GetObject(&objDesc, IID_IDirectMusicSegment8, (void**)&pSegment);
+	}
+	else {
+		std::cerr << "Warning: " << err << ", the file is loaded by DirectMusic instead." << std::endl;
+		std::wstring midi_file_w = convertAnsiToWStringWinAPI(midi_file);
+		hr = pLoader->LoadObjectFromFile(CLSID_DirectMusicSegment, IID_IDirectMusicSegment8, const_cast<WCHAR*>(midi_file_w.c_str()),
+			(void**)&pSegment);
+	}
 	if (FAILED(hr)) return hr;
 	if (!pSegment) {
 		std::cerr << "Segment is not loaded";
@@ -477,8 +977,18 @@ HRESULT PlayMidi(WCHAR* midi_file_w, BOOL isExternalSynth)
 
 	if ((!isExternalSynth) && (!isSoftwareSynth)) {
 		// Download instrument data to the synth (DLS)
-		hr = pSegment->Download(pPerformance);
-		if (FAILED(hr)) return hr;
+		if (parsed && pDownloadPort && pDLSCollection) {
+			// Only the instruments the song plays, and of drum kits only the regions of the notes played.
+			int64_t startUs = NowMicros();
+			DownloadPortInstruments(ResolveSongInstruments(timeline));
+			int64_t downloadUs = NowMicros() - startUs;
+			PrintPortStats("DLS instruments downloaded for the song");
+			std::cout << "DLS instrument download time: " << downloadUs << " us" << std::endl;
+		}
+		else {
+			hr = pSegment->Download(pPerformance);
+			if (FAILED(hr)) return hr;
+		}
 	}
 
 	MUSIC_TIME segLenTicks;
@@ -595,26 +1105,42 @@ std::wstring GetLibraryVersion(WCHAR* dllFileName) {
 	return versionStr;
 }
 
+// Reads the version resource of a system library the first time it is asked for.
+const std::wstring& LibraryVersion(const WCHAR* dllFileName) {
+	std::map<std::wstring, std::wstring>::iterator it = libraryVersions.find(dllFileName);
+	if (it == libraryVersions.end()) {
+		it = libraryVersions.insert(std::make_pair(std::wstring(dllFileName), GetLibraryVersion(const_cast<WCHAR*>(dllFileName)))).first;
+	}
+	return it->second;
+}
+
+void PrintLibraryVersions() {
+	std::wcout << "DirectSound API:\t" << DIRECT_SOUND_DLL << " version: " << LibraryVersion(DIRECT_SOUND_DLL) << std::endl;
+	std::wcout << "WinMM:\t\t\t" << WINMM_DLL << " version: " << LibraryVersion(WINMM_DLL) << std::endl;
+	std::wcout << "Windows:\t\t" << WINDOWS_NT_DLL << " version: " << LibraryVersion(WINDOWS_NT_DLL) << std::endl;
+	std::cout << std::endl;
+}
+
 void ListMidiOutDevicesWithWinmm() {
 	std::cout << "Available MIDI Out Devices:" << std::endl;
 
-	int midiOutDevCount = midiOutGetNumDevs(); // Get count
-	for (int i = 0; i < midiOutDevCount; i++) {
+	EnsureDevices(DEVICE_MIDI_OUTPUT);
+	for (int i = 0; i < int(devices.Count(DEVICE_MIDI_OUTPUT)); i++) {
 		tagMIDIOUTCAPSA caps;
-		midiOutGetDevCapsA(i, &caps, sizeof(tagMIDIOUTCAPSA));
-		midiOutDevices.push_back(caps);
-	}
-
-	for (int i = 0; i < int(midiOutDevices.size()); i++) {
-		std::cout << "[" << i << "] (" << midiOutDevices[i].wPid << ") " <<
-			midiOutDevices[i].szPname <<
-			" Drv=" << midiOutDevices[i].vDriverVersion <<
-			" PID=" << midiOutDevices[i].wPid <<
-			" MID=" << midiOutDevices[i].wMid <<
-			" DevType=" << midiOutDevices[i].wTechnology <<
-			" Voices=" << midiOutDevices[i].wVoices <<
-			" ChanMask=" << midiOutDevices[i].wChannelMask <<
-			" Funcs=" << midiOutDevices[i].dwSupport <<
+		const DeviceEntry* dd = devices.Get(DEVICE_MIDI_OUTPUT, i);
+		if (dd->caps.size() != sizeof(caps)) {
+			continue;
+		}
+		memcpy(&caps, &dd->caps[0], sizeof(caps));
+		std::cout << "[" << i << "] (" << caps.wPid << ") " <<
+			caps.szPname <<
+			" Drv=" << caps.vDriverVersion <<
+			" PID=" << caps.wPid <<
+			" MID=" << caps.wMid <<
+			" DevType=" << caps.wTechnology <<
+			" Voices=" << caps.wVoices <<
+			" ChanMask=" << caps.wChannelMask <<
+			" Funcs=" << caps.dwSupport <<
 			std::endl;
 	}
 
@@ -664,7 +1190,154 @@ void testDefaultMidiOut() {
 	return;
 }
 
-int playMidiWithWinmm(int midi_output_device_idx, char* midi_file)
+// Waits for Enter and serves the transport commands typed meanwhile, one per line:
+// P pauses and resumes, S <seconds> seeks, R <scale> sets the tempo scale, T prints the timing so far.
+void WaitForStop(Sequencer& sequencer)
+{
+	std::cout << "Press Enter to stop; P to pause / resume, S <seconds> to seek, R <scale> for the tempo, T for the timing ..." << std::endl;
+	std::string line;
+	while (std::getline(std::cin, line) && !line.empty()) {
+		char command = char(std::toupper((unsigned char)line[0]));
+		double value = std::atof(line.c_str() + 1);
+		if (command == 'P') {
+			if (sequencer.IsPaused()) {
+				sequencer.Resume();
+				std::cout << "Resumed" << std::endl;
+			}
+			else {
+				sequencer.Pause();
+				std::cout << "Paused at " << sequencer.PositionUs() / 1000 << " ms" << std::endl;
+			}
+		}
+		else if ((command == 'S') && (value >= 0)) {
+			if (sequencer.Seek(int64_t(value * 1e6))) {
+				std::cout << "Playing from " << int64_t(value * 1000) << " ms" << std::endl;
+			}
+		}
+		else if ((command == 'R') && (value > 0)) {
+			sequencer.SetTempoScale(value);
+			std::cout << "Tempo scale " << sequencer.TempoScale() << std::endl;
+		}
+		else if (command == 'T') {
+			std::cout << sequencer.TimingJson() << std::endl;
+		}
+		else {
+			break;
+		}
+	}
+}
+
+// Prints the timing of the last playback and writes it to the report file as JSON if one is given.
+bool ReportSequencerTiming(const Sequencer& sequencer, const char* report_file)
+{
+	SequencerTiming t = sequencer.Timing();
+	const TimingHistogram& delay = sequencer.DispatchDelay();
+	std::cout << "MIDI events: " << t.events << " sent, " << t.lateEvents << " later than " << t.lateThresholdUs <<
+		" us, " << t.droppedEvents << " dropped" << std::endl;
+	std::cout << "Dispatch delay: p50 " << delay.ValueAtPercentile(50.0) / 1000.0 << " us, p99 " <<
+		delay.ValueAtPercentile(99.0) / 1000.0 << " us, maximum " << delay.Max() / 1000.0 << " us" << std::endl;
+	std::cout << "SysEx: " << t.sysexMessages << " messages, " << t.sysexBytes << " bytes, " <<
+		t.SysexBytesPerSecond() << " bytes/s" << std::endl;
+
+	if (!report_file) {
+		return true;
+	}
+	std::ofstream out(report_file);
+	out << sequencer.TimingJson() << std::endl;
+	if (!out) {
+		std::cerr << "Failed to write the timing report: " << report_file << std::endl;
+		return false;
+	}
+	std::cout << "Timing report written to " << report_file << std::endl;
+	return true;
+}
+
+void PrintOptimizerStats(const MidiOutputOptimizer& optimizer)
+{
+	const MidiOutputOptimizerStats& stats = optimizer.Stats();
+	std::cout << "Output optimizer: " << stats.messagesIn << " messages in, " << stats.messagesOut << " out, " << stats.bytesIn <<
+		" bytes in, " << stats.bytesOut << " out (" << stats.BytesSaved() << " saved, " << stats.BytesSaved() * 320 / 1000 <<
+		" ms on a MIDI cable), " << stats.runningStatus << " running status, " << stats.redundant << " redundant, " <<
+		stats.noteOffsAsNoteOns << " note-offs as note-ons" << std::endl;
+}
+
+void PrintWinmmStats(const WinmmMidiSink& sink)
+{
+	const WinmmSinkStats& stats = sink.Stats();
+	std::cout << "MIDI output: " << stats.shortMessages << " short messages, " << stats.longMessages << " SysEx messages (" <<
+		stats.longBytes << " bytes in " << stats.buffersQueued << " buffers), " << stats.poolWaits << " waits for a free buffer, " <<
+		stats.deferred << " short messages sent after queued SysEx, " << stats.drainWaits << " waits for queued SysEx, " <<
+		stats.longWaitUs << " us waiting" << std::endl;
+}
+
+int playMidiWithWinmm(int midi_output_device_idx, char* midi_file, const char* report_file)
+{
+	if (!LoadSong(midi_file)) {
+		return 1;
+	}
+
+	WinmmMidiSink sink;
+	std::string err;
+	if (!sink.Open(midi_output_device_idx, err)) {
+		std::cerr << "Failed to open MIDI output: " << err << std::endl;
+		return 1;
+	}
+
+	MidiOutputOptimizer optimizer(sink, MidiOutputOptimizerOptions());
+	Sequencer sequencer;
+	sequencer.Start(timeline, optimizer);
+
+	std::cout << "Playing MIDI file: " << midi_file << std::endl;
+	WaitForStop(sequencer);
+
+	sequencer.Stop();
+	sink.Close();
+	PrintOptimizerStats(optimizer);
+	PrintWinmmStats(sink);
+	return ReportSequencerTiming(sequencer, report_file) ? 0 : 2;
+}
+
+int playMidiStreamingWithWinmm(int midi_output_device_idx, char* midi_file, const char* report_file)
+{
+	WinmmMidiSink sink;
+	std::string err;
+	if (!sink.Open(midi_output_device_idx, err)) {
+		std::cerr << "Failed to open MIDI output: " << err << std::endl;
+		return 1;
+	}
+
+	// Only the chunk headers are read before playback starts.
+	int64_t startUs = NowMicros();
+	SmfStream stream;
+	if (!stream.Open(midi_file, err)) {
+		std::cerr << "Failed to open MIDI file: " << err << std::endl;
+		return 1;
+	}
+	MidiOutputOptimizer optimizer(sink, MidiOutputOptimizerOptions());
+	Sequencer sequencer;
+	if (!sequencer.Start(stream, optimizer)) {
+		std::cerr << "Failed to read MIDI file: " << stream.Error() << std::endl;
+		return 1;
+	}
+	int64_t firstUs = NowMicros() - startUs;
+
+	std::cout << "Streaming MIDI file: " << midi_file << ", format " << stream.Format() << ", " << stream.TrackCount() <<
+		" tracks, ready to play in " << firstUs << " us" << std::endl;
+	WaitForStop(sequencer);
+
+	sequencer.Stop();
+	sink.Close();
+	PrintOptimizerStats(optimizer);
+	PrintWinmmStats(sink);
+	if (stream.Failed()) {
+		std::cerr << "Playback stopped at a corrupt track: " << stream.Error() << std::endl;
+	}
+	std::cout << "Events read: " << stream.EventsRead() << ", peak memory use: " << ProcessPeakResidentBytes() / (1024 * 1024) <<
+		" MB" << std::endl;
+	return ReportSequencerTiming(sequencer, report_file) ? 0 : 2;
+}
+
+int playMidiWithMci(int midi_output_device_idx, char* midi_file)
 {
 	HWND hWnd = GetConsoleWindow();
 	if (hWnd == NULL) {
@@ -678,6 +1351,12 @@ int playMidiWithWinmm(int midi_output_device_idx, char* midi_file)
 
 	MCIERROR err;
 
+	// The parse only prints the song statistics, MCI reads the file itself.
+	std::string parseErr;
+	if (!ParseMidiFile(midi_file, parseErr)) {
+		std::cerr << "Warning: " << parseErr << ", the file is passed to MCI as it is." << std::endl;
+	}
+
 	// 1. Open the MIDI file and give it an alias (e.g., "music")
 	cmd = "open \"" + midiFileName + "\" type sequencer alias music";
 	std::cout << "> " << cmd << std::endl;
@@ -724,43 +1403,679 @@ int playMidiWithWinmm(int midi_output_device_idx, char* midi_file)
 	return 0;
 }
 
-int main(int argc, char* argv[])
+void PrintAudioStats(const AudioDevice& device)
 {
-	std::cout << APP_NAME << " " << APP_VER << std::endl;
-	std::wstring directSoundApiVersion = GetLibraryVersion(const_cast<wchar_t*>(DIRECT_SOUND_DLL));
-	std::wcout << "DirectSound API:\t" << DIRECT_SOUND_DLL << " version: " << directSoundApiVersion << std::endl;
-	std::wstring winmmVersion = GetLibraryVersion(const_cast<wchar_t*>(WINMM_DLL));
-	std::wcout << "WinMM:\t\t\t" << WINMM_DLL << " version: " << winmmVersion << std::endl;
-	std::wstring windowsNtVersion = GetLibraryVersion(const_cast<wchar_t*>(WINDOWS_NT_DLL));
-	std::wcout << "Windows:\t\t" << WINDOWS_NT_DLL << " version: " << windowsNtVersion << std::endl;
+	AudioDeviceStats stats = device.Stats();
+	std::cout << "Audio callbacks: " << stats.callbacks << ", deadline misses: " << stats.deadlineMisses << std::endl;
+	std::cout << "Callback time: average " << stats.AverageCallbackNs() / 1000 << " us, maximum " << stats.maxCallbackNs / 1000 <<
+		" us, load " << stats.LoadPercent() << " %, worst wake-up delay " << stats.maxWakeLateNs / 1000 << " us" << std::endl;
+}
+
+// The null device for 'null', otherwise the DirectSound device of the given index.
+AudioDevice* OpenAudioDevice(char* ds_device_index_str, NullAudioDevice& nullDevice, DirectSoundAudioDevice& dsDevice)
+{
+	if (std::string(ds_device_index_str) == "null") {
+		return &nullDevice;
+	}
+
+	EnumerateDirectSoundDevices();
 	std::cout << std::endl;
+	std::string err;
+	if (!dsDevice.Open(GetDeviceGuidByIndex(ResolveDeviceIndex(DEVICE_AUDIO_OUTPUT, ds_device_index_str)), GetConsoleWindow(), err)) {
+		std::cerr << "Failed to open DirectSound device: " << err << std::endl;
+		return nullptr;
+	}
+	return &dsDevice;
+}
 
-	HRESULT hr;
+int playMidiWithSynth(char* ds_device_index_str, char* dls_file, char* midi_file, uint32_t blockFrames, const char* report_file)
+{
+	if (!LoadSong(midi_file)) {
+		return 1;
+	}
 
-	if (argc <= 1) // No arguments.
-	{
-		std::cout << "Usage: " << std::endl;
-		std::cout << "\t<executable> <Work mode> ..." << std::endl;
-		std::cout << std::endl;
+	// Instruments are loaded up front, the audio thread must not read the DLS file.
+	BuiltinInstrumentBank builtinBank;
+	InstrumentBank* bank = &builtinBank;
+	if (convertWCharToStdStringWinAPI(DLS_FILE_NONE) != dls_file) {
+		if (!LoadDlsFile(dls_file)) {
+			return 1;
+		}
+		PreloadDlsInstruments();
+		bank = &dlsBank;
+	}
 
-		std::cout << "Number of arguments depends on the work mode set as a first argument in the command line." << std::endl;
-		std::cout << "Available word modes are: " << std::endl;
-		std::cout << "\t DS - This mode uses DirectSound API;" << std::endl;
-		std::cout << "\t MM - This mode uses WinMM library." << std::endl;
-		std::cout << std::endl;
+	SynthConfig synthConfig;
+	RealtimeSynth realtime(synthConfig, blockFrames);
+	realtime.GetSynth().SetInstrumentBank(bank);
 
-		std::cout << "Arguments (4) for DirectSound mode are: " << std::endl;
-		std::cout << "\t<DirectSound device index> <MIDI output device index> <DLS file> <MIDI file>" << std::endl;
-		std::cout << "Arguments (2) for WinMM mode are: " << std::endl;
-		std::cout << "\t<Port number / Device ID> <MIDI file>" << std::endl;
-		std::cout << std::endl;
+	AudioDeviceConfig config;
+	config.sampleRate = synthConfig.sampleRate;
+	config.blockFrames = blockFrames;
 
-		std::cout << "Notes for DirectSound mode: " << std::endl;
-		std::cout << "\tSet the DirectSound device index to a negative value to use the default device." << std::endl;
-		std::cout << "\tSet the MIDI output device index to a negative value to use the default device." << std::endl;
-		std::cout << "\tTo disable loading DLS, use the '" << convertWCharToStdStringWinAPI(DLS_FILE_NONE) << "' as DLS file." << std::endl;
-		std::cout << "\tThis mode has a known problem. When a default MIDI output is selected (i.e. negative index), " <<
-			"the DirectSound API initialises automatically and maps MIDI channels incorrectly. " <<
+	std::string err;
+	NullAudioDevice nullDevice;
+	DirectSoundAudioDevice dsDevice;
+	AudioDevice* device = OpenAudioDevice(ds_device_index_str, nullDevice, dsDevice);
+	if (!device) {
+		return 1;
+	}
+	if (!device->Start(config, realtime, err)) {
+		std::cerr << "Failed to start audio output: " << err << std::endl;
+		return 1;
+	}
+
+	Sequencer sequencer;
+	sequencer.Start(timeline, realtime);
+
+	double blockMs = device->Stats().blockNs / 1e6;
+	std::cout << "Playing MIDI file: " << midi_file << " on " << device->Name() << " audio device, " <<
+		blockFrames << " frames (" << blockMs << " ms) per block, " << realtime.GetSynth().Kernels().name << " kernels" << std::endl;
+	WaitForStop(sequencer);
+
+	sequencer.Stop();
+	device->Stop();
+	dsDevice.Close();
+
+	PrintAudioStats(*device);
+	std::cout << "Synth queue: " << realtime.LateEvents() << " events late for their block, " << realtime.DroppedEvents() <<
+		" dropped" << std::endl;
+	return ReportSequencerTiming(sequencer, report_file) ? 0 : 2;
+}
+
+void ListMidiInDevicesWithWinmm() {
+	std::cout << "Available MIDI In Devices:" << std::endl;
+
+	UINT midiInDevCount = midiInGetNumDevs();
+	for (UINT i = 0; i < midiInDevCount; i++) {
+		MIDIINCAPSA caps;
+		if (midiInGetDevCapsA(i, &caps, sizeof(MIDIINCAPSA)) == MMSYSERR_NOERROR) {
+			std::cout << "[" << i << "] " << caps.szPname << " Drv=" << caps.vDriverVersion << " PID=" << caps.wPid <<
+				" MID=" << caps.wMid << std::endl;
+		}
+	}
+
+	std::cout << std::endl;
+}
+
+// Output of the thru and playlist modes: a WinMM MIDI Out device, a DirectMusic port, the built-in synthesizer
+// or a MIDI file written when the output is closed.
+struct MidiOutput {
+	std::string mode;
+	std::string path;
+	WinmmMidiSink winmmSink;
+	std::unique_ptr<MidiOutputOptimizer> optimizer;
+	DirectMusicPortSink portSink;
+	SmfFileSink fileSink;
+	BuiltinInstrumentBank builtinBank;
+	std::unique_ptr<RealtimeSynth> realtime;
+	NullAudioDevice nullDevice;
+	DirectSoundAudioDevice dsDevice;
+	AudioDevice* device;
+	MidiSink* sink;
+
+	MidiOutput() : device(nullptr), sink(nullptr) {}
+};
+
+// With allInstruments the synthesizer gets the whole DLS file loaded up front, for input which may play any program.
+// Otherwise instruments are left to be loaded per song.
+bool OpenMidiOutput(MidiOutput& out, char* output_mode, char* output_device_str, char* dls_file, uint32_t blockFrames, bool allInstruments)
+{
+	std::string err;
+	out.mode = output_mode;
+
+	if (out.mode == "MM") {
+		if (!out.winmmSink.Open(ResolveDeviceIndex(DEVICE_MIDI_OUTPUT, output_device_str), err)) {
+			std::cerr << "Failed to open MIDI output: " << err << std::endl;
+			return false;
+		}
+		out.optimizer.reset(new MidiOutputOptimizer(out.winmmSink, MidiOutputOptimizerOptions()));
+		out.sink = out.optimizer.get();
+	}
+	else if (out.mode == "DS") {
+		HRESULT hr = Initialise("-1", output_device_str, dls_file);
+		if (FAILED(hr) || !pPort) {
+			std::cerr << "Failed to initialise DirectMusic port." << std::endl;
+			print_result(hr);
+			ShutdownDirectMusic();
+			return false;
+		}
+		if (!out.portSink.Open(pDirectMusic, pPort, err)) {
+			std::cerr << "Failed to open DirectMusic port: " << err << std::endl;
+			ShutdownDirectMusic();
+			return false;
+		}
+		out.sink = &out.portSink;
+	}
+	else if (out.mode == "SYNTH") {
+		InstrumentBank* bank = &out.builtinBank;
+		if (convertWCharToStdStringWinAPI(DLS_FILE_NONE) != dls_file) {
+			if (!LoadDlsFile(dls_file)) {
+				return false;
+			}
+			if (allInstruments) {
+				for (size_t i = 0; i < dlsBank.InstrumentCount(); i++) {
+					dlsBank.LoadInstrument(i);
+				}
+				PrintDlsStats("DLS instruments");
+			}
+			bank = &dlsBank;
+		}
+
+		SynthConfig synthConfig;
+		out.realtime.reset(new RealtimeSynth(synthConfig, blockFrames));
+		out.realtime->GetSynth().SetInstrumentBank(bank);
+
+		AudioDeviceConfig config;
+		config.sampleRate = synthConfig.sampleRate;
+		config.blockFrames = blockFrames;
+		out.device = OpenAudioDevice(output_device_str, out.nullDevice, out.dsDevice);
+		if (!out.device) {
+			return false;
+		}
+		if (!out.device->Start(config, *out.realtime, err)) {
+			std::cerr << "Failed to start audio output: " << err << std::endl;
+			return false;
+		}
+		out.sink = out.realtime.get();
+	}
+	else if (out.mode == "FILE") {
+		out.path = output_device_str;
+		out.fileSink.Reserve(SMF_SINK_RESERVE_MESSAGES, SMF_SINK_RESERVE_BYTES);
+		out.sink = &out.fileSink;
+	}
+	else {
+		std::cerr << "Unknown output mode: " << out.mode << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void CloseMidiOutput(MidiOutput& out)
+{
+	if (out.device) {
+		out.device->Stop();
+		out.dsDevice.Close();
+	}
+	if (out.mode == "DS") {
+		out.portSink.Close();
+		ShutdownDirectMusic();
+	}
+	if (out.mode == "MM") {
+		out.winmmSink.Close();
+		if (out.optimizer) {
+			PrintOptimizerStats(*out.optimizer);
+			PrintWinmmStats(out.winmmSink);
+		}
+	}
+	if (out.mode == "FILE") {
+		std::string err;
+		if (out.fileSink.Save(out.path, err)) {
+			std::cout << "Wrote " << out.fileSink.MessageCount() << " MIDI messages to " << out.path << ", dropped: " <<
+				out.fileSink.Dropped() << std::endl;
+		}
+		else {
+			std::cerr << "Failed to write the MIDI file: " << err << std::endl;
+		}
+	}
+}
+
+int thruMidi(int midi_input_device_idx, char* output_mode, char* output_device_str, char* dls_file, uint32_t blockFrames)
+{
+	// Any program may be played, so the whole DLS file is loaded up front.
+	MidiOutput output;
+	if (!OpenMidiOutput(output, output_mode, output_device_str, dls_file, blockFrames, true)) {
+		return 1;
+	}
+	MidiSink* sink = output.sink;
+	AudioDevice* device = output.device;
+
+	std::string err;
+	MidiThru thru(*sink);
+	thru.Start();
+	WinmmMidiInput input;
+	if (!input.Open(midi_input_device_idx, err) || !input.Start(thru, err)) {
+		std::cerr << "Failed to open MIDI input: " << err << std::endl;
+		return 1;
+	}
+
+	std::cout << "Routing MIDI input " << midi_input_device_idx << " to " << output.mode << " output " << output_device_str << std::endl;
+	std::cout << "Press Enter to stop ..." << std::endl;
+	std::cin.get();
+
+	input.Close();
+	thru.Stop();
+	sink->Reset();
+
+	LatencySummary latency = thru.Latency().Summary();
+	std::cout << "MIDI messages: " << thru.Messages() << ", failed: " << thru.Failures() << ", dropped: " << thru.Dropped() <<
+		", broken SysEx: " << input.SysexErrors() << std::endl;
+	std::cout << "Thru latency: p50 " << latency.p50Ns / 1000.0 << " us, p99 " << latency.p99Ns / 1000.0 << " us, max " <<
+		latency.maxNs / 1000.0 << " us, mean " << latency.meanNs / 1000.0 << " us" << std::endl;
+
+	if (device) {
+		// The synthesizer plays a message with the next block, which the device outputs after the queued ones.
+		device->Stop();
+		double blockMs = device->Stats().blockNs / 1e6;
+		std::cout << "Audio output adds up to " << blockMs * (device->Config().bufferBlocks + 1) << " ms (" <<
+			device->Config().bufferBlocks + 1 << " blocks of " << blockMs << " ms)" << std::endl;
+		PrintAudioStats(*device);
+	}
+	CloseMidiOutput(output);
+	return 0;
+}
+
+// Makes the instruments of a song resident and releases the least recently used ones. Runs on a loader thread
+// while the previous song plays: the bank loads instruments under its own lock and the synthesizer finds loaded
+// ones without it; DirectMusic objects live in the multithreaded apartment.
+void PrepareSongInstruments(const Timeline& song, bool port, size_t& count, size_t& released)
+{
+	count = 0;
+	released = 0;
+	if (dlsBank.InstrumentCount() == 0) {
+		return;
+	}
+	std::map<uint32_t, InstrumentUsage> used = ResolveSongInstruments(song);
+	if (port) {
+		CoInitializeEx(NULL, COINIT_MULTITHREADED);
+		count = DownloadPortInstruments(used);
+		released = TrimResidentInstruments(used, true);
+		CoUninitialize();
+	}
+	else {
+		count = LoadSongInstruments(used);
+		released = TrimResidentInstruments(used, false);
+	}
+}
+
+int playPlaylist(char* output_mode, char* output_device_str, char* dls_file, char* input, uint32_t blockFrames, const char* report_file)
+{
+	std::string err;
+	std::vector<std::string> files;
+	if (!CollectMidiFiles(input, files, err)) {
+		std::cerr << "Failed to collect MIDI files: " << err << std::endl;
+		return 1;
+	}
+
+	MidiOutput output;
+	if (!OpenMidiOutput(output, output_mode, output_device_str, dls_file, blockFrames, false)) {
+		return 1;
+	}
+
+	bool port = (output.mode == "DS");
+	Sequencer sequencer;
+	PlaylistPlayer player(sequencer, *output.sink);
+	player.SetPrepare([port](const PlaylistEntry& entry, const Timeline& song) {
+		size_t count = 0, released = 0;
+		PrepareSongInstruments(song, port, count, released);
+		std::cout << "Next: " << entry.path << ", " << song.DurationUs() / 1000 << " ms, " << count << " new instruments, " <<
+			released << " released" << std::endl;
+	});
+
+	std::cout << "Playing " << files.size() << " MIDI files on " << output.mode << " output " << output_device_str << std::endl;
+	player.Start(files);
+	WaitForStop(sequencer);
+	player.Stop();
+
+	const std::vector<PlaylistEntry>& entries = player.Entries();
+	for (size_t i = 0; i < entries.size(); i++) {
+		const PlaylistEntry& e = entries[i];
+		if (!e.loaded) {
+			if (!e.err.empty()) {
+				std::cerr << e.path << ": FAILED: " << e.err << std::endl;
+			}
+			continue;
+		}
+		std::cout << e.path << ": " << (e.fromCache ? "cache" : "parsed") << " in " << e.loadUs << " us, prepared in " <<
+			e.prepareUs << " us" << (e.startedLate ? ", started late" : "") << std::endl;
+	}
+	if (port && (dlsBank.InstrumentCount() > 0)) {
+		PrintPortStats("DLS instruments resident on the port");
+		PrintResidentStats();
+	}
+	else if (dlsBank.InstrumentCount() > 0) {
+		PrintDlsStats("DLS instruments resident at the end of the playlist");
+		PrintResidentStats();
+	}
+	if (output.device) {
+		PrintAudioStats(*output.device);
+	}
+	CloseMidiOutput(output);
+	return ReportSequencerTiming(sequencer, report_file) ? 0 : 2;
+}
+
+int runDaemon(char* output_mode, char* output_device_str, char* dls_file, const char* pipe_name, uint32_t blockFrames)
+{
+	MidiOutput output;
+	if (!OpenMidiOutput(output, output_mode, output_device_str, dls_file, blockFrames, false)) {
+		return 1;
+	}
+
+	bool port = (output.mode == "DS");
+	std::string err;
+	bool ok = true;
+	PlayerDaemonStats stats;
+	{
+		// The daemon stops the sequencer before the output is closed.
+		Sequencer sequencer;
+		PlayerDaemon daemon(sequencer, *output.sink);
+		daemon.SetPrepare([port](const std::string& path, const Timeline& song) {
+			size_t count = 0, released = 0;
+			PrepareSongInstruments(song, port, count, released);
+			std::cout << "Prepared: " << path << ", " << song.DurationUs() / 1000 << " ms, " << count << " new instruments, " <<
+				released << " released" << std::endl;
+		});
+
+		if (std::string(pipe_name) == "-") {
+			std::cout << "Reading commands from standard input on " << output.mode << " output " << output_device_str << " ..." << std::endl;
+			daemon.Serve(std::cin, std::cout);
+		}
+		else {
+			std::cout << "Waiting for commands on " << pipe_name << " for " << output.mode << " output " << output_device_str << " ..." << std::endl;
+			ok = ServeNamedPipe(daemon, pipe_name, err);
+		}
+		stats = daemon.Stats();
+	}
+	if (!ok) {
+		std::cerr << "Failed to serve commands: " << err << std::endl;
+	}
+
+	std::cout << "Commands: " << stats.commands << ", songs loaded: " << stats.songsLoaded << ", warm starts: " << stats.warmHits <<
+		", last start: " << stats.lastStartUs << " us" << std::endl;
+	if (dlsBank.InstrumentCount() > 0) {
+		if (port) {
+			PrintPortStats("DLS instruments resident on the port");
+		}
+		else {
+			PrintDlsStats("DLS instruments resident at the end");
+		}
+		PrintResidentStats();
+	}
+	if (output.device) {
+		PrintAudioStats(*output.device);
+	}
+	CloseMidiOutput(output);
+	return ok ? 0 : 1;
+}
+
+int renderMidiToFile(char* dls_file, char* midi_file, char* output_file, unsigned threads)
+{
+	if (!LoadSong(midi_file)) {
+		return 1;
+	}
+
+	BuiltinInstrumentBank builtinBank;
+	InstrumentBank* bank = &builtinBank;
+	if (convertWCharToStdStringWinAPI(DLS_FILE_NONE) != dls_file) {
+		if (!LoadDlsFile(dls_file)) {
+			return 1;
+		}
+		PreloadDlsInstruments();
+		bank = &dlsBank;
+	}
+
+	OfflineRenderOptions options;
+	options.synth.interpolation = INTERPOLATION_CUBIC;
+	options.synth.renderThreads = (threads > 0) ? threads : std::thread::hardware_concurrency();
+	OfflineRenderer renderer(options);
+
+	std::string err;
+	PcmFileWriter out;
+	if (!out.Open(output_file, options.synth.sampleRate, 2, IsWavPath(output_file), err)) {
+		std::cerr << "Failed to create output file: " << err << std::endl;
+		return 1;
+	}
+
+	std::cout << "Rendering MIDI file: " << midi_file << " to " << output_file << " using " <<
+		renderer.GetSynth().Kernels().name << " kernels, " << renderer.GetSynth().RenderThreads() << " threads" << std::endl;
+	if (!renderer.Render(timeline, bank, out, err) || !out.Close(err)) {
+		std::cerr << "Failed to render MIDI file: " << err << std::endl;
+		return 2;
+	}
+
+	const OfflineRenderStats& stats = renderer.Stats();
+	std::cout << "Rendered " << stats.frames << " frames (" << stats.songUs / 1000 << " ms of audio) in " <<
+		stats.renderUs / 1000 << " ms, " << stats.events << " events, peak " << stats.peakVoices << " voices, " <<
+		stats.stolenVoices << " voices stolen" << std::endl;
+	std::cout << "Realtime factor: " << stats.RealtimeFactor() << "x" << std::endl;
+	return 0;
+}
+
+int renderMidiBatch(char* dls_file, char* input, char* output_dir, unsigned threads)
+{
+	std::string err;
+	std::vector<std::string> files;
+	if (!CollectMidiFiles(input, files, err)) {
+		std::cerr << "Failed to collect MIDI files: " << err << std::endl;
+		return 1;
+	}
+
+	// One bank for all workers. The synthesizer only finds resident instruments and the files are parsed
+	// by the workers, so all instruments are loaded up front.
+	BuiltinInstrumentBank builtinBank;
+	InstrumentBank* bank = &builtinBank;
+	if (convertWCharToStdStringWinAPI(DLS_FILE_NONE) != dls_file) {
+		if (!LoadDlsFile(dls_file)) {
+			return 1;
+		}
+		for (size_t i = 0; i < dlsBank.InstrumentCount(); i++) {
+			dlsBank.LoadInstrument(i);
+		}
+		bank = &dlsBank;
+	}
+
+	OfflineRenderOptions options;
+	options.synth.interpolation = INTERPOLATION_CUBIC;
+
+	std::cout << "Rendering " << files.size() << " MIDI files to " << output_dir << std::endl;
+	std::vector<BatchFileResult> results;
+	BatchSummary summary;
+	if (!RenderBatch(files, output_dir, bank, options, threads, results, summary, err)) {
+		std::cerr << "Failed to render MIDI files: " << err << std::endl;
+		return 1;
+	}
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const BatchFileResult& r = results[i];
+		if (!r.ok) {
+			std::cerr << r.input << ": FAILED: " << r.err << std::endl;
+			continue;
+		}
+		std::cout << r.input << ": " << r.stats.songUs / 1000 << " ms of audio, parse " << r.parseUs << " us, render " <<
+			r.stats.renderUs / 1000 << " ms, realtime factor " << r.stats.RealtimeFactor() << "x, worker " << r.worker << std::endl;
+	}
+
+	std::cout << std::endl;
+	std::cout << "Files: " << summary.files - summary.failed << " rendered, " << summary.failed << " failed, " <<
+		summary.threads << " threads, " << summary.stolenTasks << " files stolen between workers" << std::endl;
+	std::cout << "Wall time: " << summary.wallUs / 1000 << " ms, audio: " << summary.audioUs / 1000 << " ms" << std::endl;
+	std::cout << "Throughput: " << summary.SongsPerMinute() << " songs/min, realtime factor " << summary.RealtimeFactor() <<
+		"x, per core " << summary.RealtimeFactorPerCore() << "x" << std::endl;
+	if (summary.wallUs > 0) {
+		std::cout << "Parallel efficiency: " << 100.0 * double(summary.busyUs) / (double(summary.wallUs) * summary.threads) << " %" << std::endl;
+	}
+	if (dlsBank.InstrumentCount() > 0) {
+		PrintDlsStats("DLS instruments used by the batch");
+	}
+	return (summary.failed > 0) ? 2 : 0;
+}
+
+int buildSongCaches(char* input, unsigned threads)
+{
+	std::string err;
+	std::vector<std::string> files;
+	if (!CollectMidiFiles(input, files, err)) {
+		std::cerr << "Failed to collect MIDI files: " << err << std::endl;
+		return 1;
+	}
+
+	std::cout << "Updating song caches of " << files.size() << " MIDI files" << std::endl;
+	int64_t startUs = NowMicros();
+	std::vector<SongCacheResult> results;
+	UpdateSongCaches(files, threads, results);
+	int64_t wallUs = NowMicros() - startUs;
+
+	size_t built = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		const SongCacheResult& r = results[i];
+		switch (r.status) {
+		case SONG_CACHE_VALID:
+			std::cout << r.input << ": up to date, " << r.cacheBytes / 1024 << " KB" << std::endl;
+			break;
+		case SONG_CACHE_BUILT:
+			std::cout << r.input << ": built in " << r.buildUs << " us, " << r.cacheBytes / 1024 << " KB (" << r.reason << ")" << std::endl;
+			built++;
+			break;
+		case SONG_CACHE_FAILED:
+			std::cerr << r.input << ": FAILED: " << r.reason << std::endl;
+			failed++;
+			break;
+		}
+	}
+
+	std::cout << std::endl;
+	std::cout << "Files: " << results.size() - built - failed << " up to date, " << built << " built, " << failed << " failed in " <<
+		wallUs / 1000 << " ms" << std::endl;
+	return (failed > 0) ? 2 : 0;
+}
+
+// Time and resident memory of loading a DLS bank and of loading all of its instruments.
+struct BankLoadCost {
+	int64_t loadUs;
+	uint64_t loadBytes;
+	int64_t instrumentsUs;
+	uint64_t instrumentsBytes;
+};
+
+bool MeasureBankLoad(DlsBank& bank, const char* dls_file, bool useSnapshot, BankLoadCost& cost, std::string& err)
+{
+	uint64_t rssStart = ProcessResidentBytes();
+	int64_t startUs = NowMicros();
+	if (!bank.Load(dls_file, err, useSnapshot)) {
+		return false;
+	}
+	cost.loadUs = NowMicros() - startUs;
+	uint64_t rssLoaded = ProcessResidentBytes();
+
+	startUs = NowMicros();
+	for (size_t i = 0; i < bank.InstrumentCount(); i++) {
+		bank.LoadInstrument(i);
+	}
+	cost.instrumentsUs = NowMicros() - startUs;
+	uint64_t rssEnd = ProcessResidentBytes();
+
+	cost.loadBytes = (rssLoaded > rssStart) ? rssLoaded - rssStart : 0;
+	cost.instrumentsBytes = (rssEnd > rssStart) ? rssEnd - rssStart : 0;
+	return true;
+}
+
+int buildBankSnapshot(char* dls_file)
+{
+	std::string err;
+	BankLoadCost before;
+	BankLoadCost after;
+	std::string path = BankSnapshotPath(dls_file);
+	{
+		DlsBank bank;
+		if (!MeasureBankLoad(bank, dls_file, false, before, err)) {
+			std::cerr << "Failed to load DLS file: " << err << std::endl;
+			return 1;
+		}
+		std::cout << "DLS file: " << dls_file << ", " << bank.ImageSize() / 1024 << " KB, " << bank.InstrumentCount() <<
+			" instruments" << std::endl;
+
+		int64_t startUs = NowMicros();
+		if (!WriteBankSnapshot(dls_file, bank, err)) {
+			std::cerr << "Failed to write the bank snapshot: " << err << std::endl;
+			return 2;
+		}
+		std::cout << "Snapshot: " << path << ", written in " << (NowMicros() - startUs) / 1000 << " ms" << std::endl;
+	}
+
+	DlsBank snapshot;
+	if (!MeasureBankLoad(snapshot, dls_file, true, after, err) || !snapshot.FromSnapshot()) {
+		std::cerr << "Failed to load the bank snapshot: " << (err.empty() ? path : err) << std::endl;
+		return 2;
+	}
+	std::cout << "Snapshot size: " << snapshot.Stats().fileBytes / 1024 << " KB" << std::endl;
+
+	std::cout << std::endl;
+	std::cout << "                  Load      Resident    All instruments    Resident" << std::endl;
+	std::cout << "DLS file    " << std::setw(8) << before.loadUs << " us  " << std::setw(8) << before.loadBytes / 1024 << " KB  " <<
+		std::setw(13) << before.instrumentsUs << " us  " << std::setw(8) << before.instrumentsBytes / 1024 << " KB" << std::endl;
+	std::cout << "Snapshot    " << std::setw(8) << after.loadUs << " us  " << std::setw(8) << after.loadBytes / 1024 << " KB  " <<
+		std::setw(13) << after.instrumentsUs << " us  " << std::setw(8) << after.instrumentsBytes / 1024 << " KB" << std::endl;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::cout << APP_NAME << " " << APP_VER << std::endl;
+	std::cout << std::endl;
+
+	HRESULT hr;
+
+	if (argc <= 1) // No arguments.
+	{
+		// Reading the version resources takes time, so they are only shown here.
+		PrintLibraryVersions();
+
+		std::cout << "Usage: " << std::endl;
+		std::cout << "\t<executable> <Work mode> ..." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Number of arguments depends on the work mode set as a first argument in the command line." << std::endl;
+		std::cout << "Available word modes are: " << std::endl;
+		std::cout << "\t DS - This mode uses DirectSound API;" << std::endl;
+		std::cout << "\t MM - This mode uses WinMM library;" << std::endl;
+		std::cout << "\t STREAM - This mode uses WinMM library and reads the MIDI file while playing, for huge files;" << std::endl;
+		std::cout << "\t MCI - This mode uses the MCI sequencer of WinMM library;" << std::endl;
+		std::cout << "\t RENDER - This mode renders the MIDI file into a WAV or raw PCM file with the built-in synthesizer;" << std::endl;
+		std::cout << "\t SYNTH - This mode plays the MIDI file with the built-in synthesizer in real time;" << std::endl;
+		std::cout << "\t THRU - This mode routes a live MIDI input to a MIDI output or to the built-in synthesizer;" << std::endl;
+		std::cout << "\t PLAYLIST - This mode plays many MIDI files one after another without gaps;" << std::endl;
+		std::cout << "\t DAEMON - This mode keeps the output open and plays MIDI files on commands from a named pipe or standard input;" << std::endl;
+		std::cout << "\t BATCH - This mode renders many MIDI files into WAV files on all processor cores;" << std::endl;
+		std::cout << "\t CACHE - This mode builds the song caches of many MIDI files, so that playback starts without parsing;" << std::endl;
+		std::cout << "\t BANK - This mode compiles a DLS file into a snapshot which loads without parsing." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Arguments (4) for DirectSound mode are: " << std::endl;
+		std::cout << "\t<DirectSound device index> <MIDI output device index> <DLS file> <MIDI file>" << std::endl;
+		std::cout << "Arguments (2 or 3) for WinMM mode are: " << std::endl;
+		std::cout << "\t<Port number / Device ID> <MIDI file> [Timing report file]" << std::endl;
+		std::cout << "Arguments (2 or 3) for stream mode are: " << std::endl;
+		std::cout << "\t<Port number / Device ID> <MIDI file> [Timing report file]" << std::endl;
+		std::cout << "Arguments (2) for MCI mode are: " << std::endl;
+		std::cout << "\t<Port number / Device ID> <MIDI file>" << std::endl;
+		std::cout << "Arguments (3 to 5) for synth mode are: " << std::endl;
+		std::cout << "\t<DirectSound device index> <DLS file> <MIDI file> [Block size] [Timing report file]" << std::endl;
+		std::cout << "Arguments (3 to 5) for thru mode are: " << std::endl;
+		std::cout << "\t<MIDI input device index> <Output mode> <Output device index> [DLS file] [Block size]" << std::endl;
+		std::cout << "Arguments (4 to 6) for playlist mode are: " << std::endl;
+		std::cout << "\t<Output mode> <Output device index> <DLS file> <Input directory or list file> [Block size] [Timing report file]" << std::endl;
+		std::cout << "Arguments (3 to 5) for daemon mode are: " << std::endl;
+		std::cout << "\t<Output mode> <Output device index> <DLS file> [Pipe name] [Block size]" << std::endl;
+		std::cout << "Arguments (3 or 4) for render mode are: " << std::endl;
+		std::cout << "\t<DLS file> <MIDI file> <Output file> [Number of threads]" << std::endl;
+		std::cout << "Arguments (3 or 4) for batch mode are: " << std::endl;
+		std::cout << "\t<DLS file> <Input directory or list file> <Output directory> [Number of threads]" << std::endl;
+		std::cout << "Arguments (1 or 2) for cache mode are: " << std::endl;
+		std::cout << "\t<Input directory or list file> [Number of threads]" << std::endl;
+		std::cout << "Arguments (1) for bank mode are: " << std::endl;
+		std::cout << "\t<DLS file>" << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for DirectSound mode: " << std::endl;
+		std::cout << "\tSet the DirectSound device index to a negative value to use the default device." << std::endl;
+		std::cout << "\tSet the MIDI output device index to a negative value to use the default device." << std::endl;
+		std::cout << "\tDevices can also be given by name or by GUID in braces, which stay the same when devices are added or removed. " <<
+			"The device lists are cached in the temporary directory and only enumerated again when the WinMM devices change " <<
+			"or a device arrives or is removed while the player runs." << std::endl;
+		std::cout << "\tTo disable loading DLS, use the '" << convertWCharToStdStringWinAPI(DLS_FILE_NONE) << "' as DLS file." << std::endl;
+		std::cout << "\tThis mode has a known problem. When a default MIDI output is selected (i.e. negative index), " <<
+			"the DirectSound API initialises automatically and maps MIDI channels incorrectly. " <<
 			"Automatic initialisation does not allow manual channel mapping. " <<
 			"Incorrect channel mapping results in most of the instruments lost and quiet. " <<
 			"All this means that you should not use the default MIDI output. " << std::endl;
@@ -769,15 +2084,116 @@ int main(int argc, char* argv[])
 		std::cout << "Notes for WinMM mode: " << std::endl;
 		std::cout << "\tDo not use this mode for playing MIDI files on a Microsoft's software synthesizer, also known as Microsoft GS Wavetable Synth. " <<
 			"This mode is used mostly for software and hardware synthesizers present on your sound card or for external hardware synthesizers. " << std::endl;
+		std::cout << "\tThe player sends MIDI events itself with sub-millisecond timing. Set the device index to a negative value to use the MIDI mapper." << std::endl;
+		std::cout << "\tWhen stopped, the player reports how late the events were sent, as percentiles, with the number of late and dropped events " <<
+			"and the SysEx rate. The full report with the delay histogram is written as JSON to the timing report file if one is given, " <<
+			"and can be shown during playback by typing T and Enter." << std::endl;
+		std::cout << "\tDuring playback, P and Enter pauses and resumes, S and a position in seconds seeks, R and a scale, e.g. R 1.5, " <<
+			"changes the tempo. Pausing releases exactly the notes which sound. The same works in stream, synth and playlist mode." << std::endl;
+		std::cout << "\tSysEx messages are queued to the driver in " << WINMM_SINK_BUFFERS << " prepared buffers, so the setup at the start of a song " <<
+			"is sent back to back." << std::endl;
+		std::cout << "\tThe output uses running status, drops controller and program changes which do not change the channel and sends " <<
+			"note-offs as note-ons with velocity 0 where that saves a byte. The player prints the number of bytes saved." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for stream mode: " << std::endl;
+		std::cout << "\tThe same as WinMM mode, but the MIDI file is decoded a few events ahead of playback instead of being loaded first. " <<
+			"Playback starts at once and memory use does not grow with the size of the file, so files of hundreds of MB can be played." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for MCI mode: " << std::endl;
+		std::cout << "\tThe same as WinMM mode, but timing is left to the MCI sequencer of Windows." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for synth mode: " << std::endl;
+		std::cout << "\tThe block size is the number of frames rendered per audio callback, " << AUDIO_MIN_BLOCK_FRAMES << " to " <<
+			AUDIO_MAX_BLOCK_FRAMES << ", " << AUDIO_DEFAULT_BLOCK_FRAMES << " by default. Smaller blocks give lower latency and need a faster CPU." << std::endl;
+		std::cout << "\tUse 'null' as DirectSound device index to render without sound output, e.g. to measure missed callback deadlines." << std::endl;
+		std::cout << "\tTo use the built-in instruments instead of a DLS file, use the '" << convertWCharToStdStringWinAPI(DLS_FILE_NONE) << "' as DLS file." << std::endl;
+		std::cout << "\tThe timing report is the same as in WinMM mode." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for thru mode: " << std::endl;
+		std::cout << "\tThe output mode is MM for a WinMM MIDI Out device, DS for a DirectMusic port or SYNTH for the built-in synthesizer " <<
+			"on a DirectSound device, with 'null' and the block size as in synth mode." << std::endl;
+		std::cout << "\tWith the output mode FILE, the output device is the path of a MIDI file. The messages are recorded with their times " <<
+			"and written as a format 0 file when the player stops." << std::endl;
+		std::cout << "\tEvery message is passed on as soon as it arrives, by a thread of its own. SysEx messages longer than 64 KB " <<
+			"and broken ones are dropped. When stopped, the player reports the latency " <<
+			"from the arrival of a message to its delivery to the output as percentiles." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for playlist mode: " << std::endl;
+		std::cout << "\tThe output mode and device are the same as in thru mode, the input the same as in batch mode. " <<
+			"The output, its instruments and the sequencer stay open for the whole list." << std::endl;
+		std::cout << "\tWhile a song plays, the next one is loaded in the background, from its song cache if there is one, " <<
+			"and the instruments it needs are loaded or downloaded to the port. It then starts exactly when the current song ends, " <<
+			"without a reset in between. The timing report is the same as in WinMM mode and covers the whole list." << std::endl;
+		std::cout << "\tOnly the instruments the songs play are loaded, of drum kits only the notes played. The " << INSTRUMENT_LRU_DEFAULT_CAPACITY <<
+			" most recently used instruments stay loaded for the following songs, older ones are released." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for daemon mode: " << std::endl;
+		std::cout << "\tThe output mode and device are the same as in thru mode. The output, the instruments and the last " << PLAYER_DAEMON_SONGS <<
+			" songs loaded stay in memory between commands, so a song starts within milliseconds of its command." << std::endl;
+		std::cout << "\tCommands are read one per line from the named pipe, " << DAEMON_PIPE_DEFAULT_NAME << " by default, or from standard input " <<
+			"with '-' as pipe name, and each is answered with a line starting with 'ok' or 'error'. The commands are: " <<
+			"'play <file>', 'queue <file>' to play a file without a gap after the current and queued ones, 'stop', " <<
+			"'seek <ms>', 'pause', 'resume', 'tempo <scale>', 'status' and 'quit'." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for render mode: " << std::endl;
+		std::cout << "\tThe song is rendered as fast as the CPU allows, 44100 Hz, 16-bit stereo. " <<
+			"An output file name ending with '.wav' produces a WAV file, any other name raw PCM data." << std::endl;
+		std::cout << "\tTo use the built-in instruments instead of a DLS file, use the '" << convertWCharToStdStringWinAPI(DLS_FILE_NONE) << "' as DLS file." << std::endl;
+		std::cout << "\tDense songs are rendered by all processor cores, every core taking a part of the MIDI channels. " <<
+			"Set the number of threads to 1 to render on a single core." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for batch mode: " << std::endl;
+		std::cout << "\tThe input is a directory with .mid files or a text file with one MIDI file path per line. " <<
+			"Every file is rendered as in render mode into a WAV file of the same name in the output directory." << std::endl;
+		std::cout << "\tBy default one thread per processor core is used. All threads share one DLS file in memory." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for cache mode: " << std::endl;
+		std::cout << "\tThe input is the same as in batch mode. Next to every MIDI file a song cache named like the file with '" <<
+			SONG_CACHE_EXTENSION << "' appended is written, holding the merged timeline ready to be mapped into memory. " <<
+			"Caches which are up to date are kept." << std::endl;
+		std::cout << "\tWinMM, synth and render modes use the cache of the MIDI file when there is one and the MIDI file has not changed since. " <<
+			"A changed file is played from the file until its cache is built again." << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "Notes for bank mode: " << std::endl;
+		std::cout << "\tNext to the DLS file a snapshot named like the file with '" << BANK_SNAPSHOT_EXTENSION << "' appended is written, " <<
+			"holding the instrument index, the regions and the waves as 16-bit mono samples, ready to be mapped into memory. " <<
+			"The player reports the load time and the resident memory with the DLS file and with the snapshot." << std::endl;
+		std::cout << "\tAll modes which load a DLS file use its snapshot when there is one and the DLS file has not changed since." << std::endl;
 		std::cout << std::endl;
 
 		std::cout << "Examples: " << std::endl;
 		std::cout << "\ttool.exe DS -1 0 gm.dls music.mid" << std::endl;
 		std::cout << "\ttool.exe DS -1 0 - music.mid" << std::endl;
 		std::cout << "\ttool.exe MM 1 music.mid" << std::endl;
+		std::cout << "\ttool.exe MM 1 music.mid timing.json" << std::endl;
+		std::cout << "\ttool.exe STREAM 1 black.mid" << std::endl;
+		std::cout << "\ttool.exe MCI 1 music.mid" << std::endl;
+		std::cout << "\ttool.exe SYNTH -1 gm.dls music.mid 128" << std::endl;
+		std::cout << "\ttool.exe THRU 0 MM 1" << std::endl;
+		std::cout << "\ttool.exe THRU 0 SYNTH -1 gm.dls 64" << std::endl;
+		std::cout << "\ttool.exe THRU 0 FILE take.mid" << std::endl;
+		std::cout << "\ttool.exe PLAYLIST DS 0 gm.dls songs" << std::endl;
+		std::cout << "\ttool.exe PLAYLIST SYNTH -1 gm.dls playlist.txt 256" << std::endl;
+		std::cout << "\ttool.exe DAEMON SYNTH -1 gm.dls" << std::endl;
+		std::cout << "\ttool.exe DAEMON MM 1 - -" << std::endl;
+		std::cout << "\ttool.exe RENDER gm.dls music.mid music.wav" << std::endl;
+		std::cout << "\ttool.exe BATCH gm.dls songs rendered" << std::endl;
+		std::cout << "\ttool.exe CACHE songs" << std::endl;
+		std::cout << "\ttool.exe BANK gm.dls" << std::endl;
 		std::cout << std::endl;
 
 		ListMidiOutDevicesWithWinmm();
+		ListMidiInDevicesWithWinmm();
 
 		hr = ListDevices();
 		if (FAILED(hr))
@@ -804,20 +2220,12 @@ int main(int argc, char* argv[])
 			return 1;
 		}
 
-		char* ds_device_index_str = argv[1 + 1]; // Index of a DirectSound output device, starting from 0
-		char* midi_output_device_index_str = argv[1 + 2]; // Index of a MIDI output device, starting from 0
+		char* ds_device_index_str = argv[1 + 1]; // Index, name or GUID of a DirectSound output device, starting from 0
+		char* midi_output_device_index_str = argv[1 + 2]; // Index, name or GUID of a MIDI output device, starting from 0
 		char* dls_file = argv[1 + 3]; // DLS file
 		midi_file = argv[1 + 4]; // MIDI file
 
-		int ds_device_idx = std::atoi(ds_device_index_str);
-		midi_output_device_idx = std::atoi(midi_output_device_index_str);
-
-		WCHAR dls_file_w[MAX_PATH];
-		MultiByteToWideChar(CP_ACP, 0, dls_file, -1, dls_file_w, MAX_PATH);
-		WCHAR midi_file_w[MAX_PATH];
-		MultiByteToWideChar(CP_ACP, 0, midi_file, -1, midi_file_w, MAX_PATH);
-
-		hr = Initialise(ds_device_idx, midi_output_device_idx, dls_file_w);
+		hr = Initialise(ds_device_index_str, midi_output_device_index_str, dls_file);
 		if (FAILED(hr))
 		{
 			std::cerr << "DirectMusic failed to initialise." << std::endl;
@@ -828,7 +2236,7 @@ int main(int argc, char* argv[])
 
 		std::cout << "Playing MIDI file: " << midi_file << std::endl;
 		std::cout << "Press Enter to stop ..." << std::endl;
-		hr = PlayMidi(midi_file_w, isExternalSynth);
+		hr = PlayMidi(midi_file, isExternalSynth);
 		if (FAILED(hr))
 		{
 			std::cerr << "Failed to play MIDI file." << std::endl;
@@ -849,14 +2257,55 @@ int main(int argc, char* argv[])
 			return 1;
 		}
 
+		char* midi_output_device_index_str = argv[1 + 1]; // Index of a MIDI output device, starting from 0
+		midi_file = argv[1 + 2]; // MIDI file
+		char* report_file = (argc > 1 + 3) ? argv[1 + 3] : nullptr; // Optional JSON timing report
+
+		midi_output_device_idx = ResolveDeviceIndex(DEVICE_MIDI_OUTPUT, midi_output_device_index_str);
+
+		ListMidiOutDevicesWithWinmm();
+
+		int err = playMidiWithWinmm(midi_output_device_idx, midi_file, report_file);
+		if (err != 0) {
+			return err;
+		}
+
+		return 0;
+	}
+	else if (workModeStr == "STREAM")
+	{
+		if (argc <= 1 + 2)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* midi_output_device_index_str = argv[1 + 1]; // Index of a MIDI output device, starting from 0
+		midi_file = argv[1 + 2]; // MIDI file
+		char* report_file = (argc > 1 + 3) ? argv[1 + 3] : nullptr; // Optional JSON timing report
+
+		midi_output_device_idx = ResolveDeviceIndex(DEVICE_MIDI_OUTPUT, midi_output_device_index_str);
+
+		ListMidiOutDevicesWithWinmm();
+
+		return playMidiStreamingWithWinmm(midi_output_device_idx, midi_file, report_file);
+	}
+	else if (workModeStr == "MCI")
+	{
+		if (argc <= 1 + 2)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
 		char* midi_output_device_index_str = argv[1 + 1]; // Index of a MIDI output device, starting from 0
 		midi_file = argv[1 + 2]; // MIDI file
 
-		midi_output_device_idx = std::atoi(midi_output_device_index_str);
+		midi_output_device_idx = ResolveDeviceIndex(DEVICE_MIDI_OUTPUT, midi_output_device_index_str);
 
 		ListMidiOutDevicesWithWinmm();
 
-		int err = playMidiWithWinmm(midi_output_device_idx, midi_file);
+		int err = playMidiWithMci(midi_output_device_idx, midi_file);
 		if (err != 0) {
 			return err;
 		}
@@ -864,6 +2313,134 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	else if (workModeStr == "SYNTH")
+	{
+		if (argc <= 1 + 3)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* ds_device_index_str = argv[1 + 1]; // Index of a DirectSound output device, or 'null'
+		char* dls_file = argv[1 + 2]; // DLS file
+		midi_file = argv[1 + 3]; // MIDI file
+		uint32_t blockFrames = (argc > 1 + 4) ? uint32_t(std::atoi(argv[1 + 4])) : AUDIO_DEFAULT_BLOCK_FRAMES;
+		char* report_file = (argc > 1 + 5) ? argv[1 + 5] : nullptr; // Optional JSON timing report
+
+		return playMidiWithSynth(ds_device_index_str, dls_file, midi_file, blockFrames, report_file);
+	}
+
+	else if (workModeStr == "THRU")
+	{
+		if (argc <= 1 + 3)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		int midi_input_device_idx = std::atoi(argv[1 + 1]); // Index of a WinMM MIDI input device, starting from 0
+		char* output_mode = argv[1 + 2]; // MM, DS, SYNTH or FILE
+		char* output_device_str = argv[1 + 3]; // Index of the output device, the MIDI file to write with FILE
+		std::string noDlsFile = convertWCharToStdStringWinAPI(DLS_FILE_NONE);
+		char* dls_file = (argc > 1 + 4) ? argv[1 + 4] : &noDlsFile[0]; // DLS file, none by default
+		uint32_t blockFrames = (argc > 1 + 5) ? uint32_t(std::atoi(argv[1 + 5])) : AUDIO_MIN_BLOCK_FRAMES;
+
+		return thruMidi(midi_input_device_idx, output_mode, output_device_str, dls_file, blockFrames);
+	}
+
+	else if (workModeStr == "PLAYLIST")
+	{
+		if (argc <= 1 + 4)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* output_mode = argv[1 + 1]; // MM, DS, SYNTH or FILE
+		char* output_device_str = argv[1 + 2]; // Index of the output device, the MIDI file to write with FILE
+		char* dls_file = argv[1 + 3]; // DLS file
+		char* input = argv[1 + 4]; // Directory or list file
+		uint32_t blockFrames = (argc > 1 + 5) ? uint32_t(std::atoi(argv[1 + 5])) : AUDIO_DEFAULT_BLOCK_FRAMES;
+		const char* report_file = (argc > 1 + 6) ? argv[1 + 6] : nullptr; // Timing report file
+
+		return playPlaylist(output_mode, output_device_str, dls_file, input, blockFrames, report_file);
+	}
+	else if (workModeStr == "DAEMON")
+	{
+		if (argc <= 1 + 3)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* output_mode = argv[1 + 1]; // MM, DS, SYNTH or FILE
+		char* output_device_str = argv[1 + 2]; // Index of the output device, the MIDI file to write with FILE
+		char* dls_file = argv[1 + 3]; // DLS file
+		const char* pipe_name = (argc > 1 + 4) ? argv[1 + 4] : DAEMON_PIPE_DEFAULT_NAME; // '-' for standard input
+		uint32_t blockFrames = (argc > 1 + 5) ? uint32_t(std::atoi(argv[1 + 5])) : AUDIO_DEFAULT_BLOCK_FRAMES;
+
+		return runDaemon(output_mode, output_device_str, dls_file, pipe_name, blockFrames);
+	}
+
+	else if (workModeStr == "RENDER")
+	{
+		if (argc <= 1 + 3)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* dls_file = argv[1 + 1]; // DLS file
+		midi_file = argv[1 + 2]; // MIDI file
+		char* output_file = argv[1 + 3]; // WAV or raw PCM file
+		unsigned threads = (argc > 1 + 4) ? unsigned(std::atoi(argv[1 + 4])) : 0; // 0 is one per core
+
+		return renderMidiToFile(dls_file, midi_file, output_file, threads);
+	}
+
+	else if (workModeStr == "BATCH")
+	{
+		if (argc <= 1 + 3)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* dls_file = argv[1 + 1]; // DLS file
+		char* input = argv[1 + 2]; // Directory or list file
+		char* output_dir = argv[1 + 3]; // Output directory
+		unsigned threads = (argc > 1 + 4) ? unsigned(std::atoi(argv[1 + 4])) : 0; // 0 is one per core
+
+		return renderMidiBatch(dls_file, input, output_dir, threads);
+	}
+
+	else if (workModeStr == "CACHE")
+	{
+		if (argc <= 1 + 1)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* input = argv[1 + 1]; // Directory or list file
+		unsigned threads = (argc > 1 + 2) ? unsigned(std::atoi(argv[1 + 2])) : 0; // 0 is one per core
+
+		return buildSongCaches(input, threads);
+	}
+
+	else if (workModeStr == "BANK")
+	{
+		if (argc <= 1 + 1)
+		{
+			std::cerr << "Arguments are not set." << std::endl;
+			return 1;
+		}
+
+		char* dls_file = argv[1 + 1]; // DLS file
+
+		return buildBankSnapshot(dls_file);
+	}
+
 	std::cerr << "Unknown work mode: " << workModeStr << std::endl;
 	return 1;
 }
@@ -0,0 +1,26 @@
+#include "midi_input.h"
+
+#include "hires_clock.h"
+#include "smf.h"
+
+bool LoopbackMidiInput::ShortMessage(uint32_t message) {
+	MidiInputHandler* h = handler.load();
+	if (h) {
+		h->OnShortMessage(message, NowNanos());
+	}
+	return true;
+}
+
+bool LoopbackMidiInput::LongMessage(const uint8_t* data, uint32_t length) {
+	MidiInputHandler* h = handler.load();
+	if (h) {
+		h->OnLongMessage(data, length, NowNanos());
+	}
+	return true;
+}
+
+void LoopbackMidiInput::Reset() {
+	for (uint8_t ch = 0; ch < 16; ch++) {
+		ShortMessage(PackShortMessage(0xB0 | ch, 123, 0));
+	}
+}
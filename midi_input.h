@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "midi_sink.h"
+
+// Receiver of live MIDI input.
+class MidiInputHandler {
+public:
+	virtual ~MidiInputHandler() {}
+
+	// Called on the thread of the input, 'ingressNs' is the NowNanos() time at which the message arrived.
+	virtual void OnShortMessage(uint32_t message, int64_t ingressNs) = 0;
+
+	// Complete SysEx message including the leading 0xF0, valid during the call only.
+	virtual void OnLongMessage(const uint8_t* data, uint32_t length, int64_t ingressNs) = 0;
+};
+
+// Source of live MIDI messages, e.g. a MIDI In port.
+class MidiInput {
+public:
+	virtual ~MidiInput() {}
+
+	// Delivers messages to the handler until Stop(). The handler must stay alive until then.
+	virtual bool Start(MidiInputHandler& handler, std::string& err) = 0;
+	virtual void Stop() = 0;
+};
+
+// Virtual MIDI cable: whatever is sent to its sink side arrives at its input
+// side, on the sending thread and without any buffering. With the sequencer on
+// the sink side it stands in for a keyboard, so the thru path can be tested and
+// measured without MIDI hardware.
+class LoopbackMidiInput : public MidiInput, public MidiSink {
+public:
+	LoopbackMidiInput() : handler(nullptr) {}
+
+	bool Start(MidiInputHandler& h, std::string&) { handler.store(&h); return true; }
+	void Stop() { handler.store(nullptr); }
+
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+
+	// Sends All Notes Off on every channel, as a keyboard does not know about resets.
+	void Reset();
+
+private:
+	std::atomic<MidiInputHandler*> handler;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A MIDI message with its song time, as submitted in batches by the sequencer.
+struct MidiSinkEvent {
+	int64_t timeUs;      // Song time of the message, as played: moved on by pauses and scaled by the tempo.
+	uint32_t message;    // Packed short message; 0 for long messages.
+	uint32_t length;     // Long messages: number of bytes.
+	const uint8_t* data; // Long messages: message bytes, valid during the call only.
+};
+
+// Destination of MIDI messages produced by the player.
+// Implementations are called from the sequencer thread only.
+class MidiSink {
+public:
+	virtual ~MidiSink() {}
+
+	// Channel message packed as in midiOutShortMsg: status | data1 << 8 | data2 << 16.
+	// Behind a MidiOutputOptimizer with running status a message may come without
+	// its status byte, as data1 | data2 << 8.
+	virtual bool ShortMessage(uint32_t message) = 0;
+
+	// Complete SysEx message including the leading 0xF0, or raw bytes of an 0xF7 escape.
+	virtual bool LongMessage(const uint8_t* data, uint32_t length) = 0;
+
+	// Silences all notes and resets controllers.
+	virtual void Reset() = 0;
+
+	// Messages which are due at the same time. Sinks which can send several
+	// messages at once or which record song time override this.
+	virtual bool SubmitBatch(const MidiSinkEvent* events, size_t count) {
+		bool ok = true;
+		for (size_t i = 0; i < count; i++) {
+			if (events[i].data) {
+				ok = LongMessage(events[i].data, events[i].length) && ok;
+			}
+			else {
+				ok = ShortMessage(events[i].message) && ok;
+			}
+		}
+		return ok;
+	}
+};
+
+// Sink which drops everything. Used to measure the sequencer itself.
+class NullMidiSink : public MidiSink {
+public:
+	NullMidiSink() : shortCount(0), longCount(0), longBytes(0) {}
+
+	bool ShortMessage(uint32_t) { shortCount++; return true; }
+	bool LongMessage(const uint8_t*, uint32_t length) { longCount++; longBytes += length; return true; }
+	void Reset() {}
+
+	uint64_t shortCount;
+	uint64_t longCount;
+	uint64_t longBytes;
+};
@@ -0,0 +1,93 @@
+#include "midi_state.h"
+
+#include <cstring>
+
+#include "smf.h"
+
+void MidiState::Reset() {
+	for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+		channels[ch].program = MIDI_VALUE_UNSET;
+		channels[ch].channelPressure = MIDI_VALUE_UNSET;
+		channels[ch].pitchBend = MIDI_PITCH_BEND_UNSET;
+		memset(channels[ch].controllers, MIDI_VALUE_UNSET, sizeof(channels[ch].controllers));
+	}
+}
+
+void MidiState::Apply(uint8_t status, uint8_t data1, uint8_t data2) {
+	MidiChannelState& ch = channels[status & 0x0F];
+
+	switch (status & 0xF0) {
+	case 0xB0:
+		// Channel mode messages (120 - 127) are not state.
+		if (data1 < 120) {
+			ch.controllers[data1] = data2;
+		}
+		else if (data1 == 121) {
+			// Reset All Controllers.
+			memset(ch.controllers, MIDI_VALUE_UNSET, sizeof(ch.controllers));
+			ch.pitchBend = MIDI_PITCH_BEND_UNSET;
+			ch.channelPressure = MIDI_VALUE_UNSET;
+		}
+		break;
+	case 0xC0:
+		ch.program = data1;
+		break;
+	case 0xD0:
+		ch.channelPressure = data1;
+		break;
+	case 0xE0:
+		ch.pitchBend = uint16_t(data1 | (data2 << 7));
+		break;
+	}
+}
+
+size_t MidiState::ChaseMessages(uint32_t* out, size_t maxCount) const {
+	// Bank select, then RPN / NRPN selection, then data entry, then everything else.
+	static const uint8_t firstControllers[] = { 0, 32 };
+	static const uint8_t parameterControllers[] = { 99, 98, 101, 100, 6, 38 };
+
+	size_t count = 0;
+	for (int chIdx = 0; chIdx < MIDI_CHANNELS; chIdx++) {
+		const MidiChannelState& ch = channels[chIdx];
+		uint8_t cc = uint8_t(0xB0 | chIdx);
+
+		for (size_t i = 0; i < sizeof(firstControllers); i++) {
+			uint8_t num = firstControllers[i];
+			if ((ch.controllers[num] != MIDI_VALUE_UNSET) && (count < maxCount)) {
+				out[count++] = PackShortMessage(cc, num, ch.controllers[num]);
+			}
+		}
+		if ((ch.program != MIDI_VALUE_UNSET) && (count < maxCount)) {
+			out[count++] = PackShortMessage(uint8_t(0xC0 | chIdx), ch.program, 0);
+		}
+		for (size_t i = 0; i < sizeof(parameterControllers); i++) {
+			uint8_t num = parameterControllers[i];
+			if ((ch.controllers[num] != MIDI_VALUE_UNSET) && (count < maxCount)) {
+				out[count++] = PackShortMessage(cc, num, ch.controllers[num]);
+			}
+		}
+		for (uint8_t num = 0; num < 120; num++) {
+			if ((num == 0) || (num == 32) || (num == 6) || (num == 38) || ((num >= 98) && (num <= 101))) {
+				continue;
+			}
+			if ((ch.controllers[num] != MIDI_VALUE_UNSET) && (count < maxCount)) {
+				out[count++] = PackShortMessage(cc, num, ch.controllers[num]);
+			}
+		}
+		if ((ch.pitchBend != MIDI_PITCH_BEND_UNSET) && (count < maxCount)) {
+			out[count++] = PackShortMessage(uint8_t(0xE0 | chIdx), uint8_t(ch.pitchBend & 0x7F), uint8_t(ch.pitchBend >> 7));
+		}
+		if ((ch.channelPressure != MIDI_VALUE_UNSET) && (count < maxCount)) {
+			out[count++] = PackShortMessage(uint8_t(0xD0 | chIdx), ch.channelPressure, 0);
+		}
+	}
+
+	return count;
+}
+
+bool operator==(const MidiChannelState& a, const MidiChannelState& b) {
+	return (a.program == b.program) &&
+		(a.channelPressure == b.channelPressure) &&
+		(a.pitchBend == b.pitchBend) &&
+		(memcmp(a.controllers, b.controllers, sizeof(a.controllers)) == 0);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+const int MIDI_CHANNELS = 16;
+const uint8_t MIDI_VALUE_UNSET = 0xFF;
+const uint16_t MIDI_PITCH_BEND_UNSET = 0xFFFF;
+
+// Controller and program state of a single MIDI channel.
+// Values which were never set hold MIDI_VALUE_UNSET / MIDI_PITCH_BEND_UNSET.
+struct MidiChannelState {
+	uint8_t program;
+	uint8_t channelPressure;
+	uint16_t pitchBend;
+	uint8_t controllers[128];
+};
+
+// Channel state of all 16 channels, updated by channel messages.
+// Used to chase controllers and programs when playback starts in the middle of a song.
+struct MidiState {
+	MidiChannelState channels[MIDI_CHANNELS];
+
+	void Reset();
+	void Apply(uint8_t status, uint8_t data1, uint8_t data2);
+
+	// Writes packed short messages which bring a reset device into this state.
+	// Bank select precedes the program change, RPN / NRPN selection precedes data entry.
+	// Returns the number of messages written, at most maxCount.
+	size_t ChaseMessages(uint32_t* out, size_t maxCount) const;
+};
+
+// Upper bound of the number of messages produced by MidiState::ChaseMessages.
+const size_t MIDI_CHASE_MAX_MESSAGES = MIDI_CHANNELS * (128 + 3);
+
+bool operator==(const MidiChannelState& a, const MidiChannelState& b);
+inline bool operator!=(const MidiChannelState& a, const MidiChannelState& b) { return !(a == b); }
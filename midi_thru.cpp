@@ -0,0 +1,115 @@
+#include "midi_thru.h"
+
+#include <chrono>
+
+#include "allocation_tracker.h"
+#include "hires_clock.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h> // Link with winmm.lib
+#endif
+
+MidiThru::MidiThru(MidiSink& s) :
+	sink(s),
+	events(MIDI_THRU_EVENT_CAPACITY),
+	bytes(MIDI_THRU_BYTE_CAPACITY),
+	longMessage(MIDI_THRU_BYTE_CAPACITY),
+	latency(MIDI_THRU_LATENCY_SAMPLES),
+	messages(0),
+	failures(0),
+	dropped(0),
+	stopRequested(false)
+{
+}
+
+MidiThru::~MidiThru() {
+	Stop();
+}
+
+void MidiThru::Start() {
+	Stop();
+	stopRequested.store(false);
+	thread = std::thread(&MidiThru::Run, this);
+}
+
+void MidiThru::Stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+	stopRequested.store(true);
+	thread.join();
+}
+
+void MidiThru::OnShortMessage(uint32_t message, int64_t ingressNs) {
+	ThruEvent e;
+	e.ingressNs = ingressNs;
+	e.message = message;
+	e.length = 0;
+	if (!events.Push(e)) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void MidiThru::OnLongMessage(const uint8_t* data, uint32_t length, int64_t ingressNs) {
+	ThruEvent e;
+	e.ingressNs = ingressNs;
+	e.message = 0;
+	e.length = length;
+	// The bytes go first, so the thru thread finds them with the event.
+	if ((length == 0) || (events.FreeSpace() == 0) || !bytes.PushBulk(data, length)) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	events.Push(e);
+}
+
+void MidiThru::Forward(const ThruEvent& e) {
+	bool ok;
+	if (e.length == 0) {
+		ok = sink.ShortMessage(e.message);
+	}
+	else {
+		bytes.PopBulk(&longMessage[0], e.length);
+		ok = sink.LongMessage(&longMessage[0], e.length);
+	}
+
+	latency.Record(NowNanos() - e.ingressNs);
+	messages.fetch_add(1, std::memory_order_relaxed);
+	if (!ok) {
+		failures.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void MidiThru::Run() {
+#ifdef _WIN32
+	timeBeginPeriod(1);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+	{
+		NoAllocationScope noAllocation;
+		int64_t lastMessageUs = NowMicros();
+		while (true) {
+			ThruEvent e;
+			if (events.Pop(e)) {
+				Forward(e);
+				lastMessageUs = NowMicros();
+				continue;
+			}
+			// Everything queued before the stop has been passed on.
+			if (stopRequested.load()) {
+				break;
+			}
+			if (NowMicros() - lastMessageUs < MIDI_THRU_SPIN_US) {
+				CpuRelax();
+			}
+			else {
+				std::this_thread::sleep_for(std::chrono::microseconds(MIDI_THRU_IDLE_SLEEP_US));
+			}
+		}
+	}
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
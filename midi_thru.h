@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "latency_recorder.h"
+#include "midi_input.h"
+#include "midi_sink.h"
+#include "spsc_ring.h"
+
+/*
+
+Live MIDI thru: routes every message of a MIDI input to a sink.
+
+The input thread only copies a message into lock-free single-producer /
+single-consumer rings and returns, the thru thread passes the messages on to
+the sink. The input thread is often a driver callback, such as the one of
+WinMM, which must neither wait nor call into the output, while a sink may
+wait, e.g. the WinMM sink for a free SysEx buffer. A message which does not
+fit into the rings is dropped and counted.
+
+After a message the thru thread spins for MIDI_THRU_SPIN_US, so the messages
+of a phrase being played are passed on at once, then it sleeps for
+MIDI_THRU_IDLE_SLEEP_US at a time until the next one arrives.
+
+The latency from ingress, when the input received a message, to egress,
+when the sink has accepted it, is recorded for every message. For a MIDI port
+egress is the moment the message was handed to the driver, for the real-time
+synthesizer the moment it was queued for the next audio block.
+
+*/
+
+const size_t MIDI_THRU_LATENCY_SAMPLES = 1 << 20;
+
+class MidiThru : public MidiInputHandler {
+public:
+	explicit MidiThru(MidiSink& sink);
+	~MidiThru();
+
+	// Start before the input and stop after it: Stop() passes on what is still queued.
+	void Start();
+	void Stop();
+
+	// Input thread.
+	void OnShortMessage(uint32_t message, int64_t ingressNs);
+	void OnLongMessage(const uint8_t* data, uint32_t length, int64_t ingressNs);
+
+	uint64_t Messages() const { return messages.load(); }
+	uint64_t Failures() const { return failures.load(); }
+	uint64_t Dropped() const { return dropped.load(); }
+
+	// Only after the thru has been stopped.
+	const LatencyRecorder& Latency() const { return latency; }
+	void ClearLatency() { latency.Clear(); }
+
+private:
+	MidiThru(const MidiThru&);
+	MidiThru& operator=(const MidiThru&);
+
+	struct ThruEvent {
+		int64_t ingressNs;
+		uint32_t message; // Short messages: packed message.
+		uint32_t length;  // Long messages: number of bytes following in the byte ring, 0 for short messages.
+	};
+
+	void Run();
+	void Forward(const ThruEvent& e);
+
+	MidiSink& sink;
+	SpscRing<ThruEvent> events;
+	SpscRing<uint8_t> bytes;
+	std::vector<uint8_t> longMessage; // Thru thread: the long message taken out of the byte ring.
+	LatencyRecorder latency;
+	std::atomic<uint64_t> messages;
+	std::atomic<uint64_t> failures;
+	std::atomic<uint64_t> dropped;
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+};
+
+const size_t MIDI_THRU_EVENT_CAPACITY = 4096;
+const size_t MIDI_THRU_BYTE_CAPACITY = 64 * 1024;
+
+const int64_t MIDI_THRU_SPIN_US = 2000;
+const int64_t MIDI_THRU_IDLE_SLEEP_US = 500;
@@ -0,0 +1,81 @@
+#include "offline_renderer.h"
+
+#include <cstring>
+
+#include "hires_clock.h"
+#include "smf.h"
+
+OfflineRenderer::OfflineRenderer(const OfflineRenderOptions& options) : options(options), synth(options.synth) {
+	memset(&stats, 0, sizeof(stats));
+	pcm.resize(size_t(OFFLINE_RENDER_CHUNK) * 2);
+}
+
+void OfflineRenderer::Dispatch(const Timeline& timeline, const TimelineEvent& e) {
+	if (e.status < SMF_STATUS_SYSEX) {
+		synth.ShortMessage(PackShortMessage(e.status, e.data1, e.data2));
+	}
+	else if (e.status == SMF_STATUS_SYSEX) {
+		// The file stores the message without its leading 0xF0.
+		sysex.resize(size_t(e.payloadLength) + 1);
+		sysex[0] = SMF_STATUS_SYSEX;
+		if (e.payloadLength > 0) {
+			memcpy(&sysex[1], timeline.Payload(e), e.payloadLength);
+		}
+		synth.LongMessage(&sysex[0], uint32_t(sysex.size()));
+	}
+	else if ((e.status == SMF_STATUS_SYSEX_ESCAPE) && (e.payloadLength > 0)) {
+		synth.LongMessage(timeline.Payload(e), e.payloadLength);
+	}
+}
+
+bool OfflineRenderer::RenderFrames(PcmFileWriter& out, uint64_t frames) {
+	while (frames > 0) {
+		uint32_t n = (frames > OFFLINE_RENDER_CHUNK) ? OFFLINE_RENDER_CHUNK : uint32_t(frames);
+		synth.RenderInt16(&pcm[0], n);
+		if (!out.Write(&pcm[0], n)) {
+			return false;
+		}
+		stats.frames += n;
+		frames -= n;
+	}
+	return true;
+}
+
+bool OfflineRenderer::Render(const Timeline& timeline, InstrumentBank* bank, PcmFileWriter& out, std::string& err) {
+	memset(&stats, 0, sizeof(stats));
+	synth.Reset();
+	synth.SetInstrumentBank(bank);
+	synth.ResetStatistics();
+
+	const uint64_t sampleRate = synth.SampleRate();
+	int64_t startUs = NowMicros();
+
+	const TimelineEvent* events = timeline.Events();
+	size_t count = timeline.EventCount();
+	for (size_t i = 0; i < count; i++) {
+		uint64_t frame = (uint64_t(events[i].timeUs) * sampleRate + 500000) / 1000000;
+		if ((frame > stats.frames) && !RenderFrames(out, frame - stats.frames)) {
+			err = "can not write the rendered audio";
+			return false;
+		}
+		Dispatch(timeline, events[i]);
+		stats.events++;
+	}
+
+	// Let the released voices ring out.
+	uint64_t tailFrames = uint64_t(options.maxTailMs) * sampleRate / 1000;
+	uint64_t tailEnd = stats.frames + tailFrames;
+	while ((synth.ActiveVoices() > 0) && (stats.frames < tailEnd)) {
+		uint64_t n = tailEnd - stats.frames;
+		if (!RenderFrames(out, n > OFFLINE_RENDER_CHUNK ? OFFLINE_RENDER_CHUNK : n)) {
+			err = "can not write the rendered audio";
+			return false;
+		}
+	}
+
+	stats.renderUs = NowMicros() - startUs;
+	stats.songUs = int64_t(stats.frames * 1000000 / sampleRate);
+	stats.peakVoices = synth.PeakVoices();
+	stats.stolenVoices = synth.StolenVoices();
+	return true;
+}
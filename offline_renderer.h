@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "instrument_bank.h"
+#include "pcm_file_writer.h"
+#include "synth.h"
+#include "timeline.h"
+
+/*
+
+Renders a whole timeline through the software synthesizer into a PCM file as
+fast as the CPU allows. Events are applied at the exact frame of their song
+time; the audio between two event times is rendered in one piece of up to
+OFFLINE_RENDER_CHUNK frames. After the last event the render continues until
+all voices have died out or the tail limit is reached.
+
+A renderer owns its synthesizer and can be reused for many songs, one at a
+time. The instrument bank is only read.
+
+*/
+
+const uint32_t OFFLINE_RENDER_CHUNK = 4096;
+
+struct OfflineRenderOptions {
+	OfflineRenderOptions() : maxTailMs(5000) {}
+
+	SynthConfig synth;
+	uint32_t maxTailMs; // Longest time rendered after the last event.
+};
+
+struct OfflineRenderStats {
+	uint64_t frames;
+	int64_t songUs;        // Length of the rendered audio.
+	int64_t renderUs;      // Wall clock time of the render.
+	uint64_t events;
+	uint32_t peakVoices;
+	uint64_t stolenVoices;
+
+	// Song time per wall clock time; 0 if nothing was rendered.
+	double RealtimeFactor() const { return renderUs > 0 ? double(songUs) / double(renderUs) : 0.0; }
+};
+
+class OfflineRenderer {
+public:
+	explicit OfflineRenderer(const OfflineRenderOptions& options);
+
+	bool Render(const Timeline& timeline, InstrumentBank* bank, PcmFileWriter& out, std::string& err);
+
+	const OfflineRenderStats& Stats() const { return stats; }
+	Synth& GetSynth() { return synth; }
+
+private:
+	void Dispatch(const Timeline& timeline, const TimelineEvent& e);
+	bool RenderFrames(PcmFileWriter& out, uint64_t frames);
+
+	OfflineRenderOptions options;
+	Synth synth;
+	OfflineRenderStats stats;
+	std::vector<int16_t> pcm;
+	std::vector<uint8_t> sysex;
+};
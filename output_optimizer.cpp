@@ -0,0 +1,165 @@
+#include "output_optimizer.h"
+
+#include <cstring>
+
+#include "sequencer.h"
+#include "smf.h"
+
+namespace {
+
+// Bytes of a short message on the wire, including the status byte.
+uint32_t WireLength(uint8_t status) {
+	if (status < 0xF0) {
+		return uint32_t(ChannelMessageLength(status));
+	}
+	switch (status) {
+	case 0xF1: case 0xF3:
+		return 2;
+	case 0xF2:
+		return 3;
+	}
+	return 1;
+}
+
+}
+
+MidiOutputOptimizer::MidiOutputOptimizer(MidiSink& s, const MidiOutputOptimizerOptions& o) :
+	sink(s),
+	options(o),
+	runningStatus(0),
+	bankSelected(0)
+{
+	state.Reset();
+	batch.reserve(SEQUENCER_MAX_BATCH);
+	memset(&stats, 0, sizeof(stats));
+}
+
+bool MidiOutputOptimizer::IsRedundant(uint8_t status, uint8_t data1, uint8_t data2) const {
+	const MidiChannelState& ch = state.channels[status & 0x0F];
+	switch (status & 0xF0) {
+	case 0xB0:
+		// Data entry and increment / decrement act on the selected parameter, channel mode messages are commands.
+		// The parameter selection passes too: the state does not tell whether an RPN or an NRPN was selected last.
+		if ((data1 == 6) || (data1 == 38) || ((data1 >= 96) && (data1 <= 101)) || (data1 >= 120)) {
+			return false;
+		}
+		return ch.controllers[data1] == data2;
+	case 0xC0:
+		// Bank select takes effect with the next program change, even of the same program.
+		return (ch.program == data1) && !(bankSelected & (1 << (status & 0x0F)));
+	case 0xD0:
+		return ch.channelPressure == data1;
+	case 0xE0:
+		return ch.pitchBend == uint16_t(data1 | (data2 << 7));
+	}
+	return false;
+}
+
+bool MidiOutputOptimizer::Optimize(uint32_t message, uint32_t& out) {
+	uint8_t status = uint8_t(message);
+	uint8_t data1 = uint8_t(message >> 8);
+	uint8_t data2 = uint8_t(message >> 16);
+	uint32_t length = WireLength(status);
+	stats.messagesIn++;
+	stats.bytesIn += length;
+
+	if (status >= 0xF0) {
+		// Real-time messages leave the running status alone, system common messages cancel it.
+		if (status < 0xF8) {
+			runningStatus = 0;
+		}
+		out = message;
+		stats.messagesOut++;
+		stats.bytesOut += length;
+		return true;
+	}
+
+	if (options.dropRedundant && IsRedundant(status, data1, data2)) {
+		stats.redundant++;
+		return false;
+	}
+	state.Apply(status, data1, data2);
+	if (((status & 0xF0) == 0xB0) && ((data1 == 0) || (data1 == 32))) {
+		bankSelected |= uint16_t(1 << (status & 0x0F));
+	}
+	else if ((status & 0xF0) == 0xC0) {
+		bankSelected &= uint16_t(~(1 << (status & 0x0F)));
+	}
+
+	if (options.noteOffAsNoteOn && options.runningStatus && ((status & 0xF0) == 0x80) && (runningStatus == (0x90 | (status & 0x0F)))) {
+		status = runningStatus;
+		data2 = 0;
+		stats.noteOffsAsNoteOns++;
+	}
+
+	out = PackShortMessage(status, data1, data2);
+	if (options.runningStatus && (status == runningStatus)) {
+		out >>= 8;
+		length--;
+		stats.runningStatus++;
+	}
+	runningStatus = status;
+	stats.messagesOut++;
+	stats.bytesOut += length;
+	return true;
+}
+
+void MidiOutputOptimizer::CountLong(uint32_t length) {
+	// The device may change any channel state on SysEx, e.g. on a GS reset.
+	runningStatus = 0;
+	state.Reset();
+	bankSelected = 0;
+	stats.messagesIn++;
+	stats.messagesOut++;
+	stats.bytesIn += length;
+	stats.bytesOut += length;
+}
+
+bool MidiOutputOptimizer::ShortMessage(uint32_t message) {
+	uint32_t out = 0;
+	return !Optimize(message, out) || sink.ShortMessage(out);
+}
+
+bool MidiOutputOptimizer::LongMessage(const uint8_t* data, uint32_t length) {
+	CountLong(length);
+	return sink.LongMessage(data, length);
+}
+
+void MidiOutputOptimizer::Reset() {
+	runningStatus = 0;
+	state.Reset();
+	bankSelected = 0;
+	sink.Reset();
+}
+
+bool MidiOutputOptimizer::SubmitBatch(const MidiSinkEvent* events, size_t count) {
+	batch.clear();
+	for (size_t i = 0; i < count; i++) {
+		MidiSinkEvent e = events[i];
+		if (e.data) {
+			CountLong(e.length);
+		}
+		else if (!Optimize(e.message, e.message)) {
+			continue;
+		}
+		batch.push_back(e);
+	}
+	return batch.empty() || sink.SubmitBatch(&batch[0], batch.size());
+}
+
+uint32_t RunningStatusDecoder::Decode(uint32_t message) {
+	uint8_t first = uint8_t(message);
+	if (first >= 0x80) {
+		if (first < 0xF0) {
+			status = first;
+		}
+		else if (first < 0xF8) {
+			status = 0;
+		}
+		return message;
+	}
+	if (status == 0) {
+		return 0;
+	}
+	return (message << 8) | status;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "midi_sink.h"
+#include "midi_state.h"
+
+/*
+
+Output stage which sends fewer bytes to a slow MIDI link.
+
+A MIDI DIN cable carries 3125 bytes per second, so a dense chord or a burst of
+controllers takes milliseconds on the wire. The optimizer sits between the
+sequencer and the sink and
+
+- leaves out the status byte of a message with the same status as the one
+  before it (running status); the message is passed on as data1 | data2 << 8,
+  which only sinks that send the bytes as given, like WinMM, accept,
+- drops controller, program, channel pressure and pitch bend messages which
+  set a value the channel already has. Data entry, increment / decrement and
+  the RPN / NRPN selection always pass, as does a program change after a bank
+  select, and the state is forgotten after SysEx and resets, which may change
+  it behind the optimizer's back,
+- sends a note-off as note-on with velocity 0 when that continues the running
+  status of a note-on; the release velocity is lost, which few devices use.
+
+SysEx and system common messages cancel running status, real-time messages do
+not. RunningStatusDecoder restores the status bytes on the receiving side, so
+the result can be checked against the unoptimized stream, e.g. through a
+RecordingMidiSink.
+
+*/
+
+struct MidiOutputOptimizerOptions {
+	MidiOutputOptimizerOptions() : runningStatus(true), dropRedundant(true), noteOffAsNoteOn(true) {}
+
+	bool runningStatus;
+	bool dropRedundant;
+	bool noteOffAsNoteOn;
+};
+
+struct MidiOutputOptimizerStats {
+	uint64_t messagesIn;
+	uint64_t messagesOut;
+	uint64_t bytesIn;           // Bytes the messages take on the wire without the optimizer.
+	uint64_t bytesOut;
+	uint64_t runningStatus;     // Status bytes left out.
+	uint64_t redundant;         // Messages dropped because they did not change the channel.
+	uint64_t noteOffsAsNoteOns;
+
+	uint64_t BytesSaved() const { return bytesIn - bytesOut; }
+};
+
+class MidiOutputOptimizer : public MidiSink {
+public:
+	// The sink must outlive the optimizer.
+	MidiOutputOptimizer(MidiSink& sink, const MidiOutputOptimizerOptions& options);
+
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+	bool SubmitBatch(const MidiSinkEvent* events, size_t count);
+
+	const MidiOutputOptimizerStats& Stats() const { return stats; }
+
+private:
+	MidiOutputOptimizer(const MidiOutputOptimizer&);
+	MidiOutputOptimizer& operator=(const MidiOutputOptimizer&);
+
+	// False if the message is dropped, otherwise the message to send.
+	bool Optimize(uint32_t message, uint32_t& out);
+	void CountLong(uint32_t length);
+	bool IsRedundant(uint8_t status, uint8_t data1, uint8_t data2) const;
+
+	MidiSink& sink;
+	MidiOutputOptimizerOptions options;
+	MidiState state;          // What the device has been sent since the last reset.
+	uint8_t runningStatus;    // 0 if there is none.
+	uint16_t bankSelected;    // Channels sent a bank select since their last program change, bit per channel.
+	std::vector<MidiSinkEvent> batch;
+	MidiOutputOptimizerStats stats;
+};
+
+// Restores packed short messages from a stream sent with running status.
+class RunningStatusDecoder {
+public:
+	RunningStatusDecoder() : status(0) {}
+
+	// The complete message, or 0 for data bytes without a running status.
+	uint32_t Decode(uint32_t message);
+
+	// SysEx or a reset: the next message carries its status byte.
+	void Cancel() { status = 0; }
+
+private:
+	uint8_t status;
+};
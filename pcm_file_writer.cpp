@@ -0,0 +1,114 @@
+#include "pcm_file_writer.h"
+
+#include <cctype>
+#include <cstring>
+
+static const uint32_t WAV_HEADER_SIZE = 44;
+
+// Largest data chunk a RIFF file can describe.
+static const uint64_t WAV_MAX_DATA_BYTES = 0xFFFFFFFFull - WAV_HEADER_SIZE + 8;
+
+static void PutLE16(uint8_t* p, uint16_t v) {
+	p[0] = uint8_t(v);
+	p[1] = uint8_t(v >> 8);
+}
+
+static void PutLE32(uint8_t* p, uint32_t v) {
+	p[0] = uint8_t(v);
+	p[1] = uint8_t(v >> 8);
+	p[2] = uint8_t(v >> 16);
+	p[3] = uint8_t(v >> 24);
+}
+
+static void BuildWavHeader(uint8_t* h, uint32_t sampleRate, uint16_t channels, uint32_t dataBytes) {
+	uint16_t blockAlign = uint16_t(channels * 2);
+	memcpy(h, "RIFF", 4);
+	PutLE32(h + 4, dataBytes + WAV_HEADER_SIZE - 8);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	PutLE32(h + 16, 16);
+	PutLE16(h + 20, 1); // PCM.
+	PutLE16(h + 22, channels);
+	PutLE32(h + 24, sampleRate);
+	PutLE32(h + 28, sampleRate * blockAlign);
+	PutLE16(h + 32, blockAlign);
+	PutLE16(h + 34, 16);
+	memcpy(h + 36, "data", 4);
+	PutLE32(h + 40, dataBytes);
+}
+
+bool IsWavPath(const std::string& path) {
+	if (path.size() < 4) {
+		return false;
+	}
+	std::string ext = path.substr(path.size() - 4);
+	for (size_t i = 0; i < ext.size(); i++) {
+		ext[i] = char(tolower((unsigned char)ext[i]));
+	}
+	return ext == ".wav";
+}
+
+PcmFileWriter::PcmFileWriter() : sampleRate(0), channels(0), wavHeader(false), frames(0) {
+}
+
+PcmFileWriter::~PcmFileWriter() {
+	std::string err;
+	Close(err);
+}
+
+bool PcmFileWriter::Open(const std::string& path, uint32_t sampleRate, uint16_t channels, bool wavHeader, std::string& err) {
+	Close(err);
+
+	out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) {
+		err = "can not create file: " + path;
+		return false;
+	}
+	this->path = path;
+	this->sampleRate = sampleRate;
+	this->channels = channels;
+	this->wavHeader = wavHeader;
+	frames = 0;
+
+	if (wavHeader) {
+		uint8_t header[WAV_HEADER_SIZE];
+		BuildWavHeader(header, sampleRate, channels, 0);
+		out.write((const char*)header, sizeof(header));
+	}
+	if (!out) {
+		err = "can not write file: " + path;
+		out.close();
+		return false;
+	}
+	return true;
+}
+
+bool PcmFileWriter::Write(const int16_t* samples, uint32_t count) {
+	// Samples are little-endian in the file, as on every platform the player runs on.
+	out.write((const char*)samples, std::streamsize(count) * channels * sizeof(int16_t));
+	frames += count;
+	return bool(out);
+}
+
+bool PcmFileWriter::Close(std::string& err) {
+	if (!out.is_open()) {
+		return true;
+	}
+
+	bool ok = bool(out);
+	if (ok && wavHeader) {
+		uint64_t dataBytes = frames * channels * sizeof(int16_t);
+		if (dataBytes > WAV_MAX_DATA_BYTES) {
+			dataBytes = WAV_MAX_DATA_BYTES;
+		}
+		uint8_t header[WAV_HEADER_SIZE];
+		BuildWavHeader(header, sampleRate, channels, uint32_t(dataBytes));
+		out.seekp(0);
+		out.write((const char*)header, sizeof(header));
+		ok = bool(out);
+	}
+	out.close();
+	if (!ok) {
+		err = "can not write file: " + path;
+	}
+	return ok;
+}
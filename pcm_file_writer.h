@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Writes interleaved 16-bit PCM either as a RIFF WAVE file or as headerless raw data.
+// The WAVE header is written with zero sizes on Open and completed by Close.
+class PcmFileWriter {
+public:
+	PcmFileWriter();
+	~PcmFileWriter();
+
+	bool Open(const std::string& path, uint32_t sampleRate, uint16_t channels, bool wavHeader, std::string& err);
+	bool Write(const int16_t* samples, uint32_t frames);
+	bool Close(std::string& err);
+
+	bool IsOpen() const { return out.is_open(); }
+	uint64_t FramesWritten() const { return frames; }
+
+private:
+	PcmFileWriter(const PcmFileWriter&);
+	PcmFileWriter& operator=(const PcmFileWriter&);
+
+	std::ofstream out;
+	std::string path;
+	uint32_t sampleRate;
+	uint16_t channels;
+	bool wavHeader;
+	uint64_t frames;
+};
+
+// True if the path ends with ".wav", in any case.
+bool IsWavPath(const std::string& path);
@@ -0,0 +1,324 @@
+#include "player_daemon.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+#include "hires_clock.h"
+
+namespace {
+
+const char WHITESPACE[] = " \t\r\n";
+
+std::string Trim(const std::string& s) {
+	size_t first = s.find_first_not_of(WHITESPACE);
+	if (first == std::string::npos) {
+		return std::string();
+	}
+	size_t last = s.find_last_not_of(WHITESPACE);
+	return s.substr(first, last - first + 1);
+}
+
+}
+
+PlayerDaemon::PlayerDaemon(Sequencer& seq, MidiSink& s) :
+	sequencer(seq),
+	sink(s),
+	useCounter(0),
+	songNumber(0),
+	stopRequested(false)
+{
+	stats.commands = 0;
+	stats.songsLoaded = 0;
+	stats.warmHits = 0;
+	stats.lastStartUs = 0;
+	thread = std::thread(&PlayerDaemon::Run, this);
+}
+
+PlayerDaemon::~PlayerDaemon() {
+	stopRequested.store(true);
+	if (thread.joinable()) {
+		thread.join();
+	}
+	sequencer.Stop();
+}
+
+PlayerDaemonStats PlayerDaemon::Stats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+PlayerDaemon::SongPtr PlayerDaemon::Load(const std::string& path, std::string& err) {
+	std::map<std::string, SongPtr>::iterator it = songs.find(path);
+	if (it != songs.end()) {
+		it->second->lastUse = ++useCounter;
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.warmHits++;
+		return it->second;
+	}
+
+	SongPtr song(new Song);
+	song->path = path;
+	std::string cacheErr;
+	if (song->cache.Open(path, cacheErr)) {
+		song->timeline.Attach(song->cache.GetTimeline().Arrays());
+	}
+	else if (!song->smf.Load(path, err) || !song->timeline.Build(song->smf, err)) {
+		return SongPtr();
+	}
+	song->lastUse = ++useCounter;
+	songs[path] = song;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.songsLoaded++;
+	}
+
+	// A song which plays or is queued is still held there and is freed when it is done.
+	while (songs.size() > PLAYER_DAEMON_SONGS) {
+		std::map<std::string, SongPtr>::iterator oldest = songs.begin();
+		for (it = songs.begin(); it != songs.end(); ++it) {
+			if (it->second->lastUse < oldest->second->lastUse) {
+				oldest = it;
+			}
+		}
+		songs.erase(oldest);
+	}
+	return song;
+}
+
+// Called with the mutex held.
+void PlayerDaemon::StartSong(const SongPtr& song, int64_t startUs) {
+	// The sequencer lets go of the current and the enqueued timeline before their songs may be freed.
+	sequencer.Start(song->timeline, sink, startUs);
+	enqueued.reset();
+	playing = song;
+	songNumber = sequencer.SongNumber();
+}
+
+void PlayerDaemon::Prepare(const SongPtr& song) {
+	if (prepare) {
+		std::lock_guard<std::mutex> lock(prepareMutex);
+		prepare(song->path, song->timeline);
+	}
+}
+
+void PlayerDaemon::Advance() {
+	SongPtr next;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (enqueued && (sequencer.SongNumber() != songNumber)) {
+			// The sequencer has moved on to the enqueued song.
+			playing = enqueued;
+			enqueued.reset();
+			songNumber = sequencer.SongNumber();
+		}
+		if (playing && !sequencer.IsPlaying()) {
+			playing.reset();
+		}
+		if (enqueued || queue.empty()) {
+			return;
+		}
+		next = queue.front();
+	}
+
+	// Prepared while the current song plays, which may take a while.
+	Prepare(next);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (queue.empty() || (queue.front() != next)) {
+		// A command changed the queue meanwhile.
+		return;
+	}
+	queue.pop_front();
+	if (playing && sequencer.IsPlaying() && sequencer.Enqueue(next->timeline)) {
+		enqueued = next;
+	}
+	else {
+		// The current song ended before the next one was ready.
+		StartSong(next, 0);
+	}
+}
+
+void PlayerDaemon::Run() {
+	while (!stopRequested.load()) {
+		std::this_thread::sleep_for(std::chrono::microseconds(PLAYER_DAEMON_POLL_US));
+		Advance();
+	}
+}
+
+std::string PlayerDaemon::Play(const std::string& path, int64_t receivedUs) {
+	std::string err;
+	SongPtr song = Load(path, err);
+	if (!song) {
+		return "error " + path + ": " + err;
+	}
+	Prepare(song);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	queue.clear();
+	StartSong(song, 0);
+	stats.lastStartUs = NowMicros() - receivedUs;
+
+	std::ostringstream oss;
+	oss << "ok playing " << path << ", " << song->timeline.DurationUs() / 1000 << " ms, started in " << stats.lastStartUs << " us";
+	return oss.str();
+}
+
+std::string PlayerDaemon::Queue(const std::string& path) {
+	std::string err;
+	SongPtr song = Load(path, err);
+	if (!song) {
+		return "error " + path + ": " + err;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	queue.push_back(song);
+	std::ostringstream oss;
+	oss << "ok queued " << path << ", " << queue.size() + (enqueued ? 1 : 0) << " in the queue";
+	return oss.str();
+}
+
+std::string PlayerDaemon::Stop() {
+	std::lock_guard<std::mutex> lock(mutex);
+	sequencer.Stop();
+	queue.clear();
+	enqueued.reset();
+	playing.reset();
+	return "ok stopped";
+}
+
+std::string PlayerDaemon::Seek(const std::string& arg) {
+	char* end = nullptr;
+	double ms = strtod(arg.c_str(), &end);
+	if (arg.empty() || (*end != '\0') || (ms < 0)) {
+		return "error seek needs a position in ms";
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!playing) {
+		return "error nothing plays";
+	}
+	// Within the song playing, the enqueued one still follows.
+	if (!sequencer.Seek(int64_t(ms * 1000))) {
+		// It ended meanwhile.
+		if (enqueued) {
+			queue.push_front(enqueued);
+		}
+		StartSong(playing, int64_t(ms * 1000));
+	}
+	std::ostringstream oss;
+	oss << "ok playing " << playing->path << " from " << int64_t(ms) << " ms";
+	return oss.str();
+}
+
+std::string PlayerDaemon::Pause(bool pause) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!playing || !sequencer.IsPlaying()) {
+		return "error nothing plays";
+	}
+	std::ostringstream oss;
+	if (pause) {
+		sequencer.Pause();
+		oss << "ok paused " << playing->path << " at " << sequencer.PositionUs() / 1000 << " ms";
+	}
+	else {
+		sequencer.Resume();
+		oss << "ok playing " << playing->path;
+	}
+	return oss.str();
+}
+
+std::string PlayerDaemon::Tempo(const std::string& arg) {
+	char* end = nullptr;
+	double scale = strtod(arg.c_str(), &end);
+	if (arg.empty() || (*end != '\0') || (scale <= 0)) {
+		return "error tempo needs a scale, e.g. 1.5";
+	}
+	sequencer.SetTempoScale(scale);
+	std::ostringstream oss;
+	oss << "ok tempo " << sequencer.TempoScale();
+	return oss.str();
+}
+
+std::string PlayerDaemon::Status() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::ostringstream oss;
+	if (playing && sequencer.IsPlaying()) {
+		oss << (sequencer.IsPaused() ? "ok paused " : "ok playing ") << playing->path << " at " << sequencer.PositionUs() / 1000 << " of " <<
+			playing->timeline.DurationUs() / 1000 << " ms";
+	}
+	else {
+		oss << "ok stopped";
+	}
+	oss << ", tempo " << sequencer.TempoScale() << ", " << queue.size() + (enqueued ? 1 : 0) << " queued, " << songs.size() << " songs loaded, " << stats.warmHits <<
+		" warm starts";
+	return oss.str();
+}
+
+bool PlayerDaemon::Execute(const std::string& line, std::string& reply) {
+	int64_t receivedUs = NowMicros();
+	std::string command = Trim(line);
+	std::string arg;
+	size_t space = command.find_first_of(WHITESPACE);
+	if (space != std::string::npos) {
+		arg = Trim(command.substr(space));
+		command = command.substr(0, space);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.commands++;
+	}
+
+	if ((command == "play") || (command == "queue")) {
+		if (arg.empty()) {
+			reply = "error " + command + " needs a file";
+		}
+		else if (command == "play") {
+			reply = Play(arg, receivedUs);
+		}
+		else {
+			reply = Queue(arg);
+		}
+	}
+	else if (command == "stop") {
+		reply = Stop();
+	}
+	else if (command == "seek") {
+		reply = Seek(arg);
+	}
+	else if ((command == "pause") || (command == "resume")) {
+		reply = Pause(command == "pause");
+	}
+	else if (command == "tempo") {
+		reply = Tempo(arg);
+	}
+	else if (command == "status") {
+		reply = Status();
+	}
+	else if (command == "quit") {
+		Stop();
+		reply = "ok bye";
+		return false;
+	}
+	else {
+		reply = "error unknown command: " + command;
+	}
+	return true;
+}
+
+void PlayerDaemon::Serve(std::istream& in, std::ostream& out) {
+	std::string line;
+	std::string reply;
+	while (std::getline(in, line)) {
+		if (Trim(line).empty()) {
+			continue;
+		}
+		bool more = Execute(line, reply);
+		out << reply << std::endl;
+		if (!more) {
+			break;
+		}
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "midi_sink.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "song_cache.h"
+#include "timeline.h"
+
+/*
+
+Long-running player controlled by text commands.
+
+Starting the player for every song pays for opening the output, loading the
+DLS file and parsing the song every time. The daemon keeps the output, the
+sequencer and the instruments of the caller, and the songs it loaded, so a
+command starts a song within milliseconds. Commands come one per line from a
+control channel, e.g. a named pipe or standard input, and each is answered
+with one line which starts with "ok" or "error":
+
+	play <file>    stops what plays and starts the file
+	queue <file>   plays the file after the current and the queued ones, without a gap
+	stop           stops playback and clears the queue
+	seek <ms>      continues the current song from the position
+	pause          silences the current song and holds its position
+	resume         continues the paused song
+	tempo <scale>  plays the current and the following songs faster or slower, e.g. 0.5
+	status         what plays, the position, the length, the tempo and the queue
+	quit           stops playback and ends the daemon
+
+Songs are loaded by the command which names them, from their song cache when
+it is up to date and by parsing the file otherwise, and stay loaded until
+PLAYER_DAEMON_SONGS newer ones were loaded; one which plays or is queued
+stays alive until it is done.
+
+A monitor thread hands the next queued song to the sequencer while the
+current one plays, and starts it at once if the current one ended first.
+The prepare function runs right before a song starts or is handed to the
+sequencer, e.g. to make sure its instruments are resident, so the songs
+waiting in the queue do not push the instruments of the current one out.
+Commands are executed by one thread at a time.
+
+*/
+
+struct PlayerDaemonStats {
+	uint64_t commands;
+	uint64_t songsLoaded;   // Loaded from the song cache or parsed.
+	uint64_t warmHits;      // Songs which were loaded already.
+	int64_t lastStartUs;    // From receiving the last play command to the start of the sequencer.
+};
+
+class PlayerDaemon {
+public:
+	// Called on the thread which executes the command or on the monitor thread, never on both at once.
+	typedef std::function<void(const std::string&, const Timeline&)> PrepareFunction;
+
+	// The sequencer and the sink must outlive the daemon.
+	PlayerDaemon(Sequencer& sequencer, MidiSink& sink);
+	~PlayerDaemon();
+
+	void SetPrepare(const PrepareFunction& prepare) { this->prepare = prepare; }
+
+	// Executes one command line. False after quit.
+	bool Execute(const std::string& line, std::string& reply);
+
+	// Executes the lines read from the stream until quit or the end of the input, answering each on 'out'.
+	void Serve(std::istream& in, std::ostream& out);
+
+	PlayerDaemonStats Stats() const;
+
+private:
+	PlayerDaemon(const PlayerDaemon&);
+	PlayerDaemon& operator=(const PlayerDaemon&);
+
+	struct Song {
+		std::string path;
+		SmfFile smf;
+		SongCache cache;
+		Timeline timeline;
+		uint64_t lastUse;
+	};
+	typedef std::shared_ptr<Song> SongPtr;
+
+	SongPtr Load(const std::string& path, std::string& err);
+	void StartSong(const SongPtr& song, int64_t startUs);
+	void Prepare(const SongPtr& song);
+	void Advance();
+	void Run();
+
+	std::string Play(const std::string& path, int64_t receivedUs);
+	std::string Queue(const std::string& path);
+	std::string Stop();
+	std::string Seek(const std::string& arg);
+	std::string Pause(bool pause);
+	std::string Tempo(const std::string& arg);
+	std::string Status();
+
+	Sequencer& sequencer;
+	MidiSink& sink;
+	PrepareFunction prepare;
+	std::mutex prepareMutex;     // Held while 'prepare' runs.
+
+	// Used by the command thread only.
+	std::map<std::string, SongPtr> songs;
+	uint64_t useCounter;
+
+	// Playback state, shared with the monitor thread.
+	mutable std::mutex mutex;
+	SongPtr playing;             // The song the sequencer plays.
+	SongPtr enqueued;            // Handed to the sequencer to follow 'playing'.
+	uint32_t songNumber;         // Sequencer::SongNumber() when 'playing' started.
+	std::deque<SongPtr> queue;   // Not handed to the sequencer yet.
+	PlayerDaemonStats stats;
+
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+};
+
+// Songs kept loaded besides those which play or are queued.
+const size_t PLAYER_DAEMON_SONGS = 16;
+
+// How often the monitor thread checks the sequencer.
+const int64_t PLAYER_DAEMON_POLL_US = 5000;
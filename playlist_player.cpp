@@ -0,0 +1,121 @@
+#include "playlist_player.h"
+
+#include <chrono>
+
+#include "hires_clock.h"
+
+PlaylistPlayer::PlaylistPlayer(Sequencer& seq, MidiSink& s) :
+	sequencer(seq),
+	sink(s),
+	running(false),
+	stopRequested(false),
+	currentSong(-1)
+{
+}
+
+PlaylistPlayer::~PlaylistPlayer() {
+	Stop();
+}
+
+void PlaylistPlayer::Start(const std::vector<std::string>& files) {
+	Stop();
+
+	entries.assign(files.size(), PlaylistEntry());
+	for (size_t i = 0; i < files.size(); i++) {
+		PlaylistEntry& e = entries[i];
+		e.path = files[i];
+		e.loaded = false;
+		e.fromCache = false;
+		e.startedLate = false;
+		e.loadUs = 0;
+		e.prepareUs = 0;
+	}
+
+	currentSong.store(-1);
+	stopRequested.store(false);
+	running.store(true);
+	thread = std::thread(&PlaylistPlayer::Run, this);
+}
+
+void PlaylistPlayer::Stop() {
+	// The loader starts the sequencer, so it has to be gone before the sequencer is stopped.
+	stopRequested.store(true);
+	if (thread.joinable()) {
+		thread.join();
+	}
+	sequencer.Stop();
+}
+
+void PlaylistPlayer::Wait() {
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+// False if the player is being stopped.
+bool PlaylistPlayer::Sleep() {
+	std::this_thread::sleep_for(std::chrono::microseconds(PLAYLIST_POLL_US));
+	return !stopRequested.load();
+}
+
+bool PlaylistPlayer::Load(PlaylistEntry& entry, Slot& slot) {
+	slot.timeline.Clear();
+	slot.cache.Close();
+	slot.smf.Clear();
+
+	int64_t startUs = NowMicros();
+	std::string cacheErr;
+	if (slot.cache.Open(entry.path, cacheErr)) {
+		slot.timeline.Attach(slot.cache.GetTimeline().Arrays());
+		entry.fromCache = true;
+	}
+	else if (!slot.smf.Load(entry.path, entry.err) || !slot.timeline.Build(slot.smf, entry.err)) {
+		return false;
+	}
+	entry.loadUs = NowMicros() - startUs;
+	entry.loaded = true;
+
+	if (prepare) {
+		startUs = NowMicros();
+		prepare(entry, slot.timeline);
+		entry.prepareUs = NowMicros() - startUs;
+	}
+	return true;
+}
+
+void PlaylistPlayer::Run() {
+	int playing = -1; // Slot of the song playing.
+	size_t next = 0;
+
+	while (!stopRequested.load()) {
+		// The other slot is free: its song has been played.
+		int slot = (playing < 0) ? 0 : 1 - playing;
+		size_t song = next;
+		while ((song < entries.size()) && !stopRequested.load() && !Load(entries[song], slots[slot])) {
+			song++;
+		}
+		if ((song >= entries.size()) || stopRequested.load()) {
+			break;
+		}
+		next = song + 1;
+
+		if ((playing >= 0) && sequencer.Enqueue(slots[slot].timeline)) {
+			while (sequencer.HasQueued() && Sleep()) {
+			}
+			if (stopRequested.load()) {
+				break;
+			}
+		}
+		else {
+			// The first song, or the previous one has ended before this one was ready.
+			entries[song].startedLate = (playing >= 0);
+			sequencer.Start(slots[slot].timeline, sink);
+		}
+		playing = slot;
+		currentSong.store(int(song));
+	}
+
+	while (sequencer.IsPlaying() && Sleep()) {
+	}
+	running.store(false);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "midi_sink.h"
+#include "sequencer.h"
+#include "smf.h"
+#include "song_cache.h"
+#include "timeline.h"
+
+/*
+
+Gapless playback of a list of MIDI files.
+
+The sequencer and the sink stay open for the whole list. A loader thread
+loads the next song while the current one plays, from its song cache when the
+cache is up to date and by parsing the file otherwise, runs the prepare
+function on it, e.g. to load the instruments it needs, and queues it on the
+sequencer. The sequencer starts it exactly at the end of the current song.
+Two songs are held in memory at a time: the one playing and the next one.
+
+Files which can not be loaded are skipped. If loading a song takes longer
+than the rest of the current song, it is started as soon as it is ready,
+after the sink has been reset.
+
+*/
+
+struct PlaylistEntry {
+	std::string path;
+	bool loaded;
+	bool fromCache;
+	bool startedLate;   // The previous song had ended before this one was ready.
+	std::string err;
+	int64_t loadUs;     // Opening the song cache, or parsing and merging the file.
+	int64_t prepareUs;
+};
+
+class PlaylistPlayer {
+public:
+	// Called on the loader thread before a song is queued.
+	typedef std::function<void(const PlaylistEntry&, const Timeline&)> PrepareFunction;
+
+	// The sequencer and the sink must outlive the player.
+	PlaylistPlayer(Sequencer& sequencer, MidiSink& sink);
+	~PlaylistPlayer();
+
+	void SetPrepare(const PrepareFunction& prepare) { this->prepare = prepare; }
+
+	// Starts the loader, which starts playback with the first file it can load.
+	void Start(const std::vector<std::string>& files);
+
+	// Stops the loader and playback.
+	void Stop();
+
+	// Blocks until the last song has ended or Stop() is called.
+	void Wait();
+
+	// True until the last song has ended.
+	bool IsPlaying() const { return running.load(); }
+
+	// Index of the file playing, -1 before the first song starts.
+	int CurrentSong() const { return currentSong.load(); }
+
+	// Written by the loader thread, complete once IsPlaying() is false.
+	const std::vector<PlaylistEntry>& Entries() const { return entries; }
+
+private:
+	PlaylistPlayer(const PlaylistPlayer&);
+	PlaylistPlayer& operator=(const PlaylistPlayer&);
+
+	struct Slot {
+		SmfFile smf;
+		SongCache cache;
+		Timeline timeline;
+	};
+
+	void Run();
+	bool Load(PlaylistEntry& entry, Slot& slot);
+	bool Sleep();
+
+	Sequencer& sequencer;
+	MidiSink& sink;
+	PrepareFunction prepare;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<bool> stopRequested;
+	std::atomic<int> currentSong;
+	std::vector<PlaylistEntry> entries;
+	Slot slots[2];
+};
+
+// How often the loader checks whether the sequencer has moved on to the queued song.
+const int64_t PLAYLIST_POLL_US = 5000;
@@ -0,0 +1,56 @@
+#include "process_stats.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h> // Link with Psapi.lib
+
+uint64_t ProcessResidentBytes() {
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+		return 0;
+	}
+	return pmc.WorkingSetSize;
+}
+
+uint64_t ProcessPeakResidentBytes() {
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+		return 0;
+	}
+	return pmc.PeakWorkingSetSize;
+}
+
+#else
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+
+uint64_t ProcessResidentBytes() {
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		return 0;
+	}
+	unsigned long size = 0;
+	unsigned long resident = 0;
+	int n = fscanf(f, "%lu %lu", &size, &resident);
+	fclose(f);
+	if (n != 2) {
+		return 0;
+	}
+	return uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE));
+}
+
+uint64_t ProcessPeakResidentBytes() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return uint64_t(usage.ru_maxrss);
+#else
+	return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Resident set size of the current process in bytes, 0 if unknown.
+uint64_t ProcessResidentBytes();
+
+// Peak resident set size of the current process in bytes, 0 if unknown.
+uint64_t ProcessPeakResidentBytes();
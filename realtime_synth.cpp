@@ -0,0 +1,134 @@
+#include "realtime_synth.h"
+
+#include "allocation_tracker.h"
+
+RealtimeSynth::RealtimeSynth(const SynthConfig& config, uint32_t blockFrames) :
+	synth(config),
+	sampleRate(config.sampleRate),
+	scheduleFrames(blockFrames * REALTIME_SCHEDULE_BLOCKS),
+	events(REALTIME_EVENT_CAPACITY),
+	bytes(REALTIME_BYTE_CAPACITY),
+	anchored(false),
+	anchorUs(0),
+	anchorFrame(0),
+	renderFrame(0),
+	streamFrames(0),
+	lateEvents(0),
+	droppedEvents(0),
+	activeVoices(0)
+{
+	longMessage.resize(bytes.Capacity());
+}
+
+bool RealtimeSynth::Post(uint64_t frame, uint32_t kind, uint32_t message, const uint8_t* data, uint32_t length) {
+	// Bytes go first: once the audio thread sees the event, its bytes are already there.
+	if ((events.FreeSpace() == 0) || (bytes.FreeSpace() < length)) {
+		droppedEvents.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	if (length > 0) {
+		bytes.PushBulk(data, length);
+	}
+
+	RealtimeEvent e;
+	e.frame = frame;
+	e.message = message;
+	e.length = length;
+	e.kind = kind;
+	events.Push(e);
+	return true;
+}
+
+uint64_t RealtimeSynth::ScheduleFrame(int64_t songTimeUs) {
+	uint64_t stream = streamFrames.load(std::memory_order_acquire);
+	if (!anchored) {
+		anchored = true;
+		anchorUs = songTimeUs;
+		anchorFrame = stream + scheduleFrames;
+	}
+
+	int64_t deltaUs = songTimeUs - anchorUs;
+	uint64_t frame = anchorFrame;
+	if (deltaUs > 0) {
+		frame += (uint64_t(deltaUs) * sampleRate + 500000) / 1000000;
+	}
+	if (frame < stream) {
+		// Its block is gone: play it with the next one and move the schedule along.
+		lateEvents.fetch_add(1, std::memory_order_relaxed);
+		anchorFrame += stream - frame;
+		frame = stream;
+	}
+	return frame;
+}
+
+bool RealtimeSynth::ShortMessage(uint32_t message) {
+	return Post(REALTIME_IMMEDIATE, REALTIME_SHORT, message, nullptr, 0);
+}
+
+bool RealtimeSynth::LongMessage(const uint8_t* data, uint32_t length) {
+	return Post(REALTIME_IMMEDIATE, REALTIME_LONG, 0, data, length);
+}
+
+void RealtimeSynth::Reset() {
+	anchored = false;
+	Post(REALTIME_IMMEDIATE, REALTIME_RESET, 0, nullptr, 0);
+}
+
+bool RealtimeSynth::SubmitBatch(const MidiSinkEvent* batch, size_t count) {
+	bool ok = true;
+	for (size_t i = 0; i < count; i++) {
+		const MidiSinkEvent& e = batch[i];
+		uint64_t frame = ScheduleFrame(e.timeUs);
+		if (e.data) {
+			ok = Post(frame, REALTIME_LONG, 0, e.data, e.length) && ok;
+		}
+		else {
+			ok = Post(frame, REALTIME_SHORT, e.message, nullptr, 0) && ok;
+		}
+	}
+	return ok;
+}
+
+void RealtimeSynth::Apply(const RealtimeEvent& e) {
+	if (e.kind == REALTIME_SHORT) {
+		synth.ShortMessage(e.message);
+	}
+	else if (e.kind == REALTIME_LONG) {
+		bytes.PopBulk(&longMessage[0], e.length);
+		synth.LongMessage(&longMessage[0], e.length);
+	}
+	else {
+		synth.Reset();
+	}
+}
+
+void RealtimeSynth::RenderAudio(int16_t* out, uint32_t frames) {
+	NoAllocationScope noAllocation;
+	uint64_t blockStart = renderFrame;
+	uint64_t blockEnd = blockStart + frames;
+
+	// Render up to every message due in this block, then apply it.
+	uint32_t done = 0;
+	const RealtimeEvent* next;
+	while (((next = events.Peek()) != nullptr) && (next->frame < blockEnd)) {
+		RealtimeEvent e;
+		events.Pop(e);
+
+		if ((e.frame != REALTIME_IMMEDIATE) && (e.frame < blockStart)) {
+			lateEvents.fetch_add(1, std::memory_order_relaxed);
+		}
+		uint32_t offset = (e.frame > blockStart) ? uint32_t(e.frame - blockStart) : 0;
+		if (offset > done) {
+			synth.RenderInt16(out + size_t(done) * 2, offset - done);
+			done = offset;
+		}
+		Apply(e);
+	}
+	if (done < frames) {
+		synth.RenderInt16(out + size_t(done) * 2, frames - done);
+	}
+
+	renderFrame = blockEnd;
+	activeVoices.store(synth.ActiveVoices(), std::memory_order_relaxed);
+	streamFrames.store(blockEnd, std::memory_order_release);
+}
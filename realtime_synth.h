@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "audio_device.h"
+#include "midi_sink.h"
+#include "spsc_ring.h"
+#include "synth.h"
+
+enum RealtimeEventKind {
+	REALTIME_SHORT = 0,
+	REALTIME_LONG = 1,
+	REALTIME_RESET = 2
+};
+
+// A message on its way from the sequencer thread to the audio thread.
+struct RealtimeEvent {
+	uint64_t frame;   // Stream frame at which the message takes effect, REALTIME_IMMEDIATE for the next block.
+	uint32_t message; // Short messages: packed message.
+	uint32_t length;  // Long messages: number of bytes following in the byte ring.
+	uint32_t kind;    // RealtimeEventKind.
+};
+
+const uint64_t REALTIME_IMMEDIATE = 0;
+
+// Events scheduled this many blocks after the block being rendered when they arrive.
+const uint32_t REALTIME_SCHEDULE_BLOCKS = 2;
+
+const size_t REALTIME_EVENT_CAPACITY = 8192;
+const size_t REALTIME_BYTE_CAPACITY = 64 * 1024;
+
+/*
+
+Synthesizer played live by the sequencer on an audio device.
+
+The sequencer thread writes the messages into lock-free single-producer /
+single-consumer rings, the audio callback takes them out and renders the
+synthesizer in pieces split at the frame of every message, so the audio thread
+never waits for the sequencer and timing is exact to the sample.
+
+Messages of a batch carry their song time, which is converted to a stream
+frame: the first batch after a reset is placed REALTIME_SCHEDULE_BLOCKS blocks
+after the last rendered block, all later ones relative to it. Messages without
+song time are applied at the start of the next block. A message arriving after
+the block that should contain it has already been rendered is played at the
+start of the next block and the schedule is moved back by the difference, so
+one late batch does not make every following one late too.
+
+Instruments must be loaded before playback, the audio thread must not load
+them from disk.
+
+*/
+class RealtimeSynth : public MidiSink, public AudioCallback {
+public:
+	RealtimeSynth(const SynthConfig& config, uint32_t blockFrames);
+
+	// Configure before the device starts.
+	Synth& GetSynth() { return synth; }
+
+	// MidiSink, sequencer thread.
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+	bool SubmitBatch(const MidiSinkEvent* events, size_t count);
+
+	// AudioCallback, audio thread.
+	void RenderAudio(int16_t* out, uint32_t frames);
+
+	// Frames rendered so far.
+	uint64_t StreamFrames() const { return streamFrames.load(std::memory_order_acquire); }
+
+	uint64_t LateEvents() const { return lateEvents.load(); }
+	uint64_t DroppedEvents() const { return droppedEvents.load(); }
+	uint32_t ActiveVoices() const { return activeVoices.load(); }
+
+private:
+	bool Post(uint64_t frame, uint32_t kind, uint32_t message, const uint8_t* data, uint32_t length);
+	uint64_t ScheduleFrame(int64_t songTimeUs);
+	void Apply(const RealtimeEvent& e);
+
+	Synth synth;
+	uint32_t sampleRate;
+	uint32_t scheduleFrames;
+
+	SpscRing<RealtimeEvent> events;
+	SpscRing<uint8_t> bytes;
+	std::vector<uint8_t> longMessage; // Audio thread: long message being applied.
+
+	// Sequencer thread: song time which plays at anchorFrame.
+	bool anchored;
+	int64_t anchorUs;
+	uint64_t anchorFrame;
+
+	// Audio thread.
+	uint64_t renderFrame;
+
+	std::atomic<uint64_t> streamFrames;
+	std::atomic<uint64_t> lateEvents;
+	std::atomic<uint64_t> droppedEvents;
+	std::atomic<uint32_t> activeVoices;
+};
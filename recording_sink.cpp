@@ -0,0 +1,68 @@
+#include "recording_sink.h"
+
+#include "hires_clock.h"
+
+RecordingMidiSink::RecordingMidiSink(size_t eventCapacity, size_t byteCapacity) :
+	events(eventCapacity),
+	bytes(byteCapacity),
+	dropped(0)
+{
+}
+
+bool RecordingMidiSink::Record(int64_t songTimeUs, uint32_t kind, uint32_t message, const uint8_t* data, uint32_t length) {
+	// Bytes go first: once the consumer sees the event, its bytes are already there.
+	if ((events.FreeSpace() == 0) || (bytes.FreeSpace() < length)) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	if (length > 0) {
+		bytes.PushBulk(data, length);
+	}
+
+	RecordedEvent e;
+	e.songTimeUs = songTimeUs;
+	e.wallTimeUs = NowMicros();
+	e.message = message;
+	e.length = length;
+	e.kind = kind;
+	events.Push(e);
+	return true;
+}
+
+bool RecordingMidiSink::ShortMessage(uint32_t message) {
+	return Record(-1, RECORDED_SHORT, message, nullptr, 0);
+}
+
+bool RecordingMidiSink::LongMessage(const uint8_t* data, uint32_t length) {
+	return Record(-1, RECORDED_LONG, 0, data, length);
+}
+
+void RecordingMidiSink::Reset() {
+	Record(-1, RECORDED_RESET, 0, nullptr, 0);
+}
+
+bool RecordingMidiSink::SubmitBatch(const MidiSinkEvent* batch, size_t count) {
+	bool ok = true;
+	for (size_t i = 0; i < count; i++) {
+		const MidiSinkEvent& e = batch[i];
+		if (e.data) {
+			ok = Record(e.timeUs, RECORDED_LONG, 0, e.data, e.length) && ok;
+		}
+		else {
+			ok = Record(e.timeUs, RECORDED_SHORT, e.message, nullptr, 0) && ok;
+		}
+	}
+	return ok;
+}
+
+bool RecordingMidiSink::Pop(RecordedEvent& e, std::vector<uint8_t>& out) {
+	if (!events.Pop(e)) {
+		return false;
+	}
+	if (e.length > 0) {
+		size_t pos = out.size();
+		out.resize(pos + e.length);
+		bytes.PopBulk(&out[pos], e.length);
+	}
+	return true;
+}
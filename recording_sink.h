@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "midi_sink.h"
+#include "spsc_ring.h"
+
+enum RecordedKind {
+	RECORDED_SHORT = 0,
+	RECORDED_LONG = 1,
+	RECORDED_RESET = 2
+};
+
+struct RecordedEvent {
+	int64_t songTimeUs; // Song time given by the sequencer, or -1 when the message came without one.
+	int64_t wallTimeUs; // NowMicros() at the moment the sink received the message.
+	uint32_t message;   // Short messages: packed message.
+	uint32_t length;    // Long messages: number of bytes following in the byte stream.
+	uint32_t kind;      // RecordedKind.
+};
+
+/*
+
+Sink which captures timestamped messages into memory.
+
+Messages are written into preallocated lock-free rings, so recording never
+blocks or allocates on the sequencer thread. Another thread drains them with
+Pop(). When a ring is full the message is dropped and counted.
+
+*/
+class RecordingMidiSink : public MidiSink {
+public:
+	RecordingMidiSink(size_t eventCapacity, size_t byteCapacity);
+
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+	bool SubmitBatch(const MidiSinkEvent* events, size_t count);
+
+	// Consumer side. Long message bytes are appended to 'bytes'.
+	bool Pop(RecordedEvent& e, std::vector<uint8_t>& bytes);
+
+	uint64_t DroppedCount() const { return dropped.load(); }
+
+private:
+	bool Record(int64_t songTimeUs, uint32_t kind, uint32_t message, const uint8_t* data, uint32_t length);
+
+	SpscRing<RecordedEvent> events;
+	SpscRing<uint8_t> bytes;
+	std::atomic<uint64_t> dropped;
+};
@@ -0,0 +1,646 @@
+#include "sequencer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#include "allocation_tracker.h"
+#include "hires_clock.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h> // Link with winmm.lib
+#endif
+
+// Smallest SysEx buffer. Batches with more SysEx are split, a song with a longer message gets a larger buffer.
+static const size_t SYSEX_BUFFER_SIZE = 64 * 1024;
+
+// Holds the longest SysEx of the timeline with its leading 0xF0.
+static size_t SysexBufferSize(const Timeline& timeline) {
+	return std::max(SYSEX_BUFFER_SIZE, size_t(timeline.LongestSysex()) + 1);
+}
+
+Sequencer::Sequencer() :
+	playing(false),
+	stopRequested(false),
+	positionUs(0),
+	timeline(nullptr),
+	stream(nullptr),
+	payloadBase(nullptr),
+	sink(nullptr),
+	windowCount(0),
+	startIdx(0),
+	startUs(0),
+	spinThresholdUs(SEQUENCER_DEFAULT_SPIN_US),
+	lateThresholdUs(SEQUENCER_DEFAULT_LATE_US),
+	queued(nullptr),
+	queueOpen(false),
+	songNumber(0),
+	transportPending(false),
+	pauseRequested(false),
+	seekRequestUs(-1),
+	tempoRequest(1.0),
+	anchorWallUs(0),
+	anchorSongUs(0),
+	scale(1.0),
+	originWallUs(0),
+	paused(false),
+	pausedSongUs(0),
+	eventCount(0),
+	batchCount(0),
+	lateCount(0),
+	droppedCount(0),
+	sysexCount(0),
+	sysexBytes(0),
+	runStartUs(0),
+	runEndUs(0)
+{
+	batch.reserve(SEQUENCER_MAX_BATCH);
+	sysexBuffer.resize(SYSEX_BUFFER_SIZE);
+	memset(activeNotes, 0, sizeof(activeNotes));
+	memset(sustain, 0, sizeof(sustain));
+}
+
+Sequencer::~Sequencer() {
+	Stop();
+}
+
+bool Sequencer::Start(const Timeline& tl, MidiSink& s, int64_t fromUs) {
+	Stop();
+
+	timeline = &tl;
+	stream = nullptr;
+	payloadBase = tl.PayloadBase();
+	sink = &s;
+	startUs = (fromUs > 0) ? fromUs : 0;
+	startIdx = timeline->SeekToMicros(startUs);
+	positionUs.store(startUs);
+	if (sysexBuffer.size() < SysexBufferSize(tl)) {
+		sysexBuffer.resize(SysexBufferSize(tl));
+	}
+
+	if (startIdx > 0) {
+		MidiState state;
+		timeline->Chase(startIdx, state);
+		SendChase(state);
+	}
+
+	Launch();
+	return true;
+}
+
+bool Sequencer::Start(SmfStream& st, MidiSink& s, int64_t fromUs) {
+	Stop();
+
+	timeline = nullptr;
+	stream = &st;
+	payloadBase = st.PayloadBase();
+	sink = &s;
+	startUs = (fromUs > 0) ? fromUs : 0;
+	positionUs.store(startUs);
+	if (window.empty()) {
+		window.resize(SEQUENCER_STREAM_WINDOW);
+	}
+
+	MidiState state;
+	bool chase;
+	if (!ReadStreamTo(startUs, state, chase)) {
+		return false;
+	}
+	if (chase) {
+		SendChase(state);
+	}
+
+	Launch();
+	return true;
+}
+
+// Rewinds the stream and reads up to the position, collecting the state to chase.
+// Leaves the window at the first event from the position on.
+bool Sequencer::ReadStreamTo(int64_t songUs, MidiState& state, bool& chase) {
+	state.Reset();
+	chase = false;
+	stream->Rewind();
+	do {
+		windowCount = stream->Read(&window[0], window.size());
+		for (startIdx = 0; (startIdx < windowCount) && (window[startIdx].timeUs < songUs); startIdx++) {
+			const TimelineEvent& e = window[startIdx];
+			if (e.status < SMF_STATUS_SYSEX) {
+				state.Apply(e.status, e.data1, e.data2);
+				chase = true;
+			}
+		}
+	} while ((windowCount > 0) && (startIdx == windowCount));
+	return !stream->Failed();
+}
+
+void Sequencer::SendChase(const MidiState& state) {
+	uint32_t messages[MIDI_CHASE_MAX_MESSAGES];
+	size_t count = state.ChaseMessages(messages, MIDI_CHASE_MAX_MESSAGES);
+	for (size_t i = 0; i < count; i++) {
+		sink->ShortMessage(messages[i]);
+	}
+	SeedSustain(state);
+}
+
+// The pedals the chase holds down, so that pausing or stopping releases them.
+void Sequencer::SeedSustain(const MidiState& state) {
+	for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+		uint8_t value = state.channels[ch].controllers[64];
+		sustain[ch] = (value == MIDI_VALUE_UNSET) ? 0 : value;
+	}
+}
+
+void Sequencer::Launch() {
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queued = nullptr;
+		queueOpen = (timeline != nullptr);
+	}
+	songNumber.store(0);
+	seekRequestUs.store(-1);
+	pauseRequested.store(false);
+	transportPending.store(false);
+
+	dispatchDelay.Reset();
+	eventCount.store(0);
+	batchCount.store(0);
+	lateCount.store(0);
+	droppedCount.store(0);
+	sysexCount.store(0);
+	sysexBytes.store(0);
+	runStartUs.store(NowMicros());
+	runEndUs.store(0);
+
+	stopRequested.store(false);
+	playing.store(true);
+	thread = std::thread(&Sequencer::Run, this);
+}
+
+void Sequencer::Stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+
+	stopRequested.store(true);
+	thread.join();
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queued = nullptr;
+		queueOpen = false;
+	}
+	// The reset of the sink silences everything, the next start begins with empty tables.
+	memset(activeNotes, 0, sizeof(activeNotes));
+	memset(sustain, 0, sizeof(sustain));
+
+	if (sink) {
+		sink->Reset();
+	}
+}
+
+bool Sequencer::Enqueue(const Timeline& next) {
+	std::lock_guard<std::mutex> lock(queueMutex);
+	if (!queueOpen || queued) {
+		return false;
+	}
+	// Swapped in by the sequencer thread when the song starts.
+	if (queuedSysexBuffer.size() < SysexBufferSize(next)) {
+		queuedSysexBuffer.resize(SysexBufferSize(next));
+	}
+	queued = &next;
+	return true;
+}
+
+bool Sequencer::HasQueued() const {
+	std::lock_guard<std::mutex> lock(queueMutex);
+	return queued != nullptr;
+}
+
+// Called by the sequencer thread at the end of a song. Closes the queue if it is empty.
+const Timeline* Sequencer::TakeQueued() {
+	std::lock_guard<std::mutex> lock(queueMutex);
+	const Timeline* next = queued;
+	queued = nullptr;
+	queueOpen = (next != nullptr);
+	if (next) {
+		sysexBuffer.swap(queuedSysexBuffer);
+	}
+	return next;
+}
+
+void Sequencer::Pause() {
+	if (playing.load()) {
+		pauseRequested.store(true);
+		transportPending.store(true);
+	}
+}
+
+void Sequencer::Resume() {
+	pauseRequested.store(false);
+	transportPending.store(true);
+}
+
+bool Sequencer::Seek(int64_t songUs) {
+	if (!playing.load()) {
+		return false;
+	}
+	seekRequestUs.store((songUs > 0) ? songUs : 0);
+	transportPending.store(true);
+	return true;
+}
+
+void Sequencer::SetTempoScale(double s) {
+	tempoRequest.store(std::min(std::max(s, SEQUENCER_MIN_TEMPO_SCALE), SEQUENCER_MAX_TEMPO_SCALE));
+	transportPending.store(true);
+}
+
+void Sequencer::Wait() {
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+bool Sequencer::WaitUntil(int64_t deadlineUs) {
+	while (true) {
+		if (stopRequested.load() || transportPending.load()) {
+			return false;
+		}
+
+		int64_t remaining = deadlineUs - NowMicros();
+		if (remaining <= 0) {
+			return true;
+		}
+
+		if (remaining > spinThresholdUs) {
+			int64_t sleepUs = remaining - spinThresholdUs;
+			if (sleepUs > SEQUENCER_MAX_SLEEP_US) {
+				sleepUs = SEQUENCER_MAX_SLEEP_US;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(sleepUs));
+		}
+		else {
+			CpuRelax();
+		}
+	}
+}
+
+size_t Sequencer::DispatchBatch(const TimelineEvent* events, size_t first, size_t count, int64_t deadlineUs) {
+	int64_t timeUs = events[first].timeUs;
+
+	// Collect events due at the same time as long as their SysEx fits into the buffer,
+	// so that pointers into it stay valid for the whole batch. The rest follows in the next batch.
+	size_t end = first;
+	size_t bufferedBytes = 0;
+	while ((end < count) && (events[end].timeUs == timeUs) && (end - first < SEQUENCER_MAX_BATCH)) {
+		if (events[end].status == SMF_STATUS_SYSEX) {
+			size_t length = size_t(events[end].payloadLength) + 1;
+			if ((bufferedBytes + length > sysexBuffer.size()) && (end > first)) {
+				break;
+			}
+			bufferedBytes += length;
+		}
+		end++;
+	}
+	if (sysexBuffer.size() < bufferedBytes) {
+		// Only a stream, which is not read ahead, can hold a SysEx longer than the buffer.
+		sysexBuffer.resize(bufferedBytes);
+	}
+
+	batch.clear();
+	size_t sysexPos = 0;
+	uint32_t batchSysex = 0;
+	uint64_t batchSysexBytes = 0;
+	for (size_t i = first; i < end; i++) {
+		const TimelineEvent& e = events[i];
+		MidiSinkEvent out;
+		out.timeUs = deadlineUs - originWallUs;
+		out.message = 0;
+		out.length = 0;
+		out.data = nullptr;
+
+		if (e.status < SMF_STATUS_SYSEX) {
+			out.message = PackShortMessage(e.status, e.data1, e.data2);
+			TrackMessage(e.status, e.data1, e.data2);
+		}
+		else if (e.status == SMF_STATUS_SYSEX) {
+			// The file stores the message without its leading 0xF0.
+			uint8_t* dst = &sysexBuffer[sysexPos];
+			dst[0] = SMF_STATUS_SYSEX;
+			if (e.payloadLength > 0) {
+				memcpy(dst + 1, payloadBase + e.payloadOffset, e.payloadLength);
+			}
+			out.data = dst;
+			out.length = e.payloadLength + 1;
+			sysexPos += out.length;
+			batchSysex++;
+			batchSysexBytes += out.length;
+		}
+		else if ((e.status == SMF_STATUS_SYSEX_ESCAPE) && (e.payloadLength > 0)) {
+			out.data = payloadBase + e.payloadOffset;
+			out.length = e.payloadLength;
+			batchSysex++;
+			batchSysexBytes += out.length;
+		}
+		else {
+			// Meta events are not sent.
+			continue;
+		}
+		batch.push_back(out);
+	}
+
+	if (!batch.empty()) {
+		int64_t delayNs = NowNanos() - deadlineUs * 1000;
+		bool ok = sink->SubmitBatch(&batch[0], batch.size());
+		Account(batch.size(), delayNs, ok, batchSysex, batchSysexBytes);
+	}
+	return end;
+}
+
+// Short messages generated by the sequencer itself, at the given playback time. They go
+// through SubmitBatch so that a scheduling sink keeps them in order with the song's events.
+void Sequencer::Submit(const uint32_t* messages, size_t count, int64_t timeUs) {
+	for (size_t first = 0; first < count; first += SEQUENCER_MAX_BATCH) {
+		batch.clear();
+		for (size_t i = first; (i < count) && (i - first < SEQUENCER_MAX_BATCH); i++) {
+			MidiSinkEvent out;
+			out.timeUs = timeUs;
+			out.message = messages[i];
+			out.length = 0;
+			out.data = nullptr;
+			batch.push_back(out);
+		}
+		sink->SubmitBatch(&batch[0], batch.size());
+	}
+}
+
+// Between songs: controllers of the last song must not carry over, notes still sounding may.
+void Sequencer::SendControllerReset(int64_t timeUs) {
+	uint32_t messages[MIDI_CHANNELS];
+	for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+		messages[ch] = PackShortMessage(uint8_t(0xB0 | ch), 121, 0); // Reset All Controllers.
+		sustain[ch] = 0;
+	}
+	Submit(messages, MIDI_CHANNELS, timeUs);
+}
+
+// Releases the sustain pedals and sends a note-off for every note-on still sounding.
+void Sequencer::SilenceNotes(int64_t timeUs) {
+	// Sent in batches as they fill up.
+	uint32_t messages[SEQUENCER_MAX_BATCH];
+	size_t count = 0;
+	for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+		if (sustain[ch] >= 64) {
+			if (count == SEQUENCER_MAX_BATCH) {
+				Submit(messages, count, timeUs);
+				count = 0;
+			}
+			messages[count++] = PackShortMessage(uint8_t(0xB0 | ch), 64, 0);
+		}
+		for (int note = 0; note < 128; note++) {
+			for (uint8_t n = 0; n < activeNotes[ch][note]; n++) {
+				if (count == SEQUENCER_MAX_BATCH) {
+					Submit(messages, count, timeUs);
+					count = 0;
+				}
+				messages[count++] = PackShortMessage(uint8_t(0x80 | ch), uint8_t(note), 0);
+			}
+			activeNotes[ch][note] = 0;
+		}
+	}
+	if (count > 0) {
+		Submit(messages, count, timeUs);
+	}
+}
+
+void Sequencer::TrackMessage(uint8_t status, uint8_t data1, uint8_t data2) {
+	uint8_t ch = status & 0x0F;
+	uint8_t type = status & 0xF0;
+	if ((type == 0x90) && (data2 != 0)) {
+		if (activeNotes[ch][data1] < 0xFF) {
+			activeNotes[ch][data1]++;
+		}
+	}
+	else if ((type == 0x80) || (type == 0x90)) {
+		if (activeNotes[ch][data1] > 0) {
+			activeNotes[ch][data1]--;
+		}
+	}
+	else if (type == 0xB0) {
+		if (data1 == 64) {
+			sustain[ch] = data2;
+		}
+		else if ((data1 == 120) || (data1 == 123)) {
+			// All Sound Off, All Notes Off.
+			memset(activeNotes[ch], 0, sizeof(activeNotes[ch]));
+		}
+	}
+}
+
+// Applies the pending transport requests. False if playback cannot continue.
+bool Sequencer::ApplyTransport(Cursor& cursor) {
+	transportPending.store(false);
+	int64_t nowUs = NowMicros();
+	int64_t timeUs = nowUs - originWallUs;
+
+	// The clock stands between the last dispatched batch and the next one.
+	int64_t songUs = paused ? pausedSongUs : SongTimeAt(nowUs);
+	if (!paused && (cursor.index < cursor.count)) {
+		songUs = std::min(songUs, cursor.events[cursor.index].timeUs);
+	}
+
+	double requestedScale = tempoRequest.load();
+	if (requestedScale != scale) {
+		anchorWallUs = nowUs;
+		anchorSongUs = songUs;
+		scale = requestedScale;
+	}
+
+	bool pause = pauseRequested.load();
+	if (pause && !paused) {
+		paused = true;
+		pausedSongUs = songUs;
+		SilenceNotes(timeUs);
+	}
+
+	int64_t seekUs = seekRequestUs.exchange(-1);
+	if (seekUs >= 0) {
+		SilenceNotes(timeUs);
+		MidiState state;
+		bool chase = true;
+		if (stream) {
+			if (!ReadStreamTo(seekUs, state, chase)) {
+				return false;
+			}
+			cursor.events = &window[0];
+			cursor.count = windowCount;
+			cursor.index = startIdx;
+		}
+		else {
+			cursor.index = timeline->SeekToMicros(seekUs);
+			timeline->Chase(cursor.index, state);
+		}
+		SendControllerReset(timeUs);
+		if (chase) {
+			uint32_t messages[MIDI_CHASE_MAX_MESSAGES];
+			Submit(messages, state.ChaseMessages(messages, MIDI_CHASE_MAX_MESSAGES), timeUs);
+			SeedSustain(state);
+		}
+		cursor.songStarting = false;
+		songUs = seekUs;
+		pausedSongUs = seekUs;
+		anchorWallUs = nowUs;
+		anchorSongUs = seekUs;
+		positionUs.store(seekUs);
+	}
+
+	if (!pause && paused) {
+		paused = false;
+		anchorWallUs = nowUs;
+		anchorSongUs = pausedSongUs;
+		uint32_t pedals[MIDI_CHANNELS];
+		size_t count = 0;
+		for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+			if (sustain[ch] >= 64) {
+				pedals[count++] = PackShortMessage(uint8_t(0xB0 | ch), 64, sustain[ch]);
+			}
+		}
+		if (count > 0) {
+			Submit(pedals, count, timeUs);
+		}
+	}
+	return true;
+}
+
+// The counters have a single writer, the sequencer thread, so no read-modify-write is needed.
+static inline void Add(std::atomic<uint64_t>& counter, uint64_t n) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Sequencer::Account(size_t events, int64_t delayNs, bool ok, uint32_t sysex, uint64_t sysexLength) {
+	dispatchDelay.Record(delayNs, events);
+	Add(eventCount, events);
+	Add(batchCount, 1);
+	if (delayNs > lateThresholdUs * 1000) {
+		Add(lateCount, events);
+	}
+	if (!ok) {
+		Add(droppedCount, events);
+	}
+	if (sysex > 0) {
+		Add(sysexCount, sysex);
+		Add(sysexBytes, sysexLength);
+	}
+}
+
+SequencerTiming Sequencer::Timing() const {
+	SequencerTiming t;
+	t.events = eventCount.load(std::memory_order_relaxed);
+	t.batches = batchCount.load(std::memory_order_relaxed);
+	t.lateEvents = lateCount.load(std::memory_order_relaxed);
+	t.droppedEvents = droppedCount.load(std::memory_order_relaxed);
+	t.sysexMessages = sysexCount.load(std::memory_order_relaxed);
+	t.sysexBytes = sysexBytes.load(std::memory_order_relaxed);
+	int64_t startUs = runStartUs.load();
+	int64_t endUs = runEndUs.load();
+	t.elapsedUs = (startUs == 0) ? 0 : ((endUs != 0) ? endUs : NowMicros()) - startUs;
+	t.lateThresholdUs = lateThresholdUs;
+	return t;
+}
+
+std::string Sequencer::TimingJson() const {
+	SequencerTiming t = Timing();
+	std::ostringstream oss;
+	oss << "{\"events\": " << t.events << ", \"batches\": " << t.batches << ", \"lateEvents\": " << t.lateEvents <<
+		", \"lateThresholdUs\": " << t.lateThresholdUs << ", \"droppedEvents\": " << t.droppedEvents <<
+		", \"sysexMessages\": " << t.sysexMessages << ", \"sysexBytes\": " << t.sysexBytes <<
+		", \"sysexBytesPerSecond\": " << t.SysexBytesPerSecond() << ", \"elapsedUs\": " << t.elapsedUs <<
+		", \"dispatchDelay\": " << dispatchDelay.ToJson() << "}";
+	return oss.str();
+}
+
+void Sequencer::Run() {
+#ifdef _WIN32
+	timeBeginPeriod(1);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+	NoAllocationScope noAllocation;
+
+	Cursor cursor;
+	cursor.events = stream ? &window[0] : timeline->Events();
+	cursor.count = stream ? windowCount : timeline->EventCount();
+	cursor.index = startIdx;
+	cursor.songStarting = false;
+
+	// Song position startUs plays now, which is also its playback time.
+	scale = tempoRequest.load();
+	anchorWallUs = NowMicros();
+	anchorSongUs = startUs;
+	originWallUs = anchorWallUs - startUs;
+	paused = false;
+
+	while (!stopRequested.load()) {
+		if (transportPending.load()) {
+			if (!ApplyTransport(cursor)) {
+				break;
+			}
+			continue;
+		}
+		if (paused) {
+			// Until the next request.
+			WaitUntil(std::numeric_limits<int64_t>::max());
+			continue;
+		}
+
+		if (cursor.index == cursor.count) {
+			if (!stream) {
+				const Timeline* next = TakeQueued();
+				if (!next) {
+					break;
+				}
+				// The next song starts where this one ends.
+				anchorSongUs -= timeline->DurationUs();
+				timeline = next;
+				payloadBase = next->PayloadBase();
+				cursor.events = next->Events();
+				cursor.count = next->EventCount();
+				cursor.index = 0;
+				cursor.songStarting = true;
+				songNumber.fetch_add(1);
+				positionUs.store(0);
+				continue;
+			}
+			cursor.count = stream->Read(&window[0], window.size());
+			cursor.index = 0;
+			if (cursor.count == 0) {
+				break;
+			}
+		}
+
+		if (cursor.songStarting) {
+			int64_t deadlineUs = DeadlineOf(0);
+			if (WaitUntil(deadlineUs)) {
+				SendControllerReset(deadlineUs - originWallUs);
+				cursor.songStarting = false;
+			}
+			continue;
+		}
+
+		int64_t timeUs = cursor.events[cursor.index].timeUs;
+		int64_t deadlineUs = DeadlineOf(timeUs);
+		if (!WaitUntil(deadlineUs)) {
+			continue;
+		}
+		cursor.index = DispatchBatch(cursor.events, cursor.index, cursor.count, deadlineUs);
+		positionUs.store(timeUs);
+	}
+
+	runEndUs.store(NowMicros());
+	playing.store(false);
+
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
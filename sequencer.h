@@ -0,0 +1,245 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "midi_sink.h"
+#include "smf_stream.h"
+#include "timeline.h"
+#include "timing_histogram.h"
+
+/*
+
+Self-timed sequencer.
+
+A dedicated thread walks a pre-resolved timeline and sends every event to a
+MIDI sink at its absolute deadline. Deadlines are computed from the start
+time, so errors never accumulate. The thread sleeps until shortly before a
+deadline and spins for the rest of the time to get sub-millisecond accuracy.
+Events due at the same time are handed to the sink as one batch.
+
+A song is played either from a Timeline or from an SmfStream. A stream is
+read into a window of SEQUENCER_STREAM_WINDOW events which the thread refills
+right after dispatching its last batch, in the time it would otherwise wait
+for the next event, so memory use does not depend on the length of the song.
+
+Another timeline can be queued while a timeline plays. It starts exactly at
+the end of the current song, on the same clock and without resetting the
+sink: only Reset All Controllers is sent to every channel right before its
+first events. The song time given to the sink keeps counting across songs.
+
+The transport can be controlled while playing. Song positions are mapped to
+wall clock time through an anchor: a song position, the wall clock time it
+plays at and the tempo scale. Pausing, resuming, seeking and changing the
+tempo only move the anchor, so the deadlines of the remaining events follow
+without touching the timeline. The thread applies the requests between
+batches. It keeps a table of the notes which sound and the sustain pedals,
+so a pause or a seek sends note-offs for exactly those notes instead of
+resetting every channel; a seek then resets the controllers and chases the
+state at the new position, as Start() does.
+
+Once playing, the thread does not allocate, see allocation_tracker.h. The
+batch buffer is allocated with the sequencer, and the SysEx buffer is sized in
+Start() and Enqueue() for the longest SysEx of the song, from a pool of two
+buffers: the one in use and the one of the queued song, swapped when it
+starts. A batch whose SysEx does not fit is split. Only a stream may bring a
+longer message, for which the buffer grows.
+
+The time given to the sink is the playback time: the song time, moved on by
+pauses and scaled by the tempo, so that a sink which schedules by it, e.g.
+the realtime synth, keeps in step with the wall clock.
+
+Every batch is timed: the delay between its deadline and the moment it is
+handed to the sink is recorded for each of its events in a histogram, and
+events delayed more than the late threshold are counted as late. Events of a
+batch the sink reports as failed are counted as dropped. The counters can be
+read while playing and exported as JSON.
+
+*/
+
+// Counters of the current or last playback.
+struct SequencerTiming {
+	uint64_t events;        // Events handed to the sink, meta events excluded.
+	uint64_t batches;
+	uint64_t lateEvents;    // Dispatched later than the late threshold after their deadline.
+	uint64_t droppedEvents; // In batches the sink failed to send.
+	uint64_t sysexMessages;
+	uint64_t sysexBytes;
+	int64_t elapsedUs;      // Wall clock time since the start of playback.
+	int64_t lateThresholdUs;
+
+	double SysexBytesPerSecond() const { return (elapsedUs > 0) ? double(sysexBytes) * 1e6 / double(elapsedUs) : 0.0; }
+};
+
+class Sequencer {
+public:
+	Sequencer();
+	~Sequencer();
+
+	// Starts playback from the given song position. Controllers and programs
+	// in effect at that position are sent first.
+	// The timeline and the sink must stay alive until playback is stopped.
+	bool Start(const Timeline& timeline, MidiSink& sink, int64_t startUs = 0);
+
+	// The same for a stream, which is rewound first. Starting later in the song reads the stream
+	// up to that position. Fails if the stream is corrupt before the start position.
+	// The stream is read by the sequencer thread until playback is stopped.
+	bool Start(SmfStream& stream, MidiSink& sink, int64_t startUs = 0);
+
+	// Plays the timeline right after the current one, see above. Fails if nothing is playing,
+	// if a song is queued already or if the current song is played from a stream.
+	// The timeline must stay alive until playback is stopped.
+	bool Enqueue(const Timeline& next);
+
+	// True until the sequencer has moved on to the queued song.
+	bool HasQueued() const;
+
+	// Number of queued songs started since Start().
+	uint32_t SongNumber() const { return songNumber.load(); }
+
+	// Stops playback, drops the queued song and silences the sink.
+	void Stop();
+
+	// Blocks until the end of the last song or until Stop() is called.
+	void Wait();
+
+	bool IsPlaying() const { return playing.load(); }
+
+	// Position of the last dispatched event in the song playing, or of the last seek once the thread applied it.
+	// Only the thread sets it.
+	int64_t PositionUs() const { return positionUs.load(); }
+
+	// Transport, see above. The requests take effect within SEQUENCER_MAX_SLEEP_US.
+
+	// Silences the notes which sound and holds the position. Ignored if nothing is playing.
+	void Pause();
+
+	// Continues from the position where playback was paused, with the sustain pedals held there.
+	void Resume();
+
+	bool IsPaused() const { return pauseRequested.load(); }
+
+	// Continues the song playing from the given position, keeping the queued song and the pause state.
+	// Fails if nothing is playing.
+	bool Seek(int64_t songUs);
+
+	// Playback speed relative to the tempo of the song, clamped to SEQUENCER_MIN_TEMPO_SCALE ..
+	// SEQUENCER_MAX_TEMPO_SCALE. Kept across songs and calls to Start().
+	void SetTempoScale(double scale);
+	double TempoScale() const { return tempoRequest.load(); }
+
+	// Time before a deadline when the thread stops sleeping and starts spinning.
+	void SetSpinThresholdUs(int64_t us) { spinThresholdUs = us; }
+
+	// Delay after a deadline from which an event counts as late. Set before Start().
+	void SetLateThresholdUs(int64_t us) { lateThresholdUs = us; }
+
+	// Safe to call while playing.
+	SequencerTiming Timing() const;
+
+	// Delay of every dispatched event after its deadline.
+	const TimingHistogram& DispatchDelay() const { return dispatchDelay; }
+
+	// Timing() and DispatchDelay() as one JSON object.
+	std::string TimingJson() const;
+
+private:
+	Sequencer(const Sequencer&);
+	Sequencer& operator=(const Sequencer&);
+
+	void SendChase(const MidiState& state);
+	void SeedSustain(const MidiState& state);
+	bool ReadStreamTo(int64_t songUs, MidiState& state, bool& chase);
+	void Launch();
+	void Run();
+	const Timeline* TakeQueued();
+
+	// Where the thread stands in the song playing.
+	struct Cursor {
+		const TimelineEvent* events;
+		size_t count;
+		size_t index;
+		bool songStarting; // The controllers are reset at the deadline of song position zero.
+	};
+
+	int64_t DeadlineOf(int64_t songUs) const { return anchorWallUs + int64_t(double(songUs - anchorSongUs) / scale); }
+	int64_t SongTimeAt(int64_t wallUs) const { return anchorSongUs + int64_t(double(wallUs - anchorWallUs) * scale); }
+	bool ApplyTransport(Cursor& cursor);
+	void Submit(const uint32_t* messages, size_t count, int64_t timeUs);
+	void SendControllerReset(int64_t timeUs);
+	void SilenceNotes(int64_t timeUs);
+	void TrackMessage(uint8_t status, uint8_t data1, uint8_t data2);
+	bool WaitUntil(int64_t deadlineUs);
+	size_t DispatchBatch(const TimelineEvent* events, size_t first, size_t count, int64_t deadlineUs);
+	void Account(size_t events, int64_t delayNs, bool ok, uint32_t sysex, uint64_t sysexLength);
+
+	std::thread thread;
+	std::atomic<bool> playing;
+	std::atomic<bool> stopRequested;
+	std::atomic<int64_t> positionUs;
+
+	const Timeline* timeline;
+	SmfStream* stream;
+	const uint8_t* payloadBase;
+	MidiSink* sink;
+	std::vector<TimelineEvent> window; // Stream playback: the events read ahead.
+	size_t windowCount;
+	size_t startIdx;
+	int64_t startUs;
+	int64_t spinThresholdUs;
+	int64_t lateThresholdUs;
+	std::vector<MidiSinkEvent> batch;
+	std::vector<uint8_t> sysexBuffer;
+	std::vector<uint8_t> queuedSysexBuffer; // Sized by Enqueue() for the queued song, under the queue mutex.
+
+	mutable std::mutex queueMutex;
+	const Timeline* queued;
+	bool queueOpen;            // Cleared when the thread is done with the last song.
+	std::atomic<uint32_t> songNumber;
+
+	// Transport requests, applied by the sequencer thread.
+	std::atomic<bool> transportPending;
+	std::atomic<bool> pauseRequested;
+	std::atomic<int64_t> seekRequestUs; // -1 if none.
+	std::atomic<double> tempoRequest;
+
+	// Transport state of the sequencer thread.
+	int64_t anchorWallUs;
+	int64_t anchorSongUs;
+	double scale;
+	int64_t originWallUs;      // Playback time zero.
+	bool paused;
+	int64_t pausedSongUs;
+	uint8_t activeNotes[MIDI_CHANNELS][128]; // Note-ons without their note-off yet.
+	uint8_t sustain[MIDI_CHANNELS];
+
+	// Written by the sequencer thread only.
+	TimingHistogram dispatchDelay;
+	std::atomic<uint64_t> eventCount;
+	std::atomic<uint64_t> batchCount;
+	std::atomic<uint64_t> lateCount;
+	std::atomic<uint64_t> droppedCount;
+	std::atomic<uint64_t> sysexCount;
+	std::atomic<uint64_t> sysexBytes;
+	std::atomic<int64_t> runStartUs;
+	std::atomic<int64_t> runEndUs; // 0 while playing.
+};
+
+const int64_t SEQUENCER_DEFAULT_SPIN_US = 1500;
+const int64_t SEQUENCER_DEFAULT_LATE_US = 1000;
+
+// Longest single sleep of the thread, so that Stop() and the transport are served promptly during long pauses.
+const int64_t SEQUENCER_MAX_SLEEP_US = 20000;
+
+const double SEQUENCER_MIN_TEMPO_SCALE = 0.25;
+const double SEQUENCER_MAX_TEMPO_SCALE = 4.0;
+
+// Largest number of simultaneous events sent to the sink in one batch.
+const size_t SEQUENCER_MAX_BATCH = 256;
+
+// Events read from a stream at once. Reading them takes some tens of microseconds.
+const size_t SEQUENCER_STREAM_WINDOW = 1024;
@@ -0,0 +1,285 @@
+#include "smf.h"
+
+#include <cstring>
+#include <sstream>
+
+static uint32_t ReadBE32(const uint8_t* p) {
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint16_t ReadBE16(const uint8_t* p) {
+	return uint16_t((p[0] << 8) | p[1]);
+}
+
+static uint32_t ReadLE32(const uint8_t* p) {
+	return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+// Reads a variable length quantity (at most 4 bytes). Returns false on truncation.
+static bool ReadVarLen(const uint8_t* data, uint32_t end, uint32_t& pos, uint32_t& value) {
+	value = 0;
+	for (int i = 0; i < 4; i++) {
+		if (pos >= end) {
+			return false;
+		}
+		uint8_t b = data[pos++];
+		value = (value << 7) | (b & 0x7F);
+		if ((b & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static std::string OffsetError(const char* what, uint32_t offset) {
+	std::ostringstream oss;
+	oss << what << " at offset " << offset;
+	return oss.str();
+}
+
+static inline bool ReadEvent(const uint8_t* data, uint32_t end, uint32_t& pos, uint8_t& runningStatus, SmfEvent& e, std::string& err) {
+	e.payloadOffset = 0;
+	e.payloadLength = 0;
+	e.data1 = 0;
+	e.data2 = 0;
+	e.reserved = 0;
+
+	if (!ReadVarLen(data, end, pos, e.delta)) {
+		err = OffsetError("truncated delta time", pos);
+		return false;
+	}
+	if (pos >= end) {
+		err = OffsetError("truncated event", pos);
+		return false;
+	}
+
+	uint8_t b = data[pos];
+	if (b & 0x80) {
+		e.status = b;
+		pos++;
+	}
+	else {
+		if (runningStatus == 0) {
+			err = OffsetError("data byte without running status", pos);
+			return false;
+		}
+		e.status = runningStatus;
+	}
+
+	int msgLen = ChannelMessageLength(e.status);
+	if (msgLen > 0) {
+		if (end - pos < uint32_t(msgLen - 1)) {
+			err = OffsetError("truncated channel message", pos);
+			return false;
+		}
+		e.data1 = data[pos++];
+		if (msgLen == 3) {
+			e.data2 = data[pos++];
+		}
+		runningStatus = e.status;
+	}
+	else if ((e.status == SMF_STATUS_SYSEX) || (e.status == SMF_STATUS_SYSEX_ESCAPE) || (e.status == SMF_STATUS_META)) {
+		if (e.status == SMF_STATUS_META) {
+			if (pos >= end) {
+				err = OffsetError("truncated meta event", pos);
+				return false;
+			}
+			e.data1 = data[pos++];
+		}
+		if (!ReadVarLen(data, end, pos, e.payloadLength) || (e.payloadLength > end - pos)) {
+			err = OffsetError("truncated event payload", pos);
+			return false;
+		}
+		e.payloadOffset = pos;
+		pos += e.payloadLength;
+		runningStatus = 0;
+	}
+	else {
+		err = OffsetError("invalid status byte", pos - 1);
+		return false;
+	}
+	return true;
+}
+
+bool SmfReadEvent(const uint8_t* data, uint32_t end, uint32_t& pos, uint8_t& runningStatus, SmfEvent& e, std::string& err) {
+	return ReadEvent(data, end, pos, runningStatus, e, err);
+}
+
+SmfFile::SmfFile() : image(nullptr), imageSize(0), format(0), division(0) {
+}
+
+void SmfFile::Clear() {
+	tracks.clear();
+	events.clear();
+	image = nullptr;
+	imageSize = 0;
+	format = 0;
+	division = 0;
+	mapping.Close();
+}
+
+bool SmfFile::Load(const std::string& path, std::string& err) {
+	Clear();
+
+	if (!mapping.Open(path, err)) {
+		return false;
+	}
+
+	if (!Parse(mapping.Data(), mapping.Size(), err)) {
+		mapping.Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool SmfReadLayout(const uint8_t* data, size_t size, uint16_t& format, uint16_t& division,
+	std::vector<SmfTrackChunk>& chunks, std::string& err) {
+	chunks.clear();
+
+	if (size > 0xFFFFFFFFu) {
+		err = "file is too large";
+		return false;
+	}
+
+	uint32_t pos = 0;
+	uint32_t end = uint32_t(size);
+
+	// RIFF RMID wrapper: the SMF image is the content of the 'data' chunk.
+	if ((end >= 12) && (memcmp(data, "RIFF", 4) == 0) && (memcmp(data + 8, "RMID", 4) == 0)) {
+		pos = 12;
+		bool found = false;
+		while (pos + 8 <= end) {
+			uint32_t chunkLen = ReadLE32(data + pos + 4);
+			if (memcmp(data + pos, "data", 4) == 0) {
+				pos += 8;
+				if (chunkLen < end - pos) {
+					end = pos + chunkLen;
+				}
+				found = true;
+				break;
+			}
+			if (chunkLen > end - pos - 8) {
+				break;
+			}
+			pos += 8 + chunkLen + (chunkLen & 1);
+		}
+		if (!found) {
+			err = "RMID file has no data chunk";
+			return false;
+		}
+	}
+
+	if ((end - pos < 14) || (memcmp(data + pos, "MThd", 4) != 0)) {
+		err = "not a standard MIDI file";
+		return false;
+	}
+
+	uint32_t headerLen = ReadBE32(data + pos + 4);
+	if ((headerLen < 6) || (headerLen > end - pos - 8)) {
+		err = "invalid MThd chunk";
+		return false;
+	}
+
+	format = ReadBE16(data + pos + 8);
+	uint16_t declaredTracks = ReadBE16(data + pos + 10);
+	division = ReadBE16(data + pos + 12);
+
+	if (format > 2) {
+		std::ostringstream oss;
+		oss << "unsupported SMF format " << format;
+		err = oss.str();
+		return false;
+	}
+	if (division == 0) {
+		err = "invalid time division";
+		return false;
+	}
+
+	pos += 8 + headerLen;
+	chunks.reserve(declaredTracks);
+
+	while ((pos + 8 <= end) && (chunks.size() < declaredTracks)) {
+		uint32_t chunkLen = ReadBE32(data + pos + 4);
+		uint32_t bodyPos = pos + 8;
+
+		// Many files in the wild declare a chunk longer than the file, so the length is clamped.
+		if (chunkLen > end - bodyPos) {
+			chunkLen = end - bodyPos;
+		}
+
+		if (memcmp(data + pos, "MTrk", 4) == 0) {
+			SmfTrackChunk chunk;
+			chunk.offset = bodyPos;
+			chunk.length = chunkLen;
+			chunks.push_back(chunk);
+		}
+
+		pos = bodyPos + chunkLen;
+	}
+
+	if (chunks.empty()) {
+		err = "file contains no tracks";
+		return false;
+	}
+
+	return true;
+}
+
+bool SmfFile::Parse(const uint8_t* data, size_t size, std::string& err) {
+	tracks.clear();
+	events.clear();
+	image = data;
+	imageSize = size;
+
+	std::vector<SmfTrackChunk> chunks;
+	if (!SmfReadLayout(data, size, format, division, chunks, err)) {
+		return false;
+	}
+
+	// Three bytes per event is a good estimate for dense files and avoids most reallocations.
+	uint32_t trackBytes = 0;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		trackBytes += chunks[i].length;
+	}
+	events.reserve(trackBytes / 3);
+	tracks.reserve(chunks.size());
+
+	for (size_t i = 0; i < chunks.size(); i++) {
+		if (!ParseTrack(chunks[i].offset, chunks[i].length, err)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool SmfFile::ParseTrack(uint32_t offset, uint32_t length, std::string& err) {
+	SmfTrack track;
+	track.firstEvent = uint32_t(events.size());
+	track.eventCount = 0;
+	track.lengthTicks = 0;
+
+	const uint8_t* data = image;
+	uint32_t pos = offset;
+	uint32_t end = offset + length;
+	uint8_t runningStatus = 0;
+
+	while (pos < end) {
+		SmfEvent e;
+		if (!ReadEvent(data, end, pos, runningStatus, e, err)) {
+			return false;
+		}
+
+		events.push_back(e);
+		track.lengthTicks += e.delta;
+
+		if ((e.status == SMF_STATUS_META) && (e.data1 == SMF_META_END_OF_TRACK)) {
+			break;
+		}
+	}
+
+	track.eventCount = uint32_t(events.size()) - track.firstEvent;
+	tracks.push_back(track);
+	return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/*
+
+Standard MIDI File parser.
+
+Supports formats 0, 1 and 2, plain or wrapped into a RIFF RMID container.
+All events of all tracks are stored in a single array, track by track.
+SysEx and meta event payloads are not copied: an event keeps the offset
+and the length of its payload inside the file image.
+
+*/
+
+const uint8_t SMF_STATUS_SYSEX = 0xF0;
+const uint8_t SMF_STATUS_SYSEX_ESCAPE = 0xF7;
+const uint8_t SMF_STATUS_META = 0xFF;
+
+const uint8_t SMF_META_TEXT = 0x01;
+const uint8_t SMF_META_TRACK_NAME = 0x03;
+const uint8_t SMF_META_END_OF_TRACK = 0x2F;
+const uint8_t SMF_META_TEMPO = 0x51;
+const uint8_t SMF_META_TIME_SIGNATURE = 0x58;
+
+struct SmfEvent {
+	uint32_t delta;         // Ticks since the previous event of the same track.
+	uint32_t payloadOffset; // SysEx and meta events: payload offset in the file image.
+	uint32_t payloadLength; // SysEx and meta events: payload length.
+	uint8_t status;         // Channel message status, 0xF0 / 0xF7 for SysEx, 0xFF for meta events.
+	uint8_t data1;          // First data byte. Meta type for meta events.
+	uint8_t data2;          // Second data byte.
+	uint8_t reserved;
+};
+
+struct SmfTrack {
+	uint32_t firstEvent;  // Index of the first event in the event array.
+	uint32_t eventCount;
+	uint32_t lengthTicks; // Sum of all deltas of the track.
+};
+
+// Body of an MTrk chunk in the file image.
+struct SmfTrackChunk {
+	uint32_t offset;
+	uint32_t length;
+};
+
+class SmfFile {
+public:
+	SmfFile();
+
+	// Maps the file into memory and parses it. The mapping is owned by this object.
+	bool Load(const std::string& path, std::string& err);
+
+	// Parses a file image owned by the caller. The image must outlive this object.
+	bool Parse(const uint8_t* data, size_t size, std::string& err);
+
+	void Clear();
+
+	uint16_t Format() const { return format; }
+	uint16_t Division() const { return division; }
+	bool IsSmpte() const { return (division & 0x8000) != 0; }
+
+	size_t TrackCount() const { return tracks.size(); }
+	const SmfTrack& Track(size_t idx) const { return tracks[idx]; }
+
+	size_t EventCount() const { return events.size(); }
+	const SmfEvent* Events() const { return events.empty() ? nullptr : &events[0]; }
+	const SmfEvent* TrackEvents(size_t idx) const { return Events() + tracks[idx].firstEvent; }
+
+	// Whole file image, including a RIFF wrapper if present.
+	const uint8_t* Image() const { return image; }
+	size_t ImageSize() const { return imageSize; }
+
+	const uint8_t* Payload(const SmfEvent& e) const { return image + e.payloadOffset; }
+
+private:
+	bool ParseTrack(uint32_t offset, uint32_t length, std::string& err);
+
+	MappedFile mapping;
+	const uint8_t* image;
+	size_t imageSize;
+	uint16_t format;
+	uint16_t division;
+	std::vector<SmfTrack> tracks;
+	std::vector<SmfEvent> events;
+};
+
+// Reads the header of a SMF image, plain or wrapped into RMID, and finds its track chunks without parsing them.
+bool SmfReadLayout(const uint8_t* data, size_t size, uint16_t& format, uint16_t& division,
+	std::vector<SmfTrackChunk>& chunks, std::string& err);
+
+// Decodes the event at 'pos' of a track ending at 'end' and moves 'pos' past it.
+// 'runningStatus' carries the running status from event to event and is 0 at the start of a track.
+bool SmfReadEvent(const uint8_t* data, uint32_t end, uint32_t& pos, uint8_t& runningStatus, SmfEvent& e, std::string& err);
+
+// Length of a channel message including the status byte; 0 for non-channel statuses.
+inline int ChannelMessageLength(uint8_t status) {
+	switch (status & 0xF0) {
+	case 0x80: case 0x90: case 0xA0: case 0xB0: case 0xE0:
+		return 3;
+	case 0xC0: case 0xD0:
+		return 2;
+	}
+	return 0;
+}
+
+// Packs a channel message the way midiOutShortMsg expects it.
+inline uint32_t PackShortMessage(uint8_t status, uint8_t data1, uint8_t data2) {
+	return uint32_t(status) | (uint32_t(data1) << 8) | (uint32_t(data2) << 16);
+}
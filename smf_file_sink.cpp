@@ -0,0 +1,185 @@
+#include "smf_file_sink.h"
+
+#include <fstream>
+
+#include "hires_clock.h"
+#include "smf.h"
+
+static void WriteVarLen(std::vector<uint8_t>& out, uint32_t value) {
+	uint8_t buf[5];
+	int n = 0;
+	buf[n++] = uint8_t(value & 0x7F);
+	while ((value >>= 7) != 0) {
+		buf[n++] = uint8_t((value & 0x7F) | 0x80);
+	}
+	while (n > 0) {
+		out.push_back(buf[--n]);
+	}
+}
+
+static void WriteBE32(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back(uint8_t(value >> 24));
+	out.push_back(uint8_t(value >> 16));
+	out.push_back(uint8_t(value >> 8));
+	out.push_back(uint8_t(value));
+}
+
+SmfFileSink::SmfFileSink() : dropped(0), originUs(-1), lastTimeUs(0) {
+}
+
+void SmfFileSink::Clear() {
+	items.clear();
+	bytes.clear();
+	runningStatus.Cancel();
+	dropped = 0;
+	originUs = -1;
+	lastTimeUs = 0;
+}
+
+void SmfFileSink::Reserve(size_t messages, size_t longBytes) {
+	items.reserve(messages);
+	bytes.reserve(longBytes);
+}
+
+int64_t SmfFileSink::UntimedNow() {
+	int64_t now = NowMicros();
+	if (originUs < 0) {
+		originUs = now;
+	}
+	return now - originUs;
+}
+
+void SmfFileSink::Add(int64_t timeUs, uint32_t message, const uint8_t* data, uint32_t length) {
+	if (timeUs < lastTimeUs) {
+		timeUs = lastTimeUs;
+	}
+	lastTimeUs = timeUs;
+
+	Item item;
+	item.timeUs = timeUs;
+	item.message = message;
+	item.offset = uint32_t(bytes.size());
+	item.length = length;
+	if (length > 0) {
+		bytes.insert(bytes.end(), data, data + length);
+		runningStatus.Cancel();
+	}
+	items.push_back(item);
+}
+
+void SmfFileSink::AddShort(int64_t timeUs, uint32_t message) {
+	message = runningStatus.Decode(message);
+	if (message == 0) {
+		dropped++;
+		return;
+	}
+	Add(timeUs, message, nullptr, 0);
+}
+
+bool SmfFileSink::ShortMessage(uint32_t message) {
+	AddShort(UntimedNow(), message);
+	return true;
+}
+
+bool SmfFileSink::LongMessage(const uint8_t* data, uint32_t length) {
+	if (length > 0) {
+		Add(UntimedNow(), 0, data, length);
+	}
+	return true;
+}
+
+void SmfFileSink::Reset() {
+	runningStatus.Cancel();
+	int64_t now = UntimedNow();
+	for (int ch = 0; ch < 16; ch++) {
+		Add(now, PackShortMessage(uint8_t(0xB0 | ch), 123, 0), nullptr, 0); // All Notes Off.
+		Add(now, PackShortMessage(uint8_t(0xB0 | ch), 121, 0), nullptr, 0); // Reset All Controllers.
+	}
+}
+
+bool SmfFileSink::SubmitBatch(const MidiSinkEvent* events, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const MidiSinkEvent& e = events[i];
+		if (originUs < 0) {
+			originUs = NowMicros() - e.timeUs;
+		}
+		if (e.data) {
+			if (e.length > 0) {
+				Add(e.timeUs, 0, e.data, e.length);
+			}
+		}
+		else {
+			AddShort(e.timeUs, e.message);
+		}
+	}
+	return true;
+}
+
+bool SmfFileSink::Save(const std::string& path, std::string& err) const {
+	std::vector<uint8_t> track;
+	track.reserve(items.size() * 4 + bytes.size() + 32);
+
+	// Tempo.
+	const uint8_t tempo[] = { 0x00, SMF_STATUS_META, SMF_META_TEMPO, 0x03,
+		uint8_t(SMF_SINK_US_PER_QUARTER >> 16), uint8_t(SMF_SINK_US_PER_QUARTER >> 8), uint8_t(SMF_SINK_US_PER_QUARTER) };
+	track.insert(track.end(), tempo, tempo + sizeof(tempo));
+
+	const int64_t usPerTick = SMF_SINK_US_PER_QUARTER / SMF_SINK_DIVISION;
+	int64_t lastTick = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		const Item& item = items[i];
+		int64_t tick = item.timeUs / usPerTick;
+
+		if (item.length > 0) {
+			const uint8_t* data = &bytes[item.offset];
+			WriteVarLen(track, uint32_t(tick - lastTick));
+			if (data[0] == SMF_STATUS_SYSEX) {
+				track.push_back(SMF_STATUS_SYSEX);
+				WriteVarLen(track, item.length - 1);
+				track.insert(track.end(), data + 1, data + item.length);
+			}
+			else {
+				track.push_back(SMF_STATUS_SYSEX_ESCAPE);
+				WriteVarLen(track, item.length);
+				track.insert(track.end(), data, data + item.length);
+			}
+		}
+		else {
+			uint8_t status = uint8_t(item.message & 0xFF);
+			int len = ChannelMessageLength(status);
+			if (len == 0) {
+				// System common and real-time messages can not be stored in a SMF.
+				continue;
+			}
+			WriteVarLen(track, uint32_t(tick - lastTick));
+			track.push_back(status);
+			track.push_back(uint8_t((item.message >> 8) & 0x7F));
+			if (len == 3) {
+				track.push_back(uint8_t((item.message >> 16) & 0x7F));
+			}
+		}
+		lastTick = tick;
+	}
+
+	const uint8_t endOfTrack[] = { 0x00, SMF_STATUS_META, SMF_META_END_OF_TRACK, 0x00 };
+	track.insert(track.end(), endOfTrack, endOfTrack + sizeof(endOfTrack));
+
+	std::vector<uint8_t> header;
+	const uint8_t mthd[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1,
+		uint8_t(SMF_SINK_DIVISION >> 8), uint8_t(SMF_SINK_DIVISION & 0xFF), 'M', 'T', 'r', 'k' };
+	header.insert(header.end(), mthd, mthd + sizeof(mthd));
+	WriteBE32(header, uint32_t(track.size()));
+
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) {
+		err = "can not create file: " + path;
+		return false;
+	}
+	out.write((const char*)&header[0], std::streamsize(header.size()));
+	out.write((const char*)&track[0], std::streamsize(track.size()));
+	if (!out) {
+		err = "can not write file: " + path;
+		return false;
+	}
+	return true;
+}
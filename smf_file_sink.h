@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "midi_sink.h"
+#include "output_optimizer.h"
+
+// Sink which collects messages and writes them back as a format 0 Standard MIDI File.
+// Song time of batched messages is kept; messages sent one by one are placed by the wall clock.
+// Messages sent with running status get their status byte back; data bytes without a running status are dropped.
+class SmfFileSink : public MidiSink {
+public:
+	SmfFileSink();
+
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+	bool SubmitBatch(const MidiSinkEvent* events, size_t count);
+
+	bool Save(const std::string& path, std::string& err) const;
+	void Clear();
+
+	// Room for recording without allocating, e.g. on the sequencer thread. Past it the sink allocates.
+	void Reserve(size_t messages, size_t longBytes);
+
+	size_t MessageCount() const { return items.size(); }
+	uint64_t Dropped() const { return dropped; }
+
+private:
+	struct Item {
+		int64_t timeUs;
+		uint32_t message;
+		uint32_t offset; // Long messages: offset in 'bytes'.
+		uint32_t length; // Long messages: number of bytes.
+	};
+
+	int64_t UntimedNow();
+	void Add(int64_t timeUs, uint32_t message, const uint8_t* data, uint32_t length);
+	void AddShort(int64_t timeUs, uint32_t message);
+
+	std::vector<Item> items;
+	std::vector<uint8_t> bytes;
+	RunningStatusDecoder runningStatus;
+	uint64_t dropped;
+	int64_t originUs;   // Wall clock time of song position zero; -1 until the first message.
+	int64_t lastTimeUs;
+};
+
+// Resolution of written files: 5000 ticks per quarter note at 120 BPM, 100 us per tick.
+const uint16_t SMF_SINK_DIVISION = 5000;
+const uint32_t SMF_SINK_US_PER_QUARTER = 500000;
+
+// Reserved by the FILE output of the player, enough for most songs.
+const size_t SMF_SINK_RESERVE_MESSAGES = 1024 * 1024;
+const size_t SMF_SINK_RESERVE_BYTES = 1024 * 1024;
@@ -0,0 +1,238 @@
+#include "smf_stream.h"
+
+#include <algorithm>
+
+namespace {
+
+// Min-heap order: earliest tick first, lower track first on equal ticks, as in Timeline::Build.
+struct EntryLater {
+	template <typename T>
+	bool operator()(const T& a, const T& b) const {
+		if (a.tick != b.tick) {
+			return a.tick > b.tick;
+		}
+		return a.track > b.track;
+	}
+};
+
+bool IsEndOfTrack(const SmfEvent& e) {
+	return (e.status == SMF_STATUS_META) && (e.data1 == SMF_META_END_OF_TRACK);
+}
+
+uint32_t ReadTempo(const uint8_t* p) {
+	return (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | uint32_t(p[2]);
+}
+
+}
+
+SmfStream::SmfStream() :
+	image(nullptr),
+	imageSize(0),
+	format(0),
+	division(0),
+	smpte(false),
+	ticksPerQuarter(1),
+	nextTrack(0),
+	groupEndTick(0),
+	eventsRead(0)
+{
+	tempo.tick = 0;
+	tempo.timeUs = 0;
+	tempo.usPerQuarter = DEFAULT_US_PER_QUARTER;
+}
+
+void SmfStream::Close() {
+	chunks.clear();
+	cursors.clear();
+	heap.clear();
+	image = nullptr;
+	imageSize = 0;
+	error.clear();
+	mapping.Close();
+}
+
+bool SmfStream::Open(const std::string& path, std::string& err) {
+	Close();
+
+	if (!mapping.Open(path, err)) {
+		return false;
+	}
+	image = mapping.Data();
+	imageSize = mapping.Size();
+
+	if (!Setup(err)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool SmfStream::Parse(const uint8_t* data, size_t size, std::string& err) {
+	Close();
+
+	image = data;
+	imageSize = size;
+	if (!Setup(err)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool SmfStream::Setup(std::string& err) {
+	if (!SmfReadLayout(image, imageSize, format, division, chunks, err)) {
+		return false;
+	}
+
+	// Tempo for SMPTE division is fixed: one "quarter" is one second of frames * ticks per frame.
+	smpte = (division & 0x8000) != 0;
+	if (smpte) {
+		int fps = -int(int8_t(division >> 8));
+		uint32_t ticksPerFrame = division & 0xFF;
+		if ((fps <= 0) || (ticksPerFrame == 0)) {
+			err = "invalid SMPTE time division";
+			return false;
+		}
+		ticksPerQuarter = (fps == 29) ? 30 * ticksPerFrame : uint32_t(fps) * ticksPerFrame;
+	}
+	else {
+		ticksPerQuarter = division;
+	}
+
+	cursors.resize(chunks.size());
+	heap.reserve(chunks.size());
+	Rewind();
+	return true;
+}
+
+void SmfStream::Rewind() {
+	heap.clear();
+	nextTrack = 0;
+	groupEndTick = 0;
+	eventsRead = 0;
+	error.clear();
+	tempo.tick = 0;
+	tempo.timeUs = 0;
+	if (smpte) {
+		// 29.97 drop frame runs slower than its nominal 30 frames per second.
+		tempo.usPerQuarter = (int8_t(division >> 8) == -29) ? 1001000 : 1000000;
+	}
+	else {
+		tempo.usPerQuarter = DEFAULT_US_PER_QUARTER;
+	}
+	for (size_t i = 0; i < cursors.size(); i++) {
+		cursors[i].evictedPos = chunks[i].offset;
+	}
+}
+
+// Format 0 and 1: all tracks at once. Format 2: one track at a time, after the previous one.
+bool SmfStream::StartGroup() {
+	size_t groupEnd = (format == 2) ? nextTrack + 1 : chunks.size();
+	uint32_t trackOffset = groupEndTick;
+	for (; (nextTrack < groupEnd) && (nextTrack < chunks.size()); nextTrack++) {
+		Cursor& c = cursors[nextTrack];
+		c.pos = chunks[nextTrack].offset;
+		c.end = chunks[nextTrack].offset + chunks[nextTrack].length;
+		c.runningStatus = 0;
+		if (c.pos >= c.end) {
+			continue;
+		}
+		if (!SmfReadEvent(image, c.end, c.pos, c.runningStatus, c.next, error)) {
+			return false;
+		}
+		c.tick = trackOffset + c.next.delta;
+
+		HeapEntry entry;
+		entry.tick = c.tick;
+		entry.track = uint32_t(nextTrack);
+		heap.push_back(entry);
+		std::push_heap(heap.begin(), heap.end(), EntryLater());
+	}
+	return true;
+}
+
+// Decodes the next event of the cursor. False at the end of the track.
+bool SmfStream::Advance(Cursor& c) {
+	if (IsEndOfTrack(c.next) || (c.pos >= c.end)) {
+		return false;
+	}
+	if (!SmfReadEvent(image, c.end, c.pos, c.runningStatus, c.next, error)) {
+		return false;
+	}
+	c.tick += c.next.delta;
+	return true;
+}
+
+void SmfStream::EvictConsumed() {
+	for (size_t i = 0; i < nextTrack; i++) {
+		Cursor& c = cursors[i];
+		uint32_t aligned = uint32_t(c.pos / MAPPED_FILE_EVICT_ALIGN * MAPPED_FILE_EVICT_ALIGN);
+		if (aligned > c.evictedPos) {
+			mapping.Evict(c.evictedPos, aligned - c.evictedPos);
+			c.evictedPos = aligned;
+		}
+	}
+}
+
+size_t SmfStream::Read(TimelineEvent* out, size_t max) {
+	if (Failed()) {
+		return 0;
+	}
+	if (mapping.IsOpen()) {
+		EvictConsumed();
+	}
+
+	size_t n = 0;
+	while (n < max) {
+		if (heap.empty()) {
+			if ((nextTrack >= chunks.size()) || !StartGroup()) {
+				break;
+			}
+			continue;
+		}
+
+		std::pop_heap(heap.begin(), heap.end(), EntryLater());
+		Cursor& c = cursors[heap.back().track];
+		const SmfEvent& e = c.next;
+		uint32_t tick = c.tick;
+		if (tick > groupEndTick) {
+			groupEndTick = tick;
+		}
+
+		if (!IsEndOfTrack(e)) {
+			TimelineEvent& te = out[n++];
+			te.tick = tick;
+			te.timeUs = tempo.timeUs + int64_t(tick - tempo.tick) * tempo.usPerQuarter / ticksPerQuarter;
+			te.payloadOffset = e.payloadOffset;
+			te.payloadLength = e.payloadLength;
+			te.status = e.status;
+			te.data1 = e.data1;
+			te.data2 = e.data2;
+			te.reserved = 0;
+
+			if (!smpte && (e.status == SMF_STATUS_META) && (e.data1 == SMF_META_TEMPO) && (e.payloadLength >= 3)) {
+				uint32_t usPerQuarter = ReadTempo(image + e.payloadOffset);
+				if (usPerQuarter > 0) {
+					tempo.tick = tick;
+					tempo.timeUs = te.timeUs;
+					tempo.usPerQuarter = usPerQuarter;
+				}
+			}
+		}
+
+		if (Advance(c)) {
+			heap.back().tick = c.tick;
+			std::push_heap(heap.begin(), heap.end(), EntryLater());
+		}
+		else {
+			heap.pop_back();
+			if (Failed()) {
+				heap.clear();
+				break;
+			}
+		}
+	}
+
+	eventsRead += n;
+	return n;
+}
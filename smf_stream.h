@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "smf.h"
+#include "timeline.h"
+
+/*
+
+Streaming reader of Standard MIDI Files of any size.
+
+Opening a file maps it into memory and reads only the chunk headers. Every
+track has a cursor which decodes one event at a time, and a heap merges the
+cursors into song order, the way Timeline::Build merges parsed tracks. Tempo
+changes are applied as they come by, so the events are returned with their
+tick and time exactly as in a Timeline. Nothing is decoded before it is asked
+for, so the time to the first event does not depend on the size of the file.
+
+The pages of the mapping the cursors have moved past are evicted from memory,
+which keeps the resident set to about one block of MAPPED_FILE_EVICT_ALIGN
+bytes per track plus the read-ahead of the system.
+
+Errors in a track are found when the cursor gets there: reading stops and
+Failed() is set. Payload pointers stay valid until the stream is closed.
+
+*/
+
+class SmfStream {
+public:
+	SmfStream();
+
+	// Maps the file and finds its tracks. The mapping is owned by this object.
+	bool Open(const std::string& path, std::string& err);
+
+	// Reads a file image owned by the caller. The image must outlive this object.
+	bool Parse(const uint8_t* data, size_t size, std::string& err);
+
+	void Close();
+
+	// Decodes up to 'max' next events in song order into 'out'.
+	// Returns 0 at the end of the song and after a corrupt track was found.
+	size_t Read(TimelineEvent* out, size_t max);
+
+	// Back to the start of the song.
+	void Rewind();
+
+	bool Failed() const { return !error.empty(); }
+	const std::string& Error() const { return error; }
+
+	uint16_t Format() const { return format; }
+	size_t TrackCount() const { return chunks.size(); }
+	uint64_t EventsRead() const { return eventsRead; }
+
+	const uint8_t* PayloadBase() const { return image; }
+	const uint8_t* Payload(const TimelineEvent& e) const { return image + e.payloadOffset; }
+
+private:
+	SmfStream(const SmfStream&);
+	SmfStream& operator=(const SmfStream&);
+
+	struct Cursor {
+		SmfEvent next;       // Decoded, not yet returned.
+		uint32_t pos;        // File offset after 'next'.
+		uint32_t end;
+		uint32_t tick;       // Absolute tick of 'next'.
+		uint32_t evictedPos; // Everything before has been evicted.
+		uint8_t runningStatus;
+	};
+
+	struct HeapEntry {
+		uint32_t tick;
+		uint32_t track;
+	};
+
+	bool Setup(std::string& err);
+	bool StartGroup();
+	bool Advance(Cursor& c);
+	void EvictConsumed();
+
+	MappedFile mapping;
+	const uint8_t* image;
+	size_t imageSize;
+	uint16_t format;
+	uint16_t division;
+	bool smpte;
+	uint32_t ticksPerQuarter;
+	std::vector<SmfTrackChunk> chunks;
+
+	std::vector<Cursor> cursors; // One per track.
+	std::vector<HeapEntry> heap;
+	size_t nextTrack;            // First track not started yet.
+	uint32_t groupEndTick;       // Format 2: end of the sequences so far.
+	TempoSegment tempo;          // Tempo in effect at the last returned event.
+	uint64_t eventsRead;
+	std::string error;
+};
@@ -0,0 +1,375 @@
+#include "song_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "hires_clock.h"
+#include "work_stealing_pool.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const char CACHE_MAGIC[4] = { 'S', 'M', 'C', 'F' };
+
+// Stored as written; reads back differently on a machine of the other byte order.
+const uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+const size_t SECTION_ALIGN = 8;
+
+struct CacheSection {
+	uint64_t offset;
+	uint64_t count;
+	uint32_t elementSize;
+	uint32_t reserved;
+};
+
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t headerSize;
+	uint64_t fileSize;
+	uint64_t sourceSize;
+	int64_t sourceTime;      // Modification time as reported by the file system.
+	uint64_t sourceHash;     // FNV-1a of the whole source file.
+	uint32_t ticksPerQuarter;
+	uint32_t lengthTicks;
+	int64_t durationUs;
+	SongSummary summary;
+	uint32_t longestSysex;
+	CacheSection events;     // TimelineEvent, payload offsets relative to the payload section.
+	CacheSection tempoMap;   // TempoSegment.
+	CacheSection checkpoints; // MidiState.
+	CacheSection payload;    // Bytes.
+};
+
+static_assert(sizeof(TimelineEvent) == 24, "the song cache stores TimelineEvent as is");
+static_assert(sizeof(TempoSegment) == 16, "the song cache stores TempoSegment as is");
+static_assert(sizeof(CacheHeader) % SECTION_ALIGN == 0, "sections follow the header aligned");
+
+struct FileStamp {
+	uint64_t size;
+	int64_t time;
+};
+
+#ifdef _WIN32
+bool GetFileStamp(const std::string& path, FileStamp& stamp) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) {
+		return false;
+	}
+	stamp.size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	stamp.time = int64_t((uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime);
+	return true;
+}
+
+bool RenameReplacing(const std::string& from, const std::string& to) {
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+bool GetFileStamp(const std::string& path, FileStamp& stamp) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		return false;
+	}
+	stamp.size = uint64_t(st.st_size);
+#ifdef __APPLE__
+	stamp.time = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	stamp.time = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+bool RenameReplacing(const std::string& from, const std::string& to) {
+	return rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+uint64_t HashBytes(const uint8_t* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+size_t AlignSection(size_t offset) {
+	return (offset + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+}
+
+CacheSection MakeSection(size_t& offset, size_t count, size_t elementSize) {
+	CacheSection s;
+	s.offset = offset;
+	s.count = count;
+	s.elementSize = uint32_t(elementSize);
+	s.reserved = 0;
+	offset = AlignSection(offset + count * elementSize);
+	return s;
+}
+
+bool SectionFits(const CacheSection& s, size_t elementSize, uint64_t fileSize) {
+	return (s.elementSize == elementSize) && (s.offset % SECTION_ALIGN == 0) && (s.offset <= fileSize) &&
+		(s.count <= (fileSize - s.offset) / elementSize);
+}
+
+// Payloads inside the payload section, SysEx no longer than the recorded longest one the output buffers are sized by.
+bool EventsFit(const TimelineEvent* events, uint64_t count, uint64_t payloadSize, uint32_t longestSysex) {
+	for (uint64_t i = 0; i < count; i++) {
+		const TimelineEvent& e = events[i];
+		if (uint64_t(e.payloadOffset) + e.payloadLength > payloadSize) return false;
+		if ((e.status == SMF_STATUS_SYSEX) && (e.payloadLength > longestSysex)) return false;
+	}
+	return true;
+}
+
+// Zeros up to the given offset, which is at most SECTION_ALIGN bytes ahead.
+void PadTo(std::ofstream& out, uint64_t offset) {
+	static const char zeros[SECTION_ALIGN] = { 0 };
+	out.write(zeros, std::streamsize(offset - uint64_t(out.tellp())));
+}
+
+void WriteSection(std::ofstream& out, const CacheSection& s, const void* data) {
+	PadTo(out, s.offset);
+	if (s.count > 0) {
+		out.write((const char*)data, std::streamsize(s.count * s.elementSize));
+	}
+}
+
+}
+
+std::string SongCachePath(const std::string& midiPath) {
+	return midiPath + SONG_CACHE_EXTENSION;
+}
+
+SongSummary SummarizeSong(const SmfFile& smf, const Timeline& timeline) {
+	SongSummary s;
+	memset(&s, 0, sizeof(s));
+	s.format = smf.Format();
+	s.trackCount = uint16_t(smf.TrackCount());
+
+	uint8_t programs[MIDI_CHANNELS] = { 0 };
+	for (size_t i = 0; i < timeline.EventCount(); i++) {
+		const TimelineEvent& e = timeline.Event(i);
+		if (e.status >= SMF_STATUS_SYSEX) {
+			continue;
+		}
+		uint8_t channel = e.status & 0x0F;
+		s.channelMask |= uint16_t(1u << channel);
+		switch (e.status & 0xF0) {
+		case 0xC0:
+			programs[channel] = e.data1 & 0x7F;
+			break;
+		case 0x90:
+			if (e.data2 > 0) {
+				uint8_t program = programs[channel];
+				uint32_t* bits = (channel == 9) ? s.drumPrograms : s.melodicPrograms;
+				bits[program >> 5] |= 1u << (program & 31);
+				s.noteCount++;
+			}
+			break;
+		}
+	}
+	return s;
+}
+
+bool WriteSongCache(const std::string& midiPath, const SmfFile& smf, const Timeline& timeline, std::string& err) {
+	FileStamp stamp;
+	if (!GetFileStamp(midiPath, stamp)) {
+		err = "can not read file: " + midiPath;
+		return false;
+	}
+
+	// The payloads move from the SMF image into one block, in event order.
+	TimelineArrays a = timeline.Arrays();
+	std::vector<TimelineEvent> events(a.events, a.events + a.eventCount);
+	std::vector<uint8_t> payload;
+	for (size_t i = 0; i < events.size(); i++) {
+		TimelineEvent& e = events[i];
+		if (e.payloadLength == 0) {
+			e.payloadOffset = 0;
+			continue;
+		}
+		const uint8_t* p = a.payloadBase + e.payloadOffset;
+		e.payloadOffset = uint32_t(payload.size());
+		payload.insert(payload.end(), p, p + e.payloadLength);
+	}
+
+	CacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+	h.version = SONG_CACHE_VERSION;
+	h.byteOrder = CACHE_BYTE_ORDER;
+	h.headerSize = sizeof(CacheHeader);
+	h.sourceSize = stamp.size;
+	h.sourceTime = stamp.time;
+	h.sourceHash = HashBytes(smf.Image(), smf.ImageSize());
+	h.ticksPerQuarter = a.ticksPerQuarter;
+	h.lengthTicks = a.lengthTicks;
+	h.durationUs = a.durationUs;
+	h.summary = SummarizeSong(smf, timeline);
+	h.longestSysex = a.longestSysex;
+
+	size_t offset = sizeof(CacheHeader);
+	h.events = MakeSection(offset, events.size(), sizeof(TimelineEvent));
+	h.tempoMap = MakeSection(offset, a.tempoSegmentCount, sizeof(TempoSegment));
+	h.checkpoints = MakeSection(offset, a.checkpointCount, sizeof(MidiState));
+	h.payload = MakeSection(offset, payload.size(), 1);
+	h.fileSize = offset;
+
+	std::string path = SongCachePath(midiPath);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		out.write((const char*)&h, sizeof(h));
+		WriteSection(out, h.events, events.empty() ? nullptr : &events[0]);
+		WriteSection(out, h.tempoMap, a.tempoMap);
+		WriteSection(out, h.checkpoints, a.checkpoints);
+		WriteSection(out, h.payload, payload.empty() ? nullptr : &payload[0]);
+		PadTo(out, h.fileSize);
+		out.close();
+		if (!out) {
+			remove(tempPath.c_str());
+			err = "can not write file: " + tempPath;
+			return false;
+		}
+	}
+	if (!RenameReplacing(tempPath, path)) {
+		remove(tempPath.c_str());
+		err = "can not replace file: " + path;
+		return false;
+	}
+	return true;
+}
+
+void UpdateSongCaches(const std::vector<std::string>& files, unsigned threads, std::vector<SongCacheResult>& results) {
+	results.assign(files.size(), SongCacheResult());
+
+	WorkStealingPool pool(threads);
+	pool.Run(files.size(), [&](size_t task, unsigned) {
+		SongCacheResult& r = results[task];
+		r.input = files[task];
+		r.cache = SongCachePath(r.input);
+		r.buildUs = 0;
+		r.cacheBytes = 0;
+
+		SongCache cache;
+		if (cache.Open(r.input, r.reason)) {
+			r.status = SONG_CACHE_VALID;
+			r.cacheBytes = cache.Size();
+			return;
+		}
+
+		int64_t startUs = NowMicros();
+		SmfFile smf;
+		Timeline timeline;
+		std::string err;
+		if (!smf.Load(r.input, err) || !timeline.Build(smf, err) || !WriteSongCache(r.input, smf, timeline, err)) {
+			r.status = SONG_CACHE_FAILED;
+			r.reason = err;
+			return;
+		}
+		r.buildUs = NowMicros() - startUs;
+		r.status = SONG_CACHE_BUILT;
+
+		FileStamp stamp;
+		if (GetFileStamp(r.cache, stamp)) {
+			r.cacheBytes = stamp.size;
+		}
+	});
+}
+
+SongCache::SongCache() {
+	memset(&summary, 0, sizeof(summary));
+}
+
+void SongCache::Close() {
+	timeline.Clear();
+	memset(&summary, 0, sizeof(summary));
+	mapping.Close();
+}
+
+bool SongCache::Open(const std::string& midiPath, std::string& err) {
+	Close();
+
+	FileStamp stamp;
+	if (!GetFileStamp(midiPath, stamp)) {
+		err = "can not read file: " + midiPath;
+		return false;
+	}
+
+	std::string path = SongCachePath(midiPath);
+	std::string mapErr;
+	if (!mapping.Open(path, mapErr)) {
+		err = "no cache: " + mapErr;
+		return false;
+	}
+
+	const uint8_t* data = mapping.Data();
+	uint64_t size = mapping.Size();
+	CacheHeader h;
+	if (size < sizeof(h)) {
+		err = "cache is truncated: " + path;
+		Close();
+		return false;
+	}
+	memcpy(&h, data, sizeof(h));
+	if ((memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) != 0) || (h.version != SONG_CACHE_VERSION) ||
+		(h.byteOrder != CACHE_BYTE_ORDER) || (h.headerSize != sizeof(CacheHeader)))
+	{
+		err = "cache is of another version: " + path;
+		Close();
+		return false;
+	}
+	if ((h.fileSize != size) || !SectionFits(h.events, sizeof(TimelineEvent), size) ||
+		!SectionFits(h.tempoMap, sizeof(TempoSegment), size) || !SectionFits(h.checkpoints, sizeof(MidiState), size) ||
+		!SectionFits(h.payload, 1, size) || (h.ticksPerQuarter == 0) ||
+		!EventsFit((const TimelineEvent*)(data + h.events.offset), h.events.count, h.payload.count, h.longestSysex))
+	{
+		err = "cache is corrupt: " + path;
+		Close();
+		return false;
+	}
+
+	if (h.sourceSize != stamp.size) {
+		err = "cache is stale, the file size changed: " + path;
+		Close();
+		return false;
+	}
+	if (h.sourceTime != stamp.time) {
+		// Copied or touched files keep their content: compare the hash before giving up.
+		MappedFile source;
+		if (!source.Open(midiPath, err)) {
+			Close();
+			return false;
+		}
+		if (HashBytes(source.Data(), source.Size()) != h.sourceHash) {
+			err = "cache is stale, the file changed: " + path;
+			Close();
+			return false;
+		}
+	}
+
+	TimelineArrays a;
+	a.events = (const TimelineEvent*)(data + h.events.offset);
+	a.eventCount = size_t(h.events.count);
+	a.tempoMap = (const TempoSegment*)(data + h.tempoMap.offset);
+	a.tempoSegmentCount = size_t(h.tempoMap.count);
+	a.checkpoints = (const MidiState*)(data + h.checkpoints.offset);
+	a.checkpointCount = size_t(h.checkpoints.count);
+	a.payloadBase = data + h.payload.offset;
+	a.ticksPerQuarter = h.ticksPerQuarter;
+	a.lengthTicks = h.lengthTicks;
+	a.durationUs = h.durationUs;
+	a.longestSysex = h.longestSysex;
+	timeline.Attach(a);
+	summary = h.summary;
+	return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "smf.h"
+#include "timeline.h"
+
+/*
+
+Pre-compiled song cache.
+
+A cache file holds what Timeline::Build makes of a MIDI file: the merged and
+time-resolved events, the tempo map, the chase checkpoints and the SysEx and
+meta payloads, together with a summary of the song. The arrays are stored in
+their in-memory layout at aligned offsets, so opening a cache maps the file
+and attaches a Timeline to the arrays in place; nothing is parsed or copied.
+
+The cache of "song.mid" is "song.mid.smc" and records the size, modification
+time and hash of the file it was built from. It is used while the size and
+time still match, or when only the time changed but the hash did not. Caches
+of another version or byte order are treated as missing and built again, and
+so are caches whose events point outside the payloads.
+
+*/
+
+// What a song uses, for loading instruments ahead of playback.
+struct SongSummary {
+	uint16_t format;
+	uint16_t trackCount;
+	uint16_t channelMask;       // Bit n: channel n + 1 has channel messages.
+	uint16_t reserved;
+	uint32_t noteCount;         // Note-ons with a velocity.
+	uint32_t melodicPrograms[4]; // Bit p: notes are played with program p on a channel other than 10.
+	uint32_t drumPrograms[4];    // Bit p: notes are played with program p on channel 10.
+
+	bool UsesMelodicProgram(uint8_t program) const { return (melodicPrograms[program >> 5] >> (program & 31)) & 1; }
+	bool UsesDrumProgram(uint8_t program) const { return (drumPrograms[program >> 5] >> (program & 31)) & 1; }
+};
+
+enum SongCacheStatus {
+	SONG_CACHE_VALID,  // The cache was up to date.
+	SONG_CACHE_BUILT,  // The cache was missing or stale and has been written.
+	SONG_CACHE_FAILED
+};
+
+struct SongCacheResult {
+	std::string input;
+	std::string cache;
+	SongCacheStatus status;
+	std::string reason;   // Why the cache was built, or why it failed.
+	int64_t buildUs;      // Parsing, merging and writing.
+	uint64_t cacheBytes;
+};
+
+// Path of the cache of a MIDI file.
+std::string SongCachePath(const std::string& midiPath);
+
+// Summary of a built timeline.
+SongSummary SummarizeSong(const SmfFile& smf, const Timeline& timeline);
+
+// Writes the cache of a MIDI file from its parsed file and timeline.
+// The file is written under a temporary name and renamed, so readers never see it half written.
+bool WriteSongCache(const std::string& midiPath, const SmfFile& smf, const Timeline& timeline, std::string& err);
+
+// Makes sure the cache of every file is up to date, building the stale ones on a work-stealing pool.
+// 0 threads means one per hardware thread.
+void UpdateSongCaches(const std::vector<std::string>& files, unsigned threads, std::vector<SongCacheResult>& results);
+
+class SongCache {
+public:
+	SongCache();
+
+	// Maps the cache of a MIDI file. Fails with the reason if the cache is missing, stale or unreadable.
+	bool Open(const std::string& midiPath, std::string& err);
+	void Close();
+
+	bool IsOpen() const { return mapping.IsOpen(); }
+
+	// Attached to the mapped arrays, valid until the cache is closed.
+	const Timeline& GetTimeline() const { return timeline; }
+	const SongSummary& Summary() const { return summary; }
+	size_t Size() const { return mapping.Size(); }
+
+private:
+	SongCache(const SongCache&);
+	SongCache& operator=(const SongCache&);
+
+	MappedFile mapping;
+	Timeline timeline;
+	SongSummary summary;
+};
+
+const char SONG_CACHE_EXTENSION[] = ".smc";
+
+// Bumped whenever the layout of the file or of the stored structures changes.
+const uint32_t SONG_CACHE_VERSION = 2;
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded single-producer / single-consumer lock-free queue.
+// Push is called by one thread and Pop by another; neither ever blocks or allocates.
+// Capacity is rounded up to a power of two.
+template <typename T>
+class SpscRing {
+public:
+	explicit SpscRing(size_t capacity) : head(0), tail(0) {
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		buffer.resize(size);
+		mask = size - 1;
+	}
+
+	size_t Capacity() const { return buffer.size(); }
+
+	// Producer side.
+	bool Push(const T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == buffer.size()) {
+			return false;
+		}
+		buffer[t & mask] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Producer side: copies count items, either all of them or none.
+	bool PushBulk(const T* items, size_t count) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (buffer.size() - (t - head.load(std::memory_order_acquire)) < count) {
+			return false;
+		}
+		for (size_t i = 0; i < count; i++) {
+			buffer[(t + i) & mask] = items[i];
+		}
+		tail.store(t + count, std::memory_order_release);
+		return true;
+	}
+
+	// Producer side: free slots, exact for the producer.
+	size_t FreeSpace() const {
+		return buffer.size() - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+	}
+
+	// Consumer side.
+	bool Pop(T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = buffer[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side: copies count items, either all of them or none.
+	bool PopBulk(T* items, size_t count) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (tail.load(std::memory_order_acquire) - h < count) {
+			return false;
+		}
+		for (size_t i = 0; i < count; i++) {
+			items[i] = buffer[(h + i) & mask];
+		}
+		head.store(h + count, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side: returns the oldest item without removing it.
+	const T* Peek() const {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		return &buffer[h & mask];
+	}
+
+	// Either side: approximate number of queued items.
+	size_t Size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+private:
+	SpscRing(const SpscRing&);
+	SpscRing& operator=(const SpscRing&);
+
+	std::vector<T> buffer;
+	size_t mask;
+
+	// Head and tail are written by different threads, keep them on separate cache lines.
+	char pad0[64];
+	std::atomic<size_t> head;
+	char pad1[64];
+	std::atomic<size_t> tail;
+	char pad2[64];
+};
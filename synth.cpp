@@ -0,0 +1,608 @@
+#include "synth.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "allocation_tracker.h"
+
+// Frames rendered per chunk by RenderInt16 and by parallel renders.
+static const uint32_t INT16_CHUNK = 4096;
+
+static const uint16_t RPN_NONE = 0x3FFF;
+static const float HALF_PI = 1.57079632679489661923f;
+
+void SynthVoicePool::Allocate(uint32_t capacity) {
+	state.assign(capacity, uint8_t(VOICE_FREE));
+	channel.assign(capacity, 0);
+	note.assign(capacity, 0);
+	envStage.assign(capacity, 0);
+	age.assign(capacity, 0);
+	samples.assign(capacity, nullptr);
+	end.assign(capacity, 0);
+	loopLength.assign(capacity, 0);
+	padding.assign(capacity, 0);
+	position.assign(capacity, 0);
+	step.assign(capacity, 0);
+	baseStep.assign(capacity, 0.0);
+	envLevel.assign(capacity, 0.0f);
+	attackRate.assign(capacity, 0.0f);
+	decayRate.assign(capacity, 0.0f);
+	sustainLevel.assign(capacity, 0.0f);
+	releaseTime.assign(capacity, 0.0f);
+	releaseRate.assign(capacity, 0.0f);
+	gain.assign(capacity, 0.0f);
+	pan.assign(capacity, 0.0f);
+	gainL.assign(capacity, 0.0f);
+	gainR.assign(capacity, 0.0f);
+	finished.assign(capacity, 0);
+}
+
+Synth::Synth(const SynthConfig& config) :
+	sampleRate(config.sampleRate),
+	capacity(config.maxVoices > 0 ? config.maxVoices : 1),
+	polyphony(0),
+	masterGain(config.masterGain),
+	instruments(nullptr),
+	kernels(&BestSynthKernels()),
+	interpolation(config.interpolation),
+	activeCount(0),
+	freeCount(0),
+	nextAge(0),
+	stolenCount(0),
+	peakVoices(0),
+	partitioning(config.partitioning),
+	blockOut(nullptr),
+	blockFrames(0)
+{
+	voices.Allocate(capacity);
+	active.resize(capacity);
+	freeList.resize(capacity);
+	for (uint32_t i = 0; i < capacity; i++) {
+		// Lowest voice numbers are taken first.
+		freeList[i] = capacity - 1 - i;
+	}
+	freeCount = capacity;
+	scratch.resize(INT16_CHUNK * 2);
+
+	// More threads than cores would only wait for each other.
+	uint32_t threads = config.renderThreads;
+	uint32_t cores = std::thread::hardware_concurrency();
+	if ((cores > 0) && (threads > cores)) {
+		threads = cores;
+	}
+	if (threads > 1) {
+		workers.reset(new BlockWorkers(threads));
+		partitions.resize(threads);
+		for (size_t i = 0; i < partitions.size(); i++) {
+			partitions[i].voices.resize(capacity);
+			partitions[i].count = 0;
+			if (i > 0) {
+				partitions[i].buffer.resize(INT16_CHUNK * 2);
+			}
+		}
+	}
+
+	SetPolyphony(config.polyphony);
+	ResetChannels();
+}
+
+void Synth::SetPolyphony(uint32_t limit) {
+	if (limit == 0) {
+		limit = 1;
+	}
+	if (limit > capacity) {
+		limit = capacity;
+	}
+	polyphony = limit;
+
+	// Drop the oldest voices above the new limit.
+	while (activeCount > polyphony) {
+		uint32_t oldest = 0;
+		for (uint32_t i = 1; i < activeCount; i++) {
+			if (voices.age[active[i]] < voices.age[active[oldest]]) {
+				oldest = i;
+			}
+		}
+		FreeVoice(oldest);
+	}
+}
+
+void Synth::ResetChannels() {
+	for (int ch = 0; ch < 16; ch++) {
+		SynthChannel& c = channels[ch];
+		c.program = 0;
+		c.bankMsb = 0;
+		c.bankLsb = 0;
+		c.drum = (ch == 9);
+		c.sustain = false;
+		c.volume = (100.0f / 127.0f) * (100.0f / 127.0f);
+		c.expression = 1.0f;
+		c.pan = 0.5f;
+		c.pitchBend = 8192;
+		c.rpn = RPN_NONE;
+		c.bendRangeSemitones = 2.0f;
+		c.bendRatio = 1.0;
+	}
+}
+
+void Synth::Reset() {
+	while (activeCount > 0) {
+		FreeVoice(activeCount - 1);
+	}
+	ResetChannels();
+}
+
+bool Synth::ShortMessage(uint32_t message) {
+	uint8_t status = uint8_t(message & 0xFF);
+	uint8_t data1 = uint8_t((message >> 8) & 0x7F);
+	uint8_t data2 = uint8_t((message >> 16) & 0x7F);
+	uint8_t ch = status & 0x0F;
+
+	switch (status & 0xF0) {
+	case 0x80:
+		NoteOff(ch, data1);
+		break;
+	case 0x90:
+		if (data2 == 0) {
+			NoteOff(ch, data1);
+		}
+		else {
+			NoteOn(ch, data1, data2);
+		}
+		break;
+	case 0xB0:
+		ControlChange(ch, data1, data2);
+		break;
+	case 0xC0:
+		ProgramChange(ch, data1);
+		break;
+	case 0xE0:
+		PitchBend(ch, uint16_t(data1 | (data2 << 7)));
+		break;
+	}
+	return true;
+}
+
+bool Synth::LongMessage(const uint8_t* data, uint32_t length) {
+	static const uint8_t gmOn[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+	static const uint8_t gm2On[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x03, 0xF7 };
+	static const uint8_t gsReset[] = { 0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7 };
+	static const uint8_t xgReset[] = { 0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7 };
+
+	bool reset =
+		((length == sizeof(gmOn)) && (memcmp(data, gmOn, length) == 0)) ||
+		((length == sizeof(gm2On)) && (memcmp(data, gm2On, length) == 0)) ||
+		((length == sizeof(gsReset)) && (memcmp(data, gsReset, length) == 0)) ||
+		((length == sizeof(xgReset)) && (memcmp(data, xgReset, length) == 0));
+	if (reset) {
+		Reset();
+	}
+	return true;
+}
+
+uint32_t Synth::AllocateVoice() {
+	if ((activeCount < polyphony) && (freeCount > 0)) {
+		uint32_t v = freeList[--freeCount];
+		active[activeCount++] = v;
+		if (activeCount > peakVoices) {
+			peakVoices = activeCount;
+		}
+		return v;
+	}
+
+	// Steal the oldest released voice, or the oldest voice.
+	uint32_t best = 0;
+	bool bestReleased = false;
+	for (uint32_t i = 0; i < activeCount; i++) {
+		uint32_t v = active[i];
+		bool released = (voices.state[v] == VOICE_RELEASED);
+		if (i == 0 || (released && !bestReleased) ||
+			((released == bestReleased) && (voices.age[v] < voices.age[active[best]]))) {
+			best = i;
+			bestReleased = released;
+		}
+	}
+	stolenCount++;
+	return active[best];
+}
+
+void Synth::FreeVoice(uint32_t activeIdx) {
+	uint32_t v = active[activeIdx];
+	voices.state[v] = VOICE_FREE;
+	active[activeIdx] = active[--activeCount];
+	freeList[freeCount++] = v;
+}
+
+void Synth::NoteOn(uint8_t ch, uint8_t key, uint8_t velocity) {
+	if (!instruments) {
+		return;
+	}
+
+	const SynthChannel& c = channels[ch];
+	bool drum = c.drum || (c.bankMsb == 127);
+	const SynthRegion* region = instruments->FindRegion(c.bankMsb, c.bankLsb, c.program, drum, key, velocity);
+	if (!region || !region->wave || (region->wave->length == 0)) {
+		return;
+	}
+	const SynthWave& wave = *region->wave;
+
+	uint32_t v = AllocateVoice();
+	SynthVoicePool& p = voices;
+
+	p.state[v] = VOICE_HELD;
+	p.channel[v] = ch;
+	p.note[v] = key;
+	p.age[v] = nextAge++;
+	p.samples[v] = wave.samples;
+	if (wave.loopLength > 0) {
+		p.end[v] = wave.loopStart + wave.loopLength;
+		p.loopLength[v] = wave.loopLength;
+	}
+	else {
+		p.end[v] = wave.length;
+		p.loopLength[v] = 0;
+	}
+	p.padding[v] = wave.padding;
+	p.position[v] = 0;
+
+	double cents = (int(key) - int(region->unityNote)) * 100.0 + region->fineTuneCents;
+	p.baseStep[v] = double(wave.sampleRate) / sampleRate * pow(2.0, cents / 1200.0);
+	p.step[v] = uint64_t(p.baseStep[v] * c.bendRatio * 4294967296.0);
+
+	float rate = float(sampleRate);
+	float attackFrames = region->attackSec * rate;
+	float decayFrames = region->decaySec * rate;
+	float releaseFrames = region->releaseSec * rate;
+	p.envStage[v] = ENV_ATTACK;
+	p.envLevel[v] = 0.0f;
+	p.attackRate[v] = (attackFrames > 1.0f) ? 1.0f / attackFrames : 1.0f;
+	p.sustainLevel[v] = region->sustainLevel;
+	p.decayRate[v] = (decayFrames > 1.0f) ? (1.0f - region->sustainLevel) / decayFrames : 1.0f;
+	p.releaseTime[v] = (releaseFrames > 1.0f) ? releaseFrames : 1.0f;
+	p.releaseRate[v] = 0.0f;
+
+	float vel = velocity / 127.0f;
+	p.gain[v] = vel * vel * region->gain;
+	p.pan[v] = region->pan;
+	p.gainL[v] = 0.0f;
+	p.gainR[v] = 0.0f;
+}
+
+void Synth::ReleaseVoice(uint32_t v) {
+	voices.state[v] = VOICE_RELEASED;
+	voices.envStage[v] = ENV_RELEASE;
+	float level = voices.envLevel[v];
+	voices.releaseRate[v] = ((level > 0.0f) ? level : 1e-6f) / voices.releaseTime[v];
+}
+
+void Synth::NoteOff(uint8_t ch, uint8_t key) {
+	bool sustain = channels[ch].sustain;
+	for (uint32_t i = 0; i < activeCount; i++) {
+		uint32_t v = active[i];
+		if ((voices.state[v] == VOICE_HELD) && (voices.channel[v] == ch) && (voices.note[v] == key)) {
+			if (sustain) {
+				voices.state[v] = VOICE_SUSTAINED;
+			}
+			else {
+				ReleaseVoice(v);
+			}
+		}
+	}
+}
+
+void Synth::AllNotesOff(uint8_t ch, bool immediately) {
+	for (uint32_t i = activeCount; i > 0; i--) {
+		uint32_t v = active[i - 1];
+		if (voices.channel[v] != ch) {
+			continue;
+		}
+		if (immediately) {
+			FreeVoice(i - 1);
+		}
+		else if (voices.state[v] != VOICE_RELEASED) {
+			ReleaseVoice(v);
+		}
+	}
+}
+
+void Synth::ControlChange(uint8_t ch, uint8_t controller, uint8_t value) {
+	SynthChannel& c = channels[ch];
+	float norm = value / 127.0f;
+
+	switch (controller) {
+	case 0:
+		c.bankMsb = value;
+		break;
+	case 32:
+		c.bankLsb = value;
+		break;
+	case 6:
+		if (c.rpn == 0) {
+			c.bendRangeSemitones = float(value) + (c.bendRangeSemitones - floorf(c.bendRangeSemitones));
+			UpdatePitch(ch);
+		}
+		break;
+	case 38:
+		if (c.rpn == 0) {
+			c.bendRangeSemitones = floorf(c.bendRangeSemitones) + value / 100.0f;
+			UpdatePitch(ch);
+		}
+		break;
+	case 7:
+		c.volume = norm * norm;
+		break;
+	case 10:
+		c.pan = norm;
+		break;
+	case 11:
+		c.expression = norm * norm;
+		break;
+	case 64:
+		c.sustain = (value >= 64);
+		if (!c.sustain) {
+			for (uint32_t i = 0; i < activeCount; i++) {
+				uint32_t v = active[i];
+				if ((voices.state[v] == VOICE_SUSTAINED) && (voices.channel[v] == ch)) {
+					ReleaseVoice(v);
+				}
+			}
+		}
+		break;
+	case 98:
+	case 99:
+		// NRPN selection disables RPN data entry.
+		c.rpn = RPN_NONE;
+		break;
+	case 100:
+		c.rpn = uint16_t((c.rpn & 0x3F80) | value);
+		break;
+	case 101:
+		c.rpn = uint16_t((c.rpn & 0x007F) | (value << 7));
+		break;
+	case 120:
+		AllNotesOff(ch, true);
+		break;
+	case 121:
+		c.expression = 1.0f;
+		c.pitchBend = 8192;
+		c.rpn = RPN_NONE;
+		if (c.sustain) {
+			ControlChange(ch, 64, 0);
+		}
+		UpdatePitch(ch);
+		break;
+	case 123:
+		AllNotesOff(ch, false);
+		break;
+	}
+}
+
+void Synth::ProgramChange(uint8_t ch, uint8_t program) {
+	channels[ch].program = program;
+}
+
+void Synth::PitchBend(uint8_t ch, uint16_t value) {
+	channels[ch].pitchBend = value;
+	UpdatePitch(ch);
+}
+
+void Synth::UpdatePitch(uint8_t ch) {
+	SynthChannel& c = channels[ch];
+	double semitones = (int(c.pitchBend) - 8192) / 8192.0 * c.bendRangeSemitones;
+	c.bendRatio = pow(2.0, semitones / 12.0);
+
+	for (uint32_t i = 0; i < activeCount; i++) {
+		uint32_t v = active[i];
+		if (voices.channel[v] == ch) {
+			voices.step[v] = uint64_t(voices.baseStep[v] * c.bendRatio * 4294967296.0);
+		}
+	}
+}
+
+// Renders one voice into the output and returns false when the voice has finished.
+bool Synth::RenderVoice(uint32_t v, float* out, uint32_t frames) {
+	SynthVoicePool& p = voices;
+	const SynthChannel& c = channels[p.channel[v]];
+
+	const int16_t* s = p.samples[v];
+	uint32_t end = p.end[v];
+	uint32_t loop = p.loopLength[v];
+	uint32_t padding = p.padding[v];
+	uint64_t pos = p.position[v];
+	uint64_t step = p.step[v];
+	float level = p.envLevel[v];
+	float gl = p.gainL[v];
+	float gr = p.gainR[v];
+
+	float panPos = c.pan + p.pan[v] * 0.5f;
+	if (panPos < 0.0f) panPos = 0.0f;
+	if (panPos > 1.0f) panPos = 1.0f;
+	float panL = cosf(panPos * HALF_PI);
+	float panR = sinf(panPos * HALF_PI);
+	float channelGain = p.gain[v] * c.volume * c.expression * masterGain;
+
+	float mono[SYNTH_CONTROL_BLOCK];
+	bool finished = false;
+	uint32_t done = 0;
+	while ((done < frames) && !finished) {
+		uint32_t n = frames - done;
+		if (n > SYNTH_CONTROL_BLOCK) {
+			n = SYNTH_CONTROL_BLOCK;
+		}
+
+		// Envelope at the end of this block.
+		switch (p.envStage[v]) {
+		case ENV_ATTACK:
+			level += p.attackRate[v] * n;
+			if (level >= 1.0f) {
+				level = 1.0f;
+				p.envStage[v] = ENV_DECAY;
+			}
+			break;
+		case ENV_DECAY:
+			level -= p.decayRate[v] * n;
+			if (level <= p.sustainLevel[v]) {
+				level = p.sustainLevel[v];
+				p.envStage[v] = ENV_SUSTAIN;
+			}
+			break;
+		case ENV_RELEASE:
+			level -= p.releaseRate[v] * n;
+			break;
+		}
+		if (level <= 0.0f) {
+			level = 0.0f;
+			if (p.envStage[v] != ENV_ATTACK) {
+				finished = true;
+			}
+		}
+
+		float targetL = level * channelGain * panL;
+		float targetR = level * channelGain * panR;
+		float dl = (targetL - gl) / n;
+		float dr = (targetR - gr) / n;
+
+		uint32_t rendered = ResampleWave(*kernels, interpolation, s, end, loop, padding, pos, step, mono, n);
+		if (rendered < n) {
+			finished = true;
+		}
+		kernels->mixStereo(mono, out + done * 2, rendered, gl, dl, gr, dr);
+
+		gl = targetL;
+		gr = targetR;
+		done += n;
+	}
+
+	p.position[v] = pos;
+	p.envLevel[v] = level;
+	p.gainL[v] = gl;
+	p.gainR[v] = gr;
+	return !finished;
+}
+
+void Synth::PartitionVoices() {
+	uint32_t count = uint32_t(partitions.size());
+	for (uint32_t p = 0; p < count; p++) {
+		partitions[p].count = 0;
+	}
+
+	if (partitioning == PARTITION_VOICES) {
+		for (uint32_t i = 0; i < activeCount; i++) {
+			Partition& part = partitions[uint64_t(i) * count / activeCount];
+			part.voices[part.count++] = active[i];
+		}
+		return;
+	}
+
+	// Channels with most voices first, each to the partition with the fewest voices so far.
+	uint32_t voicesPerChannel[16] = {};
+	for (uint32_t i = 0; i < activeCount; i++) {
+		voicesPerChannel[voices.channel[active[i]]]++;
+	}
+	uint8_t order[16];
+	for (uint8_t ch = 0; ch < 16; ch++) {
+		order[ch] = ch;
+	}
+	std::sort(order, order + 16, [&](uint8_t a, uint8_t b) { return voicesPerChannel[a] > voicesPerChannel[b]; });
+
+	uint32_t load[16] = {};
+	uint8_t channelPartition[16] = {};
+	for (int i = 0; i < 16; i++) {
+		uint32_t best = 0;
+		for (uint32_t p = 1; p < count && p < 16; p++) {
+			if (load[p] < load[best]) {
+				best = p;
+			}
+		}
+		channelPartition[order[i]] = uint8_t(best);
+		load[best] += voicesPerChannel[order[i]];
+	}
+
+	for (uint32_t i = 0; i < activeCount; i++) {
+		uint32_t v = active[i];
+		Partition& part = partitions[channelPartition[voices.channel[v]]];
+		part.voices[part.count++] = v;
+	}
+}
+
+void Synth::RenderPartitionJob(void* context, unsigned worker) {
+	NoAllocationScope noAllocation;
+	static_cast<Synth*>(context)->RenderPartition(worker);
+}
+
+void Synth::RenderPartition(unsigned p) {
+	Partition& part = partitions[p];
+	float* out = blockOut;
+	if (p > 0) {
+		if (part.count == 0) {
+			return;
+		}
+		out = &part.buffer[0];
+		memset(out, 0, sizeof(float) * 2 * blockFrames);
+	}
+	for (uint32_t i = 0; i < part.count; i++) {
+		uint32_t v = part.voices[i];
+		if (!RenderVoice(v, out, blockFrames)) {
+			voices.finished[v] = 1;
+		}
+	}
+}
+
+void Synth::RenderParallel(float* out, uint32_t frames) {
+	PartitionVoices();
+	blockOut = out;
+	blockFrames = frames;
+	workers->Run(&Synth::RenderPartitionJob, this);
+
+	for (size_t p = 1; p < partitions.size(); p++) {
+		if (partitions[p].count > 0) {
+			kernels->accumulate(&partitions[p].buffer[0], out, frames * 2);
+		}
+	}
+
+	// Backwards, as in the single-threaded path.
+	for (uint32_t i = activeCount; i > 0; i--) {
+		uint32_t v = active[i - 1];
+		if (voices.finished[v]) {
+			voices.finished[v] = 0;
+			FreeVoice(i - 1);
+		}
+	}
+}
+
+void Synth::RenderBlock(float* out, uint32_t frames) {
+	memset(out, 0, sizeof(float) * 2 * frames);
+
+	if (workers && (activeCount >= SYNTH_PARALLEL_MIN_VOICES)) {
+		RenderParallel(out, frames);
+		return;
+	}
+
+	// Backwards, so that freeing a voice moves an already rendered one into its slot.
+	for (uint32_t i = activeCount; i > 0; i--) {
+		if (!RenderVoice(active[i - 1], out, frames)) {
+			FreeVoice(i - 1);
+		}
+	}
+}
+
+void Synth::RenderFloat(float* out, uint32_t frames) {
+	while (frames > 0) {
+		uint32_t n = (frames > INT16_CHUNK) ? INT16_CHUNK : frames;
+		RenderBlock(out, n);
+		out += n * 2;
+		frames -= n;
+	}
+}
+
+void Synth::RenderInt16(int16_t* out, uint32_t frames) {
+	while (frames > 0) {
+		uint32_t n = (frames > INT16_CHUNK) ? INT16_CHUNK : frames;
+		RenderBlock(&scratch[0], n);
+		kernels->floatToInt16(&scratch[0], out, n * 2);
+		out += n * 2;
+		frames -= n;
+	}
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "block_workers.h"
+#include "instrument_bank.h"
+#include "midi_sink.h"
+#include "synth_kernels.h"
+
+/*
+
+Multi-voice wavetable synthesizer rendering interleaved stereo PCM.
+
+The voice pool has a fixed capacity allocated at construction, so a note-on
+never allocates. Voice state is kept as a structure of arrays, the render loop
+walks the active voices in control blocks of SYNTH_CONTROL_BLOCK frames:
+envelopes and channel gains are evaluated once per block and the gain is
+ramped linearly across it. Resampling, mixing and the int16 conversion run
+in the kernels of synth_kernels.h, the fastest ones the CPU supports by
+default.
+
+When the polyphony limit is reached a new note steals the oldest released
+voice, or the oldest voice if none is released. The choice depends only on
+the order of the notes, so a render is reproducible.
+
+With more than one render thread, the active voices of a block are split
+into one partition per thread, either by MIDI channel or into equal groups of
+voices. Every thread renders its partition into its own buffer and the buffers
+are summed at the end of the block. Channels are only read while rendering, so
+the threads share nothing but the voices they own. Summing in a different order
+makes the output differ from a single-threaded render in the last bits.
+
+The synthesizer is not thread-safe: MIDI messages and Render calls must come
+from the same thread.
+
+*/
+
+enum SynthPartitioning {
+	PARTITION_CHANNELS = 0, // Whole channels per thread, balanced by their voice counts.
+	PARTITION_VOICES = 1    // Equal groups of voices, for songs which crowd a few channels.
+};
+
+struct SynthConfig {
+	SynthConfig() : sampleRate(44100), maxVoices(256), polyphony(256), masterGain(0.5f), interpolation(INTERPOLATION_LINEAR),
+		renderThreads(1), partitioning(PARTITION_CHANNELS) {}
+
+	uint32_t sampleRate;
+	uint32_t maxVoices;  // Capacity of the voice pool.
+	uint32_t polyphony;  // Voice limit, at most maxVoices.
+	float masterGain;
+	SynthInterpolation interpolation;
+	uint32_t renderThreads;    // Threads rendering one block, including the calling thread.
+	SynthPartitioning partitioning;
+};
+
+const uint32_t SYNTH_CONTROL_BLOCK = 32;
+
+// Blocks with fewer active voices are rendered by the calling thread alone.
+const uint32_t SYNTH_PARALLEL_MIN_VOICES = 32;
+
+enum SynthVoiceState {
+	VOICE_FREE = 0,
+	VOICE_HELD = 1,      // Key is down.
+	VOICE_SUSTAINED = 2, // Key is up, held by the sustain pedal.
+	VOICE_RELEASED = 3
+};
+
+enum SynthEnvelopeStage {
+	ENV_ATTACK = 0,
+	ENV_DECAY = 1,
+	ENV_SUSTAIN = 2,
+	ENV_RELEASE = 3
+};
+
+// Per-voice state, structure of arrays indexed by voice number.
+struct SynthVoicePool {
+	void Allocate(uint32_t capacity);
+
+	std::vector<uint8_t> state;
+	std::vector<uint8_t> channel;
+	std::vector<uint8_t> note;
+	std::vector<uint8_t> envStage;
+	std::vector<uint32_t> age;          // Note-on sequence number, used for stealing.
+	std::vector<const int16_t*> samples;
+	std::vector<uint32_t> end;          // Loop end, or wave length for one-shot waves.
+	std::vector<uint32_t> loopLength;   // 0 for one-shot waves.
+	std::vector<uint32_t> padding;      // SynthWave::padding.
+	std::vector<uint64_t> position;     // 32.32 fixed point sample position.
+	std::vector<uint64_t> step;         // 32.32 fixed point increment per output frame.
+	std::vector<double> baseStep;       // Increment without pitch bend, in samples.
+	std::vector<float> envLevel;
+	std::vector<float> attackRate;      // Envelope change per frame.
+	std::vector<float> decayRate;
+	std::vector<float> sustainLevel;
+	std::vector<float> releaseTime;     // In frames.
+	std::vector<float> releaseRate;
+	std::vector<float> gain;            // Velocity and region attenuation.
+	std::vector<float> pan;             // Region pan.
+	std::vector<float> gainL;           // Gain applied at the end of the last block.
+	std::vector<float> gainR;
+	std::vector<uint8_t> finished;      // Set by the render threads, the voice is freed after the block.
+};
+
+struct SynthChannel {
+	uint8_t program;
+	uint8_t bankMsb;
+	uint8_t bankLsb;
+	bool drum;
+	bool sustain;
+	float volume;      // CC 7, squared.
+	float expression;  // CC 11, squared.
+	float pan;         // CC 10, 0 .. 1.
+	uint16_t pitchBend;
+	uint16_t rpn;      // Selected RPN, 0x3FFF when none.
+	float bendRangeSemitones;
+	double bendRatio;
+};
+
+class Synth : public MidiSink {
+public:
+	explicit Synth(const SynthConfig& config);
+
+	void SetInstrumentBank(InstrumentBank* bank) { instruments = bank; }
+
+	// Voice limit, clamped to the pool capacity. Excess voices are released.
+	void SetPolyphony(uint32_t voices);
+	uint32_t Polyphony() const { return polyphony; }
+
+	uint32_t SampleRate() const { return sampleRate; }
+
+	void SetKernels(const SynthKernels& k) { kernels = &k; }
+	const SynthKernels& Kernels() const { return *kernels; }
+	void SetInterpolation(SynthInterpolation mode) { interpolation = mode; }
+
+	// MidiSink.
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+
+	void NoteOn(uint8_t ch, uint8_t key, uint8_t velocity);
+	void NoteOff(uint8_t ch, uint8_t key);
+	void ControlChange(uint8_t ch, uint8_t controller, uint8_t value);
+	void ProgramChange(uint8_t ch, uint8_t program);
+	void PitchBend(uint8_t ch, uint16_t value);
+	void AllNotesOff(uint8_t ch, bool immediately);
+
+	// Renders interleaved stereo frames, overwriting the output.
+	void RenderFloat(float* out, uint32_t frames);
+	void RenderInt16(int16_t* out, uint32_t frames);
+
+	uint32_t RenderThreads() const { return workers ? workers->ThreadCount() : 1; }
+
+	uint32_t ActiveVoices() const { return activeCount; }
+	uint64_t StolenVoices() const { return stolenCount; }
+	uint32_t PeakVoices() const { return peakVoices; }
+	void ResetStatistics() { stolenCount = 0; peakVoices = activeCount; }
+
+private:
+	void ResetChannels();
+	uint32_t AllocateVoice();
+	void FreeVoice(uint32_t activeIdx);
+	void ReleaseVoice(uint32_t v);
+	void UpdatePitch(uint8_t ch);
+	void RenderBlock(float* out, uint32_t frames);
+	bool RenderVoice(uint32_t v, float* out, uint32_t frames);
+	void PartitionVoices();
+	void RenderParallel(float* out, uint32_t frames);
+	void RenderPartition(unsigned partition);
+	static void RenderPartitionJob(void* context, unsigned worker);
+
+	struct Partition {
+		std::vector<uint32_t> voices;
+		uint32_t count;
+		std::vector<float> buffer; // Partition 0 renders into the output itself.
+	};
+
+	uint32_t sampleRate;
+	uint32_t capacity;
+	uint32_t polyphony;
+	float masterGain;
+	InstrumentBank* instruments;
+	const SynthKernels* kernels;
+	SynthInterpolation interpolation;
+
+	SynthVoicePool voices;
+	std::vector<uint32_t> active;   // Indices of active voices; first activeCount entries are used.
+	std::vector<uint32_t> freeList; // Indices of free voices; first freeCount entries are used.
+	uint32_t activeCount;
+	uint32_t freeCount;
+	uint32_t nextAge;
+	uint64_t stolenCount;
+	uint32_t peakVoices;
+
+	SynthChannel channels[16];
+	std::vector<float> scratch;     // Float block for RenderInt16.
+
+	std::unique_ptr<BlockWorkers> workers; // Only with more than one render thread.
+	std::vector<Partition> partitions;
+	SynthPartitioning partitioning;
+	float* blockOut;
+	uint32_t blockFrames;
+};
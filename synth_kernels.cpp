@@ -0,0 +1,213 @@
+#include "synth_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SYNTH_KERNELS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+static const float SAMPLE_SCALE = 1.0f / 32768.0f;
+static const float FRAC_SCALE = 1.0f / 16777216.0f;
+
+static inline float Fraction(uint64_t position) {
+	return float(uint32_t(position) >> 8) * FRAC_SCALE;
+}
+
+static inline float InterpolateLinear(float s0, float s1, float frac) {
+	return (s0 + (s1 - s0) * frac) * SAMPLE_SCALE;
+}
+
+// Catmull-Rom spline through four samples, evaluated between x0 and x1.
+static inline float InterpolateCubic(float xm1, float x0, float x1, float x2, float frac) {
+	float a = ((x0 - x1) * 3.0f - xm1 + x2) * 0.5f;
+	float b = x1 * 2.0f + xm1 - (x0 * 5.0f + x2) * 0.5f;
+	float c = (x1 - xm1) * 0.5f;
+	return (((a * frac + b) * frac + c) * frac + x0) * SAMPLE_SCALE;
+}
+
+static void ResampleLinearScalar(const int16_t* s, uint64_t pos, uint64_t step, float* out, uint32_t frames) {
+	for (uint32_t i = 0; i < frames; i++) {
+		uint32_t idx = uint32_t(pos >> 32);
+		out[i] = InterpolateLinear(s[idx], s[idx + 1], Fraction(pos));
+		pos += step;
+	}
+}
+
+static void ResampleCubicScalar(const int16_t* s, uint64_t pos, uint64_t step, float* out, uint32_t frames) {
+	for (uint32_t i = 0; i < frames; i++) {
+		uint32_t idx = uint32_t(pos >> 32);
+		out[i] = InterpolateCubic(s[idx - 1], s[idx], s[idx + 1], s[idx + 2], Fraction(pos));
+		pos += step;
+	}
+}
+
+static void MixStereoScalar(const float* in, float* out, uint32_t frames, float gl, float dl, float gr, float dr) {
+	for (uint32_t i = 0; i < frames; i++) {
+		float k = float(i + 1);
+		out[i * 2] += in[i] * (gl + dl * k);
+		out[i * 2 + 1] += in[i] * (gr + dr * k);
+	}
+}
+
+static void AccumulateScalar(const float* in, float* out, uint32_t samples) {
+	for (uint32_t i = 0; i < samples; i++) {
+		out[i] += in[i];
+	}
+}
+
+static void FloatToInt16Scalar(const float* in, int16_t* out, uint32_t samples) {
+	for (uint32_t i = 0; i < samples; i++) {
+		float x = in[i] * 32767.0f;
+		if (x > 32767.0f) x = 32767.0f;
+		if (x < -32768.0f) x = -32768.0f;
+		out[i] = int16_t(lrintf(x));
+	}
+}
+
+static const SynthKernels scalarKernels = {
+	"scalar",
+	ResampleLinearScalar,
+	ResampleCubicScalar,
+	MixStereoScalar,
+	AccumulateScalar,
+	FloatToInt16Scalar
+};
+
+const SynthKernels& ScalarSynthKernels() {
+	return scalarKernels;
+}
+
+#ifdef SYNTH_KERNELS_X86
+// Implemented in synth_kernels_sse2.cpp and synth_kernels_avx2.cpp.
+const SynthKernels* Sse2SynthKernelsBuilt();
+const SynthKernels* Avx2SynthKernelsBuilt();
+
+static bool CpuHasSse2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool CpuHasAvx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx) {
+		return false;
+	}
+	// The OS must save the YMM registers.
+	if ((_xgetbv(0) & 0x6) != 0x6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+const SynthKernels* Sse2SynthKernels() {
+#ifdef SYNTH_KERNELS_X86
+	static const SynthKernels* kernels = CpuHasSse2() ? Sse2SynthKernelsBuilt() : nullptr;
+	return kernels;
+#else
+	return nullptr;
+#endif
+}
+
+const SynthKernels* Avx2SynthKernels() {
+#ifdef SYNTH_KERNELS_X86
+	static const SynthKernels* kernels = CpuHasAvx2() ? Avx2SynthKernelsBuilt() : nullptr;
+	return kernels;
+#else
+	return nullptr;
+#endif
+}
+
+const SynthKernels& BestSynthKernels() {
+	if (Avx2SynthKernels()) {
+		return *Avx2SynthKernels();
+	}
+	if (Sse2SynthKernels()) {
+		return *Sse2SynthKernels();
+	}
+	return scalarKernels;
+}
+
+// Sample at an index which may lie past the end of the wave.
+static inline float SampleAt(const int16_t* s, uint32_t end, uint32_t loop, uint32_t idx) {
+	if (idx < end) {
+		return s[idx];
+	}
+	return loop ? s[idx - loop] : 0.0f;
+}
+
+uint32_t ResampleWave(const SynthKernels& kernels, SynthInterpolation interpolation,
+	const int16_t* s, uint32_t end, uint32_t loop, uint32_t padding,
+	uint64_t& pos, uint64_t step, float* out, uint32_t frames)
+{
+	bool cubic = (interpolation == INTERPOLATION_CUBIC);
+	uint32_t before = cubic ? CUBIC_MARGIN_BEFORE : LINEAR_MARGIN_BEFORE;
+	uint32_t after = cubic ? CUBIC_MARGIN_AFTER : LINEAR_MARGIN_AFTER;
+	ResampleKernel kernel = cubic ? kernels.resampleCubic : kernels.resampleLinear;
+
+	// Samples the kernels may read; frames stop at the end either way.
+	uint64_t readable = uint64_t(end) + padding;
+	uint64_t fastEnd = (readable > after) ? std::min<uint64_t>(readable - after, end) : 0;
+
+	uint32_t done = 0;
+	while (done < frames) {
+		uint32_t idx = uint32_t(pos >> 32);
+		while (idx >= end) {
+			if (loop == 0) {
+				return done;
+			}
+			pos -= uint64_t(loop) << 32;
+			idx -= loop;
+		}
+
+		if ((idx < before) || (idx >= fastEnd)) {
+			// Near the start or the end of the wave: one frame with wrap-around reads.
+			float frac = Fraction(pos);
+			if (cubic) {
+				float xm1 = s[idx > 0 ? idx - 1 : 0];
+				out[done] = InterpolateCubic(xm1, s[idx], SampleAt(s, end, loop, idx + 1), SampleAt(s, end, loop, idx + 2), frac);
+			}
+			else {
+				out[done] = InterpolateLinear(s[idx], SampleAt(s, end, loop, idx + 1), frac);
+			}
+			pos += step;
+			done++;
+			continue;
+		}
+
+		// Frames whose reads stay inside the wave.
+		uint32_t count = frames - done;
+		if (step > 0) {
+			uint64_t limit = fastEnd << 32;
+			uint64_t safe = (limit - 1 - pos) / step + 1;
+			if (safe < count) {
+				count = uint32_t(safe);
+			}
+		}
+		kernel(s, pos, step, out + done, count);
+		pos += step * count;
+		done += count;
+	}
+	return done;
+}
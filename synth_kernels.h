@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+
+Inner loops of the synthesizer render path.
+
+Every kernel exists as a scalar reference and, on x86, as SSE2 and AVX2
+versions selected at run time by the CPU features. The vector versions use the
+same arithmetic in the same order as the scalar ones, so without FMA
+contraction the results are bit-exact; the kernel benchmark checks them
+against the scalar path with a small tolerance.
+
+Positions are 32.32 fixed point sample indices. The fraction used for
+interpolation is truncated to 24 bits, which converts to float exactly in both
+the scalar and the vector code.
+
+*/
+
+enum SynthInterpolation {
+	INTERPOLATION_LINEAR = 0,
+	INTERPOLATION_CUBIC = 1
+};
+
+// Extra samples a kernel reads before and after the sample at the integer position.
+const uint32_t LINEAR_MARGIN_BEFORE = 0;
+const uint32_t LINEAR_MARGIN_AFTER = 1;
+const uint32_t CUBIC_MARGIN_BEFORE = 1;
+const uint32_t CUBIC_MARGIN_AFTER = 2;
+
+// Resamples 'frames' output samples starting at 'position' into 'out', scaled to -1 .. 1.
+// All samples read must lie inside the wave: no loop or end handling is done here.
+typedef void (*ResampleKernel)(const int16_t* samples, uint64_t position, uint64_t step, float* out, uint32_t frames);
+
+// Accumulates mono samples into interleaved stereo output.
+// Gain of frame i is gainL + stepL * (i + 1), respectively for the right channel.
+typedef void (*MixStereoKernel)(const float* in, float* out, uint32_t frames, float gainL, float stepL, float gainR, float stepR);
+
+// Adds one sample buffer to another, e.g. partial mixes of several render threads.
+typedef void (*AccumulateKernel)(const float* in, float* out, uint32_t samples);
+
+// Converts interleaved float samples to int16 with clipping and rounding to nearest.
+typedef void (*FloatToInt16Kernel)(const float* in, int16_t* out, uint32_t samples);
+
+struct SynthKernels {
+	const char* name;
+	ResampleKernel resampleLinear;
+	ResampleKernel resampleCubic;
+	MixStereoKernel mixStereo;
+	AccumulateKernel accumulate;
+	FloatToInt16Kernel floatToInt16;
+};
+
+const SynthKernels& ScalarSynthKernels();
+
+// Vector kernels, or nullptr if they are not built in or the CPU does not support them.
+const SynthKernels* Sse2SynthKernels();
+const SynthKernels* Avx2SynthKernels();
+
+// Fastest kernels supported by the CPU.
+const SynthKernels& BestSynthKernels();
+
+// Resamples a looped or one-shot wave, handling the loop wrap and the wave end around the kernel calls.
+// The kernels may read the 'padding' samples after the end, see SynthWave.
+// Returns the number of frames written; less than 'frames' when a one-shot wave has ended.
+uint32_t ResampleWave(const SynthKernels& kernels, SynthInterpolation interpolation,
+	const int16_t* samples, uint32_t end, uint32_t loopLength, uint32_t padding,
+	uint64_t& position, uint64_t step, float* out, uint32_t frames);
@@ -0,0 +1,166 @@
+#include "synth_kernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+
+// GCC and Clang compile this file with -mavx2, MSVC with /arch:AVX2 (see CMakeLists.txt and the project file).
+#if defined(__AVX2__) || defined(_MSC_VER)
+
+#include <immintrin.h>
+
+static const float SAMPLE_SCALE = 1.0f / 32768.0f;
+static const float FRAC_SCALE = 1.0f / 16777216.0f;
+
+// Splits eight 32.32 positions (four per register) into integer indices and 24-bit fractions.
+static inline void SplitPositions(__m256i p0, __m256i p1, __m256i& idx, __m256& frac) {
+	const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256i a = _mm256_permutevar8x32_epi32(p0, order);
+	__m256i b = _mm256_permutevar8x32_epi32(p1, order);
+	__m256i lo = _mm256_permute2x128_si256(a, b, 0x20);
+	idx = _mm256_permute2x128_si256(a, b, 0x31);
+	frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(lo, 8)), _mm256_set1_ps(FRAC_SCALE));
+}
+
+// Gathers the sample pairs s[idx + offset], s[idx + offset + 1] and widens them to float.
+static inline void GatherPairs(const int16_t* s, __m256i idx, int offset, __m256& first, __m256& second) {
+	__m256i p = _mm256_i32gather_epi32((const int*)(s + offset), idx, 2);
+	first = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(p, 16), 16));
+	second = _mm256_cvtepi32_ps(_mm256_srai_epi32(p, 16));
+}
+
+static inline __m256i Positions(uint64_t pos, uint64_t step) {
+	return _mm256_setr_epi64x(int64_t(pos), int64_t(pos + step), int64_t(pos + step * 2), int64_t(pos + step * 3));
+}
+
+static void ResampleLinearAvx2(const int16_t* s, uint64_t pos, uint64_t step, float* out, uint32_t frames) {
+	const __m256 scale = _mm256_set1_ps(SAMPLE_SCALE);
+	const __m256i step8 = _mm256_set1_epi64x(int64_t(step * 8));
+	__m256i p0 = Positions(pos, step);
+	__m256i p1 = Positions(pos + step * 4, step);
+
+	uint32_t i = 0;
+	for (; i + 8 <= frames; i += 8) {
+		__m256i idx;
+		__m256 frac, s0, s1;
+		SplitPositions(p0, p1, idx, frac);
+		GatherPairs(s, idx, 0, s0, s1);
+		__m256 y = _mm256_mul_ps(_mm256_add_ps(s0, _mm256_mul_ps(_mm256_sub_ps(s1, s0), frac)), scale);
+		_mm256_storeu_ps(out + i, y);
+		p0 = _mm256_add_epi64(p0, step8);
+		p1 = _mm256_add_epi64(p1, step8);
+	}
+	if (i < frames) {
+		ScalarSynthKernels().resampleLinear(s, pos + step * i, step, out + i, frames - i);
+	}
+}
+
+static void ResampleCubicAvx2(const int16_t* s, uint64_t pos, uint64_t step, float* out, uint32_t frames) {
+	const __m256 scale = _mm256_set1_ps(SAMPLE_SCALE);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	const __m256 five = _mm256_set1_ps(5.0f);
+	const __m256i step8 = _mm256_set1_epi64x(int64_t(step * 8));
+	__m256i p0 = Positions(pos, step);
+	__m256i p1 = Positions(pos + step * 4, step);
+
+	uint32_t i = 0;
+	for (; i + 8 <= frames; i += 8) {
+		__m256i idx;
+		__m256 f, xm1, x0, x1, x2;
+		SplitPositions(p0, p1, idx, f);
+		GatherPairs(s, idx, -1, xm1, x0);
+		GatherPairs(s, idx, 1, x1, x2);
+
+		__m256 a = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(x0, x1), three), xm1), x2), half);
+		__m256 b = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(x1, two), xm1), _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(x0, five), x2), half));
+		__m256 c = _mm256_mul_ps(_mm256_sub_ps(x1, xm1), half);
+		__m256 y = _mm256_add_ps(_mm256_mul_ps(a, f), b);
+		y = _mm256_add_ps(_mm256_mul_ps(y, f), c);
+		y = _mm256_add_ps(_mm256_mul_ps(y, f), x0);
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(y, scale));
+		p0 = _mm256_add_epi64(p0, step8);
+		p1 = _mm256_add_epi64(p1, step8);
+	}
+	if (i < frames) {
+		ScalarSynthKernels().resampleCubic(s, pos + step * i, step, out + i, frames - i);
+	}
+}
+
+static void MixStereoAvx2(const float* in, float* out, uint32_t frames, float gl, float dl, float gr, float dr) {
+	const __m256 vgl = _mm256_set1_ps(gl);
+	const __m256 vdl = _mm256_set1_ps(dl);
+	const __m256 vgr = _mm256_set1_ps(gr);
+	const __m256 vdr = _mm256_set1_ps(dr);
+	const __m256 eight = _mm256_set1_ps(8.0f);
+	__m256 k = _mm256_setr_ps(1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f);
+
+	uint32_t i = 0;
+	for (; i + 8 <= frames; i += 8) {
+		__m256 m = _mm256_loadu_ps(in + i);
+		__m256 l = _mm256_mul_ps(m, _mm256_add_ps(vgl, _mm256_mul_ps(vdl, k)));
+		__m256 r = _mm256_mul_ps(m, _mm256_add_ps(vgr, _mm256_mul_ps(vdr, k)));
+		// Interleaving works per 128-bit lane, the permutes restore the frame order.
+		__m256 lo = _mm256_unpacklo_ps(l, r);
+		__m256 hi = _mm256_unpackhi_ps(l, r);
+		float* o = out + i * 2;
+		_mm256_storeu_ps(o, _mm256_add_ps(_mm256_loadu_ps(o), _mm256_permute2f128_ps(lo, hi, 0x20)));
+		_mm256_storeu_ps(o + 8, _mm256_add_ps(_mm256_loadu_ps(o + 8), _mm256_permute2f128_ps(lo, hi, 0x31)));
+		k = _mm256_add_ps(k, eight);
+	}
+	for (; i < frames; i++) {
+		float kf = float(i + 1);
+		out[i * 2] += in[i] * (gl + dl * kf);
+		out[i * 2 + 1] += in[i] * (gr + dr * kf);
+	}
+}
+
+static void AccumulateAvx2(const float* in, float* out, uint32_t samples) {
+	uint32_t i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_loadu_ps(in + i)));
+	}
+	for (; i < samples; i++) {
+		out[i] += in[i];
+	}
+}
+
+static void FloatToInt16Avx2(const float* in, int16_t* out, uint32_t samples) {
+	const __m256 scale = _mm256_set1_ps(32767.0f);
+	const __m256 hi = _mm256_set1_ps(32767.0f);
+	const __m256 lo = _mm256_set1_ps(-32768.0f);
+
+	uint32_t i = 0;
+	for (; i + 16 <= samples; i += 16) {
+		__m256 a = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), hi), lo);
+		__m256 b = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), hi), lo);
+		__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(out + i), packed);
+	}
+	if (i < samples) {
+		ScalarSynthKernels().floatToInt16(in + i, out + i, samples - i);
+	}
+}
+
+static const SynthKernels avx2Kernels = {
+	"avx2",
+	ResampleLinearAvx2,
+	ResampleCubicAvx2,
+	MixStereoAvx2,
+	AccumulateAvx2,
+	FloatToInt16Avx2
+};
+
+const SynthKernels* Avx2SynthKernelsBuilt() {
+	return &avx2Kernels;
+}
+
+#else
+
+const SynthKernels* Avx2SynthKernelsBuilt() {
+	return nullptr;
+}
+
+#endif
+
+#endif
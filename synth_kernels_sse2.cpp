@@ -0,0 +1,155 @@
+#include "synth_kernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+
+#include <cstring>
+#include <emmintrin.h>
+
+static const float SAMPLE_SCALE = 1.0f / 32768.0f;
+static const float FRAC_SCALE = 1.0f / 16777216.0f;
+
+// Two 64-bit lanes, 'a' in the low one.
+static inline __m128i Set64(uint64_t a, uint64_t b) {
+	return _mm_set_epi32(int(uint32_t(b >> 32)), int(uint32_t(b)), int(uint32_t(a >> 32)), int(uint32_t(a)));
+}
+
+// Splits four 32.32 positions into integer indices and 24-bit fractions.
+static inline void SplitPositions(__m128i p01, __m128i p23, uint32_t* idx, __m128& frac) {
+	__m128 lo = _mm_shuffle_ps(_mm_castsi128_ps(p01), _mm_castsi128_ps(p23), _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 hi = _mm_shuffle_ps(_mm_castsi128_ps(p01), _mm_castsi128_ps(p23), _MM_SHUFFLE(3, 1, 3, 1));
+	_mm_storeu_si128((__m128i*)idx, _mm_castps_si128(hi));
+	frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(_mm_castps_si128(lo), 8)), _mm_set1_ps(FRAC_SCALE));
+}
+
+// Loads the sample pairs s[idx[k] + offset], s[idx[k] + offset + 1] and widens them to float.
+static inline void LoadPairs(const int16_t* s, const uint32_t* idx, int offset, __m128& first, __m128& second) {
+	int32_t pairs[4];
+	for (int k = 0; k < 4; k++) {
+		memcpy(&pairs[k], s + idx[k] + offset, sizeof(int32_t));
+	}
+	__m128i p = _mm_loadu_si128((const __m128i*)pairs);
+	first = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(p, 16), 16));
+	second = _mm_cvtepi32_ps(_mm_srai_epi32(p, 16));
+}
+
+static void ResampleLinearSse2(const int16_t* s, uint64_t pos, uint64_t step, float* out, uint32_t frames) {
+	const __m128 scale = _mm_set1_ps(SAMPLE_SCALE);
+	const __m128i step4 = Set64(step * 4, step * 4);
+	__m128i p01 = Set64(pos, pos + step);
+	__m128i p23 = Set64(pos + step * 2, pos + step * 3);
+
+	uint32_t i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		uint32_t idx[4];
+		__m128 frac, s0, s1;
+		SplitPositions(p01, p23, idx, frac);
+		LoadPairs(s, idx, 0, s0, s1);
+		__m128 y = _mm_mul_ps(_mm_add_ps(s0, _mm_mul_ps(_mm_sub_ps(s1, s0), frac)), scale);
+		_mm_storeu_ps(out + i, y);
+		p01 = _mm_add_epi64(p01, step4);
+		p23 = _mm_add_epi64(p23, step4);
+	}
+	if (i < frames) {
+		ScalarSynthKernels().resampleLinear(s, pos + step * i, step, out + i, frames - i);
+	}
+}
+
+static void ResampleCubicSse2(const int16_t* s, uint64_t pos, uint64_t step, float* out, uint32_t frames) {
+	const __m128 scale = _mm_set1_ps(SAMPLE_SCALE);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128 five = _mm_set1_ps(5.0f);
+	const __m128i step4 = Set64(step * 4, step * 4);
+	__m128i p01 = Set64(pos, pos + step);
+	__m128i p23 = Set64(pos + step * 2, pos + step * 3);
+
+	uint32_t i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		uint32_t idx[4];
+		__m128 f, xm1, x0, x1, x2;
+		SplitPositions(p01, p23, idx, f);
+		LoadPairs(s, idx, -1, xm1, x0);
+		LoadPairs(s, idx, 1, x1, x2);
+
+		__m128 a = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(x0, x1), three), xm1), x2), half);
+		__m128 b = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(x1, two), xm1), _mm_mul_ps(_mm_add_ps(_mm_mul_ps(x0, five), x2), half));
+		__m128 c = _mm_mul_ps(_mm_sub_ps(x1, xm1), half);
+		__m128 y = _mm_add_ps(_mm_mul_ps(a, f), b);
+		y = _mm_add_ps(_mm_mul_ps(y, f), c);
+		y = _mm_add_ps(_mm_mul_ps(y, f), x0);
+		_mm_storeu_ps(out + i, _mm_mul_ps(y, scale));
+		p01 = _mm_add_epi64(p01, step4);
+		p23 = _mm_add_epi64(p23, step4);
+	}
+	if (i < frames) {
+		ScalarSynthKernels().resampleCubic(s, pos + step * i, step, out + i, frames - i);
+	}
+}
+
+static void MixStereoSse2(const float* in, float* out, uint32_t frames, float gl, float dl, float gr, float dr) {
+	const __m128 vgl = _mm_set1_ps(gl);
+	const __m128 vdl = _mm_set1_ps(dl);
+	const __m128 vgr = _mm_set1_ps(gr);
+	const __m128 vdr = _mm_set1_ps(dr);
+	const __m128 four = _mm_set1_ps(4.0f);
+	__m128 k = _mm_setr_ps(1.0f, 2.0f, 3.0f, 4.0f);
+
+	uint32_t i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		__m128 m = _mm_loadu_ps(in + i);
+		__m128 l = _mm_mul_ps(m, _mm_add_ps(vgl, _mm_mul_ps(vdl, k)));
+		__m128 r = _mm_mul_ps(m, _mm_add_ps(vgr, _mm_mul_ps(vdr, k)));
+		float* o = out + i * 2;
+		_mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_unpacklo_ps(l, r)));
+		_mm_storeu_ps(o + 4, _mm_add_ps(_mm_loadu_ps(o + 4), _mm_unpackhi_ps(l, r)));
+		k = _mm_add_ps(k, four);
+	}
+	for (; i < frames; i++) {
+		float kf = float(i + 1);
+		out[i * 2] += in[i] * (gl + dl * kf);
+		out[i * 2 + 1] += in[i] * (gr + dr * kf);
+	}
+}
+
+static void AccumulateSse2(const float* in, float* out, uint32_t samples) {
+	uint32_t i = 0;
+	for (; i + 4 <= samples; i += 4) {
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(in + i)));
+	}
+	for (; i < samples; i++) {
+		out[i] += in[i];
+	}
+}
+
+static void FloatToInt16Sse2(const float* in, int16_t* out, uint32_t samples) {
+	const __m128 scale = _mm_set1_ps(32767.0f);
+	const __m128 hi = _mm_set1_ps(32767.0f);
+	const __m128 lo = _mm_set1_ps(-32768.0f);
+
+	uint32_t i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		__m128 a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), hi), lo);
+		__m128 b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), hi), lo);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+		_mm_storeu_si128((__m128i*)(out + i), packed);
+	}
+	if (i < samples) {
+		ScalarSynthKernels().floatToInt16(in + i, out + i, samples - i);
+	}
+}
+
+static const SynthKernels sse2Kernels = {
+	"sse2",
+	ResampleLinearSse2,
+	ResampleCubicSse2,
+	MixStereoSse2,
+	AccumulateSse2,
+	FloatToInt16Sse2
+};
+
+const SynthKernels* Sse2SynthKernelsBuilt() {
+	return &sse2Kernels;
+}
+
+#endif
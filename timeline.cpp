@@ -0,0 +1,369 @@
+#include "timeline.h"
+
+#include <algorithm>
+
+namespace {
+
+// Read position in one track during the merge.
+struct TrackCursor {
+	const SmfEvent* next;
+	const SmfEvent* end;
+	uint32_t tick;  // Absolute tick of *next.
+	uint32_t track;
+};
+
+// Min-heap order: earliest tick first, lower track first on equal ticks.
+struct CursorLater {
+	bool operator()(const TrackCursor& a, const TrackCursor& b) const {
+		if (a.tick != b.tick) {
+			return a.tick > b.tick;
+		}
+		return a.track > b.track;
+	}
+};
+
+bool IsEndOfTrack(const SmfEvent& e) {
+	return (e.status == SMF_STATUS_META) && (e.data1 == SMF_META_END_OF_TRACK);
+}
+
+uint32_t ReadTempo(const uint8_t* p) {
+	return (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | uint32_t(p[2]);
+}
+
+// Size of an array in an arena, with the padding up to the next allocation.
+template <typename T>
+size_t ArenaBytes(size_t count) {
+	return (sizeof(T) * count + ARENA_MIN_ALIGN - 1) / ARENA_MIN_ALIGN * ARENA_MIN_ALIGN;
+}
+
+}
+
+Timeline::Timeline() :
+	eventData(nullptr),
+	eventCount(0),
+	tempoData(nullptr),
+	tempoCount(0),
+	checkpointData(nullptr),
+	checkpointCount(0),
+	payloadBase(nullptr),
+	ticksPerQuarter(1),
+	lengthTicks(0),
+	durationUs(0),
+	longestSysex(0)
+{
+}
+
+void Timeline::Clear() {
+	arena.Reset();
+	eventData = nullptr;
+	eventCount = 0;
+	tempoData = nullptr;
+	tempoCount = 0;
+	checkpointData = nullptr;
+	checkpointCount = 0;
+	payloadBase = nullptr;
+	ticksPerQuarter = 1;
+	lengthTicks = 0;
+	durationUs = 0;
+	longestSysex = 0;
+}
+
+bool Timeline::Build(const SmfFile& smf, std::string& err) {
+	Clear();
+
+	if (smf.TrackCount() == 0) {
+		err = "MIDI file is not loaded";
+		return false;
+	}
+
+	payloadBase = smf.Image();
+
+	// Tempo for SMPTE division is fixed: one "quarter" is one second of frames * ticks per frame.
+	bool smpte = smf.IsSmpte();
+	TempoSegment first;
+	first.tick = 0;
+	first.timeUs = 0;
+	if (smpte) {
+		int fps = -int(int8_t(smf.Division() >> 8));
+		uint32_t ticksPerFrame = smf.Division() & 0xFF;
+		if ((fps <= 0) || (ticksPerFrame == 0)) {
+			err = "invalid SMPTE time division";
+			return false;
+		}
+		if (fps == 29) {
+			// 29.97 drop frame.
+			ticksPerQuarter = 30 * ticksPerFrame;
+			first.usPerQuarter = 1001000;
+		}
+		else {
+			ticksPerQuarter = uint32_t(fps) * ticksPerFrame;
+			first.usPerQuarter = 1000000;
+		}
+	}
+	else {
+		ticksPerQuarter = smf.Division();
+		first.usPerQuarter = DEFAULT_US_PER_QUARTER;
+	}
+
+	// Every array gets its final size up front: the end of track events are dropped, the tempo
+	// changes are counted and one checkpoint is kept per TIMELINE_CHECKPOINT_INTERVAL events.
+	size_t maxEvents = smf.EventCount();
+	size_t maxTempo = 1;
+	if (!smpte) {
+		const SmfEvent* smfEvents = smf.Events();
+		for (size_t i = 0; i < maxEvents; i++) {
+			const SmfEvent& e = smfEvents[i];
+			if ((e.status == SMF_STATUS_META) && (e.data1 == SMF_META_TEMPO)) {
+				maxTempo++;
+			}
+		}
+	}
+	size_t maxCheckpoints = (maxEvents + TIMELINE_CHECKPOINT_INTERVAL - 1) / TIMELINE_CHECKPOINT_INTERVAL;
+	arena.Reserve(ArenaBytes<TimelineEvent>(maxEvents) + ArenaBytes<TempoSegment>(maxTempo) +
+		ArenaBytes<MidiState>(maxCheckpoints) + ArenaBytes<TrackCursor>(smf.TrackCount()));
+	TimelineEvent* events = arena.AllocateArray<TimelineEvent>(maxEvents);
+	TempoSegment* tempoMap = arena.AllocateArray<TempoSegment>(maxTempo);
+	MidiState* checkpoints = arena.AllocateArray<MidiState>(maxCheckpoints);
+	TrackCursor* heap = arena.AllocateArray<TrackCursor>(smf.TrackCount());
+	size_t heapSize = 0;
+	eventData = events;
+	tempoData = tempoMap;
+	tempoMap[tempoCount++] = first;
+
+	uint32_t trackOffset = 0; // Format 2: start tick of the current sequence.
+	size_t trackCount = smf.TrackCount();
+	size_t trackIdx = 0;
+
+	while (trackIdx < trackCount) {
+		// Format 0 and 1: all tracks at once. Format 2: one track at a time.
+		size_t groupEnd = (smf.Format() == 2) ? trackIdx + 1 : trackCount;
+		for (; trackIdx < groupEnd; trackIdx++) {
+			const SmfTrack& track = smf.Track(trackIdx);
+			if (track.eventCount == 0) {
+				continue;
+			}
+			TrackCursor c;
+			c.next = smf.TrackEvents(trackIdx);
+			c.end = c.next + track.eventCount;
+			c.tick = trackOffset + c.next->delta;
+			c.track = uint32_t(trackIdx);
+			heap[heapSize++] = c;
+			std::push_heap(heap, heap + heapSize, CursorLater());
+		}
+
+		uint32_t groupEndTick = trackOffset;
+		while (heapSize > 0) {
+			std::pop_heap(heap, heap + heapSize, CursorLater());
+			TrackCursor& c = heap[heapSize - 1];
+			const SmfEvent& e = *c.next;
+			uint32_t tick = c.tick;
+
+			if (tick > groupEndTick) {
+				groupEndTick = tick;
+			}
+
+			if (!IsEndOfTrack(e)) {
+				const TempoSegment& seg = tempoMap[tempoCount - 1];
+				TimelineEvent te;
+				te.tick = tick;
+				te.timeUs = seg.timeUs + int64_t(tick - seg.tick) * seg.usPerQuarter / ticksPerQuarter;
+				te.payloadOffset = e.payloadOffset;
+				te.payloadLength = e.payloadLength;
+				te.status = e.status;
+				te.data1 = e.data1;
+				te.data2 = e.data2;
+				te.reserved = 0;
+				events[eventCount++] = te;
+				if ((e.status == SMF_STATUS_SYSEX) && (e.payloadLength > longestSysex)) {
+					longestSysex = e.payloadLength;
+				}
+
+				if (!smpte && (e.status == SMF_STATUS_META) && (e.data1 == SMF_META_TEMPO) && (e.payloadLength >= 3)) {
+					uint32_t tempo = ReadTempo(smf.Payload(e));
+					if (tempo > 0) {
+						if (tempoMap[tempoCount - 1].tick == tick) {
+							tempoMap[tempoCount - 1].usPerQuarter = tempo;
+						}
+						else {
+							TempoSegment& seg = tempoMap[tempoCount++];
+							seg.tick = tick;
+							seg.timeUs = te.timeUs;
+							seg.usPerQuarter = tempo;
+						}
+					}
+				}
+			}
+
+			c.next++;
+			if (c.next == c.end) {
+				heapSize--;
+			}
+			else {
+				c.tick += c.next->delta;
+				std::push_heap(heap, heap + heapSize, CursorLater());
+			}
+		}
+
+		trackOffset = groupEndTick;
+	}
+
+	BuildCheckpoints(checkpoints);
+
+	lengthTicks = trackOffset;
+	durationUs = TickToMicros(lengthTicks);
+	return true;
+}
+
+TimelineArrays Timeline::Arrays() const {
+	TimelineArrays a;
+	a.events = eventData;
+	a.eventCount = eventCount;
+	a.tempoMap = tempoData;
+	a.tempoSegmentCount = tempoCount;
+	a.checkpoints = checkpointData;
+	a.checkpointCount = checkpointCount;
+	a.payloadBase = payloadBase;
+	a.ticksPerQuarter = ticksPerQuarter;
+	a.lengthTicks = lengthTicks;
+	a.durationUs = durationUs;
+	a.longestSysex = longestSysex;
+	return a;
+}
+
+void Timeline::Attach(const TimelineArrays& a) {
+	Clear();
+	arena.Release();
+	eventData = a.events;
+	eventCount = a.eventCount;
+	tempoData = a.tempoMap;
+	tempoCount = a.tempoSegmentCount;
+	checkpointData = a.checkpoints;
+	checkpointCount = a.checkpointCount;
+	payloadBase = a.payloadBase;
+	ticksPerQuarter = a.ticksPerQuarter;
+	lengthTicks = a.lengthTicks;
+	durationUs = a.durationUs;
+	longestSysex = a.longestSysex;
+}
+
+// Fills the checkpoints of the events built, which has room for all of them.
+void Timeline::BuildCheckpoints(MidiState* checkpoints) {
+	checkpointData = checkpoints;
+	checkpointCount = (eventCount + TIMELINE_CHECKPOINT_INTERVAL - 1) / TIMELINE_CHECKPOINT_INTERVAL;
+
+	MidiState state;
+	state.Reset();
+	for (size_t i = 0; i < eventCount; i++) {
+		if (i % TIMELINE_CHECKPOINT_INTERVAL == 0) {
+			checkpoints[i / TIMELINE_CHECKPOINT_INTERVAL] = state;
+		}
+		const TimelineEvent& e = eventData[i];
+		if (e.status < SMF_STATUS_SYSEX) {
+			state.Apply(e.status, e.data1, e.data2);
+		}
+	}
+}
+
+const TempoSegment& Timeline::SegmentForTick(uint32_t tick) const {
+	size_t lo = 0;
+	size_t hi = tempoCount;
+	// Last segment with segment.tick <= tick. The first segment starts at tick 0.
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (tempoData[mid].tick <= tick) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return tempoData[lo];
+}
+
+const TempoSegment& Timeline::SegmentForMicros(int64_t timeUs) const {
+	size_t lo = 0;
+	size_t hi = tempoCount;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (tempoData[mid].timeUs <= timeUs) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return tempoData[lo];
+}
+
+int64_t Timeline::TickToMicros(uint32_t tick) const {
+	if (tempoCount == 0) {
+		return 0;
+	}
+	const TempoSegment& seg = SegmentForTick(tick);
+	return seg.timeUs + int64_t(tick - seg.tick) * seg.usPerQuarter / ticksPerQuarter;
+}
+
+uint32_t Timeline::MicrosToTick(int64_t timeUs) const {
+	if ((tempoCount == 0) || (timeUs <= 0)) {
+		return 0;
+	}
+	const TempoSegment& seg = SegmentForMicros(timeUs);
+	return seg.tick + uint32_t((timeUs - seg.timeUs) * ticksPerQuarter / seg.usPerQuarter);
+}
+
+size_t Timeline::SeekToMicros(int64_t timeUs) const {
+	size_t lo = 0;
+	size_t hi = eventCount;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (eventData[mid].timeUs < timeUs) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+size_t Timeline::SeekToTick(uint32_t tick) const {
+	size_t lo = 0;
+	size_t hi = eventCount;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (eventData[mid].tick < tick) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+void Timeline::Chase(size_t eventIdx, MidiState& state) const {
+	if (eventIdx > eventCount) {
+		eventIdx = eventCount;
+	}
+
+	size_t checkpoint = eventIdx / TIMELINE_CHECKPOINT_INTERVAL;
+	if (checkpoint < checkpointCount) {
+		state = checkpointData[checkpoint];
+	}
+	else if (checkpointCount > 0) {
+		// eventIdx == eventCount and it is a multiple of the interval.
+		checkpoint = checkpointCount - 1;
+		state = checkpointData[checkpoint];
+	}
+	else {
+		state.Reset();
+		checkpoint = 0;
+	}
+
+	for (size_t i = checkpoint * TIMELINE_CHECKPOINT_INTERVAL; i < eventIdx; i++) {
+		const TimelineEvent& e = eventData[i];
+		if (e.status < SMF_STATUS_SYSEX) {
+			state.Apply(e.status, e.data1, e.data2);
+		}
+	}
+}
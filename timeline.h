@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "arena.h"
+#include "midi_state.h"
+#include "smf.h"
+
+/*
+
+Merged, tempo-resolved event timeline.
+
+All tracks of a parsed SMF are merged into one array sorted by absolute tick
+and every event carries its absolute time in microseconds, so playback never
+has to walk the tempo map. Format 2 tracks are independent sequences and are
+played one after another.
+
+The timeline references SysEx and meta payloads inside the SMF image,
+so the SmfFile it was built from must outlive it.
+
+A built timeline owns its arrays, which are placed in one block of an arena
+sized from the SMF before the merge: building it again, e.g. for the next song
+of a playlist, reuses the block. Attach() makes it a view of arrays stored
+elsewhere instead, such as a mapped song cache, so that nothing is copied.
+
+*/
+
+struct TimelineEvent {
+	int64_t timeUs;         // Absolute time from the start of the song.
+	uint32_t tick;          // Absolute tick.
+	uint32_t payloadOffset; // SysEx and meta events: payload offset in the payload base.
+	uint32_t payloadLength;
+	uint8_t status;
+	uint8_t data1;
+	uint8_t data2;
+	uint8_t reserved;
+};
+
+// A range of ticks with a constant tempo.
+struct TempoSegment {
+	uint32_t tick;         // First tick of the segment.
+	uint32_t usPerQuarter;
+	int64_t timeUs;        // Time of the first tick.
+};
+
+// The arrays and song values of a timeline, to store it elsewhere and attach it back.
+struct TimelineArrays {
+	const TimelineEvent* events;
+	size_t eventCount;
+	const TempoSegment* tempoMap;
+	size_t tempoSegmentCount;
+	const MidiState* checkpoints; // State before every TIMELINE_CHECKPOINT_INTERVAL-th event.
+	size_t checkpointCount;
+	const uint8_t* payloadBase;
+	uint32_t ticksPerQuarter;
+	uint32_t lengthTicks;
+	int64_t durationUs;
+	uint32_t longestSysex; // Payload length of the longest SysEx event.
+};
+
+class Timeline {
+public:
+	Timeline();
+
+	bool Build(const SmfFile& smf, std::string& err);
+	void Clear();
+
+	// The arrays stay valid until the timeline is built, cleared or attached again.
+	TimelineArrays Arrays() const;
+
+	// Uses arrays owned by the caller, which must stay valid and unchanged while attached.
+	void Attach(const TimelineArrays& arrays);
+
+	size_t EventCount() const { return eventCount; }
+	const TimelineEvent* Events() const { return eventData; }
+	const TimelineEvent& Event(size_t idx) const { return eventData[idx]; }
+	const uint8_t* Payload(const TimelineEvent& e) const { return payloadBase + e.payloadOffset; }
+	const uint8_t* PayloadBase() const { return payloadBase; }
+
+	// Payload length of the longest SysEx event, 0 if there is none.
+	uint32_t LongestSysex() const { return longestSysex; }
+
+	size_t TempoSegmentCount() const { return tempoCount; }
+	const TempoSegment& TempoSegmentAt(size_t idx) const { return tempoData[idx]; }
+
+	uint32_t LengthTicks() const { return lengthTicks; }
+	int64_t DurationUs() const { return durationUs; }
+
+	// Conversions through the tempo map, O(log n) in the number of tempo changes.
+	int64_t TickToMicros(uint32_t tick) const;
+	uint32_t MicrosToTick(int64_t timeUs) const;
+
+	// Index of the first event at or after the given position, O(log n).
+	// Returns EventCount() when the position is past the last event.
+	size_t SeekToMicros(int64_t timeUs) const;
+	size_t SeekToTick(uint32_t tick) const;
+
+	// Controller and program state right before the event with the given index.
+	// Starts from the nearest checkpoint, so the cost does not depend on the position.
+	void Chase(size_t eventIdx, MidiState& state) const;
+
+private:
+	Timeline(const Timeline&);
+	Timeline& operator=(const Timeline&);
+
+	const TempoSegment& SegmentForTick(uint32_t tick) const;
+	const TempoSegment& SegmentForMicros(int64_t timeUs) const;
+	void BuildCheckpoints(MidiState* checkpoints);
+
+	// Owned arrays of a built timeline.
+	Arena arena;
+
+	// The arrays in use: the owned ones or attached ones.
+	const TimelineEvent* eventData;
+	size_t eventCount;
+	const TempoSegment* tempoData;
+	size_t tempoCount;
+	const MidiState* checkpointData; // State before eventData[i * TIMELINE_CHECKPOINT_INTERVAL].
+	size_t checkpointCount;
+
+	const uint8_t* payloadBase;
+	uint32_t ticksPerQuarter;
+	uint32_t lengthTicks;
+	int64_t durationUs;
+	uint32_t longestSysex;
+};
+
+const size_t TIMELINE_CHECKPOINT_INTERVAL = 4096;
+
+const uint32_t DEFAULT_US_PER_QUARTER = 500000; // 120 BPM.
@@ -0,0 +1,134 @@
+#include "timing_histogram.h"
+
+#include <cmath>
+#include <sstream>
+
+static const unsigned SUB_BUCKET_BITS = 6;
+static const uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+
+static inline unsigned FloorLog2(uint64_t v) {
+	unsigned r = 0;
+	if (v >> 32) { v >>= 32; r += 32; }
+	if (v >> 16) { v >>= 16; r += 16; }
+	if (v >> 8) { v >>= 8; r += 8; }
+	if (v >> 4) { v >>= 4; r += 4; }
+	if (v >> 2) { v >>= 2; r += 2; }
+	if (v >> 1) { r += 1; }
+	return r;
+}
+
+// The writer is the only thread which updates, so a relaxed load and store replace a locked add.
+template <typename T>
+static inline void Add(std::atomic<T>& value, T n) {
+	value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+TimingHistogram::TimingHistogram() {
+	Reset();
+}
+
+void TimingHistogram::Reset() {
+	for (size_t i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++) {
+		counts[i].store(0, std::memory_order_relaxed);
+	}
+	total.store(0, std::memory_order_relaxed);
+	minNs.store(TIMING_HISTOGRAM_MAX_NS, std::memory_order_relaxed);
+	maxNs.store(0, std::memory_order_relaxed);
+	sumNs.store(0.0, std::memory_order_relaxed);
+}
+
+size_t TimingHistogram::BucketIndex(int64_t ns) {
+	uint64_t v = uint64_t(ns);
+	if (v < SUB_BUCKETS * 2) {
+		return size_t(v);
+	}
+	// v lies in [2^(e + 6), 2^(e + 7)): its top 7 bits select one of 64 buckets of exponent e.
+	unsigned e = FloorLog2(v) - SUB_BUCKET_BITS;
+	return size_t(e * SUB_BUCKETS + (v >> e));
+}
+
+int64_t TimingHistogram::BucketUpperNs(size_t idx) {
+	if (idx < SUB_BUCKETS * 2) {
+		return int64_t(idx);
+	}
+	unsigned e = unsigned(idx >> SUB_BUCKET_BITS) - 1;
+	uint64_t sub = (idx & (SUB_BUCKETS - 1)) + SUB_BUCKETS;
+	return int64_t(((sub + 1) << e) - 1);
+}
+
+void TimingHistogram::Record(int64_t ns, uint64_t count) {
+	if (ns < 0) {
+		ns = 0;
+	}
+	if (ns > TIMING_HISTOGRAM_MAX_NS) {
+		ns = TIMING_HISTOGRAM_MAX_NS;
+	}
+
+	Add(counts[BucketIndex(ns)], count);
+	Add(sumNs, double(ns) * double(count));
+	if (ns < minNs.load(std::memory_order_relaxed)) {
+		minNs.store(ns, std::memory_order_relaxed);
+	}
+	if (ns > maxNs.load(std::memory_order_relaxed)) {
+		maxNs.store(ns, std::memory_order_relaxed);
+	}
+	Add(total, count);
+}
+
+int64_t TimingHistogram::Min() const {
+	return Count() ? minNs.load(std::memory_order_relaxed) : 0;
+}
+
+double TimingHistogram::Mean() const {
+	uint64_t n = Count();
+	return n ? sumNs.load(std::memory_order_relaxed) / double(n) : 0.0;
+}
+
+int64_t TimingHistogram::ValueAtPercentile(double percent) const {
+	uint64_t n = 0;
+	for (size_t i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++) {
+		n += counts[i].load(std::memory_order_relaxed);
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	uint64_t target = uint64_t(std::ceil(percent / 100.0 * double(n)));
+	if (target < 1) {
+		target = 1;
+	}
+	if (target > n) {
+		target = n;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++) {
+		seen += counts[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			int64_t upper = BucketUpperNs(i);
+			int64_t max = Max();
+			return (upper < max) ? upper : max;
+		}
+	}
+	return Max();
+}
+
+std::string TimingHistogram::ToJson() const {
+	std::ostringstream oss;
+	oss << "{\"count\": " << Count() << ", \"minNs\": " << Min() << ", \"maxNs\": " << Max() <<
+		", \"meanNs\": " << int64_t(Mean()) <<
+		", \"p50Ns\": " << ValueAtPercentile(50.0) << ", \"p90Ns\": " << ValueAtPercentile(90.0) <<
+		", \"p99Ns\": " << ValueAtPercentile(99.0) << ", \"p999Ns\": " << ValueAtPercentile(99.9) <<
+		", \"buckets\": [";
+	bool first = true;
+	for (size_t i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++) {
+		uint64_t c = counts[i].load(std::memory_order_relaxed);
+		if (c == 0) {
+			continue;
+		}
+		oss << (first ? "" : ", ") << "[" << BucketUpperNs(i) << ", " << c << "]";
+		first = false;
+	}
+	oss << "]}";
+	return oss.str();
+}
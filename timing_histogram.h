@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+
+Fixed-size histogram of durations in nanoseconds, in the style of HdrHistogram.
+
+Values below 128 ns have a bucket each. Above that, every power of two is
+split into 64 buckets, so a value is known to within 1/64 (1.6 %) of its
+size, from nanoseconds to TIMING_HISTOGRAM_MAX_NS. Larger values are counted
+in the last bucket.
+
+Recording takes one bucket index computation and a few relaxed atomic
+updates; nothing is allocated. It must be done by a single thread, while any
+thread may read the histogram at the same time, e.g. for a report during
+playback. Such a report is consistent to within the values being recorded at
+that moment.
+
+*/
+
+const int64_t TIMING_HISTOGRAM_MAX_NS = (int64_t(1) << 40) - 1; // About 18 minutes.
+const size_t TIMING_HISTOGRAM_BUCKETS = 33 * 64 + 128;
+
+class TimingHistogram {
+public:
+	TimingHistogram();
+
+	// Writer thread. Negative values are counted as 0.
+	void Record(int64_t ns, uint64_t count = 1);
+
+	// Only while nothing is recorded.
+	void Reset();
+
+	uint64_t Count() const { return total.load(std::memory_order_relaxed); }
+	int64_t Min() const;
+	int64_t Max() const { return maxNs.load(std::memory_order_relaxed); }
+	double Mean() const;
+
+	// Highest value equivalent to the value below which 'percent' of the recorded values lie.
+	int64_t ValueAtPercentile(double percent) const;
+
+	// {"count": ..., "minNs": ..., ..., "buckets": [[upperNs, count], ...]} with the non-empty buckets only.
+	std::string ToJson() const;
+
+	static size_t BucketIndex(int64_t ns);
+	static int64_t BucketUpperNs(size_t idx);
+
+private:
+	TimingHistogram(const TimingHistogram&);
+	TimingHistogram& operator=(const TimingHistogram&);
+
+	std::atomic<uint64_t> counts[TIMING_HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> total;
+	std::atomic<int64_t> minNs;
+	std::atomic<int64_t> maxNs;
+	std::atomic<double> sumNs;
+};
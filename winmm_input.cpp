@@ -0,0 +1,169 @@
+#include "winmm_input.h"
+
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h> // Link with winmm.lib
+
+#include <cstring>
+#include <sstream>
+
+#include "hires_clock.h"
+
+static void CALLBACK MidiInProc(HMIDIIN, UINT msg, DWORD_PTR instance, DWORD_PTR param1, DWORD_PTR) {
+	reinterpret_cast<WinmmMidiInput*>(instance)->OnData(msg, uintptr_t(param1));
+}
+
+WinmmMidiInput::WinmmMidiInput() :
+	hMidiIn(NULL),
+	handler(nullptr),
+	running(false),
+	sysexMemory(WINMM_INPUT_SYSEX_BUFFERS * WINMM_INPUT_SYSEX_SIZE),
+	headers(new MIDIHDR[WINMM_INPUT_SYSEX_BUFFERS]),
+	sysexMessage(WINMM_INPUT_SYSEX_MAX),
+	sysexUsed(0),
+	sysexBroken(false),
+	sysexErrors(0)
+{
+}
+
+WinmmMidiInput::~WinmmMidiInput() {
+	Close();
+}
+
+bool WinmmMidiInput::Open(int deviceIdx, std::string& err) {
+	Close();
+
+	HMIDIIN h = NULL;
+	MMRESULT result = midiInOpen(&h, UINT(deviceIdx), DWORD_PTR(&MidiInProc), DWORD_PTR(this), CALLBACK_FUNCTION);
+	if (result != MMSYSERR_NOERROR) {
+		std::ostringstream oss;
+		oss << "midiInOpen failed for device " << deviceIdx << ", error " << result;
+		err = oss.str();
+		return false;
+	}
+
+	hMidiIn = h;
+	return true;
+}
+
+void WinmmMidiInput::Close() {
+	Stop();
+	if (hMidiIn) {
+		midiInClose((HMIDIIN)hMidiIn);
+		hMidiIn = NULL;
+	}
+}
+
+bool WinmmMidiInput::Start(MidiInputHandler& h, std::string& err) {
+	Stop();
+	if (!hMidiIn) {
+		err = "MIDI input is not open";
+		return false;
+	}
+
+	HMIDIIN in = (HMIDIIN)hMidiIn;
+	for (size_t i = 0; i < WINMM_INPUT_SYSEX_BUFFERS; i++) {
+		MIDIHDR& hdr = headers[i];
+		ZeroMemory(&hdr, sizeof(hdr));
+		hdr.lpData = &sysexMemory[i * WINMM_INPUT_SYSEX_SIZE];
+		hdr.dwBufferLength = DWORD(WINMM_INPUT_SYSEX_SIZE);
+		midiInPrepareHeader(in, &hdr, sizeof(hdr));
+		midiInAddBuffer(in, &hdr, sizeof(hdr));
+	}
+
+	sysexUsed = 0;
+	sysexBroken = false;
+	handler.store(&h);
+	running.store(true);
+	MMRESULT result = midiInStart(in);
+	if (result != MMSYSERR_NOERROR) {
+		std::ostringstream oss;
+		oss << "midiInStart failed, error " << result;
+		err = oss.str();
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+void WinmmMidiInput::Stop() {
+	if (!hMidiIn || !running.load()) {
+		return;
+	}
+
+	// The driver returns the SysEx buffers on reset, they must not be queued again.
+	running.store(false);
+	HMIDIIN in = (HMIDIIN)hMidiIn;
+	midiInStop(in);
+	midiInReset(in);
+	for (size_t i = 0; i < WINMM_INPUT_SYSEX_BUFFERS; i++) {
+		midiInUnprepareHeader(in, &headers[i], sizeof(MIDIHDR));
+	}
+	handler.store(nullptr);
+}
+
+void WinmmMidiInput::OnData(unsigned msg, uintptr_t param1) {
+	int64_t ingressNs = NowNanos();
+	MidiInputHandler* h = handler.load();
+
+	if (msg == MIM_DATA) {
+		if (h) {
+			h->OnShortMessage(uint32_t(param1), ingressNs);
+		}
+	}
+	else if ((msg == MIM_LONGDATA) || (msg == MIM_LONGERROR)) {
+		// Buffers returned by the reset of a stop hold a message cut short, and must not be queued again.
+		if (!running.load()) {
+			return;
+		}
+		MIDIHDR* hdr = reinterpret_cast<MIDIHDR*>(param1);
+		if (msg == MIM_LONGERROR) {
+			// The driver received a broken message, e.g. one interrupted by another status byte.
+			if (sysexUsed > 0) {
+				sysexErrors.fetch_add(1, std::memory_order_relaxed);
+			}
+			sysexUsed = 0;
+			sysexBroken = false;
+		}
+		else if (hdr->dwBytesRecorded > 0) {
+			AppendSysex(h, reinterpret_cast<const uint8_t*>(hdr->lpData), hdr->dwBytesRecorded, ingressNs);
+		}
+		midiInAddBuffer((HMIDIIN)hMidiIn, hdr, sizeof(MIDIHDR));
+	}
+}
+
+// A message fills one buffer after another, the last one ends with 0xF7.
+void WinmmMidiInput::AppendSysex(MidiInputHandler* h, const uint8_t* data, uint32_t length, int64_t ingressNs) {
+	if (data[0] == 0xF0) {
+		if (sysexUsed > 0) {
+			// The previous message never ended.
+			sysexErrors.fetch_add(1, std::memory_order_relaxed);
+		}
+		sysexUsed = 0;
+		sysexBroken = false;
+	}
+	else if ((sysexUsed == 0) && !sysexBroken) {
+		// The rest of a message whose start was missed.
+		sysexErrors.fetch_add(1, std::memory_order_relaxed);
+		sysexBroken = true;
+	}
+
+	if (!sysexBroken) {
+		if (length > sysexMessage.size() - sysexUsed) {
+			sysexErrors.fetch_add(1, std::memory_order_relaxed);
+			sysexBroken = true;
+		}
+		else {
+			memcpy(&sysexMessage[sysexUsed], data, length);
+			sysexUsed += length;
+		}
+	}
+
+	if (data[length - 1] == 0xF7) {
+		if (!sysexBroken && h) {
+			h->OnLongMessage(&sysexMessage[0], uint32_t(sysexUsed), ingressNs);
+		}
+		sysexUsed = 0;
+		sysexBroken = false;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "midi_input.h"
+
+struct midihdr_tag;
+
+// Raw WinMM MIDI input: midiInOpen with a callback function. Messages are
+// delivered on the callback thread of the driver, SysEx through a small set of
+// buffers which are handed back to the driver after every message. A SysEx
+// message longer than a buffer arrives in several and is put together before
+// it is delivered; one the driver reports as broken (MIM_LONGERROR), one cut
+// short by a stop and one longer than WINMM_INPUT_SYSEX_MAX are dropped.
+// The handler is called on the callback thread, where it must not wait.
+class WinmmMidiInput : public MidiInput {
+public:
+	WinmmMidiInput();
+	~WinmmMidiInput();
+
+	bool Open(int deviceIdx, std::string& err);
+	void Close();
+
+	bool Start(MidiInputHandler& handler, std::string& err);
+	void Stop();
+
+	// Called by the driver callback.
+	void OnData(unsigned msg, uintptr_t param1);
+
+	// SysEx messages dropped as broken, cut short or too long.
+	uint64_t SysexErrors() const { return sysexErrors.load(); }
+
+private:
+	WinmmMidiInput(const WinmmMidiInput&);
+	WinmmMidiInput& operator=(const WinmmMidiInput&);
+
+	void AppendSysex(MidiInputHandler* h, const uint8_t* data, uint32_t length, int64_t ingressNs);
+
+	void* hMidiIn; // HMIDIIN
+	std::atomic<MidiInputHandler*> handler;
+	std::atomic<bool> running;
+	std::vector<char> sysexMemory;
+	std::unique_ptr<midihdr_tag[]> headers; // MIDIHDR, one per SysEx buffer.
+	std::vector<uint8_t> sysexMessage;      // The message being put together, of WINMM_INPUT_SYSEX_MAX bytes.
+	size_t sysexUsed;
+	bool sysexBroken;                       // The rest of the message is dropped.
+	std::atomic<uint64_t> sysexErrors;
+};
+
+const size_t WINMM_INPUT_SYSEX_BUFFERS = 4;
+const size_t WINMM_INPUT_SYSEX_SIZE = 4096;
+const size_t WINMM_INPUT_SYSEX_MAX = 64 * 1024;
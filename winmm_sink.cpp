@@ -0,0 +1,288 @@
+#include "winmm_sink.h"
+
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h> // Link with winmm.lib
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "hires_clock.h"
+
+struct WinmmLongBuffer {
+	WinmmLongBuffer() : prepared(false), queued(false) {}
+
+	MIDIHDR header;
+	std::vector<uint8_t> data;
+	bool prepared;
+	std::atomic<bool> queued; // Cleared by the completion callback.
+};
+
+struct WinmmSinkShared {
+	WinmmSinkShared() : done(NULL), queuedBuffers(0), deferredCount(0) {
+		InitializeCriticalSection(&lock);
+	}
+	~WinmmSinkShared() {
+		DeleteCriticalSection(&lock);
+		if (done) {
+			CloseHandle(done);
+		}
+	}
+
+	CRITICAL_SECTION lock; // Guards the rest.
+	HANDLE done;           // Set by the completion callback.
+	size_t queuedBuffers;
+	size_t deferredCount;
+	uint32_t deferred[WINMM_SINK_DEFERRED_MESSAGES];
+};
+
+namespace {
+
+void CALLBACK MidiOutCallback(HMIDIOUT h, UINT msg, DWORD_PTR instance, DWORD_PTR param1, DWORD_PTR) {
+	// Only a few system calls are allowed here; critical sections, midiOutShortMsg and SetEvent are among them.
+	if (msg == MOM_DONE) {
+		WinmmSinkShared* shared = (WinmmSinkShared*)instance;
+		MIDIHDR* header = (MIDIHDR*)param1;
+		EnterCriticalSection(&shared->lock);
+		((WinmmLongBuffer*)header->dwUser)->queued.store(false, std::memory_order_release);
+		if ((shared->queuedBuffers > 0) && (--shared->queuedBuffers == 0)) {
+			// The SysEx before them is out, no other is queued until they are.
+			for (size_t i = 0; i < shared->deferredCount; i++) {
+				midiOutShortMsg(h, DWORD(shared->deferred[i]));
+			}
+			shared->deferredCount = 0;
+		}
+		LeaveCriticalSection(&shared->lock);
+		SetEvent(shared->done);
+	}
+}
+
+// Waits for the next completion, or a while in case the callback came before the event was reset.
+const DWORD DONE_WAIT_MS = 10;
+
+}
+
+WinmmMidiSink::WinmmMidiSink() : hMidiOut(NULL), nextBuffer(0) {
+	memset(&stats, 0, sizeof(stats));
+}
+
+WinmmMidiSink::~WinmmMidiSink() {
+	Close();
+}
+
+bool WinmmMidiSink::Open(int deviceIdx, std::string& err) {
+	Close();
+
+	shared.reset(new WinmmSinkShared());
+	shared->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!shared->done) {
+		err = "CreateEvent failed";
+		Close();
+		return false;
+	}
+
+	UINT deviceId = (deviceIdx < 0) ? MIDI_MAPPER : UINT(deviceIdx);
+	HMIDIOUT h = NULL;
+	MMRESULT result = midiOutOpen(&h, deviceId, DWORD_PTR(&MidiOutCallback), DWORD_PTR(shared.get()), CALLBACK_FUNCTION);
+	if (result != MMSYSERR_NOERROR) {
+		std::ostringstream oss;
+		oss << "midiOutOpen failed for device " << deviceIdx << ", error " << result;
+		err = oss.str();
+		Close();
+		return false;
+	}
+	hMidiOut = h;
+
+	// Prepared once at the full size, recycled by the completion callback. Each send sets
+	// the length of its message, midiOutLongMsg sends dwBufferLength bytes.
+	buffers.reset(new WinmmLongBuffer[WINMM_SINK_BUFFERS]);
+	for (size_t i = 0; i < WINMM_SINK_BUFFERS; i++) {
+		WinmmLongBuffer& b = buffers[i];
+		b.data.resize(WINMM_SINK_BUFFER_SIZE);
+		ZeroMemory(&b.header, sizeof(b.header));
+		b.header.lpData = (LPSTR)&b.data[0];
+		b.header.dwBufferLength = WINMM_SINK_BUFFER_SIZE;
+		b.header.dwUser = DWORD_PTR(&b);
+		b.queued.store(false);
+		b.prepared = (midiOutPrepareHeader(h, &b.header, sizeof(b.header)) == MMSYSERR_NOERROR);
+		if (!b.prepared) {
+			std::ostringstream oss;
+			oss << "midiOutPrepareHeader failed for device " << deviceIdx;
+			err = oss.str();
+			Close();
+			return false;
+		}
+	}
+	nextBuffer = 0;
+	memset(&stats, 0, sizeof(stats));
+	return true;
+}
+
+void WinmmMidiSink::Close() {
+	if (hMidiOut) {
+		HMIDIOUT h = (HMIDIOUT)hMidiOut;
+		// Returns all queued buffers; the messages deferred behind them are dropped.
+		ClearDeferred();
+		midiOutReset(h);
+		Drain();
+		for (size_t i = 0; i < WINMM_SINK_BUFFERS; i++) {
+			if (buffers[i].prepared) {
+				buffers[i].header.dwBufferLength = WINMM_SINK_BUFFER_SIZE;
+				midiOutUnprepareHeader(h, &buffers[i].header, sizeof(buffers[i].header));
+			}
+		}
+		midiOutClose(h);
+		hMidiOut = NULL;
+	}
+	buffers.reset();
+	shared.reset();
+}
+
+bool WinmmMidiSink::HasQueued() const {
+	EnterCriticalSection(&shared->lock);
+	bool queued = (shared->queuedBuffers > 0);
+	LeaveCriticalSection(&shared->lock);
+	return queued;
+}
+
+bool WinmmMidiSink::HasDeferred() const {
+	EnterCriticalSection(&shared->lock);
+	bool deferred = (shared->deferredCount > 0);
+	LeaveCriticalSection(&shared->lock);
+	return deferred;
+}
+
+void WinmmMidiSink::ClearDeferred() {
+	EnterCriticalSection(&shared->lock);
+	shared->deferredCount = 0;
+	LeaveCriticalSection(&shared->lock);
+}
+
+void WinmmMidiSink::Drain() {
+	if (!buffers) {
+		return;
+	}
+	// The deferred messages are sent with the last buffer.
+	while (HasQueued()) {
+		WaitForSingleObject(shared->done, DONE_WAIT_MS);
+	}
+}
+
+WinmmLongBuffer* WinmmMidiSink::AcquireBuffer() {
+	// Buffers are queued in turn, so the next one is the one which was queued first.
+	WinmmLongBuffer* b = &buffers[nextBuffer];
+	if (b->queued.load(std::memory_order_acquire)) {
+		stats.poolWaits++;
+		int64_t startUs = NowMicros();
+		while (b->queued.load(std::memory_order_acquire)) {
+			WaitForSingleObject(shared->done, DONE_WAIT_MS);
+		}
+		stats.longWaitUs += NowMicros() - startUs;
+	}
+	nextBuffer = (nextBuffer + 1) % WINMM_SINK_BUFFERS;
+	return b;
+}
+
+bool WinmmMidiSink::QueueLong(const uint8_t* data, uint32_t length) {
+	if (!hMidiOut) {
+		return false;
+	}
+	stats.longMessages++;
+	stats.longBytes += length;
+
+	// SysEx must not overtake the short messages deferred behind the SysEx before it.
+	if (HasDeferred()) {
+		stats.drainWaits++;
+		int64_t startUs = NowMicros();
+		while (HasDeferred()) {
+			WaitForSingleObject(shared->done, DONE_WAIT_MS);
+		}
+		stats.longWaitUs += NowMicros() - startUs;
+	}
+
+	// A message larger than a buffer continues in the next ones.
+	bool ok = true;
+	while (length > 0) {
+		uint32_t n = std::min(length, WINMM_SINK_BUFFER_SIZE);
+		WinmmLongBuffer* b = AcquireBuffer();
+		memcpy(&b->data[0], data, n);
+		b->header.dwBufferLength = n;
+		b->header.dwBytesRecorded = n;
+		b->header.dwFlags &= ~MHDR_DONE;
+		b->queued.store(true, std::memory_order_release);
+		EnterCriticalSection(&shared->lock);
+		shared->queuedBuffers++;
+		LeaveCriticalSection(&shared->lock);
+		if (midiOutLongMsg((HMIDIOUT)hMidiOut, &b->header, sizeof(b->header)) != MMSYSERR_NOERROR) {
+			b->queued.store(false, std::memory_order_release);
+			EnterCriticalSection(&shared->lock);
+			shared->queuedBuffers--;
+			LeaveCriticalSection(&shared->lock);
+			ok = false;
+			break;
+		}
+		stats.buffersQueued++;
+		data += n;
+		length -= n;
+	}
+	return ok;
+}
+
+bool WinmmMidiSink::ShortMessage(uint32_t message) {
+	if (!hMidiOut) {
+		return false;
+	}
+	stats.shortMessages++;
+
+	// Real-time messages may be sent even in the middle of SysEx, the others go behind the queued one.
+	if (uint8_t(message) < 0xF8) {
+		int64_t startUs = -1;
+		while (true) {
+			EnterCriticalSection(&shared->lock);
+			bool queued = (shared->queuedBuffers > 0);
+			bool deferred = queued && (shared->deferredCount < WINMM_SINK_DEFERRED_MESSAGES);
+			if (deferred) {
+				shared->deferred[shared->deferredCount++] = message;
+			}
+			LeaveCriticalSection(&shared->lock);
+			if (deferred) {
+				stats.deferred++;
+				if (startUs >= 0) {
+					stats.longWaitUs += NowMicros() - startUs;
+				}
+				return true;
+			}
+			if (!queued) {
+				break;
+			}
+			// All deferred places are taken: wait for the callback to send them.
+			if (startUs < 0) {
+				stats.drainWaits++;
+				startUs = NowMicros();
+			}
+			WaitForSingleObject(shared->done, DONE_WAIT_MS);
+		}
+		if (startUs >= 0) {
+			stats.longWaitUs += NowMicros() - startUs;
+		}
+	}
+	return midiOutShortMsg((HMIDIOUT)hMidiOut, DWORD(message)) == MMSYSERR_NOERROR;
+}
+
+bool WinmmMidiSink::LongMessage(const uint8_t* data, uint32_t length) {
+	// The data is copied, so the message can still be queued when this returns.
+	return QueueLong(data, length);
+}
+
+void WinmmMidiSink::Reset() {
+	if (!hMidiOut) {
+		return;
+	}
+	// Notes deferred behind SysEx must not sound after the reset.
+	ClearDeferred();
+	midiOutReset((HMIDIOUT)hMidiOut);
+	Drain();
+}
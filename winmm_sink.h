@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "midi_sink.h"
+
+struct WinmmLongBuffer;
+struct WinmmSinkShared;
+
+/*
+
+Raw WinMM MIDI output: midiOutShortMsg and midiOutLongMsg.
+
+SysEx messages are copied into a pool of buffers which are allocated and
+prepared once when the device is opened. midiOutLongMsg queues a buffer and
+returns at once; the completion callback marks it free again, so a burst of
+SysEx at the start of a song, e.g. a GS or XG reset followed by the setup of
+every part, is queued back to back instead of waiting for each message to be
+transmitted in turn. Messages larger than a buffer are sent in several.
+
+The driver sends short messages immediately, so ones which follow queued SysEx
+are deferred instead: the completion callback of the last queued buffer sends
+them in order, and ShortMessage returns at once. Real-time messages may go
+anywhere on the wire and are sent at once. The sequencer only waits where the
+order needs it: SysEx which follows deferred short messages is not queued
+until they are out, i.e. until the SysEx before them has been sent, and a
+short message waits when WINMM_SINK_DEFERRED_MESSAGES are deferred already.
+At 31250 baud a 4 KB dump takes 1.3 s, so a song which sends bulk dumps
+between its notes is held up by that much per dump.
+
+*/
+
+struct WinmmSinkStats {
+	uint64_t shortMessages;
+	uint64_t longMessages;
+	uint64_t longBytes;
+	uint64_t buffersQueued;
+	uint64_t poolWaits;     // A buffer was needed while all of them were queued.
+	uint64_t deferred;      // Short messages sent by the completion callback after queued SysEx.
+	uint64_t drainWaits;    // A message waited for queued SysEx to be sent, see above.
+	int64_t longWaitUs;     // Time spent in both kinds of waits.
+};
+
+class WinmmMidiSink : public MidiSink {
+public:
+	WinmmMidiSink();
+	~WinmmMidiSink();
+
+	// Negative device index selects the MIDI mapper.
+	bool Open(int deviceIdx, std::string& err);
+	void Close();
+
+	bool ShortMessage(uint32_t message);
+	bool LongMessage(const uint8_t* data, uint32_t length);
+	void Reset();
+
+	// Blocks until all queued SysEx and the short messages deferred behind it have been sent.
+	void Drain();
+
+	const WinmmSinkStats& Stats() const { return stats; }
+
+private:
+	WinmmMidiSink(const WinmmMidiSink&);
+	WinmmMidiSink& operator=(const WinmmMidiSink&);
+
+	bool QueueLong(const uint8_t* data, uint32_t length);
+	WinmmLongBuffer* AcquireBuffer();
+	bool HasQueued() const;
+	bool HasDeferred() const;
+	void ClearDeferred();
+
+	void* hMidiOut; // HMIDIOUT
+	std::unique_ptr<WinmmSinkShared> shared; // With the completion callback.
+	std::unique_ptr<WinmmLongBuffer[]> buffers;
+	size_t nextBuffer;
+	WinmmSinkStats stats;
+};
+
+// Number of SysEx buffers and the size of each. A song setup of GS or XG parameter
+// messages fits into the pool; a bulk dump streams through it in 4 KB pieces.
+const size_t WINMM_SINK_BUFFERS = 64;
+const uint32_t WINMM_SINK_BUFFER_SIZE = 4 * 1024;
+
+// Short messages which can wait behind queued SysEx, e.g. the notes and controllers at the start of a song.
+const size_t WINMM_SINK_DEFERRED_MESSAGES = 1024;
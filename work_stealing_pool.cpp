@@ -0,0 +1,118 @@
+#include "work_stealing_pool.h"
+
+WorkStealingPool::WorkStealingPool(unsigned threadCount) :
+	current(nullptr),
+	generation(0),
+	busy(0),
+	stopping(false),
+	stolen(0)
+{
+	if (threadCount == 0) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	if (threadCount == 0) {
+		threadCount = 1;
+	}
+
+	for (unsigned i = 0; i < threadCount; i++) {
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+	for (unsigned i = 1; i < threadCount; i++) {
+		threads.push_back(std::thread(&WorkStealingPool::WorkerMain, this, i));
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	startSignal.notify_all();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void WorkStealingPool::Run(size_t count, const std::function<void(size_t, unsigned)>& task) {
+	if (count == 0) {
+		return;
+	}
+
+	// No worker is running here, so the queues can be filled without their locks.
+	size_t workers = queues.size();
+	for (size_t i = 0; i < count; i++) {
+		queues[i % workers]->tasks.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		current = &task;
+		busy = unsigned(threads.size());
+		generation++;
+	}
+	startSignal.notify_all();
+
+	Work(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (busy > 0) {
+		doneSignal.wait(lock);
+	}
+	current = nullptr;
+}
+
+void WorkStealingPool::WorkerMain(unsigned worker) {
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping && (generation == seen)) {
+				startSignal.wait(lock);
+			}
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+
+		Work(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busy == 0) {
+			doneSignal.notify_one();
+		}
+	}
+}
+
+void WorkStealingPool::Work(unsigned worker) {
+	size_t task;
+	while (NextTask(worker, task)) {
+		(*current)(task, worker);
+	}
+}
+
+bool WorkStealingPool::NextTask(unsigned worker, size_t& task) {
+	{
+		Queue& own = *queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	// Tasks are only added by Run(), so once every queue is empty the run is over.
+	size_t workers = queues.size();
+	for (size_t k = 1; k < workers; k++) {
+		Queue& victim = *queues[(worker + k) % workers];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.back();
+			victim.tasks.pop_back();
+			stolen++;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+
+Fixed set of worker threads running batches of indexed tasks.
+
+Run() deals the task indices round robin into one queue per worker. A worker
+takes tasks from the front of its own queue and, when that is empty, steals
+from the back of the other queues, so that long tasks do not leave the other
+workers idle. The calling thread works as worker 0 and Run() returns when
+every task has finished.
+
+Tasks must not call Run() themselves.
+
+*/
+
+class WorkStealingPool {
+public:
+	// 0 threads means one per hardware thread.
+	explicit WorkStealingPool(unsigned threads);
+	~WorkStealingPool();
+
+	unsigned ThreadCount() const { return unsigned(queues.size()); }
+
+	// Calls task(index, worker) for every index in [0, count).
+	void Run(size_t count, const std::function<void(size_t, unsigned)>& task);
+
+	// Tasks executed by a worker other than the one they were dealt to, over all runs.
+	uint64_t StolenTasks() const { return stolen.load(); }
+
+private:
+	WorkStealingPool(const WorkStealingPool&);
+	WorkStealingPool& operator=(const WorkStealingPool&);
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+
+	void WorkerMain(unsigned worker);
+	void Work(unsigned worker);
+	bool NextTask(unsigned worker, size_t& task);
+
+	std::vector<std::unique_ptr<Queue> > queues; // One per worker, including the caller.
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable startSignal;
+	std::condition_variable doneSignal;
+	const std::function<void(size_t, unsigned)>* current;
+	uint64_t generation;
+	unsigned busy;      // Worker threads still working on the current run.
+	bool stopping;
+	std::atomic<uint64_t> stolen;
+};